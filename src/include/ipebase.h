@@ -33,6 +33,8 @@
 #define IPEBASE_H
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <cstdio>
 #include <memory>
 #include <string>
@@ -141,15 +143,16 @@ public:
 
 private:
     void detach(int n) noexcept;
+    void release() noexcept;
 
 private:
     struct Imp {
-	int iRefCount;
+	std::atomic<int> iRefCount;
 	int iSize;
 	int iCapacity;
 	char * iData;
     };
-    static Imp * theEmptyString;
+    static Imp theEmptyString;
     static Imp * emptyString() noexcept;
     Imp * iImp;
 };
@@ -324,6 +327,24 @@ private:
     std::FILE * iFile;
 };
 
+class HashStream : public Stream {
+public:
+    HashStream();
+    virtual void putChar(char ch);
+    virtual void putString(String s);
+    virtual void putCString(const char * s);
+    virtual void putRaw(const char * data, int size);
+    //! Return the hash of everything written so far.
+    inline uint64_t hash() const noexcept { return iHash; }
+    //! Combine hash value \a h with \a value.
+    static inline uint64_t mix(uint64_t h, uint64_t value) noexcept {
+	return h ^ (value + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2));
+    }
+
+private:
+    uint64_t iHash;
+};
+
 // --------------------------------------------------------------------
 
 class DataSource {
@@ -383,6 +404,7 @@ public:
     using DebugHandler = void (*)(const char *);
 
     static String folder(IpeFolder ft, const char * fname = nullptr);
+    static void setFolder(IpeFolder ft, String path);
     static FILE * fopen(const char * fname, const char * mode);
     static int mkdir(String path);
     static int mkdirTree(String path);
@@ -396,18 +418,43 @@ public:
     static bool listDirectory(String path, std::vector<String> & files);
     static String realPath(String fname);
     static String readFile(String fname);
-    static String howToRunLatex(LatexType engine, String docname) noexcept;
+    static int renameFile(String from, String to);
+    static String howToRunLatex(LatexType engine, String docname, String dir = String(),
+				String format = String()) noexcept;
+    static String howToDumpLatexFormat(LatexType engine, String docname,
+				       String name) noexcept;
     static int system(String cmd);
     static String createTarball(String tex);
     static double toDouble(String s);
     static int toNumber(String s, int & iValue, double & dValue);
     static String spiroVersion();
     static String gslVersion();
+    static int threadCount() noexcept;
+    static void setThreadCount(int n) noexcept;
     static std::pair<int, std::vector<const char *>> setupNodeJs();
 };
 
 // --------------------------------------------------------------------
 
+//! An exclusive lock on a file, held until the object is destroyed.
+/*! \ingroup base
+  The lock is advisory: it only keeps out other FileLock objects on the
+  same file, in this or in other processes. */
+class FileLock {
+public:
+    explicit FileLock(String fname, bool wait = true) noexcept;
+    ~FileLock();
+    FileLock(const FileLock &) = delete;
+    FileLock & operator=(const FileLock &) = delete;
+    //! Has the lock been obtained?
+    bool locked() const noexcept { return iHandle != -1; }
+
+private:
+    std::intptr_t iHandle;
+};
+
+// --------------------------------------------------------------------
+
 inline bool Fixed::operator==(const Fixed & rhs) const { return iValue == rhs.iValue; }
 
 inline bool Fixed::operator!=(const Fixed & rhs) const { return iValue != rhs.iValue; }
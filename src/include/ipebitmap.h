@@ -36,6 +36,8 @@
 #include "ipegeo.h"
 #include "ipexml.h"
 
+#include <mutex>
+
 // --------------------------------------------------------------------
 
 namespace ipe {
@@ -76,6 +78,7 @@ public:
 
     inline int objNum() const;
     inline void setObjNum(int objNum) const;
+    inline uint32_t checksum() const;
 
     std::pair<Buffer, Buffer> embed() const;
 
@@ -96,17 +99,18 @@ private:
     void computeChecksum();
     void unpack(Buffer alphaChannel);
     void analyze();
+    void computePixelData();
 
 private:
     struct Imp {
-	int iRefCount;
+	std::atomic<int> iRefCount;
 	uint32_t iFlags;
 	int iWidth;
 	int iHeight;
 	int iColorKey;
 	Buffer iData;      // native-endian ARGB32 or DCT encoded
 	Buffer iPixelData; // native-endian ARGB32 pre-multiplied for Cairo
-	bool iPixelsComputed;
+	std::once_flag iPixelsOnce;
 	uint32_t iChecksum;
 	mutable int iObjNum; // Object number (e.g. in PDF file)
     };
@@ -144,6 +148,9 @@ inline int Bitmap::objNum() const { return iImp->iObjNum; }
 //! Set object number of the bitmap.
 inline void Bitmap::setObjNum(int objNum) const { iImp->iObjNum = objNum; }
 
+//! Return checksum of the bitmap data.
+inline uint32_t Bitmap::checksum() const { return iImp->iChecksum; }
+
 //! Two bitmaps are equal if they share the same data.
 inline bool Bitmap::operator==(const Bitmap & rhs) const { return iImp == rhs.iImp; }
 
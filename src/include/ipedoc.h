@@ -157,11 +157,13 @@ public:
 	ErrWritingSource,
 	ErrRunLatex,
 	ErrLatex,
-	ErrLatexOutput
+	ErrLatexOutput,
+	ErrLatexFormat
     };
-    int runLatex(String docname, String & logFile);
-    int runLatex(String docname);
-    int prepareLatexRun(Latex ** pConverter);
+    int runLatex(String docname, String & logFile, int shards = 1);
+    int runLatex(String docname, int shards = 1);
+    static void setLatexCache(String dir);
+    int prepareLatexRun(Latex ** pConverter, int shards = 1, String docname = String());
     void runLatexAsync(String docname);
     int completeLatexRun(String & texLog, Latex * converter);
 
@@ -238,6 +238,34 @@ public:
 
 // --------------------------------------------------------------------
 
+class Polyline {
+public:
+    //! Remove all points.
+    void clear() {
+	iX.clear();
+	iY.clear();
+    }
+    //! Return number of points.
+    int size() const { return iX.size(); }
+    //! Append a point.
+    void push_back(const Vector & v) {
+	iX.push_back(v.x);
+	iY.push_back(v.y);
+    }
+    //! Return point.
+    Vector point(int i) const { return Vector(iX[i], iY[i]); }
+    int nearestVertex(const Vector & v, double & sqDist) const;
+    int nearestSegment(const Vector & v, double & sqDist) const;
+
+public:
+    //! x-coordinates of the points.
+    std::vector<double> iX;
+    //! y-coordinates of the points.
+    std::vector<double> iY;
+};
+
+// --------------------------------------------------------------------
+
 class Bezier {
 public:
     //! Default constructor, uninitialized curve.
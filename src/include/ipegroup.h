@@ -104,11 +104,13 @@ public:
 
 private:
     void detach();
+    struct Imp;
+    static void release(Imp * imp);
 
 private:
     struct Imp {
 	List iObjects;
-	int iRefCount;
+	std::atomic<int> iRefCount;
 	TPinned iPinned; // is any of the objects in the list pinned?
     };
 
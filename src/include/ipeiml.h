@@ -56,8 +56,15 @@ public:
     Page * parsePageSelection();
     virtual Buffer pdfStream(int objNum);
     bool parseBitmap();
+    //! Make a bitmap known to the parser, for images that refer to its objNum.
+    void addBitmap(Bitmap bitmap) { iBitmaps.push_back(bitmap); }
     bool parseAttributeMapping(AttributeMap & map);
 
+private:
+    String parsePagesInParallel(Document & doc);
+    String parseRemainingPages(Document & doc, const std::string & rest, int start,
+			       int from);
+
 private:
     std::vector<Bitmap> iBitmaps;
 };
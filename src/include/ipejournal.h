@@ -0,0 +1,104 @@
+// -*- C++ -*-
+// --------------------------------------------------------------------
+// Journal of document edits
+// --------------------------------------------------------------------
+/*
+
+    This file is part of the extensible drawing editor Ipe.
+    Copyright (c) 1993-2024 Otfried Cheong
+
+    Ipe is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    As a special exception, you have permission to link Ipe with the
+    CGAL library and distribute executables, as long as you follow the
+    requirements of the Gnu General Public License in regard to all of
+    the software in the executable aside from CGAL.
+
+    Ipe is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+    or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+    License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ipe; if not, you can find it at
+    "http://www.gnu.org/copyleft/gpl.html", or write to the Free
+    Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#ifndef IPEJOURNAL_H
+#define IPEJOURNAL_H
+
+#include "ipebitmap.h"
+
+#include <cstdio>
+#include <memory>
+
+// --------------------------------------------------------------------
+
+namespace ipe {
+
+class Document;
+class Page;
+
+class Journal {
+public:
+    //! Errors returned by recover().
+    enum RecoverErrors {
+	ENoJournal = -1, //!< The file cannot be read or is not a journal.
+	EMismatch = -2,  //!< The journal was made for a different document.
+	ECorrupt = -3,   //!< A record could not be applied.
+	ELocked = -4,    //!< Another journal is using the file.
+    };
+
+    Journal();
+    ~Journal();
+    Journal(const Journal &) = delete;
+    Journal & operator=(const Journal &) = delete;
+
+    bool lock(const char * fname);
+    bool open(const char * fname, const Document * doc);
+    int recover(const char * fname, Document * doc);
+    bool record(const Document * doc, int pno = -1);
+    void close();
+    //! Is the journal open for writing?
+    bool isOpen() const { return iFile != nullptr; }
+
+private:
+    struct PageState {
+	uint64_t iHash; //!< Page::contentHash()
+	uint64_t iHeader;
+	std::vector<uint64_t> iObjects;
+    };
+
+    void closeFile();
+    void reset(const Document * doc);
+    uint64_t fingerprint(const Document * doc) const;
+    PageState pageState(const Page * page) const;
+    void numberBitmaps(const std::vector<Bitmap> & bitmaps);
+    void writePage(Stream & stream, const Page * page, int pno, const PageState & prev,
+		   const PageState & cur);
+    int replay(const String & data, Document * doc, int & end);
+    bool applyPage(Document * doc, int pno, const char * xml, int size,
+		   const char * ops);
+
+private:
+    std::FILE * iFile;
+    std::unique_ptr<FileLock> iLock;
+    String iLockFile;
+    //! Cascade::version() and hash of the properties.
+    uint64_t iStyle;
+    uint64_t iProperties;
+    std::vector<PageState> iPages;
+    //! Bitmaps by journal id (id - 1), whether a replay knows them.
+    std::vector<Bitmap> iBitmaps;
+    std::vector<bool> iWritten;
+};
+
+} // namespace ipe
+
+// --------------------------------------------------------------------
+#endif
@@ -54,13 +54,29 @@ public:
     int scanObject(const Object * obj);
     int scanPage(Page * page);
     void addPageNumber(int pno, int vno, int npages, int nviews);
-    int createLatexSource(Stream & stream, String preamble);
-    bool readPdf(DataSource & source);
+    int splitIntoShards(int shards);
+    //! Return number of Latex runs the text objects are split into.
+    int shards() const noexcept { return std::max(1, size(iShardStart) - 1); }
+    //! Set the name of a format file to be used by Latex (or empty for none).
+    /*! If \a dump is true, the format must be made before Latex runs. */
+    void setFormat(String format, bool dump = false) {
+	iFormat = format;
+	iDumpFormat = dump;
+    }
+    //! Return the name of the format file used by Latex.
+    String format() const noexcept { return iFormat; }
+    //! Return the name of the format file to be made before Latex runs, if any.
+    String formatToDump() const noexcept { return iDumpFormat ? iFormat : String(); }
+    void createFormatSource(Stream & stream, String preamble);
+    int createLatexSource(Stream & stream, String preamble, int shard = 0);
+    bool readPdf(DataSource & source, int shard = 0);
     bool updateTextObjects();
     PdfResources * takeResources();
 
 private:
-    bool getXForm(String key, const PdfDict * ipeInfo);
+    void createSources();
+    void writePreamble(Stream & stream, String preamble);
+    bool getXForm(String key, const PdfDict * ipeInfo, const PdfFile & pdf, int offset);
     void warn(String msg);
 
 private:
@@ -79,11 +95,20 @@ private:
     bool iSequentialText;
     LatexType iLatexType;
 
-    PdfFile iPdf;
-
     //! List of text objects scanned. Objects not owned.
     TextList iTextObjects;
 
+    //! Number of text objects that did not have an XForm yet.
+    int iNewCount;
+
+    //! Name of the precompiled format file to use.
+    String iFormat;
+    //! Does the format file still have to be made?
+    bool iDumpFormat;
+
+    //! Index of first text object of each shard, followed by size of iTextObjects.
+    std::vector<int> iShardStart;
+
     //! List of XForm objects read from PDF file.  Objects owned!
     XFormList iXForms;
 
@@ -91,6 +91,7 @@ public:
 
     //! Save the object in XML format.
     virtual void saveAsXml(Stream & stream, String layer) const = 0;
+    uint64_t contentHash() const;
 
     //! Draw the object.
     virtual void draw(Painter & painter) const = 0;
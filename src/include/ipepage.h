@@ -51,6 +51,7 @@ public:
     static Page * basic();
 
     void saveAsXml(Stream & stream) const;
+    void saveHeaderAsXml(Stream & stream) const;
     void saveAsIpePage(Stream & stream) const;
     void saveSelection(Stream & stream) const;
 
@@ -92,7 +93,10 @@ public:
     //! Return name of view.
     String viewName(int index) const noexcept { return iViews[index].iName; }
     //! Set name of view.
-    void setViewName(int index, String name) noexcept { iViews[index].iName = name; }
+    void setViewName(int index, String name) noexcept {
+	iViews[index].iName = name;
+	invalidateHashes();
+    }
     //! Return if view is marked.
     bool markedView(int index) const { return iViews[index].iMarked; }
     //! Set if view is marked.
@@ -118,7 +122,10 @@ public:
     }
 
     std::vector<Matrix> layerMatrices(int view) const;
-    void clearLayerMatrices(int view) { iViews[view].iLayerMatrices.clear(); }
+    void clearLayerMatrices(int view) {
+	iViews[view].iLayerMatrices.clear();
+	invalidateHashes();
+    }
     void setLayerMatrix(int view, int layer, const Matrix & m);
 
     void setVisible(int view, String layer, bool vis);
@@ -164,12 +171,20 @@ public:
     //! Set selection status of object at index \a i.
     inline void setSelect(int i, TSelect sel) { iObjects[i].iSelect = sel; }
     //! Set layer of object at index \a i.
-    inline void setLayerOf(int i, int layer) { iObjects[i].iLayer = layer; }
+    inline void setLayerOf(int i, int layer) {
+	iObjects[i].iLayer = layer;
+	invalidateHashes();
+    }
 
     Rect pageBBox(const Cascade * sheet) const;
     Rect viewBBox(const Cascade * sheet, int view) const;
     Rect bbox(int i) const;
 
+    uint64_t objectHash(int i) const;
+    uint64_t layerHash(int layer) const;
+    uint64_t viewHash(int view) const;
+    uint64_t contentHash() const;
+
     void transform(int i, const Matrix & m);
     double distance(int i, const Vector & v, double bound) const;
     void snapVtx(int i, const Vector & mouse, Vector & pos, double & bound) const;
@@ -231,10 +246,34 @@ private:
 	TSelect iSelect;
 	int iLayer;
 	mutable Rect iBBox;
+	mutable std::atomic<bool> iBBoxValid; // is iBBox up to date?
+	mutable uint64_t iHash;
+	mutable std::atomic<bool> iHashValid; // is iHash up to date?
 	Object * iObject;
     };
     typedef std::vector<SObject> ObjSeq;
 
+    //! Hashes of the page, which are not copied with it.
+    struct SHashes {
+	SHashes() {}
+	SHashes(const SHashes &) {}
+	SHashes & operator=(const SHashes &) {
+	    iLayersValid = iViewsValid = iContentValid = false;
+	    return *this;
+	}
+
+	std::vector<uint64_t> iLayers;
+	std::vector<uint64_t> iViews;
+	uint64_t iContent = 0;
+	std::atomic<bool> iLayersValid = false;
+	std::atomic<bool> iViewsValid = false;
+	std::atomic<bool> iContentValid = false;
+    };
+
+    void invalidateHashes() const noexcept {
+	iHashes.iLayersValid = iHashes.iViewsValid = iHashes.iContentValid = false;
+    }
+
     LayerSeq iLayers;
     ViewSeq iViews;
 
@@ -243,6 +282,7 @@ private:
     bool iUseTitle[2];
     String iSection[2];
     ObjSeq iObjects;
+    mutable SHashes iHashes;
     String iNotes;
     bool iMarked;
     Attribute iStyle;
@@ -67,6 +67,9 @@ public:
 
     void setAttributeMap(const AttributeMap * map);
     Attribute lookup(Kind kind, Attribute sym) const;
+    void setDetail(double size);
+    //! Return size of details that can be omitted (zero to draw exactly).
+    inline double detail() const { return iDetail; }
 
     void transform(const Matrix & m);
     void untransform(TTransformations trans);
@@ -167,6 +170,7 @@ protected:
     const Cascade * iCascade;
     const AttributeMap * iAttributeMap;
     int iInPath;
+    double iDetail;
 };
 
 // --------------------------------------------------------------------
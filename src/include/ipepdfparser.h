@@ -35,6 +35,9 @@
 #include "ipebase.h"
 #include "ipegeo.h"
 
+#include <new>
+#include <string_view>
+#include <type_traits>
 #include <unordered_map>
 
 // --------------------------------------------------------------------
@@ -53,10 +56,12 @@ class PdfArray;
 class PdfDict;
 
 class PdfFile;
+class PdfArena;
 
 class PdfObj {
 public:
     virtual ~PdfObj() = 0;
+    void operator delete(PdfObj * obj, std::destroying_delete_t);
     virtual const PdfNull * null() const noexcept;
     virtual const PdfBool * boolean() const noexcept;
     virtual const PdfNumber * number() const noexcept;
@@ -68,6 +73,10 @@ public:
     virtual void write(Stream & stream, const PdfRenumber * renumber = nullptr,
 		       bool inflate = false) const noexcept = 0;
     String repr() const noexcept;
+
+private:
+    bool iInArena = false;
+    friend class PdfArena;
 };
 
 class PdfNull : public PdfObj {
@@ -113,6 +122,7 @@ public:
     virtual void write(Stream & stream, const PdfRenumber * renumber,
 		       bool inflate) const noexcept;
     inline String value() const noexcept { return iValue; }
+    inline bool binary() const noexcept { return iBinary; }
     String decode() const noexcept;
 
 private:
@@ -192,18 +202,64 @@ public:
     void setLateStream(int pos) noexcept { iLateStreamPosition = pos; }
     int lateStream() const noexcept { return iLateStreamPosition; }
 
+private:
+    const PdfObj * find(const String & key) const noexcept;
+
 private:
     struct Item {
 	String iKey;
+	size_t iHash;
 	const PdfObj * iVal;
     };
     std::vector<Item> iItems;
+    //! Hash index on the keys, only for large dictionaries.
+    std::unique_ptr<std::unordered_map<std::string_view, int>> iIndex;
     int iLateStreamPosition;
     Buffer iStream;
 };
 
 // --------------------------------------------------------------------
 
+class PdfArena {
+public:
+    PdfArena();
+    ~PdfArena();
+    PdfArena(const PdfArena &) = delete;
+    PdfArena & operator=(const PdfArena &) = delete;
+
+    template <typename T, typename... Args>
+    T * make(Args &&... args);
+    String intern(const char * name, int len);
+    void clear() noexcept;
+    void merge(PdfArena & other);
+
+private:
+    void * allocate(size_t size);
+
+private:
+    std::vector<char *> iBlocks;
+    size_t iBlock;
+    size_t iUsed;
+    std::vector<PdfObj *> iObjects;
+    std::unordered_map<std::string_view, String> iNames;
+};
+
+//! Create a new object of type \a T in the arena.
+/*! The object is owned by the arena, and destroyed when the arena is
+  cleared or destroyed.  Calling delete on it is harmless. */
+template <typename T, typename... Args>
+T * PdfArena::make(Args &&... args) {
+    T * obj = ::new (allocate(sizeof(T))) T(std::forward<Args>(args)...);
+    obj->iInArena = true;
+    // numbers, references, booleans, and null own no memory
+    if constexpr (!(std::is_same_v<T, PdfNumber> || std::is_same_v<T, PdfRef>
+		    || std::is_same_v<T, PdfBool> || std::is_same_v<T, PdfNull>))
+	iObjects.push_back(obj);
+    return obj;
+}
+
+// --------------------------------------------------------------------
+
 //! A PDF lexical token.
 struct PdfToken {
     //! The various types of tokens.
@@ -230,7 +286,7 @@ struct PdfToken {
 
 class PdfParser {
 public:
-    PdfParser(DataSource & source);
+    PdfParser(DataSource & source, PdfArena * arena = nullptr);
 
     inline void getChar() { iCh = iSource.getChar(); }
     inline bool eos() const noexcept { return (iCh == EOF); }
@@ -247,9 +303,16 @@ private:
     void skipWhiteSpace();
     PdfArray * makeArray();
     PdfDict * makeDict(bool lateStream);
+    String makeName(const String & tok);
+    template <typename T, typename... Args>
+    T * make(Args &&... args) {
+	if (iArena) return iArena->make<T>(std::forward<Args>(args)...);
+	return new T(std::forward<Args>(args)...);
+    }
 
 private:
     DataSource & iSource;
+    PdfArena * iArena;
     int iCh;
     PdfToken iTok;
 };
@@ -257,6 +320,7 @@ private:
 class PdfFile {
 public:
     bool parse(DataSource & source);
+    bool parse(const Buffer & data, int threads);
     const PdfObj * object(int num) const noexcept;
     const PdfDict * catalog() const noexcept;
     const PdfDict * page(int pno = 0) const noexcept;
@@ -265,19 +329,33 @@ public:
     int countPages() const { return static_cast<int>(iPages.size()); }
     Rect mediaBox(const PdfDict * page) const;
     int findPageFromPageObjectNumber(int objNum) const;
+    //! Return the arena holding the parsed objects.
+    std::shared_ptr<PdfArena> arena() const noexcept { return iArena; }
 
 private:
+    using ObjectList = std::vector<std::pair<int, std::unique_ptr<const PdfObj>>>;
+
+    bool parseSource(DataSource & source);
     bool readPageTree(const PdfObj * ptn = nullptr);
     bool parseFromXRefObj(PdfParser & parser, DataSource & source);
     bool parseSequentially(DataSource & source);
+    bool readObjects(const std::vector<int> & xref, bool objStreams, DataSource & source);
+    bool readObjectsParallel(const std::vector<int> & xref, bool objStreams);
+    bool isObjectStream(const PdfObj * obj) const;
     bool parseObjectStream(const PdfDict * d);
+    bool readObjectStream(const PdfDict * d, PdfArena * arena, ObjectList & objs) const;
     bool readDelayedStreams(std::vector<int> & delayed, DataSource & source);
 
 private:
+    // must be destroyed after the objects it holds
+    std::shared_ptr<PdfArena> iArena = std::make_shared<PdfArena>();
     std::unordered_map<int, std::unique_ptr<const PdfObj>> iObjects;
     std::unique_ptr<const PdfDict> iTrailer;
     std::vector<const PdfDict *> iPages;
     std::vector<int> iPageObjectNumbers;
+    //! File data while parsing in parallel.
+    const Buffer * iData = nullptr;
+    int iThreads = 1;
 };
 
 } // namespace ipe
@@ -55,6 +55,9 @@ public:
     explicit Reference(const AllAttributes & attr, Attribute name, Vector pos);
 
     explicit Reference(const XmlAttributes & attr, String data);
+    Reference(const Reference & rhs);
+    ~Reference();
+    Reference & operator=(const Reference &) = delete;
 
     virtual Object * clone() const;
 
@@ -102,7 +105,13 @@ public:
     static uint32_t flagsFromName(String name);
 
 private:
+    //! Snap positions of the symbol at one size.
+    struct Snaps {
+	std::vector<Vector> iPos;
+	Snaps * iNext; //!< Snap positions cached before.
+    };
     void cacheSnaps(const Symbol * symbol, double size) const;
+    const std::vector<Vector> & snaps() const noexcept;
 
 private:
     Attribute iName;
@@ -112,7 +121,9 @@ private:
     Attribute iFill;
     Attribute iPen;
     uint32_t iFlags;
-    mutable std::vector<Vector> iSnap; // caching info from the symbol itself
+    // caching info from the symbol itself, see cacheSnaps()
+    mutable std::atomic<Snaps *> iSnaps;
+    mutable std::atomic<const Snaps *> iSnap;
 };
 
 } // namespace ipe
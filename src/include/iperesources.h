@@ -83,7 +83,9 @@ public:
 public:
     PdfResources();
     virtual ~PdfResources() = default;
-    bool collect(const PdfDict * resources, PdfFile * file);
+    bool collect(const PdfDict * resources, PdfFile * file, int offset = 0,
+		 String suffix = String());
+    int nextObjectNumber() const noexcept;
     virtual const PdfObj * object(int num) const noexcept;
     virtual const PdfDict * baseResources() const noexcept;
     void addPageNumber(SPageNumber & pn) noexcept;
@@ -96,17 +98,23 @@ public:
     void setIpeXForm(int num);
 
 private:
-    void add(int num, PdfFile * file);
-    void addIndirect(const PdfObj * q, PdfFile * file);
-    bool addToResource(PdfDict * d, String key, const PdfObj * el, PdfFile * file);
+    void add(int num, PdfFile * file, int offset);
+    void addIndirect(const PdfObj * q, PdfFile * file, int offset);
+    bool addToResource(PdfDict * d, String key, const PdfObj * el, PdfFile * file,
+		       int offset);
+    void addRunResources(int num);
 
 private:
+    //! Arenas of the PdfFiles the objects were taken from (must outlive iObjects).
+    std::vector<std::shared_ptr<PdfArena>> iArenas;
     std::unordered_map<int, std::unique_ptr<const PdfObj>> iObjects;
     std::vector<int> iEmbedSequence;
     // which of the objects in the PDF file are XForms corresponding to Ipe text objects
     std::unordered_set<int> ipeXForms;
     //! Page number objects.
     std::vector<SPageNumber> iPageNumbers;
+    //! Resources of the current later Latex run that were not renamed.
+    std::unique_ptr<PdfDict> iRunResources;
 };
 
 } // namespace ipe
@@ -44,6 +44,63 @@ class Ellipse;
 class ClosedSpline;
 class Curve;
 
+class BezierCache {
+public:
+    //! Polygonal approximation of the Bezier curves to one tolerance.
+    struct Flattening {
+	int iExponent;               //!< The tolerance is 2 ^ iExponent.
+	std::vector<Vector> iPoints; //!< Chunk of each curve, starting at iV[0].
+	std::vector<int> iChunk;     //!< First point of each chunk, and the end.
+	std::vector<Rect> iBox;      //!< Bounding box of each chunk.
+	Flattening * iNext;
+    };
+    //! Bezier curves of the splines in a subpath.
+    struct Data {
+	Data()
+	    : iFlat(nullptr) {}
+	~Data();
+	const Flattening & flattening(const Matrix & m, double tolerance) const;
+	std::vector<Bezier> iBez; //!< Bezier curves of all segments.
+	std::vector<int> iFirst;  //!< First curve of each segment, and the end.
+	std::vector<Rect> iHull;  //!< Bounding box of control points of each curve.
+	mutable std::atomic<Flattening *> iFlat;
+    };
+    //! Long runs of straight segments simplified for drawing to one precision.
+    struct Decimation {
+	struct Run {
+	    int iBegin, iEnd;   //!< Segments iBegin to iEnd - 1 are replaced.
+	    int iFirst, iLast;  //!< By points iFirst to iLast - 1.
+	};
+	int iExponent;               //!< The precision is 2 ^ iExponent.
+	std::vector<Vector> iPoints; //!< Points of all runs.
+	std::vector<Run> iRuns;
+	Decimation * iNext;
+    };
+
+    BezierCache() noexcept
+	: iData(nullptr)
+	, iDecimation(nullptr) {}
+    //! The cache is never shared between copies.
+    BezierCache(const BezierCache &) noexcept
+	: iData(nullptr)
+	, iDecimation(nullptr) {}
+    BezierCache & operator=(const BezierCache &) noexcept {
+	clear();
+	return *this;
+    }
+    ~BezierCache() { clear(); }
+    void clear() noexcept;
+    //! Return cached data, or nullptr.
+    const Data * data() const noexcept { return iData.load(std::memory_order_acquire); }
+    const Data * publish(Data * data) const noexcept;
+    const Decimation * decimation(int exponent) const noexcept;
+    const Decimation * publish(Decimation * decimation) const noexcept;
+
+private:
+    mutable std::atomic<Data *> iData;
+    mutable std::atomic<Decimation *> iDecimation;
+};
+
 class CurveSegment {
 public:
     enum Type { EArc, ESegment, ESpline, EOldSpline, ECardinalSpline, ESpiroSpline };
@@ -75,6 +132,7 @@ private:
     CurveSegment(const Curve * curve, int index);
 
     const Vector * cps() const;
+    void computeBeziers(std::vector<Bezier> & bez) const;
 
 private:
     const Curve * iCurve;
@@ -149,8 +207,14 @@ public:
     virtual void snapBnd(const Vector & mouse, const Matrix & m, Vector & pos,
 			 double & bound) const;
 
+private:
+    const BezierCache::Data & bezierData() const;
+
 public:
     std::vector<Vector> iCP; // control points
+
+private:
+    BezierCache iCache;
 };
 
 class Curve : public SubPath {
@@ -192,6 +256,10 @@ public:
 
 private:
     void appendSpline(const std::vector<Vector> & v, CurveSegment::Type type);
+    const BezierCache::Data & bezierData() const;
+    const BezierCache::Decimation * decimation(const Matrix & m, double tolerance) const;
+    int straightRun(int i, int n) const;
+    const Polyline & straightPoints(int i, int j, const Matrix & m, bool mid) const;
 
 private:
     struct Seg {
@@ -209,6 +277,7 @@ private:
     std::vector<Seg> iSeg;
     std::vector<Vector> iCP; // control points
     std::vector<Matrix> iM;  // for arcs
+    BezierCache iCache;
 
     friend class CurveSegment;
 };
@@ -264,7 +333,7 @@ private:
     typedef std::vector<SubPath *> SubPathSeq;
     struct Imp {
 	~Imp();
-	int iRefCount;
+	std::atomic<int> iRefCount;
 	SubPathSeq iSubPaths;
     };
     Imp * iImp;
@@ -112,6 +112,8 @@ public:
     Attribute find(Kind, Attribute sym) const;
 
     void remove(Kind kind, Attribute sym);
+    //! Return a number that changes whenever the style sheet is modified.
+    inline uint64_t version() const { return iVersion; }
 
     void saveAsXml(Stream & stream, bool saveBitmaps = false) const;
 
@@ -122,8 +124,7 @@ public:
 
     //! Return Latex preamble.
     inline String preamble() const { return iPreamble; }
-    //! Set LaTeX preamble.
-    inline void setPreamble(const String & str) { iPreamble = str; }
+    void setPreamble(const String & str);
 
     const Layout * layout() const;
     void setLayout(const Layout & margins);
@@ -149,8 +150,7 @@ public:
 
     //! Return name of style sheet.
     inline String name() const { return iName; }
-    //! Set name of style sheet.
-    inline void setName(const String & name) { iName = name; }
+    void setName(const String & name);
 
 private:
     typedef std::map<int, Symbol> SymbolMap;
@@ -161,6 +161,7 @@ private:
     typedef std::map<int, Attribute> Map;
 
     bool iStandard;
+    uint64_t iVersion;
     String iName;
     SymbolMap iSymbols;
     GradientMap iGradients;
@@ -177,6 +178,8 @@ private:
     TLineJoin iLineJoin;
     TLineCap iLineCap;
     TFillRule iFillRule;
+
+    friend class Cascade;
 };
 
 class Cascade {
@@ -218,8 +221,20 @@ public:
     void allNames(Kind kind, AttributeSeq & seq) const;
     int findDefinition(Kind kind, Attribute sym) const;
 
+    uint64_t version() const;
+
+private:
+    struct Lookup;
+    const Lookup * lookup() const;
+    void clearLookup();
+
 private:
     std::vector<StyleSheet *> iSheets;
+    uint64_t iVersion;
+    //! Flattened attribute definitions of the cascade.
+    mutable std::atomic<Lookup *> iLookup;
+    //! Outdated tables, which may still be in use by another thread.
+    mutable std::vector<Lookup *> iRetired;
 };
 
 } // namespace ipe
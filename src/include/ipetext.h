@@ -114,7 +114,8 @@ public:
     void setText(String text);
 
     struct XForm {
-	int iRefCount;
+	std::atomic<int> iRefCount;
+	int iIpeId; // number of the text object in the Latex source
 	Rect iBBox;
 	int iDepth;
 	float iStretch;
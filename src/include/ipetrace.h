@@ -0,0 +1,97 @@
+// -*- C++ -*-
+// --------------------------------------------------------------------
+// Tracing of time spent in Ipelib
+// --------------------------------------------------------------------
+/*
+
+    This file is part of the extensible drawing editor Ipe.
+    Copyright (c) 1993-2024 Otfried Cheong
+
+    Ipe is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    As a special exception, you have permission to link Ipe with the
+    CGAL library and distribute executables, as long as you follow the
+    requirements of the Gnu General Public License in regard to all of
+    the software in the executable aside from CGAL.
+
+    Ipe is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+    or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+    License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ipe; if not, you can find it at
+    "http://www.gnu.org/copyleft/gpl.html", or write to the Free
+    Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#ifndef IPETRACE_H
+#define IPETRACE_H
+
+#include "ipebase.h"
+
+#include <atomic>
+
+// --------------------------------------------------------------------
+
+namespace ipe {
+
+class Trace {
+public:
+    //! Times the enclosing scope.
+    class Span {
+    public:
+	explicit Span(const char * name) noexcept;
+	~Span() noexcept;
+	Span(const Span &) = delete;
+	Span & operator=(const Span &) = delete;
+
+    private:
+	const char * iName;
+	int64_t iStart; // in microseconds, negative if not tracing
+    };
+
+    //! Accumulated statistics for one span path or counter.
+    struct Stat {
+	String iName;   //!< Span path ("outer/inner") or counter name.
+	int64_t iCount; //!< Number of calls, or value of counter.
+	double iTotal;  //!< Total time in milliseconds (zero for counters).
+	double iMax;    //!< Longest call in milliseconds (zero for counters).
+    };
+
+    static void enable(bool on) noexcept;
+    //! Is tracing currently enabled?
+    static bool enabled() noexcept { return sEnabled.load(std::memory_order_relaxed); }
+    static void count(const char * name, int64_t delta = 1) noexcept;
+    static void reset();
+    static std::vector<Stat> spans();
+    static std::vector<Stat> counters();
+    static bool saveChromeTrace(const char * fname);
+
+private:
+    static std::atomic<bool> sEnabled;
+};
+
+} // namespace ipe
+
+// Tracing is compiled out if IPE_NO_TRACE is defined.
+#ifdef IPE_NO_TRACE
+#define IPE_TRACE_SPAN(name)
+#define IPE_TRACE_COUNT(name, delta)
+#else
+#define IPE_TRACE_CONCAT2(a, b) a##b
+#define IPE_TRACE_CONCAT(a, b) IPE_TRACE_CONCAT2(a, b)
+#define IPE_TRACE_SPAN(name)                                                             \
+    ipe::Trace::Span IPE_TRACE_CONCAT(ipeTraceSpan, __LINE__)(name)
+#define IPE_TRACE_COUNT(name, delta)                                                     \
+    do {                                                                                 \
+	if (ipe::Trace::enabled()) ipe::Trace::count(name, delta);                       \
+    } while (0)
+#endif
+
+// --------------------------------------------------------------------
+#endif
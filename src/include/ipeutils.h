@@ -35,6 +35,8 @@
 #include "ipebitmap.h"
 #include "ipepainter.h"
 
+#include <functional>
+
 // --------------------------------------------------------------------
 
 namespace ipe {
@@ -170,6 +172,53 @@ private:
     Buffer iOut;
 };
 
+// --------------------------------------------------------------------
+
+class SpillFile {
+public:
+    SpillFile();
+    ~SpillFile();
+    SpillFile(const SpillFile &) = delete;
+    SpillFile & operator=(const SpillFile &) = delete;
+
+    //! Can pages be stored?
+    bool isOpen() const { return iFile != nullptr; }
+    int store(const Page * page);
+    int store(const Object * obj);
+    Page * load(int id);
+    Object * loadObject(int id);
+    //! Was an object (rather than a page) stored under \a id?
+    bool isObject(int id) const {
+	return 0 <= id && id < int(iEntries.size()) && iEntries[id].iObject;
+    }
+    void release(int id);
+    //! Return number of bytes used in the file.
+    long size() const { return iEnd; }
+
+    static size_t estimate(const Page * page);
+    static size_t estimate(const Object * obj);
+
+private:
+    int store(const Page * page, bool object);
+
+    struct Entry {
+	long iOffset;
+	int iSize; // negative when released
+	bool iObject;
+	//! The typeset text of the Text objects, in the order of the page.
+	std::vector<Text::XForm *> iXForms;
+    };
+    FILE * iFile;
+    long iEnd;
+    std::vector<Entry> iEntries;
+};
+
+// --------------------------------------------------------------------
+
+void parallelFor(int n, int threads, const std::function<void(int, int, int)> & fn);
+bool runInWorkers(int n, int workers, const std::function<String(int)> & work,
+		  const std::function<void(int, String)> & done);
+
 } // namespace ipe
 
 // --------------------------------------------------------------------
@@ -2928,9 +2928,11 @@ function MODEL:saction_custom()
 	    }
   t.undo = function (t, doc)
              doc[t.pno][t.primary]:setCustom(t.original)
+	     doc[t.pno]:invalidateBBox(t.primary)
 	   end
   t.redo = function (t, doc)
              doc[t.pno][t.primary]:setCustom(t.custom)
+	     doc[t.pno]:invalidateBBox(t.primary)
            end
   self:register(t)
 end
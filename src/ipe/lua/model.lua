@@ -591,10 +591,15 @@ function MODEL:runLatex()
   if prefs.freeze_in_latex then
     success, errmsg, result, log = self.doc:runLatex(self.file_name)
   else
-    success, converter, errmsg, result = self.doc:prepareLatexRun()
-    if converter then
-      self:waitDialog(self.doc:howToRunLatex(self.file_name), "Compiling Latex")
+    -- a cached format may have been made by an older Latex, then try again
+    for attempt = 1, 2 do
+      success, converter, errmsg, result = self.doc:prepareLatexRun(self.file_name)
+      if not converter then break end
+      self:waitDialog(self.doc:howToRunLatex(self.file_name, converter),
+		      "Compiling Latex")
       success, errmsg, result, log = self.doc:completeLatexRun(converter)
+      if result ~= "latexformat" then break end
+      result = "runlatex"
     end
   end
   if success then
@@ -653,7 +658,9 @@ function MODEL:newDocument()
 
   self.undo = { {} }
   self.redo = {}
+  self.spill = nil
   self:markAsUnmodified()
+  self:discardJournal()
 
   self.doc = ipe.Document()
   for _, w in ipairs(config.styleList) do
@@ -699,7 +706,9 @@ function MODEL:tryLoadDocument(fname)
 
     self.undo = { {} }
     self.redo = {}
+    self.spill = nil
     self:markAsUnmodified()
+    self:openJournal(true)
 
     self:setPage()
 
@@ -766,6 +775,7 @@ function MODEL:saveDocument(fname)
   self:markAsUnmodified()
   self.ui:explain("Saved document '" .. fname .. "'")
   self.file_name = fname
+  self:openJournal(false)
   self:setCaption()
   self:updateRecentFiles(fname)
   return true
@@ -836,18 +846,7 @@ function MODEL:autosave()
   if not self:isModified() then return end
   local f
   if self.file_name then
-    if prefs.autosave_filename:find("%%s") then
-      f = self.file_name:match(prefs.basename_pattern) or self.file_name
-      f = string.format(prefs.autosave_filename, f)
-    else
-      f = prefs.autosave_filename
-    end
-    if f:sub(1, 1) ~= prefs.fsep then -- relative filename
-      local d = self.file_name:match(prefs.dir_pattern)
-      if d then
-        f = d .. prefs.fsep .. f
-      end
-    end
+    f = self:companionFile(prefs.autosave_filename)
   else
     f = prefs.autosave_unnamed
   end
@@ -858,6 +857,86 @@ function MODEL:autosave()
   end
 end
 
+-- name of a file belonging to the document file
+-- pattern can contain '%s' for the filename of the document,
+-- a relative filename is in the directory of the document
+function MODEL:companionFile(pattern)
+  local f
+  if pattern:find("%%s") then
+    f = self.file_name:match(prefs.basename_pattern) or self.file_name
+    f = string.format(pattern, f)
+  else
+    f = pattern
+  end
+  if f:sub(1, 1) ~= prefs.fsep then -- relative filename
+    local d = self.file_name:match(prefs.dir_pattern)
+    if d then
+      f = d .. prefs.fsep .. f
+    end
+  end
+  return f
+end
+
+----------------------------------------------------------------------
+
+-- start a journal for the document as it is in its file
+-- if recover is true, first apply the journal left by an earlier session
+function MODEL:openJournal(recover)
+  self:discardJournal()
+  if not prefs.journal_filename or not self.file_name then return end
+  local f = self:companionFile(prefs.journal_filename)
+  local j = ipe.Journal()
+  if not j:lock(f) then
+    self:warning("Changes will not be recorded in a journal",
+		 "The document '" .. self.file_name ..
+		   "' is being edited in another Ipe window, which keeps " ..
+		   "the journal '" .. f .. "'.")
+    return
+  end
+  if recover and ipe.fileExists(f) and
+    messageBox(self.ui:win(), "question",
+	       "There are unsaved changes to this document",
+	       "Ipe was not closed properly while you were editing '" ..
+		 self.file_name .. "'.\n\nDo you wish to recover your changes?",
+	       "okcancel") == 1 then
+    local n, err, code = j:recover(f, self.doc)
+    if n then
+      self.save_timestamp = self.save_timestamp + 1 -- document is modified
+      self.ui:explain("Recovered " .. n .. " changes from " .. f)
+    else
+      self:warning("Changes could not be recovered", err)
+      if code == -3 then -- journal was applied partially
+	self.doc = ipe.Document(self.file_name) or self.doc
+      end
+    end
+  end
+  if not j:isOpen() and not j:open(f, self.doc) then
+    self:warning("Cannot write journal",
+		 "Ipe cannot write the journal of your changes to '" .. f .. "'.")
+    return
+  end
+  self.journal = j
+  self.journal_file = f
+end
+
+-- record the changes made by undo step t
+function MODEL:recordJournal(t)
+  if self.journal and not self.journal:record(self.doc, t.pno) then
+    self:warning("Cannot write journal",
+		 "Ipe cannot write the journal of your changes to '" ..
+		   self.journal_file .. "'.")
+    self.journal = nil
+  end
+end
+
+-- remove the journal, the changes have been saved or discarded
+function MODEL:discardJournal()
+  if not self.journal then return end
+  os.remove(self.journal_file)
+  self.journal:close() -- release the lock after removing the file
+  self.journal = nil
+end
+
 ----------------------------------------------------------------------
 
 function MODEL:closeEvent()
@@ -869,26 +948,139 @@ function MODEL:closeEvent()
 			 "savediscardcancel")
     if r == 0 or (r == 1 and self:action_save()) then
       self.okay_close = true
+      self:discardJournal()
       self.ui:close()
     end
   else
     self.okay_close = true
+    self:discardJournal()
     self.ui:close()
   end
 end
 
 ----------------------------------------------------------------------
 
--- TODO:  limit on undo stack size?
 function MODEL:registerOnly(t)
   self.pristine = false
   -- store it on undo stack
   self.undo[#self.undo + 1] = t
   -- flush redo stack
   self.redo = {}
+  self:limitUndo()
+  self:recordJournal(t)
   self:setPage()
 end
 
+-- Keep the pages and objects held by the undo stack within
+-- prefs.undo_memory.  Those of older steps are moved to a temporary
+-- file, and are loaded again when these steps are undone.
+function MODEL:limitUndo()
+  if not prefs.undo_memory then return end
+  if not self.spill then self.spill = ipe.SpillFile() end
+  local budget = prefs.undo_memory * 1048576
+  local total = 0
+  local first, last -- the steps that do not fit
+  for i = #self.undo, 2, -1 do
+    local t = self.undo[i]
+    if t.spilled then break end  -- older steps have been moved as well
+    if not t.memory then
+      t.memory = 0
+      self:undoValues(t, function (tbl, k, v)
+			   t.memory = t.memory + self.spill:estimate(v)
+			 end)
+    end
+    total = total + t.memory
+    if total > budget then
+      first = i
+      last = last or i
+    end
+  end
+  if not first then return end
+  -- move the oldest step first, so that the steps undone first are
+  -- stored last, and their space in the file can be reused
+  for i = first, last do
+    if not self:spillUndo(self.undo[i]) then
+      -- no temporary file: forget these steps and all older ones
+      self:forgetUndo(last)
+      return
+    end
+  end
+end
+
+-- call fn(tbl, k, v) for each page or object v = tbl[k] held by
+-- undo step t, either directly or in a plain table it holds (such as
+-- a list of objects)
+function MODEL:undoValues(t, fn)
+  local seen = {}
+  local function visit(tbl, nested)
+    for k, v in pairs(tbl) do
+      if type(v) == "userdata" and self.spill:estimate(v) > 0 then
+	fn(tbl, k, v)
+      elseif type(v) == "table" and nested and not seen[v]
+	and getmetatable(v) == nil then
+	seen[v] = true
+	visit(v, false)
+      end
+    end
+  end
+  visit(t, true)
+end
+
+-- move the pages and objects of undo step t to the temporary file
+function MODEL:spillUndo(t)
+  local spilled = {}
+  local ok = true
+  self:undoValues(t, function (tbl, k, v)
+		       if not ok then return end
+		       local id = self.spill:store(v)
+		       if id then
+			 spilled[#spilled + 1] = { tbl, k, id }
+		       elseif id == false then
+			 ok = false
+		       end
+		     end)
+  if not ok then
+    for _, s in ipairs(spilled) do self.spill:release(s[3]) end
+    return false
+  end
+  for _, s in ipairs(spilled) do s[1][s[2]] = nil end
+  t.spilled = spilled
+  return true
+end
+
+-- load the pages and objects of undo step t from the temporary file
+-- returns false, leaving the step as it is, if one cannot be read back
+function MODEL:unspillUndo(t)
+  if not t.spilled then return true end
+  local values = {}
+  for i, s in ipairs(t.spilled) do
+    values[i] = self.spill:load(s[3])
+    if not values[i] then return false end
+  end
+  for i = #t.spilled, 1, -1 do
+    local s = t.spilled[i]
+    s[1][s[2]] = values[i]
+    self.spill:release(s[3])
+  end
+  t.spilled = nil
+  return true
+end
+
+-- make step i the oldest step, it can no longer be undone
+function MODEL:forgetUndo(i)
+  for j = 1, i do
+    local t = self.undo[j]
+    if t.spilled then
+      for _, s in ipairs(t.spilled) do self.spill:release(s[3]) end
+    end
+  end
+  local n = #self.undo
+  local bottom = { save_timestamp = self.undo[i].save_timestamp }
+  table.move(self.undo, i + 1, n, 2)
+  for j = n - i + 2, n do self.undo[j] = nil end
+  self.undo[1] = bottom
+end
+
 function MODEL:register(t)
   -- store selection
   t.original_selection = self:selection()
@@ -1031,8 +1223,14 @@ function MODEL:action_undo()
     return
   end
   t = self.undo[#self.undo]
+  if not self:unspillUndo(t) then
+    self:warning("Cannot undo '" .. t.label .. "'",
+		 "The undo information could not be read back from its temporary file.")
+    return
+  end
   table.remove(self.undo)
   t.undo(t, self.doc)
+  self:recordJournal(t)
   self.ui:explain("Undo '" .. t.label .. "'")
   self.redo[#self.redo + 1] = t
   if t.pno then
@@ -1073,6 +1271,8 @@ function MODEL:action_redo()
   t.redo(t, self.doc)
   self.ui:explain("Redo '" .. t.label .. "'")
   self.undo[#self.undo + 1] = t
+  self:limitUndo()
+  self:recordJournal(t)
   if t.pno then
     self.pno = t.pno
   elseif t.pno1 then
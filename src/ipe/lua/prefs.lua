@@ -59,6 +59,12 @@ prefs.latex_service_url = "https://latexonline.cc"
 -- set to nil to disable autosaving
 prefs.autosave_interval = 600 -- 10 minutes
 
+-- Memory in megabytes that the undo information may use
+-- the pages and objects saved by older steps are compressed and moved
+-- to a temporary file, and are read back when these steps are undone
+-- nil keeps all undo information in memory
+prefs.undo_memory = 256
+
 -- Filename for autosaving
 -- can contain '%s' for the filename of the current file
 -- can use 'home' for the user's home directory
@@ -72,6 +78,15 @@ else
   prefs.autosave_unnamed = home .. "/autosave.ipe"
 end
 
+-- Filename for the journal of edits made since the document was saved
+-- it is written after every change, and replayed when Ipe opens the
+-- document again after a crash
+-- can contain '%s' for the filename of the current file
+-- if filename is relative, store in same directory as document itself
+-- documents that have not been saved yet have no journal
+-- set to nil to disable the journal
+prefs.journal_filename = "%s.journal"
+
 -- Should Ipe show the Developer menu
 -- (only useful if you develop ipelets or want to customize Ipe)
 prefs.developer = false
@@ -685,60 +685,6 @@ local function path_len(points)
   return t
 end
 
--- perform moving average
-local function smooth_path(v)
-  local M = prefs.ink_smoothing
-  local w = { v[1] }
-  for i = 2,#v-1 do
-    local p = V(0,0)
-    for j = i-M, i+M do
-      local q
-      if j < 1 then q = v[1] elseif j > #v then q = v[#v] else q = v[i] end
-      p = p + q
-    end
-    w[#w+1] = (1/(2*M+1)) * p
-  end
-  w[#w+1] = v[#v]
-  return w
-end
-
-local function simplify_path(points, tolerance)
-  local marked = {}
-  marked[1] = true
-  marked[#points] = true
-  local stack = { { 1, #points } }
-
-  -- mark points to keep
-  while #stack > 0 do
-    local pair = table.remove(stack)
-    local first = pair[1]
-    local last = pair[2]
-    local max_dist = 0
-    local index = nil
-    local seg = ipe.Segment(points[first], points[last])
-    for i = first + 1,last do
-      local d = seg:distance(points[i])
-      if d > max_dist then
-        index = i
-        max_dist = d
-      end
-    end
-    if max_dist > tolerance then
-      marked[index] = true
-      stack[#stack + 1] = { first, index }
-      stack[#stack + 1] = { index, last }
-    end
-  end
-  -- only use marked vertices
-  local out = {}
-  for i, point in ipairs(points) do
-    if marked[i] then
-      out[#out+1] = point
-    end
-  end
-  return out
-end
-
 -- vector for control points around p2
 local function tang(p1, p2, p3)
   return (p2-p1):normalized() + (p3 - p2):normalized()
@@ -800,42 +746,40 @@ function INKTOOL:new(model)
   setmetatable(tool, INKTOOL)
   tool.model = model
   local v = model.ui:pos()
-  tool.v = { v }
+  tool.last = v
   -- print("make ink tool")
   model.ui:shapeTool(tool)
   local s = model.doc:sheets():find("color", model.attributes.stroke)
   tool.setColor(s.r, s.g, s.b)
   tool.w = model.doc:sheets():find("pen", model.attributes.pen)
+  -- the stroke is collected and drawn by the native shape tool
+  tool.addInk(v, tool.w * model.ui:zoom())
   model.ui:setCursor(tool.w, s.r, s.g, s.b)
   return tool
 end
 
-function INKTOOL:compute(incremental)
+function INKTOOL:compute()
   local v = self.v
-  if incremental and #v > 2 then
-    self.shape[#self.shape+1]={ type="segment", v[#v-1], v[#v]}
-  else
-    self.shape = { type="curve", closed=false }
-    for i = 2, #v do
-      self.shape[#self.shape + 1] = { type="segment", v[i-1], v[i] }
-    end
+  self.shape = { type="curve", closed=false }
+  for i = 2, #v do
+    self.shape[#self.shape + 1] = { type="segment", v[i-1], v[i] }
   end
-  self.setShape( { self.shape }, 0, self.w * self.model.ui:zoom())
 end
 
 function INKTOOL:mouseButton(button, modifiers, press)
-  if self.shape then
-    self.v = smooth_path(self.v)
-    self.v = simplify_path(self.v, prefs.ink_tolerance / self.model.ui:zoom())
+  if self.moved then
+    -- smooth and simplify the stroke
+    self.v = self.finishInk(prefs.ink_smoothing,
+                            prefs.ink_tolerance / self.model.ui:zoom())
   else
-    self.v = { self.v[1], self.v[1] }
+    self.v = { self.last, self.last }
   end
   if prefs.ink_spline then
     self.shape = compute_spline(self.v)
     self.shape.type = "curve"
     self.shape.closed = false
   else
-    self:compute(false)
+    self:compute()
   end
   local obj = ipe.Path(self.model.attributes, { self.shape })
   -- round linecaps are prettier for handwriting
@@ -855,12 +799,13 @@ function INKTOOL:mouseButton(button, modifiers, press)
 end
 
 function INKTOOL:mouseMove()
-  local v1 = self.v[#self.v]
+  local v1 = self.last
   local v2 = self.model.ui:pos()
   if (v1-v2):len() * self.model.ui:zoom() > prefs.ink_min_movement then
     -- do not update if motion is too small
-    self.v[#self.v + 1] = v2
-    self:compute(true)
+    self.last = v2
+    self.moved = true
+    self.addInk(v2)
     local r = ipe.Rect()
     local offset = V(self.w, self.w)
     r:add(v1)
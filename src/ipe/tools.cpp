@@ -42,6 +42,8 @@ extern "C" {
 
 #include "ipelua.h"
 
+#include <algorithm>
+
 using namespace ipe;
 using namespace ipelua;
 
@@ -144,6 +146,7 @@ void ShapeTool::draw(Painter & painter) const {
     painter.newPath();
     iShape.draw(painter);
     painter.drawPath(EStrokedOnly);
+    if (!iInk.empty()) drawInk(painter);
     painter.setStroke(Attribute(Color(0, 1000, 0)));
     painter.setPen(Attribute(Fixed::fromDouble(1.0)));
     painter.newPath();
@@ -227,6 +230,84 @@ void ShapeTool::addMark(const Vector & v, TMarkType t) {
     iMarks.push_back(m);
 }
 
+// Number of segments of the ink stroke drawn as one path.
+constexpr int INK_CHUNK = 64;
+
+//! Append a point to the ink stroke.
+/*! The ink stroke is drawn in addition to the shape.  It is kept in
+  chunks with a bounding box, so that when only the end of the stroke
+  is repainted, the other chunks need not be drawn. */
+void ShapeTool::addInk(const Vector & v) {
+    int n = iInk.size();
+    iInk.push_back(v);
+    if (n > 0) iInkBox.back().addPoint(v);
+    if (n % INK_CHUNK == 0) iInkBox.push_back(Rect(v));
+}
+
+//! Return the ink stroke, smoothed and simplified.
+/*! Smoothing replaces each interior point by the average of the \a
+  smoothing points before it, the point itself, and the \a smoothing
+  points after it.  Simplification then keeps only those points needed
+  so that the stroke stays within \a tolerance (Douglas-Peucker). */
+std::vector<Vector> ShapeTool::finishInk(int smoothing, double tolerance) const {
+    const int n = iInk.size();
+    if (n < 3) return iInk;
+    std::vector<Vector> w = iInk;
+    if (smoothing > 0) {
+	auto at = [&](int j) { return iInk[std::clamp(j, 0, n - 1)]; };
+	Vector sum = Vector::ZERO;
+	for (int j = 1 - smoothing; j <= 1 + smoothing; ++j) sum += at(j);
+	for (int i = 1; i < n - 1; ++i) {
+	    w[i] = (1.0 / (2 * smoothing + 1)) * sum;
+	    sum += at(i + smoothing + 1) - at(i - smoothing);
+	}
+    }
+    std::vector<bool> keep(n, false);
+    keep[0] = keep[n - 1] = true;
+    std::vector<std::pair<int, int>> stack{{0, n - 1}};
+    while (!stack.empty()) {
+	auto [first, last] = stack.back();
+	stack.pop_back();
+	Segment seg(w[first], w[last]);
+	double maxDist = 0.0;
+	int index = -1;
+	for (int i = first + 1; i < last; ++i) {
+	    double d = seg.distance(w[i]);
+	    if (d > maxDist) {
+		index = i;
+		maxDist = d;
+	    }
+	}
+	if (maxDist > tolerance) {
+	    keep[index] = true;
+	    stack.emplace_back(first, index);
+	    stack.emplace_back(index, last);
+	}
+    }
+    std::vector<Vector> result;
+    for (int i = 0; i < n; ++i)
+	if (keep[i]) result.push_back(w[i]);
+    return result;
+}
+
+// Draw the chunks of the ink stroke that meet the area being repainted.
+void ShapeTool::drawInk(Painter & painter) const {
+    Rect clip = iCanvas->paintRect();
+    if (!clip.isEmpty()) {
+	Vector margin(iPen, iPen);
+	clip = Rect(clip.bottomLeft() - margin, clip.topRight() + margin);
+    }
+    for (int c = 0; c < size(iInkBox); ++c) {
+	int first = c * INK_CHUNK;
+	int last = std::min(first + INK_CHUNK, size(iInk) - 1);
+	if (last == first || (!clip.isEmpty() && !clip.intersects(iInkBox[c]))) continue;
+	painter.newPath();
+	painter.moveTo(iInk[first]);
+	for (int i = first + 1; i <= last; ++i) painter.lineTo(iInk[i]);
+	painter.drawPath(EStrokedOnly);
+    }
+}
+
 void ShapeTool::snapVtx(const Vector & mouse, Vector & pos, double & bound,
 			bool cp) const {
     if (!iSnap) return;
@@ -96,15 +96,24 @@ public:
     void setSnapping(bool snap, bool skipLast);
     void clearMarks();
     void addMark(const Vector & v, TMarkType t);
+    void addInk(const Vector & v);
+    std::vector<Vector> finishInk(int smoothing, double tolerance) const;
+    //! Set pen width.
+    void setPen(double pen) { iPen = pen; }
 
     virtual void draw(Painter & painter) const;
     virtual void snapVtx(const Vector & mouse, Vector & pos, double & bound,
 			 bool cp) const;
 
+private:
+    void drawInk(Painter & painter) const;
+
 private:
     double iPen;
     Shape iShape;
     Shape iAuxShape;
+    std::vector<Vector> iInk; // points of ink stroke
+    std::vector<Rect> iInkBox; // bounding box of each chunk of the ink stroke
     struct SMark {
 	Vector v;
 	TMarkType t;
@@ -366,6 +366,27 @@ static int shapetool_setmarks(lua_State * L) {
     return 0;
 }
 
+static int shapetool_addink(lua_State * L) {
+    ShapeTool * tool = (ShapeTool *)lua_touserdata(L, lua_upvalueindex(1));
+    Vector * v = check_vector(L, 1);
+    tool->addInk(*v);
+    if (lua_isnumber(L, 2)) tool->setPen(luaL_checknumber(L, 2));
+    return 0;
+}
+
+static int shapetool_finishink(lua_State * L) {
+    ShapeTool * tool = (ShapeTool *)lua_touserdata(L, lua_upvalueindex(1));
+    int smoothing = (int)luaL_checknumber(L, 1);
+    double tolerance = luaL_checknumber(L, 2);
+    std::vector<Vector> v = tool->finishInk(smoothing, tolerance);
+    lua_createtable(L, v.size(), 0);
+    for (int i = 0; i < size(v); ++i) {
+	push_vector(L, v[i]);
+	lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+}
+
 static int pastetool_setmatrix(lua_State * L) {
     PasteTool * tool = (PasteTool *)lua_touserdata(L, lua_upvalueindex(1));
     Matrix * m = check_matrix(L, 1);
@@ -393,6 +414,12 @@ static int appui_shapetool(lua_State * L) {
     lua_pushlightuserdata(L, tool);
     lua_pushcclosure(L, shapetool_setsnapping, 1);
     lua_setfield(L, -2, "setSnapping");
+    lua_pushlightuserdata(L, tool);
+    lua_pushcclosure(L, shapetool_addink, 1);
+    lua_setfield(L, -2, "addInk");
+    lua_pushlightuserdata(L, tool);
+    lua_pushcclosure(L, shapetool_finishink, 1);
+    lua_setfield(L, -2, "finishInk");
     canvas->setTool(tool);
     return 0;
 }
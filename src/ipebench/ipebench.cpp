@@ -0,0 +1,590 @@
+// --------------------------------------------------------------------
+// Ipebench: benchmarks for the hot paths of Ipelib
+// --------------------------------------------------------------------
+/*
+
+    This file is part of the extensible drawing editor Ipe.
+    Copyright (c) 1993-2024 Otfried Cheong
+
+    Ipe is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    As a special exception, you have permission to link Ipe with the
+    CGAL library and distribute executables, as long as you follow the
+    requirements of the Gnu General Public License in regard to all of
+    the software in the executable aside from CGAL.
+
+    Ipe is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+    or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+    License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ipe; if not, you can find it at
+    "http://www.gnu.org/copyleft/gpl.html", or write to the Free
+    Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include "ipedoc.h"
+#include "ipeimage.h"
+#include "ipelatex.h"
+#include "ipepainter.h"
+#include "ipepath.h"
+#include "ipepdfwriter.h"
+#include "ipesnap.h"
+#include "ipethumbs.h"
+#include "ipeutils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+
+using namespace ipe;
+
+// --------------------------------------------------------------------
+
+// Parameters of the synthetic document.
+struct Params {
+    int pages = 20;
+    int objects = 200;    // per page
+    double text = 0.2;    // fraction of objects that are text
+    int bitmaps = 4;      // in the whole document
+    int views = 3;        // per page
+    uint32_t seed = 1;
+    int repeat = 5;
+    int queries = 1000;   // snap queries per page
+    int thumbWidth = 600; // width of rendered pages
+};
+
+// Small linear congruential generator, so that the same seed gives the
+// same document on every platform.
+class Random {
+public:
+    explicit Random(uint32_t seed)
+	: iState(seed) {}
+    uint32_t next() {
+	iState = iState * 1664525u + 1013904223u;
+	return iState;
+    }
+    double uniform(double lo, double hi) {
+	return lo + (hi - lo) * (next() >> 8) / 16777216.0;
+    }
+    int below(int n) { return int((uint64_t(next()) * n) >> 32); }
+
+private:
+    uint32_t iState;
+};
+
+// --------------------------------------------------------------------
+
+static Bitmap makeBitmap(Random & rnd) {
+    constexpr int w = 256;
+    constexpr int h = 256;
+    Buffer data(w * h * 3);
+    char * p = data.data();
+    uint32_t base = rnd.next();
+    for (int y = 0; y < h; ++y) {
+	for (int x = 0; x < w; ++x) {
+	    *p++ = char(x ^ base);
+	    *p++ = char(y ^ (base >> 8));
+	    *p++ = char((x * y) ^ (base >> 16));
+	}
+    }
+    return Bitmap(w, h, Bitmap::ERGB, data);
+}
+
+static Object * makePath(Random & rnd, const Rect & paper) {
+    AllAttributes attr;
+    Vector p(rnd.uniform(paper.left(), paper.right()),
+	     rnd.uniform(paper.bottom(), paper.top()));
+    Shape shape;
+    switch (rnd.below(4)) {
+    case 0: { // polyline
+	Curve * c = new Curve;
+	Vector q = p;
+	int n = 3 + rnd.below(6);
+	for (int i = 0; i < n; ++i) {
+	    Vector r = q + Vector(rnd.uniform(-40, 40), rnd.uniform(-40, 40));
+	    c->appendSegment(q, r);
+	    q = r;
+	}
+	shape.appendSubPath(c);
+	break;
+    }
+    case 1: { // filled polygon
+	Curve * c = new Curve;
+	Vector q = p;
+	int n = 3 + rnd.below(4);
+	for (int i = 0; i < n; ++i) {
+	    Vector r = q + Vector(rnd.uniform(-30, 30), rnd.uniform(-30, 30));
+	    c->appendSegment(q, r);
+	    q = r;
+	}
+	c->setClosed(true);
+	shape.appendSubPath(c);
+	attr.iPathMode = EStrokedAndFilled;
+	attr.iFill = Attribute(Color(rnd.below(1001), rnd.below(1001), rnd.below(1001)));
+	break;
+    }
+    case 2: { // spline
+	Curve * c = new Curve;
+	std::vector<Vector> v;
+	v.push_back(p);
+	for (int i = 0; i < 4; ++i)
+	    v.push_back(v.back() + Vector(rnd.uniform(-50, 50), rnd.uniform(-50, 50)));
+	c->appendSpline(v);
+	shape.appendSubPath(c);
+	break;
+    }
+    default: // circle
+	shape = Shape(p, rnd.uniform(2, 40));
+	break;
+    }
+    return new Path(attr, shape);
+}
+
+static Object * makeText(Random & rnd, const Rect & paper, int no) {
+    AllAttributes attr;
+    Vector p(rnd.uniform(paper.left(), paper.right()),
+	     rnd.uniform(paper.bottom(), paper.top()));
+    char buf[64];
+    if (rnd.below(4) == 0) {
+	snprintf(buf, sizeof(buf),
+		 "Paragraph %d with some formula $\\sum_{i=1}^{%d} x_i^2$.", no,
+		 rnd.below(100));
+	return new Text(attr, String(buf), p, Text::EMinipage, rnd.uniform(80, 200));
+    }
+    snprintf(buf, sizeof(buf), "Label $p_{%d}$", no);
+    return new Text(attr, String(buf), p, Text::ELabel);
+}
+
+//! Create a synthetic document.
+/*! Page i has one layer per view, and view j shows layers 0 to j, like
+  a slide that is revealed step by step. */
+static Document * makeDocument(const Params & par) {
+    Random rnd(par.seed);
+    Document * doc = new Document;
+    Rect paper = doc->cascade()->findLayout()->paper();
+    std::vector<Bitmap> bitmaps;
+    for (int i = 0; i < par.bitmaps; ++i) bitmaps.push_back(makeBitmap(rnd));
+    for (int pno = 0; pno < par.pages; ++pno) {
+	Page * page = new Page;
+	char buf[32];
+	for (int l = 0; l < par.views; ++l) {
+	    snprintf(buf, sizeof(buf), "layer%d", l);
+	    page->addLayer(buf);
+	}
+	for (int v = 0; v < par.views; ++v) {
+	    page->insertView(v, page->layer(v));
+	    for (int l = 0; l <= v; ++l) page->setVisible(v, page->layer(l), true);
+	}
+	for (int i = 0; i < par.objects; ++i) {
+	    int layer = i * par.views / par.objects;
+	    Object * obj = (rnd.uniform(0, 1) < par.text) ? makeText(rnd, paper, i)
+							 : makePath(rnd, paper);
+	    page->append(ENotSelected, layer, obj);
+	}
+	for (int b = pno; b < par.bitmaps; b += par.pages) {
+	    Vector p(rnd.uniform(paper.left(), paper.right() - 100),
+		     rnd.uniform(paper.bottom(), paper.top() - 100));
+	    Rect r(p, p + Vector(100, 100));
+	    page->append(ENotSelected, 0, new Image(r, bitmaps[b]));
+	}
+	doc->push_back(page);
+    }
+    return doc;
+}
+
+// --------------------------------------------------------------------
+
+struct Result {
+    const char * iName;
+    std::vector<double> iTimes; // in milliseconds
+    long iSize; // output size or count, depending on scenario
+};
+
+class Bench {
+public:
+    Bench(const Params & par, const char * only)
+	: iPar(par)
+	, iOnly(only) {}
+    void run(const char * name, const std::function<long()> & fn,
+	     const std::function<void()> & setup = nullptr);
+    void report(FILE * out) const;
+
+private:
+    const Params & iPar;
+    const char * iOnly;
+    std::vector<Result> iResults;
+};
+
+// run fn once to warm up, then iPar.repeat times with timing; setup
+// is called before each run of fn, and is not timed
+void Bench::run(const char * name, const std::function<long()> & fn,
+		const std::function<void()> & setup) {
+    if (iOnly && strcmp(iOnly, name)) return;
+    fprintf(stderr, "%s...\n", name);
+    if (setup) setup();
+    Result r{name, {}, fn()};
+    for (int i = 0; i < iPar.repeat; ++i) {
+	if (setup) setup();
+	auto t0 = std::chrono::steady_clock::now();
+	fn();
+	auto t1 = std::chrono::steady_clock::now();
+	r.iTimes.push_back(std::chrono::duration<double, std::milli>(t1 - t0).count());
+    }
+    iResults.push_back(r);
+}
+
+// write results as JSON
+void Bench::report(FILE * out) const {
+    fprintf(out, "{\n  \"ipelib\": %d,\n", IPELIB_VERSION);
+    fprintf(out,
+	    "  \"parameters\": {\"pages\": %d, \"objects\": %d, \"text\": %g, "
+	    "\"bitmaps\": %d, \"views\": %d, \"seed\": %u, \"repeat\": %d, "
+	    "\"queries\": %d, \"threads\": %d},\n",
+	    iPar.pages, iPar.objects, iPar.text, iPar.bitmaps, iPar.views, iPar.seed,
+	    iPar.repeat, iPar.queries, Platform::threadCount());
+    fprintf(out, "  \"results\": [");
+    for (int i = 0; i < size(iResults); ++i) {
+	const Result & r = iResults[i];
+	std::vector<double> t = r.iTimes;
+	std::sort(t.begin(), t.end());
+	double mean = 0.0;
+	for (double x : t) mean += x;
+	mean = t.empty() ? 0.0 : mean / t.size();
+	double median = t.empty() ? 0.0 : t[t.size() / 2];
+	double best = t.empty() ? 0.0 : t.front();
+	fprintf(out,
+		"%s\n    {\"scenario\": \"%s\", \"min_ms\": %.3f, \"median_ms\": %.3f, "
+		"\"mean_ms\": %.3f, \"size\": %ld}",
+		i ? "," : "", r.iName, best, median, mean, r.iSize);
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+// --------------------------------------------------------------------
+
+static void usage() {
+    fprintf(stderr,
+	    "Usage: ipebench [ -pages <n> ] [ -objects <n> ] [ -text <fraction> ] "
+	    "[ -bitmaps <n> ]\n"
+	    "                [ -views <n> ] [ -seed <n> ] [ -repeat <n> ] "
+	    "[ -queries <n> ]\n"
+	    "                [ -only <scenario> ] [ -o <file> ]\n"
+	    "Ipebench times Ipelib on a synthetic document and writes the results "
+	    "in JSON format.\n"
+	    " -pages   : number of pages (default 20).\n"
+	    " -objects : number of objects per page (default 200).\n"
+	    " -text    : fraction of objects that are text (default 0.2).\n"
+	    " -bitmaps : number of bitmaps in the document (default 4).\n"
+	    " -views   : number of views per page (default 3).\n"
+	    " -seed    : seed for the document generator (default 1).\n"
+	    " -repeat  : number of timed runs of each scenario (default 5).\n"
+	    " -queries : number of snap queries per page (default 1000).\n"
+	    " -only    : run only this scenario.\n"
+	    " -o       : write results to file instead of standard output.\n"
+	    "Scenarios: save-xml load-xml save-pdf load-pdf pdf-pages render "
+	    "render-parallel\n"
+	    "           snap bbox hit-test load-paths latex-source\n"
+	    "Render-parallel runs Latex on the document, renders all views on "
+	    "IPETHREADS threads,\nand fails if the result differs from serial "
+	    "rendering.\n");
+    exit(1);
+}
+
+int main(int argc, char * argv[]) {
+    Platform::initLib(IPELIB_VERSION);
+
+    Params par;
+    const char * only = nullptr;
+    const char * outName = nullptr;
+    for (int i = 1; i < argc; i += 2) {
+	if (i + 1 == argc) usage();
+	const char * arg = argv[i + 1];
+	if (!strcmp(argv[i], "-pages"))
+	    par.pages = std::max(1, atoi(arg));
+	else if (!strcmp(argv[i], "-objects"))
+	    par.objects = std::max(1, atoi(arg));
+	else if (!strcmp(argv[i], "-text"))
+	    par.text = Lex(String(arg)).getDouble();
+	else if (!strcmp(argv[i], "-bitmaps"))
+	    par.bitmaps = std::max(0, atoi(arg));
+	else if (!strcmp(argv[i], "-views"))
+	    par.views = std::max(1, atoi(arg));
+	else if (!strcmp(argv[i], "-seed"))
+	    par.seed = uint32_t(strtoul(arg, nullptr, 10));
+	else if (!strcmp(argv[i], "-repeat"))
+	    par.repeat = std::max(1, atoi(arg));
+	else if (!strcmp(argv[i], "-queries"))
+	    par.queries = std::max(0, atoi(arg));
+	else if (!strcmp(argv[i], "-only"))
+	    only = arg;
+	else if (!strcmp(argv[i], "-o"))
+	    outName = arg;
+	else
+	    usage();
+    }
+
+    std::unique_ptr<Document> doc(makeDocument(par));
+    Bench bench(par, only);
+
+    String xml;
+    {
+	StringStream stream(xml);
+	doc->save(stream, FileFormat::Xml, SaveFlag::SaveNormal);
+    }
+    String pdf;
+    {
+	StringStream stream(pdf);
+	doc->save(stream, FileFormat::Pdf, SaveFlag::SaveNormal);
+    }
+
+    bench.run("save-xml", [&]() {
+	String data;
+	StringStream stream(data);
+	doc->save(stream, FileFormat::Xml, SaveFlag::SaveNormal);
+	return long(data.size());
+    });
+
+    bench.run("load-xml", [&]() {
+	Buffer buffer(xml.data(), xml.size());
+	BufferSource source(buffer);
+	int reason;
+	std::unique_ptr<Document> d(Document::load(source, FileFormat::Xml, reason));
+	if (!d) fprintf(stderr, "Failed to load XML document (%d)\n", reason);
+	return long(xml.size());
+    });
+
+    bench.run("save-pdf", [&]() {
+	String data;
+	StringStream stream(data);
+	doc->save(stream, FileFormat::Pdf, SaveFlag::SaveNormal);
+	return long(data.size());
+    });
+
+    bench.run("load-pdf", [&]() {
+	Buffer buffer(pdf.data(), pdf.size());
+	BufferSource source(buffer);
+	int reason;
+	std::unique_ptr<Document> d(Document::load(source, FileFormat::Pdf, reason));
+	if (!d) fprintf(stderr, "Failed to load PDF document (%d)\n", reason);
+	return long(pdf.size());
+    });
+
+    bench.run("pdf-pages", [&]() {
+	String data;
+	StringStream stream(data);
+	PdfWriter writer(stream, doc.get(), nullptr, SaveFlag::Export, 0, -1, 9);
+	writer.createPages();
+	writer.createTrailer();
+	return long(data.size());
+    });
+
+    // Render all views of all pages on several threads at once, and
+    // check that the result is the same as when rendering serially.
+    // Each run uses a freshly loaded document, so that no cache is
+    // warm, and comes before the serial rendering scenarios.  Build
+    // Ipelib with -fsanitize=thread to check for data races.
+    //
+    // Latex is run on each document, so that the text objects have
+    // their XForms and fonts, and rendering them is checked as well.
+    // With the Latex cache, only the first run calls Latex.
+    auto loadXml = [&]() {
+	Buffer buffer(xml.data(), xml.size());
+	BufferSource source(buffer);
+	int reason;
+	return std::unique_ptr<Document>(Document::load(source, FileFormat::Xml, reason));
+    };
+    bool latexFailed = false;
+    auto loadTypeset = [&]() {
+	std::unique_ptr<Document> d = loadXml();
+	int err = d->runLatex("ipebench");
+	if (err != Document::ErrNone && err != Document::ErrNoText && !latexFailed) {
+	    fprintf(stderr, "Running Latex failed (error %d), so text objects "
+			    "are not rendered.\n", err);
+	    latexFailed = true;
+	}
+	return d;
+    };
+    Document::setLatexCache(Platform::folder(FolderLatex, "cache"));
+    std::vector<std::pair<int, int>> views;
+    for (int pno = 0; pno < doc->countPages(); ++pno)
+	for (int v = 0; v < doc->page(pno)->countViews(); ++v) views.emplace_back(pno, v);
+    std::unique_ptr<Document> fresh;
+    std::vector<Buffer> serial;
+    int mismatches = 0;
+    bench.run(
+	"render-parallel",
+	[&]() {
+	    std::vector<Buffer> result(views.size());
+	    int threads = Platform::threadCount();
+	    parallelFor(size(views), threads, [&](int, int begin, int end) {
+		Thumbnail tn(fresh.get(), par.thumbWidth);
+		for (int i = begin; i < end; ++i)
+		    result[i] = tn.render(fresh->page(views[i].first), views[i].second);
+	    });
+	    if (serial.empty()) {
+		std::unique_ptr<Document> d = loadTypeset();
+		Thumbnail tn(d.get(), par.thumbWidth);
+		for (const auto & [pno, v] : views)
+		    serial.push_back(tn.render(d->page(pno), v));
+	    }
+	    long bytes = 0;
+	    for (int i = 0; i < size(views); ++i) {
+		bytes += result[i].size();
+		if (result[i].size() != serial[i].size()
+		    || memcmp(result[i].data(), serial[i].data(), serial[i].size()))
+		    ++mismatches;
+	    }
+	    return bytes;
+	},
+	[&]() { fresh = loadTypeset(); });
+
+    bench.run("render", [&]() {
+	Thumbnail tn(doc.get(), par.thumbWidth);
+	long bytes = 0;
+	for (int pno = 0; pno < doc->countPages(); ++pno) {
+	    const Page * page = doc->page(pno);
+	    bytes += tn.render(page, page->countViews() - 1).size();
+	}
+	return bytes;
+    });
+
+    bench.run("snap", [&]() {
+	Snap snap;
+	snap.iSnap = Snap::ESnapVtx | Snap::ESnapCtl | Snap::ESnapBd | Snap::ESnapInt;
+	snap.iGridVisible = false;
+	snap.iGridSize = 8;
+	snap.iAngleSize = IpePi / 6.0;
+	snap.iSnapDistance = 10;
+	snap.iWithAxes = false;
+	snap.iOrigin = Vector::ZERO;
+	snap.iDir = 0.0;
+	Random rnd(par.seed);
+	Rect paper = doc->cascade()->findLayout()->paper();
+	long snapped = 0;
+	for (int pno = 0; pno < doc->countPages(); ++pno) {
+	    const Page * page = doc->page(pno);
+	    for (int q = 0; q < par.queries; ++q) {
+		Vector pos(rnd.uniform(paper.left(), paper.right()),
+			   rnd.uniform(paper.bottom(), paper.top()));
+		if (snap.snap(pos, page, page->countViews() - 1, 10.0)) ++snapped;
+	    }
+	}
+	return snapped;
+    });
+
+    bench.run("bbox", [&]() {
+	Rect box;
+	for (int pno = 0; pno < doc->countPages(); ++pno) {
+	    const Page * page = doc->page(pno);
+	    for (int i = 0; i < page->count(); ++i) {
+		page->invalidateBBox(i);
+		box.addRect(page->bbox(i));
+	    }
+	}
+	return long(box.width());
+    });
+
+    // Hit-testing a plot with a long polygonal chain.
+    Shape plot;
+    {
+	Curve * c = new Curve;
+	Vector q(0, 400);
+	for (int i = 1; i <= 100000; ++i) {
+	    Vector r(i * 0.005, 400 + 100 * sin(i * 0.001) + 5 * sin(i * 0.37));
+	    c->appendSegment(q, r);
+	    q = r;
+	}
+	plot.appendSubPath(c);
+    }
+    bench.run("hit-test", [&]() {
+	Random rnd(par.seed);
+	long hits = 0;
+	for (int q = 0; q < par.queries; ++q) {
+	    Vector v(rnd.uniform(0, 500), rnd.uniform(250, 550));
+	    if (plot.distance(v, Matrix(), 10.0) < 10.0) ++hits;
+	    Vector pos;
+	    double bound = 10.0;
+	    plot.snapBnd(v, Matrix(), pos, bound);
+	    plot.snapVtx(v, Matrix(), pos, bound, false);
+	}
+	return hits;
+    });
+
+    // Path data of path-heavy pages: the random paths and a plot with
+    // 10000 vertices on each page.
+    std::vector<String> pathData;
+    {
+	Random rnd(par.seed);
+	Rect paper = doc->cascade()->findLayout()->paper();
+	for (int pno = 0; pno < par.pages; ++pno) {
+	    for (int i = 0; i < par.objects; ++i) {
+		std::unique_ptr<Object> obj(makePath(rnd, paper));
+		String data;
+		StringStream stream(data);
+		obj->asPath()->shape().save(stream);
+		pathData.push_back(data);
+	    }
+	    Shape shape;
+	    Curve * c = new Curve;
+	    Vector q(0, 400);
+	    for (int i = 1; i <= 10000; ++i) {
+		Vector r(i * 0.05, q.y + rnd.uniform(-1, 1));
+		c->appendSegment(q, r);
+		q = r;
+	    }
+	    shape.appendSubPath(c);
+	    String data;
+	    StringStream stream(data);
+	    shape.save(stream);
+	    pathData.push_back(data);
+	}
+    }
+    bench.run("load-paths", [&]() {
+	long bytes = 0;
+	for (const String & data : pathData) {
+	    Shape shape;
+	    if (!shape.load(data)) fprintf(stderr, "Failed to load path data\n");
+	    bytes += data.size();
+	}
+	return bytes;
+    });
+
+    bench.run("latex-source", [&]() {
+	Latex converter(doc->cascade(), LatexType::Pdftex, false);
+	for (int pno = 0; pno < doc->countPages(); ++pno)
+	    converter.scanPage(doc->page(pno));
+	String data;
+	StringStream stream(data);
+	converter.createLatexSource(stream, doc->properties().iPreamble);
+	return long(data.size());
+    });
+
+    FILE * out = stdout;
+    if (outName) {
+	out = Platform::fopen(outName, "w");
+	if (!out) {
+	    fprintf(stderr, "Cannot open '%s' for writing.\n", outName);
+	    return 1;
+	}
+    }
+    bench.report(out);
+    if (out != stdout) fclose(out);
+    if (mismatches) {
+	fprintf(stderr, "Parallel rendering differs from serial rendering in %d views.\n",
+		mismatches);
+	return 1;
+    }
+    return 0;
+}
+
+// --------------------------------------------------------------------
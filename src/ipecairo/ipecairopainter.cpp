@@ -31,8 +31,11 @@
 #include "ipecairopainter.h"
 #include "ipefonts.h"
 #include "ipepdfparser.h"
+#include "ipestyle.h"
 #include "ipetext.h"
+#include "ipetrace.h"
 
+#include <cmath>
 // for std::memset
 #include <cstring>
 
@@ -337,6 +340,13 @@ static void drawImage(cairo_t * cr, const PdfDict * d, const PdfResourceBase * r
   \brief Ipe Painter using Cairo and Freetype as a backend.
 
   This painter draws to a Cairo surface.
+
+  When drawing to an image surface, small symbols (such as the marks
+  of a scatter plot) are drawn only once for each size and set of
+  parameters, and then stamped as bitmaps.  Tiling and gradient
+  patterns are created once and reused for all paths filled with them.
+  Details smaller than a quarter pixel may be omitted when drawing to
+  an image surface (see Painter::setDetail()).
 */
 
 //! Construct a painter.
@@ -352,6 +362,22 @@ CairoPainter::CairoPainter(const Cascade * sheet, Fonts * fonts, cairo_t * cc,
     , iFilterBest(filterBest)
     , iType3Font(false) {
     iDimmed = false;
+    // omit details smaller than a quarter pixel on the screen
+    if (!filterBest
+	&& cairo_surface_get_type(cairo_get_target(cc)) == CAIRO_SURFACE_TYPE_IMAGE) {
+	cairo_matrix_t cm;
+	cairo_get_matrix(cc, &cm);
+	setDetail(0.25 / std::hypot(cm.xx, cm.yx));
+    }
+}
+
+CairoPainter::~CairoPainter() {
+    for (auto & [key, stamp] : iStamps) {
+	if (stamp.iSurface) cairo_surface_destroy(stamp.iSurface);
+    }
+    for (auto & [key, pattern] : iPatterns) {
+	if (pattern) cairo_pattern_destroy(pattern);
+    }
 }
 
 void CairoPainter::doPush() { cairo_save(iCairo); }
@@ -423,22 +449,7 @@ void CairoPainter::doDrawPath(TPathMode mode) {
 	} else if (t == nullptr) {
 	    // gradient
 
-	    cairo_pattern_t * p;
-	    if (g->iType == Gradient::ERadial)
-		p = cairo_pattern_create_radial(g->iV[0].x, g->iV[0].y, g->iRadius[0],
-						g->iV[1].x, g->iV[1].y, g->iRadius[1]);
-	    else
-		p = cairo_pattern_create_linear(g->iV[0].x, g->iV[0].y, g->iV[1].x,
-						g->iV[1].y);
-
-	    cairo_pattern_set_extend(p,
-				     g->iExtend ? CAIRO_EXTEND_PAD : CAIRO_EXTEND_NONE);
-
-	    for (const auto & stop : g->iStops) {
-		cairo_pattern_add_color_stop_rgb(
-		    p, stop.offset, stop.color.iRed.toDouble(),
-		    stop.color.iGreen.toDouble(), stop.color.iBlue.toDouble());
-	    }
+	    cairo_pattern_t * p = gradientPattern(g);
 
 	    const Matrix & m0 = (matrix() * g->iMatrix).inverse();
 	    cairo_matrix_t m;
@@ -446,7 +457,6 @@ void CairoPainter::doDrawPath(TPathMode mode) {
 	    cairo_pattern_set_matrix(p, &m);
 
 	    cairo_set_source(iCairo, p);
-	    cairo_pattern_destroy(p); // pass ownership to iCairo
 
 	    if (mode == EStrokedAndFilled)
 		cairo_fill_preserve(iCairo);
@@ -458,36 +468,14 @@ void CairoPainter::doDrawPath(TPathMode mode) {
 	} else {
 	    // tiling
 
-	    cairo_surface_t * s = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 32, 32);
-	    uint8_t * data = cairo_image_surface_get_data(s);
-	    memset(data, 0, 4 * 32 * 32);
-
-	    cairo_t * cc = cairo_create(s);
-	    cairo_set_source_rgba(cc, fillColor.iRed.toDouble(),
-				  fillColor.iGreen.toDouble(), fillColor.iBlue.toDouble(),
-				  opacity().toDouble());
-
-	    cairo_rectangle(cc, 0, 0, 32, 32 * t->iWidth / t->iStep);
-	    cairo_fill(cc);
-	    cairo_destroy(cc);
-	    cairo_pattern_t * p = cairo_pattern_create_for_surface(s);
-	    cairo_surface_destroy(s); // pass ownership to pattern
-	    cairo_pattern_set_extend(p, CAIRO_EXTEND_REPEAT);
-
-	    cairo_matrix_t m;
-	    cairo_matrix_init_scale(&m, 1.0, 32.0 / t->iStep);
-	    cairo_matrix_rotate(&m, -double(t->iAngle));
-	    cairo_pattern_set_matrix(p, &m);
-
-	    cairo_set_source(iCairo, p);
-	    cairo_pattern_destroy(p); // pass ownership to iCairo
+	    cairo_set_source(iCairo, tilingPattern(t, fillColor, opacity()));
 
 	    if (mode == EStrokedAndFilled)
 		cairo_fill_preserve(iCairo);
 	    else
 		cairo_fill(iCairo);
 
-	    // release pattern so pattern and surface are destroyed
+	    // release pattern
 	    cairo_set_source_rgb(iCairo, 0.0, 0.0, 0.0);
 	}
     }
@@ -526,6 +514,178 @@ void CairoPainter::doDrawPath(TPathMode mode) {
 
 void CairoPainter::doAddClipPath() { cairo_clip(iCairo); }
 
+//! Return the pattern for gradient \a g, without its matrix.
+cairo_pattern_t * CairoPainter::gradientPattern(const Gradient * g) {
+    cairo_pattern_t *& p = iPatterns[PatternKey{g, {}}];
+    if (p) return p;
+    if (g->iType == Gradient::ERadial)
+	p = cairo_pattern_create_radial(g->iV[0].x, g->iV[0].y, g->iRadius[0], g->iV[1].x,
+					g->iV[1].y, g->iRadius[1]);
+    else
+	p = cairo_pattern_create_linear(g->iV[0].x, g->iV[0].y, g->iV[1].x, g->iV[1].y);
+
+    cairo_pattern_set_extend(p, g->iExtend ? CAIRO_EXTEND_PAD : CAIRO_EXTEND_NONE);
+
+    for (const auto & stop : g->iStops) {
+	cairo_pattern_add_color_stop_rgb(p, stop.offset, stop.color.iRed.toDouble(),
+					 stop.color.iGreen.toDouble(),
+					 stop.color.iBlue.toDouble());
+    }
+    return p;
+}
+
+//! Return the pattern for tiling \a t in the given color.
+cairo_pattern_t * CairoPainter::tilingPattern(const Tiling * t, Color color,
+					      Fixed opacity) {
+    PatternKey key{t, {color.iRed.toDouble(), color.iGreen.toDouble(),
+		       color.iBlue.toDouble(), opacity.toDouble()}};
+    cairo_pattern_t *& p = iPatterns[key];
+    if (p) return p;
+    cairo_surface_t * s = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 32, 32);
+    uint8_t * data = cairo_image_surface_get_data(s);
+    memset(data, 0, 4 * 32 * 32);
+
+    cairo_t * cc = cairo_create(s);
+    cairo_set_source_rgba(cc, key.iColor[0], key.iColor[1], key.iColor[2], key.iColor[3]);
+
+    cairo_rectangle(cc, 0, 0, 32, 32 * t->iWidth / t->iStep);
+    cairo_fill(cc);
+    cairo_destroy(cc);
+    p = cairo_pattern_create_for_surface(s);
+    cairo_surface_destroy(s); // pass ownership to pattern
+    cairo_pattern_set_extend(p, CAIRO_EXTEND_REPEAT);
+
+    cairo_matrix_t m;
+    cairo_matrix_init_scale(&m, 1.0, 32.0 / t->iStep);
+    cairo_matrix_rotate(&m, -double(t->iAngle));
+    cairo_pattern_set_matrix(p, &m);
+    return p;
+}
+
+// --------------------------------------------------------------------
+
+// largest stamp in pixels, and most stamps kept by one painter
+constexpr double MAX_STAMP_SIZE = 64.0;
+constexpr size_t MAX_STAMPS = 1024;
+
+void CairoPainter::doDrawSymbol(Attribute symbol) {
+    if (!drawStamp(symbol)) Painter::doDrawSymbol(symbol);
+}
+
+// Draw the symbol by stamping a bitmap if possible.  This requires an
+// image surface, and a transformation to pixels that is a uniform
+// scaling (possibly with reflection) and a translation.  The
+// translation is rounded to the nearest quarter pixel.  Returns false
+// if the symbol must be drawn as vectors.
+bool CairoPainter::drawStamp(Attribute symbol) {
+    // keep exact rendering when the best quality was asked for
+    if (iFilterBest || cairo_surface_get_type(cairo_get_target(iCairo))
+			   != CAIRO_SURFACE_TYPE_IMAGE)
+	return false;
+    Attribute name = iAttributeMap ? iAttributeMap->map(ESymbol, symbol) : symbol;
+    if (!name.isSymbolic()) return false;
+    cairo_matrix_t cm;
+    cairo_get_matrix(iCairo, &cm);
+    Matrix m = Matrix(cm.xx, cm.yx, cm.xy, cm.yy, cm.x0, cm.y0) * matrix();
+    double s = std::fabs(m.a[0]);
+    if (m.a[1] != 0.0 || m.a[2] != 0.0 || s == 0.0
+	|| std::fabs(std::fabs(m.a[3]) - s) > 1e-9 * s)
+	return false;
+    double qx = std::round(4.0 * m.a[4]);
+    double qy = std::round(4.0 * m.a[5]);
+    double px = std::floor(0.25 * qx);
+    double py = std::floor(0.25 * qy);
+    int fx = int(qx - 4.0 * px);
+    int fy = int(qy - 4.0 * py);
+
+    const State & st = state();
+    StampKey key;
+    key.iSymbol = name.index();
+    key.iMap = iAttributeMap;
+    Color c[4] = {st.iStroke, st.iFill, st.iSymStroke, st.iSymFill};
+    for (int i = 0; i < 4; ++i) {
+	key.iColors[3 * i] = c[i].iRed.internal();
+	key.iColors[3 * i + 1] = c[i].iGreen.internal();
+	key.iColors[3 * i + 2] = c[i].iBlue.internal();
+    }
+    key.iPens[0] = st.iPen.internal();
+    key.iPens[1] = st.iSymPen.internal();
+    key.iPens[2] = st.iOpacity.internal();
+    key.iPens[3] = st.iStrokeOpacity.internal();
+    key.iStyles[0] = st.iLineCap;
+    key.iStyles[1] = st.iLineJoin;
+    key.iStyles[2] = st.iFillRule;
+    key.iStyles[3] = st.iTiling.internal();
+    key.iStyles[4] = st.iGradient.internal();
+    key.iDashStyle = st.iDashStyle;
+    key.iScale = s;
+    key.iFlags = (m.a[0] < 0) | (m.a[3] < 0) << 1 | fx << 2 | fy << 4;
+
+    auto it = iStamps.find(key);
+    if (it == iStamps.end()) {
+	if (iStamps.size() >= MAX_STAMPS) return false;
+	Matrix sm(m.a[0], 0.0, 0.0, m.a[3], 0.25 * fx, 0.25 * fy);
+	double zoom = iZoom / std::hypot(cm.xx, cm.yx); // zoom in pixels
+	it = iStamps.emplace(key, makeStamp(symbol, sm, zoom)).first;
+    }
+    const Stamp & stamp = it->second;
+    if (!stamp.iSurface) return false;
+    cairo_save(iCairo);
+    cairo_identity_matrix(iCairo);
+    cairo_set_source_surface(iCairo, stamp.iSurface, px + stamp.iX, py + stamp.iY);
+    cairo_pattern_set_filter(cairo_get_source(iCairo), CAIRO_FILTER_NEAREST);
+    cairo_paint(iCairo);
+    cairo_restore(iCairo);
+    return true;
+}
+
+// Draw the symbol with transformation m to pixels into a bitmap just
+// large enough to hold it.  Returns an empty stamp if it is too large.
+CairoPainter::Stamp CairoPainter::makeStamp(Attribute symbol, const Matrix & m,
+					    double zoom) {
+    Stamp stamp{nullptr, 0, 0};
+    Attribute name = iAttributeMap ? iAttributeMap->map(ESymbol, symbol) : symbol;
+    const Symbol * sym = cascade()->findSymbol(name);
+    if (!sym) return stamp;
+    Rect box;
+    sym->iObject->addToBBox(box, m, false);
+    if (box.isEmpty() || box.width() > MAX_STAMP_SIZE || box.height() > MAX_STAMP_SIZE)
+	return stamp;
+
+    // record the drawing to find its extent including the line width
+    cairo_surface_t * rec =
+	cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, nullptr);
+    cairo_t * cc = cairo_create(rec);
+    cairo_set_tolerance(cc, cairo_get_tolerance(iCairo));
+    cairo_set_antialias(cc, cairo_get_antialias(iCairo));
+    CairoPainter painter(iCascade, iFonts, cc, zoom, iPretty, iFilterBest);
+    painter.setDimmed(iDimmed);
+    painter.setAttributeMap(iAttributeMap);
+    painter.setState(state());
+    painter.transform(m);
+    painter.drawSymbol(symbol);
+    if (painter.type3Font()) iType3Font = true;
+    cairo_destroy(cc);
+
+    double x, y, w, h;
+    cairo_recording_surface_ink_extents(rec, &x, &y, &w, &h);
+    int x0 = int(std::floor(x));
+    int y0 = int(std::floor(y));
+    int wd = int(std::ceil(x + w)) - x0;
+    int ht = int(std::ceil(y + h)) - y0;
+    if (0 < wd && wd <= 2 * MAX_STAMP_SIZE && 0 < ht && ht <= 2 * MAX_STAMP_SIZE) {
+	stamp.iSurface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, wd, ht);
+	stamp.iX = x0;
+	stamp.iY = y0;
+	cc = cairo_create(stamp.iSurface);
+	cairo_set_source_surface(cc, rec, -x0, -y0);
+	cairo_paint(cc);
+	cairo_destroy(cc);
+    }
+    cairo_surface_destroy(rec);
+    return stamp;
+}
+
 // --------------------------------------------------------------------
 
 void CairoPainter::doDrawBitmap(Bitmap bitmap) {
@@ -626,11 +786,11 @@ void CairoPainter::executeStream(const PdfDict * stream, const PdfDict * resourc
 // --------------------------------------------------------------------
 
 //! Clear PDF argument stack
+/*! The arguments live in iArgArena, which keeps its memory for the
+  next operator. */
 void CairoPainter::clearArgs() {
-    while (!iArgs.empty()) {
-	delete iArgs.back();
-	iArgs.pop_back();
-    }
+    iArgs.clear();
+    iArgArena.clear();
 }
 
 const PdfDict * CairoPainter::findResource(String kind, String name) {
@@ -644,6 +804,7 @@ const PdfDict * CairoPainter::findResource(String kind, String name) {
 
 void CairoPainter::execute(const PdfDict * xform, const PdfDict * resources,
 			   bool applyMatrix) {
+    IPE_TRACE_SPAN("CairoPainter::execute");
     // ipeDebug("execute %s", xform->dictRepr().z());
     iResourceStack.push_back(resources);
     std::vector<double> m;
@@ -669,7 +830,7 @@ void CairoPainter::execute(const PdfDict * xform, const PdfDict * resources,
     }
     Buffer buffer = xform->inflate();
     BufferSource source(buffer);
-    PdfParser parser(source);
+    PdfParser parser(source, &iArgArena);
     clearArgs(); // if called recursively...
     while (!parser.eos()) {
 	PdfToken tok = parser.token();
@@ -1045,15 +1206,25 @@ void CairoPainter::opn() {
     cairo_new_path(iCairo);
 }
 
-// TODO: cache patterns instead of recreating them for every object?
-// caching would need different handling of uncolored tiling patterns.
-// shading patterns are not implemented here, because Ipe and tikz create
-// them using the 'sh' operator.
+// Tiling patterns are drawn once and kept by the painter.  An uncolored
+// pattern (PaintType 2) is painted in the current colors, so the key
+// contains the fill and stroke colors and opacities as well.  Shading
+// patterns are not implemented here, because Ipe and tikz create them
+// using the 'sh' operator.
 void CairoPainter::createPattern() {
     auto & ps = iPdfState.back();
     const PdfDict * pat = findResource("Pattern", ps.iFillPattern);
     // handle tiling patterns only
     if (pat && pat->getInteger("PatternType") == 1) {
+	PatternKey key{pat,
+		       {ps.iFillRgb[0], ps.iFillRgb[1], ps.iFillRgb[2], ps.iFillOpacity,
+			ps.iStrokeRgb[0], ps.iStrokeRgb[1], ps.iStrokeRgb[2],
+			ps.iStrokeOpacity}};
+	cairo_pattern_t *& cpat = iPatterns[key];
+	if (cpat) {
+	    cairo_set_source(iCairo, cpat);
+	    return;
+	}
 	int paintType = pat->getInteger("PaintType");
 	double xstep, ystep;
 	if (!pat->getNumber("XStep", xstep) || !pat->getNumber("YStep", ystep)) return;
@@ -1110,7 +1281,8 @@ void CairoPainter::createPattern() {
 	cairo_surface_flush(sf);
 	cairo_destroy(cc);
 
-	cairo_pattern_t * cpat = cairo_pattern_create_for_surface(sf);
+	cpat = cairo_pattern_create_for_surface(sf);
+	cairo_surface_destroy(sf); // pass ownership to pattern
 	cairo_pattern_set_extend(cpat, CAIRO_EXTEND_REPEAT);
 
 	Matrix mx;
@@ -1126,7 +1298,6 @@ void CairoPainter::createPattern() {
 	cairoMatrix(cm, mx);
 	cairo_pattern_set_matrix(cpat, &cm);
 	cairo_set_source(iCairo, cpat);
-	cairo_pattern_destroy(cpat);
     }
 }
 
@@ -38,6 +38,9 @@
 
 #include <cairo.h>
 
+#include <compare>
+#include <map>
+
 // --------------------------------------------------------------------
 
 namespace ipe {
@@ -49,7 +52,7 @@ class CairoPainter : public Painter {
 public:
     CairoPainter(const Cascade * sheet, Fonts * fonts, cairo_t * cc, double zoom,
 		 bool pretty, bool filterBest);
-    virtual ~CairoPainter() {}
+    virtual ~CairoPainter();
 
     void setDimmed(bool dim) { iDimmed = dim; }
 
@@ -71,8 +74,40 @@ protected:
     virtual void doDrawPath(TPathMode mode) override;
     virtual void doDrawBitmap(Bitmap bitmap) override;
     virtual void doDrawText(const Text * text) override;
+    virtual void doDrawSymbol(Attribute symbol) override;
 
 private:
+    //! Identifies a symbol drawn at one scale, see drawStamp().
+    /*! The symbol inherits the painter state, so all of it is part of
+      the key. */
+    struct StampKey {
+	int iSymbol;
+	const AttributeMap * iMap;
+	int32_t iColors[12]; // stroke, fill, sym-stroke, sym-fill
+	int32_t iPens[4];    // pen, sym-pen, opacity, stroke opacity
+	int iStyles[5];      // line cap, line join, fill rule, tiling, gradient
+	String iDashStyle;
+	double iScale;
+	int iFlags; // orientation of the axes and subpixel position
+	std::partial_ordering operator<=>(const StampKey &) const = default;
+    };
+    struct Stamp {
+	cairo_surface_t * iSurface; // nullptr if the symbol is drawn as vectors
+	int iX, iY;                 // offset of the surface from the symbol origin
+    };
+
+    bool drawStamp(Attribute symbol);
+    Stamp makeStamp(Attribute symbol, const Matrix & m, double zoom);
+
+    //! Identifies a fill pattern.
+    struct PatternKey {
+	const void * iSource; // Tiling, Gradient, or PDF pattern dictionary
+	double iColor[8];     // colors and opacities used by the pattern
+	auto operator<=>(const PatternKey &) const = default;
+    };
+    cairo_pattern_t * gradientPattern(const Gradient * g);
+    cairo_pattern_t * tilingPattern(const Tiling * t, Color color, Fixed opacity);
+
     const PdfDict * findResource(String kind, String name);
     void drawGlyphs(std::vector<cairo_glyph_t> & glyphs);
     void collectGlyphs(String s, std::vector<cairo_glyph_t> & glyphs, Vector & textPos);
@@ -131,7 +166,13 @@ private:
 
     bool iType3Font;
 
+    // bitmaps of small symbols drawn by this painter
+    std::map<StampKey, Stamp> iStamps;
+    // fill patterns, kept for the lifetime of the painter
+    std::map<PatternKey, cairo_pattern_t *> iPatterns;
+
     // PDF operator drawing
+    PdfArena iArgArena;
     std::vector<const PdfObj *> iArgs;
 
     std::vector<const PdfDict *> iResourceStack;
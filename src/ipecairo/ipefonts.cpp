@@ -32,6 +32,7 @@
 #include "ipepdfparser.h"
 #include "ipexml.h"
 
+#include <mutex>
 #include <string>
 
 #include <ft2build.h>
@@ -67,6 +68,9 @@ private:
     bool iScreenFontLoaded;
     cairo_font_face_t * iScreenFont;
     std::vector<FaceEntry> iCache;
+    // Fonts objects may be used on different threads (IpePresenter renders
+    // in the background), and they share the faces in iCache.
+    std::recursive_mutex iMutex;
 
 public:
     bool iOk;
@@ -119,6 +123,7 @@ cairo_font_face_t * Engine::screenFont() {
 }
 
 void Engine::discard(FT_Face ftFace) {
+    std::lock_guard lock(iMutex);
     ++iFacesDiscarded;
     auto it =
 	std::find_if(iCache.begin(), iCache.end(),
@@ -135,6 +140,7 @@ static void face_data_destroy(FT_Face ftFace) { engine.discard(ftFace); }
 
 std::pair<cairo_font_face_t *, FT_Face> Engine::getCairoFont(String name,
 							     const Buffer & data) {
+    std::lock_guard lock(iMutex);
     uint32_t checksum = data.checksum();
     for (auto & entry : iCache) {
 	if (entry.iName == name && entry.iChecksum == checksum) {
@@ -32,6 +32,11 @@
 #include "ipetool.h"
 
 #include "ipecairopainter.h"
+#include "ipetrace.h"
+
+#include <cairo.h>
+#include <cmath>
+#include <cstring>
 
 using namespace ipe;
 
@@ -82,6 +87,8 @@ CanvasBase::CanvasBase() {
     iFifiVisible = false;
     iFifiMode = Snap::ESnapNone;
     iSelectionVisible = true;
+    iRasterThreshold = 200;
+    iSelectionKey = 0;
 
     iType3Font = false;
 
@@ -157,7 +164,10 @@ void CanvasBase::setPage(const Page * page, int pno, int view, const Cascade * s
 
 //! Set style of canvas drawing.
 /*! Includes paper color, pretty text, and grid. */
-void CanvasBase::setCanvasStyle(const Style & style) { iStyle = style; }
+void CanvasBase::setCanvasStyle(const Style & style) {
+    iStyle = style;
+    iSelectionBitmap = Bitmap();
+}
 
 //! Set current pan position.
 /*! The pan position is the user coordinate that is displayed at
@@ -453,31 +463,171 @@ void CanvasBase::drawFifi(cairo_t * cr) {
 // --------------------------------------------------------------------
 
 //! Draw the current canvas tool.
-/*! If no tool is set, it draws the selected objects. */
+/*! If no tool is set, it draws the selected objects.  When many
+  objects are selected, they are rendered into a bitmap that is kept
+  until the page or the selection changes. */
 void CanvasBase::drawTool(Painter & painter) {
     if (iTool) {
 	iTool->draw(painter);
     } else if (iSelectionVisible) {
+	int count = 0;
 	for (int i = 0; i < iPage->count(); ++i) {
-	    if (iPage->objectVisible(iView, i)) {
-		if (iPage->select(i) == EPrimarySelected) {
-		    painter.setStroke(Attribute(iStyle.selectionSurroundColor));
-		    painter.setPen(Attribute(Fixed(iStyle.selectionSurroundWidth)));
-		    iPage->object(i)->drawSimple(painter);
-		    painter.setStroke(Attribute(iStyle.primarySelectionColor));
-		    painter.setPen(Attribute(Fixed(iStyle.primarySelectionWidth)));
-		    iPage->object(i)->drawSimple(painter);
-		} else if (iPage->select(i) == ESecondarySelected) {
-		    painter.setStroke(Attribute(iStyle.selectionSurroundColor));
-		    painter.setPen(Attribute(Fixed(iStyle.selectionSurroundWidth)));
-		    iPage->object(i)->drawSimple(painter);
-		    painter.setStroke(Attribute(iStyle.secondarySelectionColor));
-		    painter.setPen(Attribute(Fixed(iStyle.secondarySelectionWidth)));
-		    iPage->object(i)->drawSimple(painter);
-		}
+	    if (iPage->select(i) && iPage->objectVisible(iView, i)) ++count;
+	}
+	if (iRasterThreshold == 0 || count < iRasterThreshold) {
+	    drawSelection(painter);
+	    return;
+	}
+	uint64_t key = selectionKey();
+	if (iSelectionBitmap.isNull() || key != iSelectionKey) {
+	    Rect area;
+	    for (int i = 0; i < iPage->count(); ++i) {
+		if (iPage->select(i) && iPage->objectVisible(iView, i))
+		    area.addRect(iPage->bbox(i));
+	    }
+	    double pad = iStyle.selectionSurroundWidth / iZoom;
+	    area = Rect(area.bottomLeft() - Vector(pad, pad),
+			area.topRight() + Vector(pad, pad));
+	    area.clipTo(visibleRect());
+	    iSelectionArea = area;
+	    iSelectionBitmap =
+		renderBitmap(iSelectionArea, [this](Painter & p) { drawSelection(p); });
+	    iSelectionKey = key;
+	}
+	if (iSelectionBitmap.isNull()) return;
+	painter.pushMatrix();
+	painter.transform(Matrix(iSelectionArea.width(), 0.0, 0.0,
+				 iSelectionArea.height(), iSelectionArea.left(),
+				 iSelectionArea.bottom()));
+	painter.drawBitmap(iSelectionBitmap);
+	painter.popMatrix();
+    }
+}
+
+//! Draw the outline of the selected objects.
+void CanvasBase::drawSelection(Painter & painter) {
+    for (int i = 0; i < iPage->count(); ++i) {
+	if (iPage->objectVisible(iView, i)) {
+	    if (iPage->select(i) == EPrimarySelected) {
+		painter.setStroke(Attribute(iStyle.selectionSurroundColor));
+		painter.setPen(Attribute(Fixed(iStyle.selectionSurroundWidth)));
+		iPage->object(i)->drawSimple(painter);
+		painter.setStroke(Attribute(iStyle.primarySelectionColor));
+		painter.setPen(Attribute(Fixed(iStyle.primarySelectionWidth)));
+		iPage->object(i)->drawSimple(painter);
+	    } else if (iPage->select(i) == ESecondarySelected) {
+		painter.setStroke(Attribute(iStyle.selectionSurroundColor));
+		painter.setPen(Attribute(Fixed(iStyle.selectionSurroundWidth)));
+		iPage->object(i)->drawSimple(painter);
+		painter.setStroke(Attribute(iStyle.secondarySelectionColor));
+		painter.setPen(Attribute(Fixed(iStyle.secondarySelectionWidth)));
+		iPage->object(i)->drawSimple(painter);
+	    }
+	}
+    }
+}
+
+//! Return a hash of the selection and of the part of the page shown.
+/*! Selecting objects only updates the tool, so the bitmap of the
+  selection is checked against this key. */
+uint64_t CanvasBase::selectionKey() const {
+    uint64_t h = 14695981039346656037ull;
+    auto mix = [&h](uint64_t v) { h = (h ^ v) * 1099511628211ull; };
+    auto mixDouble = [&mix](double d) {
+	uint64_t v;
+	memcpy(&v, &d, sizeof(v));
+	mix(v);
+    };
+    mix(uint64_t(uintptr_t(iPage)));
+    mix(uint64_t(iView));
+    mixDouble(iZoom);
+    mixDouble(iPan.x);
+    mixDouble(iPan.y);
+    mixDouble(iBWidth);
+    mixDouble(iBHeight);
+    for (int i = 0; i < iPage->count(); ++i) {
+	if (iPage->select(i) && iPage->objectVisible(iView, i)) {
+	    mix(uint64_t(i) << 2 | iPage->select(i));
+	    mix(uint64_t(uintptr_t(iPage->object(i))));
+	}
+    }
+    return h;
+}
+
+//! Set number of selected objects from which the selection is drawn as a bitmap.
+void CanvasBase::setRasterThreshold(int count) {
+    iRasterThreshold = count;
+    iSelectionBitmap = Bitmap();
+}
+
+//! Return the part of the page visible on the canvas (in user coordinates).
+Rect CanvasBase::visibleRect() const {
+    return Rect(devToUser(Vector(0, 0)), devToUser(Vector(iWidth, iHeight)));
+}
+
+//! Render into a bitmap covering \a area.
+/*! \a draw is called with a painter mapping user coordinates to the
+  bitmap, in the same way as the painter passed to drawTool().  The
+  resolution is that of the canvas, reduced for very large areas.
+
+  \a area is extended to a whole number of pixels.  Draw the bitmap
+  with a matrix mapping the unit square to \a area.  Returns a null
+  bitmap if \a area is empty. */
+Bitmap CanvasBase::renderBitmap(Rect & area,
+				const std::function<void(Painter &)> & draw) {
+    IPE_TRACE_SPAN("CanvasBase::renderBitmap");
+    if (area.isEmpty() || iWidth <= 0 || !iPage) return Bitmap();
+    // limit memory use when dragging a large selection
+    const double maxPixels = 1 << 23;
+    double dpr = iBWidth / iWidth;
+    double s = iZoom * dpr; // pixels per unit
+    double pixels = area.width() * area.height() * s * s;
+    if (pixels > maxPixels) {
+	dpr *= std::sqrt(maxPixels / pixels);
+	s = iZoom * dpr;
+    }
+    int w = int(std::ceil(area.width() * s));
+    int h = int(std::ceil(area.height() * s));
+    if (w <= 0 || h <= 0) return Bitmap();
+    Vector topLeft = area.topLeft();
+    area = Rect(Vector(topLeft.x, topLeft.y - h / s),
+		Vector(topLeft.x + w / s, topLeft.y));
+
+    cairo_surface_t * surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+    cairo_t * cc = cairo_create(surface);
+    cairo_scale(cc, dpr, dpr);
+    {
+	CairoPainter painter(iCascade, iFonts.get(), cc, iZoom, false, false);
+	painter.transform(
+	    Matrix(iZoom, 0.0, 0.0, -iZoom, -iZoom * topLeft.x, iZoom * topLeft.y));
+	painter.pushMatrix();
+	draw(painter);
+	painter.popMatrix();
+    }
+    cairo_destroy(cc);
+    cairo_surface_flush(surface);
+
+    // cairo premultiplies alpha, Bitmap expects it unmultiplied
+    Buffer data(4 * w * h);
+    uint32_t * q = (uint32_t *)data.data();
+    const uint8_t * rows = cairo_image_surface_get_data(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+    for (int y = 0; y < h; ++y) {
+	const uint32_t * p = (const uint32_t *)(rows + y * stride);
+	for (int x = 0; x < w; ++x) {
+	    uint32_t pixel = *p++;
+	    uint32_t alpha = pixel >> 24;
+	    if (alpha > 0 && alpha < 255) {
+		uint32_t r = ((pixel >> 16) & 0xff) * 255 / alpha;
+		uint32_t g = ((pixel >> 8) & 0xff) * 255 / alpha;
+		uint32_t b = (pixel & 0xff) * 255 / alpha;
+		pixel = (alpha << 24) | (r << 16) | (g << 8) | b;
 	    }
+	    *q++ = pixel;
 	}
     }
+    cairo_surface_destroy(surface);
+    return Bitmap(w, h, Bitmap::ENative | Bitmap::ERGB | Bitmap::EAlpha, data);
 }
 
 //! Set an observer.
@@ -580,6 +730,7 @@ Vector CanvasBase::simpleSnapPos() const {
 //! Mark for update with redrawing of objects.
 void CanvasBase::update() {
     iRepaintObjects = true;
+    iSelectionBitmap = Bitmap();
     invalidate();
 }
 
@@ -618,6 +769,7 @@ void CanvasBase::computeFifi(double x, double y) {
 // --------------------------------------------------------------------
 
 bool CanvasBase::refreshSurface() {
+    IPE_TRACE_SPAN("CanvasBase::refreshSurface");
     if (!iSurface || iBWidth != cairo_image_surface_get_width(iSurface)
 	|| iBHeight != cairo_image_surface_get_height(iSurface)) {
 	// size has changed
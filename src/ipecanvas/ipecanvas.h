@@ -34,6 +34,8 @@
 
 #include "ipelib.h"
 
+#include <functional>
+
 // --------------------------------------------------------------------
 
 // Avoid including cairo.h
@@ -119,6 +121,9 @@ public:
     Vector simpleSnapPos() const;
     //! Return current snapping information.
     inline const Snap & snap() const { return iSnap; }
+    //! Return area being repainted (in user coordinates), or empty if unknown.
+    /*! This is only meaningful while the tool is drawn. */
+    inline Rect paintRect() const { return iPaintRect; }
 
     //! Set ink mode.
     inline void setInkMode(bool ink) { isInkMode = ink; }
@@ -160,6 +165,13 @@ public:
     int canvasWidth() const { return iWidth; }
     int canvasHeight() const { return iHeight; }
 
+    //! Return number of selected objects from which the selection is drawn as a bitmap.
+    /*! Zero means that the selection is always drawn as vectors. */
+    int rasterThreshold() const { return iRasterThreshold; }
+    void setRasterThreshold(int count);
+    Rect visibleRect() const;
+    Bitmap renderBitmap(Rect & area, const std::function<void(Painter &)> & draw);
+
     virtual void setCursor(TCursor cursor, double w = 1.0, Color * color = nullptr) = 0;
 
     static int selectPageOrView(Document * doc, int page = -1, int startIndex = 0,
@@ -175,6 +187,8 @@ protected:
     void drawGrid(cairo_t * cc);
     void drawObjects(cairo_t * cc);
     void drawTool(Painter & painter);
+    void drawSelection(Painter & painter);
+    uint64_t selectionKey() const;
     void snapToPaperAndFrame();
     bool refreshSurface();
     void computeFifi(double x, double y);
@@ -210,10 +224,16 @@ protected:
     Vector iMousePos;
     Vector iGlobalPos;
     Vector iOldFifi; // last fifi position that has been drawn
+    Rect iPaintRect; // area being repainted while drawing the tool
     bool iFifiVisible;
     Snap::TSnapModes iFifiMode;
     bool iSelectionVisible;
 
+    int iRasterThreshold;
+    Bitmap iSelectionBitmap; // selection drawn by drawTool, if rasterized
+    Rect iSelectionArea;     // area covered by iSelectionBitmap
+    uint64_t iSelectionKey;  // selection and view drawn in iSelectionBitmap
+
     const PdfResources * iResources;
     std::unique_ptr<Fonts> iFonts;
     bool iType3Font;
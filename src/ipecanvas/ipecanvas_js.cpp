@@ -168,6 +168,7 @@ Canvas::Canvas(val bottomCanvas, val topCanvas) {
     addIpeCanvasJS();
     iBottomCanvas = bottomCanvas;
     iTopCanvas = topCanvas;
+    setRasterThreshold(0); // JsPainter cannot draw bitmaps
 
     updateSize();
     iNeedPaint = false;
@@ -56,6 +56,7 @@ protected:
     virtual void doClosePath();
 
     virtual void doDrawPath(TPathMode mode);
+    virtual void doDrawBitmap(Bitmap bitmap);
 
 private:
     QPainter * iQP;
@@ -95,6 +96,23 @@ void IpeQtPainter::doDrawPath(TPathMode mode) {
     }
 }
 
+void IpeQtPainter::doDrawBitmap(Bitmap bitmap) {
+    Buffer data = bitmap.pixelData();
+    if (!data.size()) return;
+    QImage image((const uchar *)data.data(), bitmap.width(), bitmap.height(),
+		 QImage::Format_ARGB32_Premultiplied);
+    Matrix tf =
+	matrix()
+	* Matrix(1.0 / bitmap.width(), 0.0, 0.0, -1.0 / bitmap.height(), 0.0, 1.0);
+    iQP->save();
+    iQP->setTransform(QTransform(tf.a[0], tf.a[1], tf.a[2], tf.a[3], tf.a[4], tf.a[5]),
+		      true);
+    iQP->setRenderHint(QPainter::SmoothPixmapTransform);
+    iQP->setOpacity(opacity().toDouble());
+    iQP->drawImage(0, 0, image);
+    iQP->restore();
+}
+
 // --------------------------------------------------------------------
 
 //! Construct a new canvas.
@@ -336,7 +354,10 @@ void Canvas::paintEvent(QPaintEvent * ev) {
 	IpeQtPainter qp(iCascade, &qPainter);
 	qp.transform(canvasTfm());
 	qp.pushMatrix();
+	iPaintRect = Rect(devToUser(Vector(r.left(), r.top())),
+			  devToUser(Vector(r.right() + 1, r.bottom() + 1)));
 	drawTool(qp);
+	iPaintRect.clear();
 	qp.popMatrix();
     }
     qPainter.end();
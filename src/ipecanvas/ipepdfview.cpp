@@ -31,6 +31,12 @@
 #include "ipepdfview.h"
 
 #include "ipecairopainter.h"
+#include "ipefonts.h"
+
+#ifndef IPEWASM
+#include <condition_variable>
+#include <thread>
+#endif
 
 using namespace ipe;
 
@@ -48,6 +54,8 @@ PdfViewBase::PdfViewBase() {
     iPage = nullptr;
     iStream = nullptr;
     iFonts = nullptr;
+    iCache = nullptr;
+    iSurfaceCached = false;
 
     iPan = Vector::ZERO;
     iZoom = 1.0;
@@ -68,7 +76,7 @@ PdfViewBase::~PdfViewBase() {
     if (iSurface) {
 	ipeDebug("Surface has %d references left",
 		 cairo_surface_get_reference_count(iSurface));
-	cairo_surface_finish(iSurface);
+	if (!iSurfaceCached) cairo_surface_finish(iSurface);
 	cairo_surface_destroy(iSurface);
     }
     ipeDebug("PdfViewBase::~PdfViewBase");
@@ -77,11 +85,14 @@ PdfViewBase::~PdfViewBase() {
 // --------------------------------------------------------------------
 
 //! Provide the PDF document.
-void PdfViewBase::setPdf(const PdfFile * pdf, Fonts * fonts) {
+/*! If \a cache is given, pages are rendered through the cache, which
+  must have been given the same document and fonts. */
+void PdfViewBase::setPdf(const PdfFile * pdf, Fonts * fonts, PdfRenderCache * cache) {
     iPage = nullptr;
     iStream = nullptr;
     iPdf = pdf;
     iFonts = fonts;
+    iCache = cache;
 }
 
 //! Provide the page to view.
@@ -132,15 +143,18 @@ Matrix PdfViewBase::canvasTfm() const {
     return Matrix(center()) * Linear(iZoom, 0, 0, -iZoom) * Matrix(-iPan);
 }
 
-// --------------------------------------------------------------------
+//! Return the parameters for rendering \a page in this view.
+PdfRenderKey PdfViewBase::renderKey(const PdfDict * page, const Rect & paper) const {
+    return PdfRenderKey{page,  paper,    iWidth, iHeight, iBWidth,
+			iBHeight, iPan, iZoom, iBackground};
+}
 
-void PdfViewBase::drawPaper(cairo_t * cc) {
-    if (!iPaperBox.isEmpty()) {
-	cairo_rectangle(cc, iPaperBox.left(), iPaperBox.bottom(), iPaperBox.width(),
-			iPaperBox.height());
-	cairo_set_source_rgb(cc, 1.0, 1.0, 1.0);
-	cairo_fill(cc);
-    }
+bool PdfRenderKey::operator==(const PdfRenderKey & rhs) const noexcept {
+    return iPage == rhs.iPage && iPaperBox.bottomLeft() == rhs.iPaperBox.bottomLeft()
+	   && iPaperBox.topRight() == rhs.iPaperBox.topRight() && iWidth == rhs.iWidth
+	   && iHeight == rhs.iHeight && iBWidth == rhs.iBWidth
+	   && iBHeight == rhs.iBHeight && iPan == rhs.iPan && iZoom == rhs.iZoom
+	   && iBackground == rhs.iBackground;
 }
 
 // --------------------------------------------------------------------
@@ -153,6 +167,9 @@ void PdfViewBase::updatePdf() {
 
 // --------------------------------------------------------------------
 
+// how soon to try again when the page is being rendered in the background
+constexpr int RENDER_RETRY_MSEC = 20;
+
 void PdfViewBase::refreshSurface() {
     if (!iSurface || iBWidth != cairo_image_surface_get_width(iSurface)
 	|| iBHeight != cairo_image_surface_get_height(iSurface)) {
@@ -161,34 +178,257 @@ void PdfViewBase::refreshSurface() {
 	//          iWidth, iHeight, iBWidth, iBHeight);
 	if (iSurface) cairo_surface_destroy(iSurface);
 	iSurface = nullptr;
+	iSurfaceCached = false;
 	iRepaint = true;
     }
     if (iRepaint) {
 	iRepaint = false;
+	PdfRenderKey key = renderKey(iPage, iPaperBox);
+	if (iCache && iPage && !iBlackout) {
+	    cairo_surface_t * surface = iCache->surface(key);
+	    if (!surface) {
+		// the background thread is busy, keep showing the old page
+		if (!iSurface) {
+		    iSurface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, iBWidth,
+							  iBHeight);
+		    render(iSurface, key, nullptr, iCascade.get(), iFonts, true);
+		}
+		iRepaint = true;
+		invalidateLater(RENDER_RETRY_MSEC);
+		return;
+	    }
+	    if (iSurface) cairo_surface_destroy(iSurface);
+	    iSurface = surface;
+	    iSurfaceCached = true;
+	    return;
+	}
+	if (iSurfaceCached) {
+	    // do not draw over a surface owned by the cache
+	    cairo_surface_destroy(iSurface);
+	    iSurface = nullptr;
+	    iSurfaceCached = false;
+	}
 	if (!iSurface)
 	    iSurface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, iBWidth, iBHeight);
-	cairo_t * cc = cairo_create(iSurface);
-	// background
-	cairo_set_source_rgb(cc, iBackground.iRed.toDouble(),
-			     iBackground.iGreen.toDouble(), iBackground.iBlue.toDouble());
-	cairo_rectangle(cc, 0, 0, iBWidth, iBHeight);
-	cairo_fill(cc);
-
-	if (!iBlackout) {
-	    cairo_translate(cc, 0.5 * iBWidth, 0.5 * iBHeight);
-	    cairo_scale(cc, iBWidth / iWidth, iBHeight / iHeight);
-	    cairo_scale(cc, iZoom, -iZoom);
-	    cairo_translate(cc, -iPan.x, -iPan.y);
-
-	    drawPaper(cc);
-	    if (iStream) {
-		CairoPainter painter(iCascade.get(), iFonts, cc, iZoom, false, false);
-		painter.executeStream(iStream, iPage);
+	render(iSurface, key, iStream, iCascade.get(), iFonts, iBlackout);
+    }
+}
+
+//! Render a page into an image surface of the size given in \a key.
+void PdfViewBase::render(cairo_surface_t * surface, const PdfRenderKey & key,
+			 const PdfDict * stream, const Cascade * cascade, Fonts * fonts,
+			 bool blackout) {
+    cairo_t * cc = cairo_create(surface);
+    // background
+    cairo_set_source_rgb(cc, key.iBackground.iRed.toDouble(),
+			 key.iBackground.iGreen.toDouble(),
+			 key.iBackground.iBlue.toDouble());
+    cairo_rectangle(cc, 0, 0, key.iBWidth, key.iBHeight);
+    cairo_fill(cc);
+
+    if (!blackout) {
+	cairo_translate(cc, 0.5 * key.iBWidth, 0.5 * key.iBHeight);
+	cairo_scale(cc, key.iBWidth / key.iWidth, key.iBHeight / key.iHeight);
+	cairo_scale(cc, key.iZoom, -key.iZoom);
+	cairo_translate(cc, -key.iPan.x, -key.iPan.y);
+
+	const Rect & paper = key.iPaperBox;
+	if (!paper.isEmpty()) {
+	    cairo_rectangle(cc, paper.left(), paper.bottom(), paper.width(),
+			    paper.height());
+	    cairo_set_source_rgb(cc, 1.0, 1.0, 1.0);
+	    cairo_fill(cc);
+	}
+	if (stream) {
+	    CairoPainter painter(cascade, fonts, cc, key.iZoom, false, false);
+	    painter.executeStream(stream, key.iPage);
+	}
+    }
+    cairo_surface_flush(surface);
+    cairo_destroy(cc);
+}
+
+// --------------------------------------------------------------------
+
+/*! \class ipe::PdfRenderCache
+  \ingroup canvas
+  \brief Rendered pages shared by several PdfViewBase's.
+
+  The cache keeps the most recently used rendered pages, up to a total
+  size of \a maxBytes.  A background thread renders pages that are
+  likely to be shown next (see prerender), so that navigating to them
+  only needs to copy the surface to the screen.
+
+  All rendering, on the background thread or on the calling thread,
+  holds a lock, since the Fonts object is not thread-safe.  The
+  calling thread never waits for this lock (see surface).
+*/
+
+struct PdfRenderCache::Worker {
+#ifndef IPEWASM
+    std::thread iThread;
+    std::condition_variable iWake;
+#endif
+    bool iStop = false;
+};
+
+//! Create an empty cache.
+PdfRenderCache::PdfRenderCache(size_t maxBytes)
+    : iMaxBytes(maxBytes)
+    , iBytes(0)
+    , iPdf(nullptr)
+    , iFonts(nullptr)
+    , iHasType3(false) {
+    iCascade = std::make_unique<Cascade>();
+    iCascade->insert(0, StyleSheet::standard());
+}
+
+PdfRenderCache::~PdfRenderCache() { setPdf(nullptr, nullptr); }
+
+//! Stop the background thread and wait for it to finish.
+void PdfRenderCache::stopWorker() {
+    if (!iWorker) return;
+    {
+	std::lock_guard lock(iMutex);
+	iWorker->iStop = true;
+	iJobs.clear();
+    }
+#ifndef IPEWASM
+    iWorker->iWake.notify_one();
+    iWorker->iThread.join();
+#endif
+    iWorker.reset();
+}
+
+//! Provide the PDF document and fonts to render with.
+/*! This discards all rendered pages.  Must be called before the
+  previous document or fonts are destroyed. */
+void PdfRenderCache::setPdf(const PdfFile * pdf, Fonts * fonts) {
+    stopWorker();
+    for (auto & [key, surface] : iSurfaces) cairo_surface_destroy(surface);
+    iSurfaces.clear();
+    iBytes = 0;
+    iPdf = pdf;
+    iFonts = fonts;
+    iHasType3 = false;
+}
+
+//! Does the document use a Type3 font?
+/*! Only considers the pages rendered so far.  Use this instead of
+  Fonts::hasType3Font while the background thread may be running. */
+bool PdfRenderCache::hasType3Font() const noexcept { return iHasType3; }
+
+// find surface and move it to the front, with iMutex held
+cairo_surface_t * PdfRenderCache::lookup(const PdfRenderKey & key) {
+    auto it = std::find_if(iSurfaces.begin(), iSurfaces.end(),
+			   [&key](const auto & entry) { return entry.first == key; });
+    if (it == iSurfaces.end()) return nullptr;
+    iSurfaces.splice(iSurfaces.begin(), iSurfaces, it);
+    return cairo_surface_reference(it->second);
+}
+
+// render page and insert in cache, with iRenderMutex held
+cairo_surface_t * PdfRenderCache::renderLocked(const PdfRenderKey & key) {
+    {
+	// someone else may have rendered it while we waited for the lock
+	std::lock_guard lock(iMutex);
+	if (cairo_surface_t * surface = lookup(key)) return surface;
+    }
+    cairo_surface_t * surface =
+	cairo_image_surface_create(CAIRO_FORMAT_RGB24, key.iBWidth, key.iBHeight);
+    const PdfObj * stream = key.iPage->get("Contents", iPdf);
+    PdfViewBase::render(surface, key, stream ? stream->dict() : nullptr, iCascade.get(),
+			iFonts, false);
+    if (iFonts->hasType3Font()) iHasType3 = true;
+    size_t bytes = size_t(cairo_image_surface_get_stride(surface))
+		   * cairo_image_surface_get_height(surface);
+    std::lock_guard lock(iMutex);
+    iSurfaces.emplace_front(key, cairo_surface_reference(surface));
+    iBytes += bytes;
+    // keep at least the surface just rendered
+    while (iBytes > iMaxBytes && iSurfaces.size() > 1) {
+	cairo_surface_t * old = iSurfaces.back().second;
+	iBytes -= size_t(cairo_image_surface_get_stride(old))
+		  * cairo_image_surface_get_height(old);
+	cairo_surface_destroy(old);
+	iSurfaces.pop_back();
+    }
+    return surface;
+}
+
+//! Return the rendered page for \a key, rendering it if necessary.
+/*! The caller owns a reference to the returned surface, and must not
+  draw on it.
+
+  If the background thread is rendering another page, this does not
+  wait.  It returns nullptr, and the page is rendered next on the
+  background thread. */
+cairo_surface_t * PdfRenderCache::surface(const PdfRenderKey & key) {
+    {
+	std::lock_guard lock(iMutex);
+	if (cairo_surface_t * surface = lookup(key)) return surface;
+    }
+    std::unique_lock render(iRenderMutex, std::try_to_lock);
+    if (render.owns_lock()) return renderLocked(key);
+    {
+	std::lock_guard lock(iMutex);
+	if (std::none_of(iJobs.begin(), iJobs.end(),
+			 [&key](const Job & job) { return job.iKey == key; }))
+	    iJobs.insert(iJobs.begin(), Job{nullptr, -1, key});
+    }
+#ifndef IPEWASM
+    if (iWorker) iWorker->iWake.notify_one();
+#endif
+    return nullptr;
+}
+
+//! Render pages for \a view in the background.
+/*! The pages are rendered in the order given, and replace any pages
+  still waiting to be rendered for the same view.  Jobs for different
+  views are interleaved, so that the first key of each view is done
+  first.  Without thread support, this does nothing. */
+void PdfRenderCache::prerender(const PdfViewBase * view, std::vector<PdfRenderKey> keys) {
+#ifndef IPEWASM
+    if (!iPdf) return;
+    {
+	std::lock_guard lock(iMutex);
+	std::erase_if(iJobs, [view](const Job & job) { return job.iView == view; });
+	for (int i = 0; i < size(keys); ++i) {
+	    if (keys[i].iBWidth >= 1 && keys[i].iBHeight >= 1)
+		iJobs.push_back(Job{view, i, keys[i]});
+	}
+	std::stable_sort(iJobs.begin(), iJobs.end(),
+			 [](const Job & a, const Job & b) { return a.iRank < b.iRank; });
+    }
+    if (!iWorker) {
+	iWorker = std::make_unique<Worker>();
+	iWorker->iThread = std::thread(&PdfRenderCache::work, this);
+    } else
+	iWorker->iWake.notify_one();
+#endif
+}
+
+// the background thread
+void PdfRenderCache::work() {
+#ifndef IPEWASM
+    for (;;) {
+	PdfRenderKey key;
+	{
+	    std::unique_lock lock(iMutex);
+	    iWorker->iWake.wait(lock,
+				[this] { return iWorker->iStop || !iJobs.empty(); });
+	    if (iWorker->iStop) return;
+	    key = iJobs.front().iKey;
+	    iJobs.erase(iJobs.begin());
+	    if (cairo_surface_t * surface = lookup(key)) {
+		cairo_surface_destroy(surface);
+		continue;
 	    }
 	}
-	cairo_surface_flush(iSurface);
-	cairo_destroy(cc);
+	std::lock_guard lock(iRenderMutex);
+	cairo_surface_destroy(renderLocked(key));
     }
+#endif
 }
 
 // --------------------------------------------------------------------
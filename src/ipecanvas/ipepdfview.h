@@ -33,6 +33,10 @@
 #include "ipelib.h"
 #include "ipepdfparser.h"
 
+#include <atomic>
+#include <list>
+#include <mutex>
+
 // --------------------------------------------------------------------
 
 // Avoid including cairo.h
@@ -44,6 +48,22 @@ typedef struct _cairo_surface cairo_surface_t;
 namespace ipe {
 
 class Fonts;
+class PdfRenderCache;
+
+// --------------------------------------------------------------------
+
+//! Everything that determines the pixels of a rendered PDF page.
+struct PdfRenderKey {
+    const PdfDict * iPage;
+    Rect iPaperBox;
+    double iWidth, iHeight;   // size of view
+    double iBWidth, iBHeight; // size of backing store
+    Vector iPan;
+    double iZoom;
+    Color iBackground;
+
+    bool operator==(const PdfRenderKey & rhs) const noexcept;
+};
 
 // --------------------------------------------------------------------
 
@@ -52,7 +72,7 @@ class PdfViewBase {
 public:
     virtual ~PdfViewBase();
 
-    void setPdf(const PdfFile * pdf, Fonts * fonts);
+    void setPdf(const PdfFile * pdf, Fonts * fonts, PdfRenderCache * cache = nullptr);
     void setPage(const PdfDict * page, const Rect & paper);
     void setBackground(const Color & bg);
     void setBlackout(bool bo);
@@ -77,6 +97,7 @@ public:
     void setZoom(double zoom);
 
     Matrix canvasTfm() const;
+    PdfRenderKey renderKey(const PdfDict * page, const Rect & paper) const;
 
     void updatePdf();
     virtual void invalidate(int x, int y, int w, int h) = 0;
@@ -84,8 +105,14 @@ public:
 
 protected:
     PdfViewBase();
-    void drawPaper(cairo_t * cc);
     void refreshSurface();
+    //! Redraw the view after \a msec milliseconds.
+    virtual void invalidateLater(int msec) = 0;
+
+public:
+    static void render(cairo_surface_t * surface, const PdfRenderKey & key,
+		       const PdfDict * stream, const Cascade * cascade, Fonts * fonts,
+		       bool blackout);
 
 protected:
     double iWidth, iHeight;
@@ -97,6 +124,7 @@ protected:
 
     bool iRepaint;
     cairo_surface_t * iSurface;
+    bool iSurfaceCached; // iSurface is shared with iCache
 
     std::unique_ptr<Cascade> iCascade; // dummy stylesheet
 
@@ -105,6 +133,48 @@ protected:
     const PdfDict * iStream;
     const PdfFile * iPdf;
     Fonts * iFonts;
+    PdfRenderCache * iCache;
+};
+
+// --------------------------------------------------------------------
+
+class PdfRenderCache {
+public:
+    explicit PdfRenderCache(size_t maxBytes);
+    ~PdfRenderCache();
+    PdfRenderCache(const PdfRenderCache &) = delete;
+    PdfRenderCache & operator=(const PdfRenderCache &) = delete;
+
+    void setPdf(const PdfFile * pdf, Fonts * fonts);
+    cairo_surface_t * surface(const PdfRenderKey & key);
+    void prerender(const PdfViewBase * view, std::vector<PdfRenderKey> keys);
+    bool hasType3Font() const noexcept;
+
+private:
+    struct Job {
+	const PdfViewBase * iView;
+	int iRank;
+	PdfRenderKey iKey;
+    };
+    cairo_surface_t * lookup(const PdfRenderKey & key);
+    cairo_surface_t * renderLocked(const PdfRenderKey & key);
+    void stopWorker();
+    void work();
+
+private:
+    size_t iMaxBytes;
+    size_t iBytes;
+    std::unique_ptr<Cascade> iCascade; // dummy stylesheet
+    const PdfFile * iPdf;
+    Fonts * iFonts;
+    //! Rendered surfaces, most recently used first.
+    std::list<std::pair<PdfRenderKey, cairo_surface_t *>> iSurfaces;
+    std::vector<Job> iJobs;
+    std::mutex iMutex;       // protects iSurfaces, iBytes, iJobs
+    std::mutex iRenderMutex; // serializes use of iFonts
+    std::atomic<bool> iHasType3;
+    struct Worker;
+    std::unique_ptr<Worker> iWorker;
 };
 
 } // namespace ipe
@@ -62,6 +62,12 @@ void PdfView::invalidate(int x, int y, int w, int h) {
     [iView setNeedsDisplayInRect:rect];
 }
 
+void PdfView::invalidateLater(int msec) {
+    IpePdfView * view = iView;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, int64_t(msec) * NSEC_PER_MSEC),
+		   dispatch_get_main_queue(), ^{ [view setNeedsDisplay:YES]; });
+}
+
 void PdfView::drawRect(NSRect rect) {
     NSSize s = [iView bounds].size;
     NSSize sb = [iView convertSizeToBacking:s];
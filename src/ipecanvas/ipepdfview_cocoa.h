@@ -58,6 +58,7 @@ public:
 private:
     virtual void invalidate();
     virtual void invalidate(int x, int y, int w, int h);
+    virtual void invalidateLater(int msec);
 
 private:
     IpePdfView * iView;
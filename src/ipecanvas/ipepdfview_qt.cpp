@@ -34,6 +34,7 @@
 
 #include <QPaintEvent>
 #include <QPainter>
+#include <QTimer>
 
 using namespace ipe;
 
@@ -54,6 +55,10 @@ void PdfView::invalidate(int x, int y, int w, int h) {
     QWidget::update(QRect(x, y, w, h));
 }
 
+void PdfView::invalidateLater(int msec) {
+    QTimer::singleShot(msec, this, [this]() { QWidget::update(); });
+}
+
 // --------------------------------------------------------------------
 
 void PdfView::paintEvent(QPaintEvent * ev) {
@@ -56,6 +56,7 @@ protected:
     virtual void paintEvent(QPaintEvent * ev);
     virtual void mousePressEvent(QMouseEvent * ev);
     virtual QSize sizeHint() const;
+    virtual void invalidateLater(int msec);
 };
 
 } // namespace ipe
@@ -56,6 +56,9 @@ void PdfView::invalidate(int x, int y, int w, int h) {
     InvalidateRect(hwnd, &r, FALSE);
 }
 
+// the timer is handled in wndProc
+void PdfView::invalidateLater(int msec) { SetTimer(hwnd, 1, msec, nullptr); }
+
 // --------------------------------------------------------------------
 
 void PdfView::updateSize() {
@@ -113,6 +116,10 @@ LRESULT CALLBACK PdfView::wndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM
     case WM_PAINT:
 	if (view) view->wndPaint();
 	return 0;
+    case WM_TIMER:
+	KillTimer(hwnd, wParam);
+	if (view) view->invalidate();
+	return 0;
     case WM_SIZE:
 	if (view) {
 	    view->updateSize();
@@ -54,6 +54,7 @@ private:
 
     virtual void invalidate();
     virtual void invalidate(int x, int y, int w, int h);
+    virtual void invalidateLater(int msec);
 
 private:
     static const wchar_t className[];
@@ -345,8 +345,39 @@ TransformTool::TransformTool(CanvasBase * canvas, Page * page, int view, TType t
 	iValid = false;
     else if (iType != ETranslate && iMouseDown == iOrigin)
 	iValid = false;
-    else
+    else {
 	iCanvas->setCursor(CanvasBase::EHandCursor);
+	rasterize();
+    }
+}
+
+//! Render a large selection once, so that dragging only transforms a bitmap.
+/*! The page is redrawn exactly when the tool finishes. */
+void TransformTool::rasterize() {
+    int count = 0;
+    Rect bbox;
+    for (int i = 0; i < iPage->count(); ++i) {
+	if (iPage->select(i)) {
+	    ++count;
+	    bbox.addRect(iPage->bbox(i));
+	}
+    }
+    int threshold = iCanvas->rasterThreshold();
+    if (threshold == 0 || count < threshold) return;
+    // objects can be dragged into view from just outside the canvas
+    Rect visible = iCanvas->visibleRect();
+    Vector margin = 0.5 * (visible.topRight() - visible.bottomLeft());
+    visible = Rect(visible.bottomLeft() - margin, visible.topRight() + margin);
+    double pad = 2.0 / iCanvas->zoom();
+    iPreviewArea =
+	Rect(bbox.bottomLeft() - Vector(pad, pad), bbox.topRight() + Vector(pad, pad));
+    iPreviewArea.clipTo(visible);
+    iPreview = iCanvas->renderBitmap(iPreviewArea, [this](Painter & painter) {
+	painter.setStroke(Attribute(Color(0, 600, 0)));
+	for (int i = 0; i < iPage->count(); ++i) {
+	    if (iPage->select(i)) iPage->object(i)->drawSimple(painter);
+	}
+    });
 }
 
 //! Check that the transformation can be performed.
@@ -355,6 +386,12 @@ bool TransformTool::isValid() const { return iValid; }
 void TransformTool::draw(Painter & painter) const {
     painter.setStroke(Attribute(Color(0, 600, 0)));
     painter.transform(iTransform);
+    if (!iPreview.isNull()) {
+	painter.transform(Matrix(iPreviewArea.width(), 0.0, 0.0, iPreviewArea.height(),
+				 iPreviewArea.left(), iPreviewArea.bottom()));
+	painter.drawBitmap(iPreview);
+	return;
+    }
     for (int i = 0; i < iPage->count(); ++i) {
 	if (iPage->select(i)) iPage->object(i)->drawSimple(painter);
     }
@@ -108,6 +108,7 @@ public:
 
 protected:
     void compute(const Vector & v);
+    void rasterize();
 
 protected:
     Page * iPage;
@@ -121,6 +122,8 @@ protected:
     Matrix iTransform;
     Vector iOrigin;
     Angle iDir;
+    Bitmap iPreview;    // selection rendered once, if it is large
+    Rect iPreviewArea;  // area covered by iPreview
 
     bool iValid;
 };
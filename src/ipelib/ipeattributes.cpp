@@ -31,6 +31,8 @@
 
 #include "ipeattributes.h"
 
+#include <mutex>
+
 // --------------------------------------------------------------------
 
 /*! \defgroup attr Ipe Attributes
@@ -203,11 +205,15 @@ void Effect::pageDictionary(Stream & stream) const {
 
   The Repository is a singleton object.  It is created the first time
   it is used. You obtain access to the repository using get().
+  It can be used from several threads at once.
 */
 
 // pointer to singleton object
 Repository * Repository::singleton = nullptr;
 
+// protects the singleton and its strings
+static std::mutex repositoryMutex;
+
 //! Constructor.
 Repository::Repository() {
     // put certain strings at index 0 ..
@@ -227,17 +233,22 @@ Repository::Repository() {
 
 //! Get pointer to singleton Repository.
 Repository * Repository::get() {
+    std::lock_guard lock(repositoryMutex);
     if (!singleton) { singleton = new Repository(); }
     return singleton;
 }
 
 //! Return string with given index.
-String Repository::toString(int index) const { return iStrings[index]; }
+String Repository::toString(int index) const {
+    std::lock_guard lock(repositoryMutex);
+    return iStrings[index];
+}
 
 //! Return index of given string.
 /*! The string is added to the repository if it doesn't exist yet. */
 int Repository::toIndex(String str) {
     assert(!str.empty());
+    std::lock_guard lock(repositoryMutex);
     std::vector<String>::const_iterator it =
 	std::find(iStrings.begin(), iStrings.end(), str);
     if (it != iStrings.end()) return (it - iStrings.begin());
@@ -247,6 +258,7 @@ int Repository::toIndex(String str) {
 
 //! Destroy repository object.
 void Repository::cleanup() {
+    std::lock_guard lock(repositoryMutex);
     delete singleton;
     singleton = nullptr;
 }
@@ -69,22 +69,19 @@ using namespace ipe;
   assumed that the string is UTF-8 encoded, but only the unicode
   member function actually requires this. In particular, all indices
   into the string are byte indices, not Unicode character indices.
+
+  The reference count is atomic, and the data of a shared string is
+  never modified, so that copies of the same string can be used on
+  several threads at once.  (A single String object must not be
+  modified while another thread uses it.)
 */
 
-String::Imp * String::theEmptyString = {nullptr};
+// All empty strings share this representation.  Its reference count
+// is never modified, so that empty strings can be created and destroyed
+// on several threads at once.
+String::Imp String::theEmptyString = {{2}, 0, 0, nullptr};
 
-String::Imp * String::emptyString() noexcept {
-    if (theEmptyString == nullptr) {
-	theEmptyString = new Imp;
-	theEmptyString->iRefCount = 10; // always > 1
-	theEmptyString->iSize = 0;
-	theEmptyString->iCapacity = 0;
-	theEmptyString->iData = nullptr;
-    }
-    // increment every time it's requested to make sure it's never destroyed
-    ++theEmptyString->iRefCount;
-    return theEmptyString;
-}
+String::Imp * String::emptyString() noexcept { return &theEmptyString; }
 
 //! Construct an empty string.
 String::String() noexcept { iImp = emptyString(); }
@@ -101,6 +98,7 @@ String::String(const char * str) noexcept {
 	iImp->iCapacity = (len + 32) & ~15;
 	iImp->iData = new char[iImp->iCapacity];
 	memcpy(iImp->iData, str, iImp->iSize);
+	iImp->iData[iImp->iSize] = '\0';
     }
 }
 
@@ -108,7 +106,6 @@ String::String(const char * str) noexcept {
 String String::withData(char * data, int len) noexcept {
     if (!len) len = strlen(data);
     String r; // empty string
-    --r.iImp->iRefCount;
     r.iImp = new Imp;
     r.iImp->iRefCount = 1;
     r.iImp->iSize = len;
@@ -128,6 +125,7 @@ String::String(const char * str, int len) noexcept {
 	iImp->iCapacity = (len + 32) & ~15;
 	iImp->iData = new char[iImp->iCapacity];
 	memcpy(iImp->iData, str, iImp->iSize);
+	iImp->iData[iImp->iSize] = '\0';
     }
 }
 
@@ -141,6 +139,7 @@ String::String(const std::string & rhs) noexcept {
 	iImp->iCapacity = (rhs.length() + 32) & ~15;
 	iImp->iData = new char[iImp->iCapacity];
 	memcpy(iImp->iData, rhs.c_str(), iImp->iSize);
+	iImp->iData[iImp->iSize] = '\0';
     }
 }
 
@@ -148,7 +147,7 @@ String::String(const std::string & rhs) noexcept {
 //! This only copies the reference and takes constant time.
 String::String(const String & rhs) noexcept {
     iImp = rhs.iImp;
-    iImp->iRefCount++;
+    if (iImp != &theEmptyString) iImp->iRefCount.fetch_add(1, std::memory_order_relaxed);
 }
 
 //! Construct a substring.
@@ -167,43 +166,45 @@ String::String(const String & rhs, int index, int len) noexcept {
 	iImp->iCapacity = (len + 32) & ~15;
 	iImp->iData = new char[iImp->iCapacity];
 	memcpy(iImp->iData, rhs.iImp->iData + index, len);
+	iImp->iData[len] = '\0';
     }
 }
 
 //! Assignment takes constant time.
 String & String::operator=(const String & rhs) noexcept {
     if (iImp != rhs.iImp) {
-	if (iImp->iRefCount == 1) {
-	    delete[] iImp->iData;
-	    delete iImp;
-	} else
-	    iImp->iRefCount--;
+	release();
 	iImp = rhs.iImp;
-	iImp->iRefCount++;
+	if (iImp != &theEmptyString)
+	    iImp->iRefCount.fetch_add(1, std::memory_order_relaxed);
     }
     return *this;
 }
 
 //! Destruct string if reference count has reached zero.
-String::~String() noexcept {
-    if (iImp->iRefCount == 1) {
+String::~String() noexcept { release(); }
+
+//! Drop the reference to the representation, deleting it if it was the last one.
+void String::release() noexcept {
+    if (iImp != &theEmptyString
+	&& iImp->iRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
 	delete[] iImp->iData;
 	delete iImp;
-    } else
-	iImp->iRefCount--;
+    }
 }
 
 //! Make a private copy of the string with \a n bytes to spare.
-/*! When a private copy has to be made an extra 32 bytes are ensured. */
+/*! When a private copy has to be made an extra 32 bytes are ensured.
+  There is always room for the final zero byte. */
 void String::detach(int n) noexcept {
-    if (iImp == theEmptyString) {
+    if (iImp == &theEmptyString) {
 	iImp = new Imp;
 	iImp->iRefCount = 1;
 	iImp->iSize = 0;
-	n = (n + 0x1f) & ~0x1f;
-	iImp->iCapacity = (n >= 16) ? n : 16;
+	iImp->iCapacity = (n + 0x20) & ~0x1f;
 	iImp->iData = new char[iImp->iCapacity];
-    } else if (iImp->iRefCount > 1 || (iImp->iSize + n > iImp->iCapacity)) {
+    } else if (iImp->iRefCount.load(std::memory_order_acquire) > 1
+	       || (iImp->iSize + n >= iImp->iCapacity)) {
 	Imp * imp = new Imp;
 	imp->iRefCount = 1;
 	imp->iSize = iImp->iSize;
@@ -211,21 +212,21 @@ void String::detach(int n) noexcept {
 	while (imp->iSize + 32 + n > imp->iCapacity) imp->iCapacity *= 2;
 	imp->iData = new char[imp->iCapacity];
 	memcpy(imp->iData, iImp->iData, imp->iSize);
-	iImp->iRefCount--;
-	if (iImp->iRefCount == 0) {
-	    delete[] iImp->iData;
-	    delete iImp;
-	}
+	release();
 	iImp = imp;
     }
 }
 
 //! Return a C style string with final zero byte.
+/*! The zero byte is written when the string is modified, so this does
+  not modify shared data (except for strings created using withData). */
 const char * String::z() const noexcept {
-    if (iImp == theEmptyString) return "";
-    String * This = const_cast<String *>(this);
-    if (iImp->iSize == iImp->iCapacity) This->detach(1);
-    This->iImp->iData[iImp->iSize] = '\0';
+    if (iImp == &theEmptyString) return "";
+    if (iImp->iSize == iImp->iCapacity) {
+	String * This = const_cast<String *>(this);
+	This->detach(1);
+	This->iImp->iData[iImp->iSize] = '\0';
+    }
     return data();
 }
 
@@ -270,6 +271,7 @@ int String::rfind(char ch) const noexcept {
 void String::erase() noexcept {
     detach(0);
     iImp->iSize = 0;
+    iImp->iData[0] = '\0';
 }
 
 //! Append \a rhs to this string.
@@ -278,6 +280,7 @@ void String::append(const String & rhs) noexcept {
     detach(n);
     memcpy(iImp->iData + iImp->iSize, rhs.iImp->iData, n);
     iImp->iSize += n;
+    iImp->iData[iImp->iSize] = '\0';
 }
 
 //! Append \a rhs to this string.
@@ -287,6 +290,7 @@ void String::append(const char * rhs) noexcept {
 	detach(n);
 	memcpy(iImp->iData + iImp->iSize, rhs, n);
 	iImp->iSize += n;
+	iImp->iData[iImp->iSize] = '\0';
     }
 }
 
@@ -294,6 +298,7 @@ void String::append(const char * rhs) noexcept {
 void String::append(char ch) noexcept {
     detach(1);
     iImp->iData[iImp->iSize++] = ch;
+    iImp->iData[iImp->iSize] = '\0';
 }
 
 //! Append a single unicode character \a ch in UTF-8 encoding.
@@ -304,11 +309,13 @@ void String::appendUtf8(uint16_t ch) noexcept {
 	detach(2);
 	iImp->iData[iImp->iSize++] = 0xc0 | (ch >> 6);
 	iImp->iData[iImp->iSize++] = 0x80 | (ch & 0x3f);
+	iImp->iData[iImp->iSize] = '\0';
     } else {
 	detach(3);
 	iImp->iData[iImp->iSize++] = 0xe0 | (ch >> 12);
 	iImp->iData[iImp->iSize++] = 0x80 | ((ch >> 6) & 0x3f);
 	iImp->iData[iImp->iSize++] = 0x80 | (ch & 0x3f);
+	iImp->iData[iImp->iSize] = '\0';
     }
 }
 
@@ -744,6 +751,33 @@ long FileStream::tell() const { return std::ftell(iFile); }
 
 // --------------------------------------------------------------------
 
+/*! \class ipe::HashStream
+  \ingroup base
+  \brief Stream computing a 64-bit FNV-1a hash of the data written.
+*/
+
+//! Constructor.
+HashStream::HashStream()
+    : iHash(14695981039346656037ull) {
+    // nothing
+}
+
+void HashStream::putChar(char ch) { iHash = (iHash ^ uint8_t(ch)) * 1099511628211ull; }
+
+void HashStream::putString(String s) { putRaw(s.data(), s.size()); }
+
+void HashStream::putCString(const char * s) {
+    while (*s) putChar(*s++);
+}
+
+void HashStream::putRaw(const char * data, int size) {
+    uint64_t h = iHash;
+    for (int i = 0; i < size; i++) h = (h ^ uint8_t(data[i])) * 1099511628211ull;
+    iHash = h;
+}
+
+// --------------------------------------------------------------------
+
 /*! \class ipe::DataSource
  * \ingroup base
  * \brief Interface for getting data for parsing.
@@ -48,7 +48,9 @@ extern bool dctDecode(Buffer dctData, Buffer pixelData);
   The bitmap provides a slot for short-term storage of an "object
   number".  The PDF embedder, for instance, sets it to the PDF object
   number when embedding the bitmap, and can reuse it when "drawing"
-  the bitmap.
+  the bitmap.  Since the slot is shared by all copies, a document
+  must not be saved on two threads at once.  Rendering on several
+  threads is fine.
 */
 
 //! Default constructor constructs null bitmap.
@@ -99,7 +101,6 @@ std::pair<int, int> Bitmap::init(const XmlAttributes & attr) {
     iImp->iRefCount = 1;
     iImp->iFlags = 0;
     iImp->iColorKey = -1;
-    iImp->iPixelsComputed = false;
     iImp->iObjNum = Lex(attr["id"]).getInt();
     iImp->iWidth = Lex(attr["width"]).getInt();
     iImp->iHeight = Lex(attr["height"]).getInt();
@@ -138,7 +139,6 @@ Bitmap::Bitmap(int width, int height, uint32_t flags, Buffer data) {
     iImp->iWidth = width;
     iImp->iHeight = height;
     iImp->iData = data;
-    iImp->iPixelsComputed = false;
     assert(iImp->iWidth > 0 && iImp->iHeight > 0);
     unpack(Buffer());
     computeChecksum();
@@ -260,21 +260,22 @@ void Bitmap::analyze() {
 /*! Since Bitmaps are reference counted, this is very fast. */
 Bitmap::Bitmap(const Bitmap & rhs) {
     iImp = rhs.iImp;
-    if (iImp) iImp->iRefCount++;
+    if (iImp) iImp->iRefCount.fetch_add(1, std::memory_order_relaxed);
 }
 
 //! Destructor.
 Bitmap::~Bitmap() {
-    if (iImp && --iImp->iRefCount == 0) { delete iImp; }
+    if (iImp && iImp->iRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1) delete iImp;
 }
 
 //! Assignment operator (takes care of reference counting).
 /*! Very fast. */
 Bitmap & Bitmap::operator=(const Bitmap & rhs) {
     if (this != &rhs) {
-	if (iImp && --iImp->iRefCount == 0) delete iImp;
+	if (rhs.iImp) rhs.iImp->iRefCount.fetch_add(1, std::memory_order_relaxed);
+	if (iImp && iImp->iRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	    delete iImp;
 	iImp = rhs.iImp;
-	if (iImp) iImp->iRefCount++;
     }
     return *this;
 }
@@ -415,38 +416,43 @@ void Bitmap::savePixels(const char * fname) {
   Otherwise, returns a buffer of size width() * height() uint32_t's.
   The data is in cairo ARGB32 format, that is native-endian uint32_t's
   with premultiplied alpha.
+
+  The pixels are computed only once, even if several threads render
+  the same bitmap at the same time.
 */
 Buffer Bitmap::pixelData() {
-    if (!iImp->iPixelsComputed) {
-	iImp->iPixelsComputed = true;
-	if (isJpeg()) {
-	    Buffer stream = iImp->iData;
-	    Buffer pixels;
-	    pixels = Buffer(4 * width() * height());
-	    if (!dctDecode(stream, pixels)) return Buffer();
+    std::call_once(iImp->iPixelsOnce, [this] { computePixelData(); });
+    return iImp->iPixelData;
+}
+
+//! Compute the pixels returned by pixelData().
+void Bitmap::computePixelData() {
+    if (isJpeg()) {
+	Buffer stream = iImp->iData;
+	Buffer pixels;
+	pixels = Buffer(4 * width() * height());
+	if (dctDecode(stream, pixels)) iImp->iPixelData = pixels;
+    } else {
+	if (hasAlpha() || colorKey() >= 0) {
+	    // premultiply RGB data
+	    Buffer pixels(iImp->iData.size());
+	    uint32_t * p = (uint32_t *)iImp->iData.data();
+	    uint32_t * q = (uint32_t *)pixels.data();
+	    uint32_t * fin = p + width() * height();
+	    uint32_t pixel, alpha, alphaM, r, g, b;
+	    while (p < fin) {
+		pixel = *p++;
+		alpha = (pixel & 0xff000000);
+		alphaM = alpha >> 24;
+		r = alphaM * (pixel & 0xff0000) / 255;
+		g = alphaM * (pixel & 0x00ff00) / 255;
+		b = alphaM * (pixel & 0x0000ff) / 255;
+		*q++ = alpha | (r & 0xff0000) | (g & 0x00ff00) | (b & 0x0000ff);
+	    }
 	    iImp->iPixelData = pixels;
-	} else {
-	    if (hasAlpha() || colorKey() >= 0) {
-		// premultiply RGB data
-		iImp->iPixelData = Buffer(iImp->iData.size());
-		uint32_t * p = (uint32_t *)iImp->iData.data();
-		uint32_t * q = (uint32_t *)iImp->iPixelData.data();
-		uint32_t * fin = p + width() * height();
-		uint32_t pixel, alpha, alphaM, r, g, b;
-		while (p < fin) {
-		    pixel = *p++;
-		    alpha = (pixel & 0xff000000);
-		    alphaM = alpha >> 24;
-		    r = alphaM * (pixel & 0xff0000) / 255;
-		    g = alphaM * (pixel & 0x00ff00) / 255;
-		    b = alphaM * (pixel & 0x0000ff) / 255;
-		    *q++ = alpha | (r & 0xff0000) | (g & 0x00ff00) | (b & 0x0000ff);
-		}
-	    } else
-		iImp->iPixelData = iImp->iData;
-	}
+	} else
+	    iImp->iPixelData = iImp->iData;
     }
-    return iImp->iPixelData;
 }
 
 // --------------------------------------------------------------------
@@ -36,6 +36,7 @@
 #include "ipepdfwriter.h"
 #include "ipereference.h"
 #include "ipestyle.h"
+#include "ipetrace.h"
 #include "ipeutils.h"
 
 #include <errno.h>
@@ -205,6 +206,7 @@ Document * doParsePdf(DataSource & source, int & reason) {
   negative, it is an error code, see Document::LoadErrors.
 */
 Document * Document::load(DataSource & source, FileFormat format, int & reason) {
+    IPE_TRACE_SPAN("Document::load");
     if (format == FileFormat::Xml) return doParseXml(source, reason);
 
     if (format == FileFormat::Pdf) return doParsePdf(source, reason);
@@ -257,6 +259,7 @@ Document * Document::loadWithErrorReport(const char * fname) {
 /*! Returns true if sucessful.
  */
 bool Document::save(TellStream & stream, FileFormat format, uint32_t flags) const {
+    IPE_TRACE_SPAN("Document::save");
     if (format == FileFormat::Xml) {
 	stream << "<?xml version=\"1.0\"?>\n";
 	stream << "<!DOCTYPE ipe SYSTEM \"ipe.dtd\">\n";
@@ -275,16 +278,15 @@ bool Document::save(TellStream & stream, FileFormat format, uint32_t flags) cons
 	if (!(flags & SaveFlag::Export)) {
 	    String xmlData;
 	    StringStream stream(xmlData);
+	    // all bitmaps have been embedded and carry correct object number
+	    saveAsXml(stream, true);
 	    if (compresslevel > 0) {
-		DeflateStream dfStream(stream, compresslevel);
-		// all bitmaps have been embedded and carry correct object number
-		saveAsXml(dfStream, true);
-		dfStream.close();
-		writer.createXmlStream(xmlData, true);
-	    } else {
-		saveAsXml(stream, true);
+		int size;
+		Buffer deflated = DeflateStream::deflate(xmlData.data(), xmlData.size(),
+							 size, compresslevel);
+		writer.createXmlStream(String(deflated.data(), size), true);
+	    } else
 		writer.createXmlStream(xmlData, false);
-	    }
 	}
 	writer.createTrailer();
 	return true;
@@ -352,6 +354,8 @@ void Document::findBitmaps(BitmapFinder & bm) const {
 }
 
 //! Save in XML format into an Stream.
+/*! If Ipelib can use several threads (see Platform::threadCount), the
+  pages are written into separate buffers in parallel. */
 void Document::saveAsXml(Stream & stream, bool usePdfBitmaps) const {
     stream << "<ipe version=\"" << FILE_FORMAT << "\"";
     if (!iProperties.iCreator.empty())
@@ -434,7 +438,19 @@ void Document::saveAsXml(Stream & stream, bool usePdfBitmaps) const {
     iCascade->saveAsXml(stream);
 
     // save pages
-    for (int i = 0; i < countPages(); ++i) page(i)->saveAsXml(stream);
+    int threads = Platform::threadCount();
+    if (threads > 1 && countPages() > 1) {
+	std::vector<String> pages(countPages());
+	parallelFor(countPages(), threads, [&](int, int begin, int end) {
+	    for (int i = begin; i < end; ++i) {
+		StringStream pageStream(pages[i]);
+		page(i)->saveAsXml(pageStream);
+	    }
+	});
+	for (const String & data : pages) stream << data;
+    } else {
+	for (int i = 0; i < countPages(); ++i) page(i)->saveAsXml(stream);
+    }
     stream << "</ipe>\n";
 }
 
@@ -527,7 +543,192 @@ Page * Document::remove(int no) {
 
 // --------------------------------------------------------------------
 
-int Document::prepareLatexRun(Latex ** pConverter) {
+// Return the directory (with a final separator) for Latex run k out of n.
+static String latexRunDir(int k, int n) {
+    String dir = Platform::folder(FolderLatex);
+    dir += IPESEP;
+    if (n > 1) {
+	StringStream ss(dir);
+	ss << "shard" << k;
+	dir += IPESEP;
+    }
+    return dir;
+}
+
+// the number of format files kept in the Latex folder
+constexpr int MAX_LATEX_FORMATS = 4;
+// the number of Latex runs kept in the cache
+constexpr int MAX_CACHED_RUNS = 128;
+
+// Move name to the end of the list of recently used files in dir, and
+// remove the files with extensions exts of names dropped from the
+// list.  Several Ipe processes may share the directory, so the list is
+// updated under a lock, and replaced in a single step.
+static void useLatexFiles(String dir, const char * list, String name, int keep,
+			  std::initializer_list<const char *> exts) {
+    String base = dir + list;
+    FileLock lock(base + ".lock");
+    String text = Platform::readFile(base + ".txt");
+    std::vector<String> names;
+    for (Lex lex(text); !lex.eos();) {
+	String f = lex.nextToken();
+	if (!f.empty() && f != name) names.push_back(f);
+    }
+    names.push_back(name);
+    while (size(names) > keep) {
+	for (const char * ext : exts) std::remove((dir + names.front() + ext).z());
+	names.erase(names.begin());
+    }
+    String tmp = base + ".tmp";
+    std::FILE * f = Platform::fopen(tmp.z(), "wb");
+    if (!f) return;
+    for (const auto & n : names) std::fprintf(f, "%s\n", n.z());
+    if (std::fclose(f) == 0) Platform::renameFile(tmp, base + ".txt");
+}
+
+static void useLatexFormat(String dir, String name) {
+    useLatexFiles(dir, "ipeformats", name, MAX_LATEX_FORMATS,
+		  {".fmt", ".tex", ".log", ".nofmt"});
+}
+
+// Directory of the cache of Latex runs (with final separator), empty
+// if there is no cache.
+static String latexCacheDir;
+
+static bool writeLatexFile(String fname, String data) {
+    std::FILE * f = Platform::fopen(fname.z(), "wb");
+    if (!f) return false;
+    bool okay = std::fwrite(data.data(), 1, data.size(), f) == size_t(data.size());
+    return std::fclose(f) == 0 && okay;
+}
+
+// The cached result of a Latex run is found by the hash of its key:
+// the engine, the directory of the document (where Latex finds
+// included files), and the Latex source with the preamble or format.
+static String latexCacheKey(String dir, LatexType engine, String docname,
+			    String & name) {
+    String key;
+    StringStream ss(key);
+    ss << int(engine) << "\n";
+    if (!docname.empty()) {
+	String path = Platform::realPath(docname);
+	int i = path.rfind(IPESEP);
+	if (i > 0) ss << path.left(i);
+    }
+    ss << "\n" << Platform::readFile(dir + "ipetemp.tex");
+    HashStream hs;
+    hs << key;
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "ipe-%016llx", (unsigned long long)hs.hash());
+    name = buf;
+    return key;
+}
+
+// Copy the cached result of the Latex run with this key to dir.
+static bool fetchLatexRun(String dir, String name, String key) {
+    String base = latexCacheDir + name;
+    if (Platform::readFile(base + ".key") != key) return false;
+    String pdf = Platform::readFile(base + ".pdf");
+    String log = Platform::readFile(base + ".log");
+    if (pdf.empty() || log.empty() || !writeLatexFile(dir + "ipetemp.pdf", pdf)
+	|| !writeLatexFile(dir + "ipetemp.log", log))
+	return false;
+    useLatexFiles(latexCacheDir, "ipetexts", name, MAX_CACHED_RUNS,
+		  {".key", ".pdf", ".log"});
+    return true;
+}
+
+// Move the result of a successful Latex run in dir to the cache.  The
+// key is written last, so that a result is never found incomplete.
+static void storeLatexRun(String dir, String name, String key) {
+    String base = latexCacheDir + name;
+    if (Platform::renameFile(dir + "ipetemp.pdf", base + ".pdf") != 0
+	|| Platform::renameFile(dir + "ipetemp.log", base + ".log") != 0
+	|| !writeLatexFile(dir + "ipetemp.key", key)
+	|| Platform::renameFile(dir + "ipetemp.key", base + ".key") != 0)
+	return;
+    useLatexFiles(latexCacheDir, "ipetexts", name, MAX_CACHED_RUNS,
+		  {".key", ".pdf", ".log"});
+}
+
+// Set the format file containing the preamble of this Latex run.  If
+// it does not exist in the Latex folder yet, its source is written
+// there, and the format is marked to be made before Latex runs (see
+// Latex::formatToDump()).  No format is set if none can be used.
+static void setLatexFormat(Latex * converter, LatexType engine, String preamble,
+			   String docname) {
+    // the preamble may specify a format, or Latex may be told to use its own
+    if (preamble.hasPrefix("%&") || getenv("IPETEXFORMAT")) return;
+    String source;
+    StringStream ss(source);
+    converter->createFormatSource(ss, preamble);
+    const char * tex = (engine == LatexType::Xetex)    ? "xetex"
+		       : (engine == LatexType::Luatex) ? "luatex"
+						       : "pdftex";
+    char name[32];
+    std::snprintf(name, sizeof(name), "ipe-%s-%08x", tex,
+		  Buffer(source.data(), source.size()).checksum());
+    String dir = latexRunDir(0, 1);
+    String base = dir + name;
+    useLatexFormat(dir, name);
+
+    if (Platform::fileExists(base + ".fmt")) {
+	converter->setFormat(name);
+	return;
+    }
+    if (Platform::fileExists(base + ".nofmt")) return; // failed before
+    if (Platform::howToDumpLatexFormat(engine, docname, name).empty()) return;
+    std::FILE * file = Platform::fopen((base + ".tex").z(), "wb");
+    if (!file) return;
+    std::fwrite(source.data(), 1, source.size(), file);
+    std::fclose(file);
+    std::remove((base + ".log").z());
+    converter->setFormat(name, true);
+}
+
+// Check the format made before the Latex run.  If it could not be
+// made, for instance because the preamble loads native fonts, it is
+// marked so that Ipe does not try again.
+static void checkLatexFormat(String name) {
+    String base = latexRunDir(0, 1) + name;
+    if (Platform::fileExists(base + ".fmt")
+	&& Platform::readFile(base + ".log").find("\n!") < 0)
+	return;
+    ipeDebug("Cannot create Latex format '%s'", name.z());
+    std::remove((base + ".fmt").z());
+    std::FILE * file = Platform::fopen((base + ".nofmt").z(), "wb");
+    if (file) std::fclose(file);
+}
+
+// Did Latex fail to start with the format of converter?  Then the
+// format file is removed, so that it will be created again.
+static bool latexFormatFailed(Latex * converter, int shards) {
+    String format = converter->format();
+    if (format.empty()) return false;
+    String log = Platform::readFile(latexRunDir(0, shards) + "ipetemp.log");
+    if (log.hasPrefix("This is ") || log.hasPrefix("entering extended mode"))
+	return false;
+    std::remove((latexRunDir(0, 1) + format + ".fmt").z());
+    return true;
+}
+
+//! Prepare running Latex on the text objects of the document.
+/*! Writes the Latex source file(s) and returns the converter object
+  through \a pConverter.  If \a shards is larger than one, the text
+  objects may be split over up to \a shards Latex runs (see
+  Latex::splitIntoShards()), each in its own subdirectory of the Latex
+  folder.  The caller must then run Latex in each of these
+  directories before calling completeLatexRun().
+
+  Unless the preamble specifies a format itself, the document
+  preamble is precompiled into a format file cached in the Latex
+  folder, which Latex then loads instead of processing the preamble
+  again.  If the format does not exist yet, it must be made before
+  running Latex, see Latex::formatToDump() and
+  Platform::howToRunLatex().  The directory of \a docname is searched
+  for files included by the preamble.  If the format cannot be made,
+  Latex processes the preamble as usual. */
+int Document::prepareLatexRun(Latex ** pConverter, int shards, String docname) {
     *pConverter = nullptr;
     std::unique_ptr<Latex> converter(
 	new Latex(cascade(), iProperties.iTexEngine, iProperties.iSequentialText));
@@ -551,79 +752,145 @@ int Document::prepareLatexRun(Latex ** pConverter) {
     } else if (count == 0)
 	return ErrNoText;
 
-    // First we need a directory
-    String latexDir = Platform::folder(FolderLatex);
-    if (Platform::mkdirTree(latexDir) != 0) {
-	ipeDebug("Latex directory '%s' does not exist and cannot be created!\n",
-		 latexDir.z());
-	return ErrNoDir;
-    }
-    latexDir += IPESEP;
-    String texFile = latexDir + "ipetemp.tex";
-    String pdfFile = latexDir + "ipetemp.pdf";
-    String logFile = latexDir + "ipetemp.log";
-
-    std::remove(logFile.z());
-    std::remove(pdfFile.z());
-
-    std::FILE * file = Platform::fopen(texFile.z(), "wb");
-    if (!file) return ErrWritingSource;
-    FileStream stream(file);
-    int err = converter->createLatexSource(stream, properties().iPreamble);
-    std::fclose(file);
-
-    if (err < 0) return ErrWritingSource;
+    shards = converter->splitIntoShards(shards);
+    for (int k = 0; k < shards; ++k) {
+	// First we need a directory
+	String latexDir = latexRunDir(k, shards);
+	if (Platform::mkdirTree(latexDir.left(latexDir.size() - 1)) != 0) {
+	    ipeDebug("Latex directory '%s' does not exist and cannot be created!\n",
+		     latexDir.z());
+	    return ErrNoDir;
+	}
+	if (k == 0)
+	    setLatexFormat(converter.get(), iProperties.iTexEngine, iProperties.iPreamble,
+			   docname);
+	String texFile = latexDir + "ipetemp.tex";
+	String pdfFile = latexDir + "ipetemp.pdf";
+	String logFile = latexDir + "ipetemp.log";
+
+	std::remove(logFile.z());
+	std::remove(pdfFile.z());
+
+	std::FILE * file = Platform::fopen(texFile.z(), "wb");
+	if (!file) return ErrWritingSource;
+	FileStream stream(file);
+	int err = converter->createLatexSource(stream, properties().iPreamble, k);
+	std::fclose(file);
+
+	if (err < 0) return ErrWritingSource;
+    }
 
     *pConverter = converter.release();
     return ErrNone;
 }
 
+//! Read the results of the Latex run(s) prepared by prepareLatexRun().
+/*! Takes ownership of \a converter.  Returns ErrLatexFormat if
+  Latex could not load the cached format, for instance because it was
+  made by an older Latex.  The format has then been removed, and
+  preparing and running Latex again will succeed. */
 int Document::completeLatexRun(String & texLog, Latex * converter) {
-    texLog = "";
-    String pdfFile = Platform::folder(FolderLatex, "ipetemp.pdf");
-    String logFile = Platform::folder(FolderLatex, "ipetemp.log");
-
-    // Check log file for Pdflatex version and errors
-    texLog = Platform::readFile(logFile);
-    if (!texLog.hasPrefix("This is ") && !texLog.hasPrefix("entering extended mode"))
-	return ErrRunLatex;
-    int i = texLog.find('\n');
-    if (i < 0) return ErrRunLatex;
-    String version = texLog.substr(8, i);
-    ipeDebug("%s", version.z());
-    // Check for error
-    if (texLog.find("\n!") >= 0) return ErrLatex;
-
-    std::FILE * pdfF = Platform::fopen(pdfFile.z(), "rb");
-    if (!pdfF) return ErrLatex;
-    FileSource source(pdfF);
-    bool okay = converter->readPdf(source);
-    std::fclose(pdfF);
-    if (!okay) return ErrLatexOutput;
-
-    okay = converter->updateTextObjects();
+    std::unique_ptr<Latex> owner(converter);
+    if (!converter->formatToDump().empty()) checkLatexFormat(converter->formatToDump());
+    int shards = converter->shards();
+    for (int k = 0; k < shards; ++k) {
+	texLog = "";
+	String pdfFile = latexRunDir(k, shards) + "ipetemp.pdf";
+	String logFile = latexRunDir(k, shards) + "ipetemp.log";
+
+	// Check log file for Pdflatex version and errors
+	texLog = Platform::readFile(logFile);
+	if (!texLog.hasPrefix("This is ")
+	    && !texLog.hasPrefix("entering extended mode")) {
+	    return latexFormatFailed(converter, shards) ? ErrLatexFormat : ErrRunLatex;
+	}
+	int i = texLog.find('\n');
+	if (i < 0) return ErrRunLatex;
+	String version = texLog.substr(8, i);
+	if (k == 0) ipeDebug("%s", version.z());
+	// Check for error
+	if (texLog.find("\n!") >= 0) return ErrLatex;
+
+	std::FILE * pdfF = Platform::fopen(pdfFile.z(), "rb");
+	if (!pdfF) return ErrLatex;
+	FileSource source(pdfF);
+	bool okay = converter->readPdf(source, k);
+	std::fclose(pdfF);
+	if (!okay) return ErrLatexOutput;
+    }
+
+    bool okay = converter->updateTextObjects();
     if (okay) {
 	setResources(converter->takeResources());
 	// resources()->show();
     }
-    delete converter;
     return okay ? ErrNone : ErrLatexOutput;
 }
 
-int Document::runLatex(String docname, String & texLog) {
-    Latex * converter = nullptr;
-    int err = prepareLatexRun(&converter);
-    if (err) return err;
-    String cmd = Platform::howToRunLatex(iProperties.iTexEngine, docname);
-    if (cmd.empty() || Platform::system(cmd)) return ErrRunLatex;
-    return completeLatexRun(texLog, converter);
+/*! If \a shards is larger than one, large documents are typeset by up
+  to \a shards Latex processes running in parallel, unless Latex runs
+  in the cloud.  Each process embeds its own subsets of the fonts, so
+  this should only be used when the document is not saved as PDF
+  afterwards, for instance to render it to bitmaps. */
+int Document::runLatex(String docname, String & texLog, int shards) {
+    String url = Platform::readFile(Platform::folder(FolderLatex, "url1.txt"));
+    if (url.left(4) == "http") shards = 1;
+    // a cached format may have been made by an older Latex, then try again
+    for (int attempt = 0;; ++attempt) {
+	Latex * converter = nullptr;
+	int err = prepareLatexRun(&converter, shards, docname);
+	if (err) return err;
+	int n = converter->shards();
+	std::vector<String> names(n), keys(n);
+	std::vector<char> cached(n, false);
+	if (!latexCacheDir.empty()) {
+	    for (int k = 0; k < n; ++k) {
+		String dir = latexRunDir(k, n);
+		keys[k] = latexCacheKey(dir, iProperties.iTexEngine, docname, names[k]);
+		cached[k] = fetchLatexRun(dir, names[k], keys[k]);
+	    }
+	}
+	// all Latex runs need the format, so it is made first
+	String format = converter->formatToDump();
+	if (!format.empty())
+	    Platform::system(
+		Platform::howToDumpLatexFormat(iProperties.iTexEngine, docname, format));
+	parallelFor(n, n, [&](int, int begin, int) {
+	    if (cached[begin]) return;
+	    String cmd = Platform::howToRunLatex(iProperties.iTexEngine, docname,
+						 latexRunDir(begin, n));
+	    if (!cmd.empty()) Platform::system(cmd);
+	});
+	err = completeLatexRun(texLog, converter);
+	if (err == ErrNone && !latexCacheDir.empty()) {
+	    for (int k = 0; k < n; ++k)
+		if (!cached[k]) storeLatexRun(latexRunDir(k, n), names[k], keys[k]);
+	}
+	if (err != ErrLatexFormat) return err;
+	if (attempt > 0) return ErrRunLatex;
+    }
+}
+
+//! Keep the results of the Latex runs made by runLatex() in directory \a dir.
+/*! When a document is typeset with the same preamble, the same texts,
+  and the same engine as an earlier document in the same directory,
+  the earlier result is used instead of running Latex again.  The
+  directory may be shared by several processes.  Changes to files that
+  the texts include are not noticed, so this is meant for batch
+  conversions.  An empty \a dir switches the cache off (the default). */
+void Document::setLatexCache(String dir) {
+    if (!dir.empty() && Platform::mkdirTree(dir) == 0) {
+	latexCacheDir = dir;
+	latexCacheDir += IPESEP;
+    } else
+	latexCacheDir = String();
 }
 
 //! Run Pdflatex (suitable for console applications)
 /*! Success/error is reported on stderr. */
-int Document::runLatex(String docname) {
+int Document::runLatex(String docname, int shards) {
     String logFile;
-    switch (runLatex(docname, logFile)) {
+    switch (runLatex(docname, logFile, shards)) {
     case ErrNoText:
 	fprintf(stderr, "No text objects in document, no need to run Pdflatex.\n");
 	return 0;
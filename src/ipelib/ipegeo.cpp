@@ -50,6 +50,11 @@ const double BEZIER_INTERSECT_PRECISION = 1.0;
 
 #include "ipegeo.h"
 
+#include <cfloat>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using namespace ipe;
 
 inline double sq(double x) { return x * x; }
@@ -403,6 +408,140 @@ bool Segment::snap(const Vector & mouse, Vector & pos, double & bound) const {
 
 // --------------------------------------------------------------------
 
+/*! \class ipe::Polyline
+  \ingroup geo
+  \brief A sequence of points, stored as separate coordinate arrays.
+
+  This is used to answer nearest-vertex and nearest-segment queries
+  for many points at once, such as for the long polygonal chains of
+  plots and maps.  The coordinates are stored in separate arrays so
+  that the queries can process two points at once using SSE2 on x86
+  processors.  On other processors a plain loop is used.
+
+  The queries compare squared distances computed in the fastest way.
+  The caller should compute the exact distance to the point or segment
+  found, for instance using Segment::distance().
+*/
+
+//! Find the point nearest to \a v.
+/*! Returns its index and sets \a sqDist to its squared distance,
+  or returns -1 if there are no points.  Of several nearest points,
+  the first one is returned. */
+int Polyline::nearestVertex(const Vector & v, double & sqDist) const {
+    const int n = size();
+    const double * x = iX.data();
+    const double * y = iY.data();
+    double best = DBL_MAX;
+    int bestIndex = -1;
+    int i = 0;
+#ifdef __SSE2__
+    if (n >= 4) {
+	const __m128d vx = _mm_set1_pd(v.x);
+	const __m128d vy = _mm_set1_pd(v.y);
+	const __m128d two = _mm_set1_pd(2.0);
+	__m128d index = _mm_set_pd(1.0, 0.0);
+	__m128d minD = _mm_set1_pd(DBL_MAX);
+	__m128d minI = _mm_set1_pd(-1.0);
+	for (; i + 2 <= n; i += 2) {
+	    __m128d dx = _mm_sub_pd(_mm_loadu_pd(x + i), vx);
+	    __m128d dy = _mm_sub_pd(_mm_loadu_pd(y + i), vy);
+	    __m128d d = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+	    __m128d less = _mm_cmplt_pd(d, minD);
+	    minD = _mm_or_pd(_mm_and_pd(less, d), _mm_andnot_pd(less, minD));
+	    minI = _mm_or_pd(_mm_and_pd(less, index), _mm_andnot_pd(less, minI));
+	    index = _mm_add_pd(index, two);
+	}
+	double d[2], k[2];
+	_mm_storeu_pd(d, minD);
+	_mm_storeu_pd(k, minI);
+	int lane = (d[1] < d[0] || (d[1] == d[0] && k[1] < k[0])) ? 1 : 0;
+	if (k[lane] >= 0.0) {
+	    best = d[lane];
+	    bestIndex = int(k[lane]);
+	}
+    }
+#endif
+    for (; i < n; ++i) {
+	double d = sq(x[i] - v.x) + sq(y[i] - v.y);
+	if (d < best) {
+	    best = d;
+	    bestIndex = i;
+	}
+    }
+    sqDist = best;
+    return bestIndex;
+}
+
+//! Find the segment nearest to \a v.
+/*! Segment i connects points i and i + 1.  Returns the index of the
+  nearest segment and sets \a sqDist to its squared distance, or
+  returns -1 if there are less than two points. */
+int Polyline::nearestSegment(const Vector & v, double & sqDist) const {
+    const int n = size() - 1;
+    const double * x = iX.data();
+    const double * y = iY.data();
+    double best = DBL_MAX;
+    int bestIndex = -1;
+    int i = 0;
+#ifdef __SSE2__
+    if (n >= 4) {
+	const __m128d vx = _mm_set1_pd(v.x);
+	const __m128d vy = _mm_set1_pd(v.y);
+	const __m128d zero = _mm_setzero_pd();
+	const __m128d one = _mm_set1_pd(1.0);
+	const __m128d tiny = _mm_set1_pd(DBL_MIN);
+	const __m128d two = _mm_set1_pd(2.0);
+	__m128d index = _mm_set_pd(1.0, 0.0);
+	__m128d minD = _mm_set1_pd(DBL_MAX);
+	__m128d minI = _mm_set1_pd(-1.0);
+	for (; i + 2 <= n; i += 2) {
+	    __m128d px = _mm_loadu_pd(x + i);
+	    __m128d py = _mm_loadu_pd(y + i);
+	    __m128d dx = _mm_sub_pd(_mm_loadu_pd(x + i + 1), px);
+	    __m128d dy = _mm_sub_pd(_mm_loadu_pd(y + i + 1), py);
+	    __m128d wx = _mm_sub_pd(vx, px);
+	    __m128d wy = _mm_sub_pd(vy, py);
+	    __m128d len = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+	    __m128d t = _mm_div_pd(_mm_add_pd(_mm_mul_pd(wx, dx), _mm_mul_pd(wy, dy)),
+				   _mm_max_pd(len, tiny));
+	    t = _mm_min_pd(_mm_max_pd(t, zero), one);
+	    __m128d ex = _mm_sub_pd(wx, _mm_mul_pd(t, dx));
+	    __m128d ey = _mm_sub_pd(wy, _mm_mul_pd(t, dy));
+	    __m128d d = _mm_add_pd(_mm_mul_pd(ex, ex), _mm_mul_pd(ey, ey));
+	    __m128d less = _mm_cmplt_pd(d, minD);
+	    minD = _mm_or_pd(_mm_and_pd(less, d), _mm_andnot_pd(less, minD));
+	    minI = _mm_or_pd(_mm_and_pd(less, index), _mm_andnot_pd(less, minI));
+	    index = _mm_add_pd(index, two);
+	}
+	double d[2], k[2];
+	_mm_storeu_pd(d, minD);
+	_mm_storeu_pd(k, minI);
+	int lane = (d[1] < d[0] || (d[1] == d[0] && k[1] < k[0])) ? 1 : 0;
+	if (k[lane] >= 0.0) {
+	    best = d[lane];
+	    bestIndex = int(k[lane]);
+	}
+    }
+#endif
+    for (; i < n; ++i) {
+	double dx = x[i + 1] - x[i];
+	double dy = y[i + 1] - y[i];
+	double wx = v.x - x[i];
+	double wy = v.y - y[i];
+	double t = (wx * dx + wy * dy) / max(dx * dx + dy * dy, DBL_MIN);
+	t = min(max(t, 0.0), 1.0);
+	double d = sq(wx - t * dx) + sq(wy - t * dy);
+	if (d < best) {
+	    best = d;
+	    bestIndex = i;
+	}
+    }
+    sqDist = best;
+    return bestIndex;
+}
+
+// --------------------------------------------------------------------
+
 /*! \class ipe::Linear
   \ingroup geo
   \brief Linear transformation in the plane (2x2 matrix).
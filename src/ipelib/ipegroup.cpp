@@ -43,6 +43,10 @@ using namespace ipe;
   be used like any Ipe object.
 
   This is an application of the "Composite" pattern.
+
+  The components are shared between copies of a group, using an atomic
+  reference count, and are copied only when an attribute of the group
+  is changed.
 */
 
 //! Create empty group (objects can be added later).
@@ -74,34 +78,21 @@ Group::Group(const XmlAttributes & attr)
 Group::Group(const Group & rhs)
     : Object(rhs) {
     iImp = rhs.iImp;
-    iImp->iRefCount++;
+    iImp->iRefCount.fetch_add(1, std::memory_order_relaxed);
     iClip = rhs.iClip;
     iUrl = rhs.iUrl;
     iDecoration = rhs.iDecoration;
 }
 
 //! Destructor.
-Group::~Group() {
-    if (iImp->iRefCount == 1) {
-	for (List::iterator it = iImp->iObjects.begin(); it != iImp->iObjects.end();
-	     ++it) {
-	    delete *it;
-	    *it = nullptr;
-	}
-	delete iImp;
-    } else
-	iImp->iRefCount--;
-}
+Group::~Group() { release(iImp); }
 
 //! Assignment operator (constant-time).
 Group & Group::operator=(const Group & rhs) {
     if (this != &rhs) {
-	if (iImp->iRefCount == 1)
-	    delete iImp;
-	else
-	    iImp->iRefCount--;
+	rhs.iImp->iRefCount.fetch_add(1, std::memory_order_relaxed);
+	release(iImp);
 	iImp = rhs.iImp;
-	iImp->iRefCount++;
 	iClip = rhs.iClip;
 	iUrl = rhs.iUrl;
 	iDecoration = rhs.iDecoration;
@@ -335,6 +326,15 @@ void Group::detach() {
     iImp->iPinned = old->iPinned;
     for (const_iterator it = old->iObjects.begin(); it != old->iObjects.end(); ++it)
 	iImp->iObjects.push_back((*it)->clone());
+    release(old);
+}
+
+//! Drop a reference to \a imp, deleting it and its objects if it was the last one.
+void Group::release(Imp * imp) {
+    if (imp->iRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+	for (Object * obj : imp->iObjects) delete obj;
+	delete imp;
+    }
 }
 
 Attribute Group::getAttribute(Property prop) const noexcept {
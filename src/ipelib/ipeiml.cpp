@@ -35,6 +35,10 @@
 #include "ipepage.h"
 #include "ipereference.h"
 #include "ipestyle.h"
+#include "ipetrace.h"
+#include "ipeutils.h"
+
+#include <atomic>
 
 using namespace ipe;
 
@@ -67,8 +71,10 @@ ImlParser::ImlParser(DataSource & source)
 Buffer ImlParser::pdfStream(int /* objNum */) { return Buffer(); }
 
 //! Read a complete  document from IML stream.
-/*! Returns an error code. */
+/*! Returns an error code.  If Ipelib can use several threads (see
+  Platform::threadCount), the pages are parsed in parallel. */
 int ImlParser::parseDocument(Document & doc) {
+    IPE_TRACE_SPAN("ImlParser::parseDocument");
     Document::SProperties properties = doc.properties();
 
     String tag = parseToTag();
@@ -140,6 +146,11 @@ int ImlParser::parseDocument(Document & doc) {
 	tag = parseToTag();
     }
 
+    if (tag == "page" && Platform::threadCount() > 1) {
+	tag = parsePagesInParallel(doc);
+	if (tag.empty()) return ESyntaxError;
+    }
+
     while (tag == "page") {
 	// read one page
 	Page * page = new Page;
@@ -153,6 +164,105 @@ int ImlParser::parseDocument(Document & doc) {
     return ESuccess;
 }
 
+namespace {
+
+// Reads characters from a range of memory.
+class RangeSource : public DataSource {
+public:
+    RangeSource(const char * data, int size)
+	: iData(data)
+	, iSize(size)
+	, iPos(0) {}
+    virtual int getChar() override { return iPos < iSize ? uint8_t(iData[iPos++]) : EOF; }
+
+private:
+    const char * iData;
+    int iSize;
+    int iPos;
+};
+
+// Find the ranges of the <page> elements at the start of \a s.  Stops
+// at anything that is not a page, such as a comment or </ipe>, and
+// returns its offset.
+int findPages(const std::string & s, std::vector<std::pair<int, int>> & pages) {
+    size_t pos = 0;
+    for (;;) {
+	while (pos < s.size() && uint8_t(s[pos]) <= ' ') ++pos;
+	if (s.compare(pos, 5, "<page") || pos + 5 >= s.size()
+	    || !(uint8_t(s[pos + 5]) <= ' ' || s[pos + 5] == '>' || s[pos + 5] == '/'))
+	    break;
+	size_t end = s.find("</page>", pos);
+	if (end == std::string::npos) break;
+	end += 7;
+	pages.emplace_back(int(pos), int(end));
+	pos = end;
+    }
+    return int(pos);
+}
+
+} // namespace
+
+//! Parse the pages of the document on several threads.
+/*! On calling, stream must be just past the first \c page.  Reads
+  the rest of the stream, splits it into pages, and parses the pages
+  in parallel, each with its own parser.  If a page cannot be parsed
+  on its own (because the split was wrong), all pages are parsed
+  again serially, so the result is the same as with the serial parser.
+
+  Returns the tag following the last page, or an empty string after
+  a syntax error. */
+String ImlParser::parsePagesInParallel(Document & doc) {
+    IPE_TRACE_SPAN("ImlParser::parsePagesInParallel");
+    int start = iPos - 6; // offset of "<page"
+    std::string rest = "<page";
+    while (!eos()) {
+	rest += char(iCh);
+	getChar();
+    }
+    std::vector<std::pair<int, int>> ranges;
+    int trailer = findPages(rest, ranges);
+    std::vector<std::unique_ptr<Page>> pages(ranges.size());
+    std::atomic<bool> ok{true};
+    parallelFor(size(ranges), Platform::threadCount(), [&](int, int begin, int end) {
+	for (int i = begin; i < end && ok; ++i) {
+	    RangeSource source(rest.data() + ranges[i].first,
+			       ranges[i].second - ranges[i].first);
+	    ImlParser parser(source);
+	    parser.iBitmaps = iBitmaps;
+	    std::unique_ptr<Page> page(new Page);
+	    if (parser.parseToTag() == "page" && parser.parsePage(*page) && parser.eos())
+		pages[i] = std::move(page);
+	    else
+		ok = false;
+	}
+    });
+    if (!ok) return parseRemainingPages(doc, rest, start, 0);
+    for (auto & page : pages) doc.push_back(page.release());
+    return parseRemainingPages(doc, rest, start, trailer);
+}
+
+//! Parse pages serially from offset \a from in \a rest.
+/*! \a rest starts at offset \a start in the stream.  Returns the tag
+  following the last page, or an empty string after a syntax error. */
+String ImlParser::parseRemainingPages(Document & doc, const std::string & rest, int start,
+				      int from) {
+    RangeSource source(rest.data() + from, int(rest.size()) - from);
+    ImlParser parser(source);
+    parser.iBitmaps = iBitmaps;
+    String tag = parser.parseToTag();
+    while (tag == "page") {
+	Page * page = new Page;
+	doc.push_back(page);
+	if (!parser.parsePage(*page)) {
+	    tag = String();
+	    break;
+	}
+	tag = parser.parseToTag();
+    }
+    iPos = start + from + parser.parsePosition();
+    return tag;
+}
+
 //! Parse an Bitmap.
 /*! On calling, stream must be just past \c bitmap. */
 bool ImlParser::parseBitmap() {
@@ -0,0 +1,567 @@
+// --------------------------------------------------------------------
+// Journal of document edits
+// --------------------------------------------------------------------
+/*
+
+    This file is part of the extensible drawing editor Ipe.
+    Copyright (c) 1993-2024 Otfried Cheong
+
+    Ipe is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    As a special exception, you have permission to link Ipe with the
+    CGAL library and distribute executables, as long as you follow the
+    requirements of the Gnu General Public License in regard to all of
+    the software in the executable aside from CGAL.
+
+    Ipe is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+    or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+    License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ipe; if not, you can find it at
+    "http://www.gnu.org/copyleft/gpl.html", or write to the Free
+    Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include "ipejournal.h"
+#include "ipedoc.h"
+#include "ipeiml.h"
+#include "ipepage.h"
+#include "ipetrace.h"
+#include "ipeutils.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+
+using namespace ipe;
+
+// --------------------------------------------------------------------
+
+/*! \class ipe::Journal
+  \ingroup doc
+  \brief Append-only file of the edits made to a document since it was saved.
+
+  The journal starts from the document as it was loaded or saved, and
+  record() appends the changes made by each undoable action as one
+  transaction, flushed to disk immediately.  After a crash, recover()
+  applies all complete transactions to the document loaded from the
+  same file again.
+
+  Changes are found by comparing the content hashes of the objects,
+  which the page caches (see Page::objectHash()), with those recorded
+  before, so that recording an edit does not depend on the size of the
+  document.  Changes to the style sheets are noticed through
+  Cascade::version().  Only the fingerprint of the document written at
+  the start of the journal is computed from its XML representation.
+
+  A page record contains the page attributes and the objects that are
+  new, and says in which order the remaining objects are kept.  Pages
+  that are inserted, deleted, or moved are described by a permutation
+  of the pages.  When the style sheets or the document properties
+  change, the entire document is recorded instead.
+
+  Images refer to their bitmaps by a number assigned by the journal,
+  and each bitmap is written only once.
+
+  A journal holds an exclusive lock on the file with ".lock" appended
+  to its name, from lock() until close().  Another Ipe editing the same
+  document then can neither overwrite the journal nor recover it.
+*/
+
+namespace {
+
+constexpr int FORMAT = 1;
+
+void hashProperties(HashStream & hs, const Document * doc) {
+    Document::SProperties props = doc->properties();
+    for (const String & s :
+	 {props.iTitle, props.iAuthor, props.iSubject, props.iKeywords, props.iLanguage,
+	  props.iPreamble, props.iCreated, props.iModified, props.iCreator}) {
+	hs << s;
+	hs.putChar(0);
+    }
+    hs << int(props.iTexEngine) << int(props.iFullScreen) << int(props.iNumberPages)
+       << int(props.iSequentialText);
+}
+
+// hash of the properties
+uint64_t propertiesHash(const Document * doc) {
+    HashStream hs;
+    hashProperties(hs, doc);
+    return hs.hash();
+}
+
+// hash of properties and style sheets, the same in every session
+uint64_t docHash(const Document * doc) {
+    HashStream hs;
+    hashProperties(hs, doc);
+    doc->cascade()->saveAsXml(hs);
+    return hs.hash();
+}
+
+// read a number that is followed by the character sep
+bool number(const char *& p, long & value, char sep) {
+    char * q;
+    value = std::strtol(p, &q, 10);
+    if (q == p || *q != sep) return false;
+    p = q;
+    return true;
+}
+
+} // namespace
+
+// --------------------------------------------------------------------
+
+//! Create a journal that is not open.
+Journal::Journal()
+    : iFile(nullptr)
+    , iStyle(0)
+    , iProperties(0) {}
+
+//! Close the journal file, but do not remove it.
+Journal::~Journal() { close(); }
+
+//! Close the journal file, but do not remove it.
+/*! This also releases the lock. */
+void Journal::close() {
+    closeFile();
+    if (iLock) {
+	// remove the lock file while it is still ours: a FileLock that
+	// opened it before then tries again (on Windows this fails)
+	std::remove(iLockFile.z());
+	iLock.reset();
+    }
+}
+
+// Stop writing, but keep the lock.
+void Journal::closeFile() {
+    if (iFile) std::fclose(iFile);
+    iFile = nullptr;
+}
+
+//! Lock the journal file \a fname for this journal.
+/*! Returns false if another journal, possibly in another process,
+  holds the lock.  open() and recover() take the lock themselves, but
+  calling lock() first tells whether an existing journal file belongs
+  to a document that is still being edited. */
+bool Journal::lock(const char * fname) {
+    String lockFile = String(fname) + ".lock";
+    if (iLock && iLockFile == lockFile) return true;
+    close();
+    auto fl = std::make_unique<FileLock>(lockFile, false);
+    if (!fl->locked()) return false;
+    iLock = std::move(fl);
+    iLockFile = lockFile;
+    return true;
+}
+
+//! Start a new journal for \a doc.
+/*! The document must be in the state in which it was loaded from or
+  saved to its file.  An existing journal file is overwritten, unless
+  another journal holds its lock. */
+bool Journal::open(const char * fname, const Document * doc) {
+    IPE_TRACE_SPAN("Journal::open");
+    if (!lock(fname)) return false;
+    closeFile();
+    reset(doc);
+    iFile = Platform::fopen(fname, "wb");
+    if (!iFile) return false;
+    std::fprintf(iFile, "IpeJournal %d %016llx\n", FORMAT,
+		 (unsigned long long)fingerprint(doc));
+    if (std::fflush(iFile) != 0) {
+	closeFile();
+	return false;
+    }
+    return true;
+}
+
+//! Apply the journal in file \a fname to \a doc, and continue it.
+/*! The document must have been loaded from the file the journal was
+  started for.  Returns the number of edits applied, or a negative
+  value from RecoverErrors.  Transactions that were not completely
+  written are dropped.  If the result is not negative, the document
+  has been changed, and later edits can be recorded in the same journal
+  (unless it could not be opened for writing, see isOpen()).  The file
+  is left alone if another journal holds its lock.
+*/
+int Journal::recover(const char * fname, Document * doc) {
+    IPE_TRACE_SPAN("Journal::recover");
+    if (!lock(fname)) return ELocked;
+    closeFile();
+    String data = Platform::readFile(fname);
+    int version = 0;
+    int start = 0;
+    unsigned long long fp = 0;
+    if (data.empty()
+	|| std::sscanf(data.z(), "IpeJournal %d %llx%n", &version, &fp, &start) != 2
+	|| version != FORMAT || start >= data.size() || data[start] != '\n')
+	return ENoJournal;
+    ++start;
+    reset(doc);
+    if (fp != fingerprint(doc)) return EMismatch;
+
+    int end = start;
+    int count = replay(data, nullptr, end);
+    int applied = start;
+    if (replay(data.left(end), doc, applied) != count) return ECorrupt;
+
+    // continue after the last complete transaction
+    iStyle = doc->cascade()->version();
+    iProperties = propertiesHash(doc);
+    iPages.clear();
+    for (int i = 0; i < doc->countPages(); ++i) iPages.push_back(pageState(doc->page(i)));
+    std::fill(iWritten.begin(), iWritten.end(), true);
+    iFile = Platform::fopen(fname, "wb");
+    if (iFile && (std::fwrite(data.data(), 1, end, iFile) != size_t(end)
+		  || std::fflush(iFile) != 0))
+	closeFile();
+    return count;
+}
+
+//! Append the changes made to \a doc since the last record.
+/*! If the edit changed only page \a pno (counting from zero), only this
+  page is examined.  Returns false if the journal is not open or
+  could not be written. */
+bool Journal::record(const Document * doc, int pno) {
+    if (!iFile) return false;
+    IPE_TRACE_SPAN("Journal::record");
+    String out;
+    StringStream stream(out);
+    if (doc->cascade()->version() != iStyle || propertiesHash(doc) != iProperties) {
+	// style sheets or properties changed, save everything
+	String xml;
+	StringStream xs(xml);
+	doc->saveAsXml(xs);
+	stream << "F " << xml.size() << "\n" << xml << "\n";
+	reset(doc);
+    } else if (0 <= pno && pno < doc->countPages()
+	       && doc->countPages() == int(iPages.size())) {
+	PageState st = pageState(doc->page(pno));
+	writePage(stream, doc->page(pno), pno, iPages[pno], st);
+	iPages[pno] = std::move(st);
+    } else {
+	int n = doc->countPages();
+	// find unchanged pages, then pages changed in place
+	std::map<uint64_t, std::vector<int>> where;
+	for (int i = int(iPages.size()) - 1; i >= 0; --i)
+	    where[iPages[i].iHash].push_back(i);
+	std::vector<int> from(n, -1);
+	std::vector<bool> used(iPages.size(), false);
+	for (int i = 0; i < n; ++i) {
+	    auto it = where.find(doc->page(i)->contentHash());
+	    if (it != where.end() && !it->second.empty()) {
+		from[i] = it->second.back();
+		it->second.pop_back();
+		used[from[i]] = true;
+	    }
+	}
+	bool moved = (n != int(iPages.size()));
+	for (int i = 0; i < n; ++i) {
+	    if (from[i] < 0 && i < int(used.size()) && !used[i]) {
+		from[i] = i;
+		used[i] = true;
+	    }
+	    moved = moved || from[i] != i;
+	}
+	if (moved) {
+	    stream << "M " << n;
+	    for (int i = 0; i < n; ++i) stream << " " << from[i];
+	    stream << "\n";
+	}
+	PageState empty{0, 0, {}};
+	std::vector<PageState> states;
+	for (int i = 0; i < n; ++i) {
+	    const Page * page = doc->page(i);
+	    if (from[i] >= 0 && iPages[from[i]].iHash == page->contentHash()) {
+		states.push_back(std::move(iPages[from[i]]));
+	    } else {
+		states.push_back(pageState(page));
+		writePage(stream, page, i, from[i] < 0 ? empty : iPages[from[i]],
+			  states.back());
+	    }
+	}
+	iPages = std::move(states);
+    }
+    if (out.empty()) return true;
+    stream << "C\n";
+    if (std::fwrite(out.data(), 1, out.size(), iFile) != size_t(out.size())
+	|| std::fflush(iFile) != 0) {
+	closeFile();
+	return false;
+    }
+    return true;
+}
+
+// --------------------------------------------------------------------
+
+// Number the bitmaps of doc, and take its state.
+// A replay does the same when it starts and after a document record.
+void Journal::reset(const Document * doc) {
+    iBitmaps.clear();
+    iStyle = doc->cascade()->version();
+    iProperties = propertiesHash(doc);
+    iPages.clear();
+    for (int i = 0; i < doc->countPages(); ++i) {
+	BitmapFinder bm;
+	bm.scanPage(doc->page(i));
+	numberBitmaps(bm.iBitmaps);
+	iPages.push_back(pageState(doc->page(i)));
+    }
+    iWritten.assign(iBitmaps.size(), true);
+}
+
+// Hash of the XML representation of doc, after reset(doc).  Unlike
+// the state kept between records, it does not depend on the session.
+uint64_t Journal::fingerprint(const Document * doc) const {
+    uint64_t h = docHash(doc);
+    for (int i = 0; i < doc->countPages(); ++i) {
+	const Page * page = doc->page(i);
+	HashStream hs;
+	page->saveHeaderAsXml(hs);
+	uint64_t ph = hs.hash();
+	for (int j = 0; j < page->count(); ++j) {
+	    HashStream os;
+	    page->object(j)->saveAsXml(os, page->layer(page->layerOf(j)));
+	    ph = HashStream::mix(ph, os.hash());
+	}
+	h = HashStream::mix(h, ph);
+    }
+    return h;
+}
+
+// Set the objNum of the bitmaps to their journal id.
+void Journal::numberBitmaps(const std::vector<Bitmap> & bitmaps) {
+    for (const Bitmap & b : bitmaps) {
+	size_t i = 0;
+	while (i < iBitmaps.size() && !iBitmaps[i].equal(b)) ++i;
+	if (i == iBitmaps.size()) {
+	    iBitmaps.push_back(b);
+	    iWritten.push_back(false);
+	}
+	b.setObjNum(i + 1);
+    }
+}
+
+// The objects are compared by their hash cached on the page.
+Journal::PageState Journal::pageState(const Page * page) const {
+    PageState st;
+    st.iHash = page->contentHash();
+    HashStream hs;
+    page->saveHeaderAsXml(hs);
+    st.iHeader = hs.hash();
+    st.iObjects.reserve(page->count());
+    for (int i = 0; i < page->count(); ++i)
+	st.iObjects.push_back(HashStream::mix(page->objectHash(i), page->layerOf(i)));
+    return st;
+}
+
+// Write a record for the change from prev to cur, if there is one.
+void Journal::writePage(Stream & stream, const Page * page, int pno,
+			const PageState & prev, const PageState & cur) {
+    if (prev.iHeader == cur.iHeader && prev.iObjects == cur.iObjects) return;
+    // keep old objects with the same hash, in runs where possible
+    std::map<uint64_t, std::vector<int>> where;
+    for (int i = int(prev.iObjects.size()) - 1; i >= 0; --i)
+	where[prev.iObjects[i]].push_back(i);
+    String ops;
+    StringStream os(ops);
+    std::vector<int> fresh;
+    char kind = 0;
+    int first = 0, count = 0;
+    auto flush = [&]() {
+	if (kind == 'K')
+	    os << " K " << first << " " << count;
+	else if (kind == 'N')
+	    os << " N " << count;
+    };
+    for (int j = 0; j < int(cur.iObjects.size()); ++j) {
+	auto it = where.find(cur.iObjects[j]);
+	if (it != where.end() && !it->second.empty()) {
+	    int i = it->second.back();
+	    it->second.pop_back();
+	    if (kind == 'K' && first + count == i) {
+		++count;
+	    } else {
+		flush();
+		kind = 'K';
+		first = i;
+		count = 1;
+	    }
+	} else {
+	    fresh.push_back(j);
+	    if (kind == 'N') {
+		++count;
+	    } else {
+		flush();
+		kind = 'N';
+		count = 1;
+	    }
+	}
+    }
+    flush();
+
+    String xml;
+    StringStream xs(xml);
+    xs << "<ipepage>\n";
+    BitmapFinder bm;
+    for (int j : fresh) page->object(j)->accept(bm);
+    numberBitmaps(bm.iBitmaps);
+    for (const Bitmap & b : bm.iBitmaps) {
+	int id = b.objNum();
+	if (!iWritten[id - 1]) {
+	    b.saveAsXml(xs, id);
+	    iWritten[id - 1] = true;
+	}
+    }
+    page->saveHeaderAsXml(xs);
+    for (int j : fresh) page->object(j)->saveAsXml(xs, page->layer(page->layerOf(j)));
+    xs << "</page>\n</ipepage>\n";
+    stream << "P " << pno << " " << xml.size() << "\n" << xml << "O" << ops << "\n";
+}
+
+// --------------------------------------------------------------------
+
+// Replay the records of complete transactions, starting at offset end.
+// If doc is nullptr, the records are only checked.  Returns the number
+// of transactions, and sets end to the offset after the last one.
+// Returns -1 if a record could not be applied.
+int Journal::replay(const String & data, Document * doc, int & end) {
+    const char * base = data.z();
+    const char * last = base + data.size();
+    const char * p = base + end;
+    int count = 0;
+    while (last - p >= 2) {
+	char op = p[0];
+	if (op == 'C' && p[1] == '\n') {
+	    p += 2;
+	    end = p - base;
+	    ++count;
+	    continue;
+	}
+	if (p[1] != ' ') break;
+	++p;
+	long a, b;
+	if (op == 'F') {
+	    if (!number(++p, a, '\n') || a < 0 || last - ++p < a + 1 || p[a] != '\n')
+		break;
+	    if (doc) {
+		Buffer buffer(p, a);
+		BufferSource source(buffer);
+		int reason;
+		std::unique_ptr<Document> d(
+		    Document::load(source, FileFormat::Xml, reason));
+		if (!d) return -1;
+		delete doc->replaceCascade(d->replaceCascade(new Cascade));
+		doc->setProperties(d->properties());
+		while (doc->countPages() > 0) delete doc->remove(doc->countPages() - 1);
+		while (d->countPages() > 0) doc->push_back(d->remove(0));
+		reset(doc);
+	    }
+	    p += a + 1;
+	} else if (op == 'M') {
+	    std::vector<int> from;
+	    if (!number(++p, a, ' ') || a < 1) break;
+	    bool ok = true;
+	    for (long i = 0; ok && i < a; ++i) {
+		ok = number(++p, b, i + 1 < a ? ' ' : '\n');
+		from.push_back(b);
+	    }
+	    if (!ok) break;
+	    ++p;
+	    if (doc) {
+		int n = doc->countPages();
+		std::vector<bool> used(n, false);
+		for (int i : from) {
+		    if (i < -1 || i >= n || (i >= 0 && used[i])) return -1;
+		    if (i >= 0) used[i] = true;
+		}
+		std::vector<Page *> pages;
+		while (doc->countPages() > 0) pages.push_back(doc->remove(0));
+		for (int i : from) {
+		    doc->push_back(i >= 0 ? pages[i] : Page::basic());
+		    if (i >= 0) pages[i] = nullptr;
+		}
+		for (Page * page : pages) delete page;
+	    }
+	} else if (op == 'P') {
+	    if (!number(++p, a, ' ') || !number(++p, b, '\n') || b < 0
+		|| last - ++p < b + 2 || p[b] != 'O')
+		break;
+	    const char * xml = p;
+	    p += b + 1;
+	    const char * nl = static_cast<const char *>(std::memchr(p, '\n', last - p));
+	    if (!nl) break;
+	    if (doc && !applyPage(doc, a, xml, b, String(p, nl - p).z())) return -1;
+	    p = nl + 1;
+	} else
+	    break;
+    }
+    return count;
+}
+
+// Apply a page record.
+bool Journal::applyPage(Document * doc, int pno, const char * xml, int size,
+			const char * ops) {
+    if (pno < 0 || pno >= doc->countPages()) return false;
+    Buffer buffer(xml, size);
+    BufferSource source(buffer);
+    ImlParser parser(source);
+    for (size_t i = 0; i < iBitmaps.size(); ++i) {
+	if (iBitmaps[i].isNull()) continue;
+	iBitmaps[i].setObjNum(i + 1);
+	parser.addBitmap(iBitmaps[i]);
+    }
+    std::unique_ptr<Page> page(parser.parsePageSelection());
+    if (!page) return false;
+    BitmapFinder bm;
+    bm.scanPage(page.get());
+    for (const Bitmap & b : bm.iBitmaps) {
+	int id = b.objNum();
+	if (id < 1) return false;
+	if (id > int(iBitmaps.size())) {
+	    iBitmaps.resize(id);
+	    iWritten.resize(id, true);
+	}
+	iBitmaps[id - 1] = b;
+    }
+
+    // append the objects in their final order, then remove the new
+    // objects from the front
+    const Page * old = doc->page(pno);
+    int fresh = page->count();
+    int next = 0;
+    const char * p = ops;
+    while (*p == ' ') {
+	char op = *++p;
+	long a, b;
+	if (op == 'K' && number(p += 2, a, ' ')
+	    && (number(++p, b, ' ') || number(p, b, 0))) {
+	    if (a < 0 || b < 0 || a + b > old->count()) return false;
+	    for (long i = a; i < a + b; ++i) {
+		int layer = page->findLayer(old->layer(old->layerOf(i)));
+		if (layer < 0) return false;
+		page->append(ENotSelected, layer, old->object(i)->clone());
+	    }
+	} else if (op == 'N' && (number(p += 2, a, ' ') || number(p, a, 0))) {
+	    if (a < 0 || next + a > fresh) return false;
+	    for (long i = 0; i < a; ++i, ++next)
+		page->append(ENotSelected, page->layerOf(next),
+			     page->object(next)->clone());
+	} else
+	    return false;
+    }
+    if (*p || next != fresh) return false;
+    while (fresh > 0) page->remove(--fresh);
+    delete doc->set(pno, page.release());
+    return true;
+}
+
+// --------------------------------------------------------------------
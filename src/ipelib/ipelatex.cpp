@@ -31,6 +31,7 @@
 #include "ipegroup.h"
 #include "ipereference.h"
 #include "ipestyle.h"
+#include "ipetrace.h"
 
 #include "ipelatex.h"
 
@@ -38,6 +39,9 @@
 
 using namespace ipe;
 
+// the smallest number of text objects worth starting a separate Latex run for
+constexpr int MIN_SHARD_SIZE = 200;
+
 /*! \class ipe::Latex
   \brief Object that converts latex source to PDF format.
 
@@ -53,6 +57,8 @@ Latex::Latex(const Cascade * sheet, LatexType latexType, bool sequentialText) {
     iLatexType = latexType;
     iXetex = (latexType == LatexType::Xetex);
     iSequentialText = sequentialText;
+    iNewCount = 0;
+    iDumpFormat = false;
 }
 
 //! Destructor.
@@ -163,85 +169,16 @@ void Latex::addPageNumber(int pno, int vno, int npages, int nviews) {
     iResources->addPageNumber(pn);
 }
 
-/*! Create a Latex source file with all the text objects collected
-  before.  The client should have prepared a directory for the
-  Pdflatex run, and pass the name of the Latex source file to be
-  written by Latex.
-
-  Returns the number of text objects that did not yet have an XForm,
-  or a negative error code.
-*/
-int Latex::createLatexSource(Stream & stream, String preamble) {
-    int count = 0;
-    if (preamble.hasPrefix("%&")) {
-	int i = preamble.find('\n');
-	if (i < 0) {
-	    stream << preamble << "\n";
-	    preamble.erase();
-	} else {
-	    stream << preamble.left(i + 1);
-	    preamble = preamble.substr(i + 1);
-	}
-    }
-    stream << "\\nonstopmode\n";
-    if (!iXetex) {
-	// for parser testing: \\pdfobjcompresslevel2\\pdfminorversion5
-	stream << "\\expandafter\\ifx\\csname pdfobjcompresslevel\\endcsname"
-	       << "\\relax\\else\\pdfobjcompresslevel0\\fi\n";
-	if (iLatexType == LatexType::Luatex)
-	    // load luatex85 for new versions of Luatex
-	    stream << "\\expandafter\\ifx\\csname pdfcolorstack\\endcsname\\relax"
-		   << "\\RequirePackage{luatex85}\\fi\n";
-    }
-    stream << "\\documentclass{article}\n"
-	   << "\\newdimen\\ipefs\n"
-	   << "\\newcounter{ipePage}\\newcounter{ipeView}\n"
-	   << "\\newcounter{ipePages}\\newcounter{ipeViews}\n"
-	   << "\\newcommand{\\PageTitle}[1]{#1}\n"
-	   << "\\newcommand{\\ipesymbol}[4]{$\\bullet$}\n";
-    stream << "\\def\\ipedefinecolors#1{\\ipecolorpreamble{#1}"
-	      "\\let\\ipecolorpreamble\\relax}\n"
-	   << "\\def\\ipecolorpreamble#1{\\usepackage[#1]{xcolor}\n";
-    AttributeSeq colors;
-    iCascade->allNames(EColor, colors);
-    for (AttributeSeq::const_iterator it = colors.begin(); it != colors.end(); ++it) {
-	// only symbolic names (not black, white, void)
-	String name = it->string();
-	Color value = iCascade->find(EColor, *it).color();
-	if (value.isGray())
-	    stream << "\\definecolor{" << name << "}{gray}{" << value.iRed << "}\n";
-	else
-	    stream << "\\definecolor{" << name << "}{rgb}{" << value.iRed << ","
-		   << value.iGreen << "," << value.iBlue << "}\n";
-    }
-    stream << "}\n";
-    if (iXetex) {
-	stream << "\\def\\ipesetcolor#1#2#3{\\special{pdf:bc [#1 #2 #3]}}\n"
-	       << "\\def\\iperesetcolor{\\special{pdf:ec}}\n";
-    } else {
-	stream << "\\makeatletter\n"
-	       << "\\def\\ipesetcolor#1#2#3{\\def\\current@color{#1 #2 #3 rg #1 #2 #3 RG}"
-	       << "\\pdfcolorstack\\@pdfcolorstack push{\\current@color}}\n"
-	       << "\\def\\iperesetcolor{\\pdfcolorstack\\@pdfcolorstack pop}\n"
-	       << "\\makeatother\n";
-    }
-    stream << iCascade->findPreamble() << "\n"
-	   << preamble << "\n"
-	   << "\\ipedefinecolors{}\n"
-	   << "\\pagestyle{empty}\n"
-	   << "\\newcount\\bigpoint\\dimen0=0.01bp\\bigpoint=\\dimen0\n"
-	   << "\\begin{document}\n"
-	   << "\\begin{picture}(500,500)\n";
-
-    if (iXetex) stream << "\\special{pdf:obj @ipeforms []}\n";
-
-    // generate Latex source for each text object
+// Generate Latex source for each text object, and sort them unless
+// text is sequential (so that equal sources become adjacent).
+void Latex::createSources() {
+    iNewCount = 0;
     for (auto & it : iTextObjects) {
 	StringStream source(it.iSource);
 
 	const Text * text = it.iText;
 
-	if (!text->getXForm()) count++;
+	if (!text->getXForm()) ++iNewCount;
 
 	Attribute fsAttr = iCascade->find(ETextSize, it.iSize);
 
@@ -285,8 +222,139 @@ int Latex::createLatexSource(Stream & stream, String preamble) {
     if (!iSequentialText)
 	std::sort(iTextObjects.begin(), iTextObjects.end(),
 		  [](const SText & a, const SText & b) { return a.iSource < b.iSource; });
+    IPE_TRACE_COUNT("Latex text objects", iNewCount);
+}
 
+//! Split the text objects into at most \a shards parts for separate Latex runs.
+/*! Text objects with the same source end up in the same part.  Each
+  part has at least MIN_SHARD_SIZE different text objects, as starting
+  Latex takes time, so there may be fewer parts than requested.  With
+  sequential text there is always a single part.
+
+  Must be called before createLatexSource(), and returns the number of
+  parts.  The Latex source for part \a k is written by
+  createLatexSource(stream, preamble, k), and the resulting PDF must be
+  read with readPdf(source, k), in order of \a k.
+*/
+int Latex::splitIntoShards(int shards) {
+    createSources();
+    std::vector<int> unique;
     for (int i = 0; i < size(iTextObjects); ++i) {
+	if (iSequentialText || i == 0
+	    || iTextObjects[i].iSource != iTextObjects[i - 1].iSource)
+	    unique.push_back(i);
+    }
+    if (iSequentialText) shards = 1;
+    shards = std::max(1, std::min(shards, size(unique) / MIN_SHARD_SIZE));
+    iShardStart.clear();
+    for (int k = 0; k < shards; ++k) {
+	int first = int64_t(k) * size(unique) / shards;
+	iShardStart.push_back(unique.empty() ? 0 : unique[first]);
+    }
+    iShardStart.push_back(size(iTextObjects));
+    return shards;
+}
+
+// Write the preamble, from \documentclass to just before \begin{document}.
+void Latex::writePreamble(Stream & stream, String preamble) {
+    if (iLatexType == LatexType::Luatex)
+	// load luatex85 for new versions of Luatex
+	stream << "\\expandafter\\ifx\\csname pdfcolorstack\\endcsname\\relax"
+	       << "\\RequirePackage{luatex85}\\fi\n";
+    stream << "\\documentclass{article}\n"
+	   << "\\let\\ipeendpreamble\\relax\n"
+	   << "\\newdimen\\ipefs\n"
+	   << "\\newcounter{ipePage}\\newcounter{ipeView}\n"
+	   << "\\newcounter{ipePages}\\newcounter{ipeViews}\n"
+	   << "\\newcommand{\\PageTitle}[1]{#1}\n"
+	   << "\\newcommand{\\ipesymbol}[4]{$\\bullet$}\n";
+    stream << "\\def\\ipedefinecolors#1{\\ipecolorpreamble{#1}"
+	      "\\let\\ipecolorpreamble\\relax}\n"
+	   << "\\def\\ipecolorpreamble#1{\\usepackage[#1]{xcolor}\n";
+    AttributeSeq colors;
+    iCascade->allNames(EColor, colors);
+    for (AttributeSeq::const_iterator it = colors.begin(); it != colors.end(); ++it) {
+	// only symbolic names (not black, white, void)
+	String name = it->string();
+	Color value = iCascade->find(EColor, *it).color();
+	if (value.isGray())
+	    stream << "\\definecolor{" << name << "}{gray}{" << value.iRed << "}\n";
+	else
+	    stream << "\\definecolor{" << name << "}{rgb}{" << value.iRed << ","
+		   << value.iGreen << "," << value.iBlue << "}\n";
+    }
+    stream << "}\n";
+    if (iXetex) {
+	stream << "\\def\\ipesetcolor#1#2#3{\\special{pdf:bc [#1 #2 #3]}}\n"
+	       << "\\def\\iperesetcolor{\\special{pdf:ec}}\n";
+    } else {
+	stream << "\\makeatletter\n"
+	       << "\\def\\ipesetcolor#1#2#3{\\def\\current@color{#1 #2 #3 rg #1 #2 #3 RG}"
+	       << "\\pdfcolorstack\\@pdfcolorstack push{\\current@color}}\n"
+	       << "\\def\\iperesetcolor{\\pdfcolorstack\\@pdfcolorstack pop}\n"
+	       << "\\makeatother\n";
+    }
+    stream << iCascade->findPreamble() << "\n"
+	   << preamble << "\n"
+	   << "\\ipedefinecolors{}\n"
+	   << "\\pagestyle{empty}\n"
+	   << "\\newcount\\bigpoint\\dimen0=0.01bp\\bigpoint=\\dimen0\n";
+}
+
+//! Create the Latex source for a format file containing the preamble.
+/*! Latex with this format loaded processes the source created by
+  createLatexSource() with setFormat() much faster: Its
+  \\documentclass command skips the entire preamble, up to
+  \\ipeendpreamble.  If the format cannot be found, Latex uses its
+  standard format and processes the source normally.
+*/
+void Latex::createFormatSource(Stream & stream, String preamble) {
+    stream << "\\nonstopmode\n";
+    writePreamble(stream, preamble);
+    stream << "\\long\\def\\documentclass#1\\ipeendpreamble{}\n"
+	   << "\\dump\n";
+}
+
+/*! Create a Latex source file with all the text objects collected
+  before (or with the text objects of one part, see
+  splitIntoShards()).  The client should have prepared a directory for
+  the Pdflatex run, and pass the name of the Latex source file to be
+  written by Latex.
+
+  If a format has been set with setFormat(), the source asks Latex to
+  load it (see createFormatSource()).
+
+  Returns the number of text objects that did not yet have an XForm,
+  or a negative error code.
+*/
+int Latex::createLatexSource(Stream & stream, String preamble, int shard) {
+    IPE_TRACE_SPAN("Latex::createLatexSource");
+    if (iShardStart.empty()) splitIntoShards(1);
+    if (preamble.hasPrefix("%&")) {
+	int i = preamble.find('\n');
+	if (i < 0) {
+	    stream << preamble << "\n";
+	    preamble.erase();
+	} else {
+	    stream << preamble.left(i + 1);
+	    preamble = preamble.substr(i + 1);
+	}
+    } else if (!iFormat.empty())
+	stream << "%&" << iFormat << "\n";
+    stream << "\\nonstopmode\n";
+    if (!iXetex) {
+	// for parser testing: \\pdfobjcompresslevel2\\pdfminorversion5
+	stream << "\\expandafter\\ifx\\csname pdfobjcompresslevel\\endcsname"
+	       << "\\relax\\else\\pdfobjcompresslevel0\\fi\n";
+    }
+    writePreamble(stream, preamble);
+    stream << "\\ipeendpreamble\n"
+	   << "\\begin{document}\n"
+	   << "\\begin{picture}(500,500)\n";
+
+    if (iXetex) stream << "\\special{pdf:obj @ipeforms []}\n";
+
+    for (int i = iShardStart[shard]; i < iShardStart[shard + 1]; ++i) {
 	auto & it = iTextObjects[i];
 	if (!iSequentialText && i > 0 && it.iSource == iTextObjects[i - 1].iSource)
 	    continue;
@@ -319,10 +387,11 @@ int Latex::createLatexSource(Stream & stream, String preamble) {
 	stream << "\\special{pdf:close @ipeforms}\n"
 	       << "\\special{pdf:put @resources << /Ipe @ipeforms >>}\n";
     stream << "\\end{document}\n";
-    return count;
+    return iNewCount;
 }
 
-bool Latex::getXForm(String key, const PdfDict * ipeInfo) {
+bool Latex::getXForm(String key, const PdfDict * ipeInfo, const PdfFile & pdf,
+		     int offset) {
     /*
        /Type /XObject
        /Subtype /Form
@@ -340,7 +409,7 @@ bool Latex::getXForm(String key, const PdfDict * ipeInfo) {
 	iXetex ? ipeInfo->get("IpeXForm") : iResources->findResource("XObject", key);
     int xformNum = -1;
     if (xform && xform->ref()) {
-	xformNum = xform->ref()->value();
+	xformNum = xform->ref()->value() + offset;
 	xform = iResources->object(xformNum);
     }
     if (!xform || !xform->dict()) return false;
@@ -361,22 +430,22 @@ bool Latex::getXForm(String key, const PdfDict * ipeInfo) {
 	ipeInfo = xformd;
     }
     // Get  id
-    int ipeId = ipeInfo->getInteger("IpeId", &iPdf);
-    int ipeDepth = ipeInfo->getInteger("IpeDepth", &iPdf);
+    int ipeId = ipeInfo->getInteger("IpeId", &pdf);
+    int ipeDepth = ipeInfo->getInteger("IpeDepth", &pdf);
     if (ipeId < 0 || ipeDepth < 0) return false;
-    xf->iRefCount = ipeId; // abusing refcount field
+    xf->iIpeId = ipeId;
     xf->iDepth = ipeDepth;
     double val;
-    if (!ipeInfo->getNumber("IpeStretch", val, &iPdf)) return false;
+    if (!ipeInfo->getNumber("IpeStretch", val, &pdf)) return false;
     xf->iStretch = val;
 
     // Get BBox
     std::vector<double> a;
-    if (!xformd->getNumberArray("BBox", &iPdf, a) || a.size() != 4) return false;
+    if (!xformd->getNumberArray("BBox", &pdf, a) || a.size() != 4) return false;
     xf->iBBox.addPoint(Vector(a[0], a[1]));
     xf->iBBox.addPoint(Vector(a[2], a[3]));
 
-    if (!xformd->getNumberArray("Matrix", &iPdf, a) || a.size() != 6) return false;
+    if (!xformd->getNumberArray("Matrix", &pdf, a) || a.size() != 6) return false;
     if (a[0] != 1.0 || a[1] != 0.0 || a[2] != 0.0 || a[3] != 1.0) {
 	ipeDebug("PDF XObject has a non-trivial transformation");
 	return false;
@@ -387,37 +456,49 @@ bool Latex::getXForm(String key, const PdfDict * ipeInfo) {
 
 //! Read the PDF file created by Pdflatex.
 /*! Must have performed the call to Pdflatex, and pass the name of the
-  resulting output file.
+  resulting output file.  If the text objects were split into several
+  parts, this must be called for each part in order.
 */
-bool Latex::readPdf(DataSource & source) {
-    if (!iPdf.parse(source)) {
+bool Latex::readPdf(DataSource & source, int shard) {
+    IPE_TRACE_SPAN("Latex::readPdf");
+    PdfFile pdf;
+    if (!pdf.parse(source)) {
 	warn("Ipe cannot parse the PDF file produced by Pdflatex.");
 	return false;
     }
 
-    const PdfDict * page1 = iPdf.page();
+    // objects and names of later parts must not clash with earlier ones
+    int offset = 0;
+    String suffix;
+    if (shard > 0) {
+	offset = iResources->nextObjectNumber();
+	StringStream ss(suffix);
+	ss << "-" << shard;
+    }
+
+    const PdfDict * page1 = pdf.page();
 
-    const PdfObj * res = page1->get("Resources", &iPdf);
+    const PdfObj * res = page1->get("Resources", &pdf);
     if (!res || !res->dict()) return false;
 
-    if (!iResources->collect(res->dict(), &iPdf)) return false;
+    if (!iResources->collect(res->dict(), &pdf, offset, suffix)) return false;
 
     if (iXetex) {
-	const PdfObj * obj = res->dict()->get("Ipe", &iPdf);
+	const PdfObj * obj = res->dict()->get("Ipe", &pdf);
 	if (!obj || !obj->array()) {
 	    warn("Page 1 has no /Ipe link.");
 	    return false;
 	}
 	for (int i = 0; i < obj->array()->count(); i++) {
-	    const PdfObj * info = obj->array()->obj(i, &iPdf);
+	    const PdfObj * info = obj->array()->obj(i, &pdf);
 	    if (!info || !info->dict()) return false;
 	    const PdfObj * ref = info->dict()->get("IpeXForm");
 	    if (!ref || !ref->ref()) return false;
-	    iResources->setIpeXForm(ref->ref()->value());
-	    if (!getXForm(String(), info->dict())) return false;
+	    iResources->setIpeXForm(ref->ref()->value() + offset);
+	    if (!getXForm(String(), info->dict(), pdf, offset)) return false;
 	}
     } else {
-	const PdfObj * obj = res->dict()->get("XObject", &iPdf);
+	const PdfObj * obj = res->dict()->get("XObject", &pdf);
 	if (!obj || !obj->dict()) {
 	    warn("Page 1 has no XForms.");
 	    return false;
@@ -426,8 +507,8 @@ bool Latex::readPdf(DataSource & source) {
 	for (int i = 0; i < xo->count(); i++) {
 	    String key = xo->key(i);
 	    if (!xo->value(i)->ref()) return false;
-	    iResources->setIpeXForm(xo->value(i)->ref()->value());
-	    if (!getXForm(key, nullptr)) return false;
+	    iResources->setIpeXForm(xo->value(i)->ref()->value() + offset);
+	    if (!getXForm(key + suffix, nullptr, pdf, offset)) return false;
 	}
     }
     // iResources->show();
@@ -439,7 +520,7 @@ bool Latex::readPdf(DataSource & source) {
 bool Latex::updateTextObjects() {
     std::sort(iXForms.begin(), iXForms.end(),
 	      [](const Text::XForm * a, const Text::XForm * b) {
-		  return a->iRefCount < b->iRefCount;
+		  return a->iIpeId < b->iIpeId;
 	      });
 
     int curXForm = 0;
@@ -450,7 +531,7 @@ bool Latex::updateTextObjects() {
 	    if (xf == nullptr) return false;
 	    iTextObjects[i].iText->setXForm(xf);
 	} else {
-	    if (i + 1 != iXForms[curXForm]->iRefCount) return false;
+	    if (i + 1 != iXForms[curXForm]->iIpeId) return false;
 	    xf = iXForms[curXForm];
 	    iXForms[curXForm] = nullptr;
 	    xf->iRefCount = 0;
@@ -127,6 +127,7 @@
 #include "ipeobject.h"
 #include "ipegeo.h"
 #include "ipepainter.h"
+#include "ipeutils.h"
 
 using namespace ipe;
 
@@ -320,6 +321,26 @@ void Object::setCustom(Attribute value) {
 //! Return value of the 'custom' attribute
 Attribute Object::getCustom() const noexcept { return iCustom; }
 
+//! Return a 64-bit hash of the contents of the object.
+/*! The hash is computed from the XML representation of the object and
+  the data of the bitmaps of its images.  Objects with the same hash
+  can be assumed to be equal.  (As the XML representation refers to
+  bitmaps by their object number, equal images may have different
+  hashes.)  Page caches the hash of its objects, see
+  Page::objectHash(). */
+uint64_t Object::contentHash() const {
+    HashStream stream;
+    saveAsXml(stream, String());
+    uint64_t h = stream.hash();
+    BitmapFinder bm;
+    accept(bm);
+    for (const Bitmap & b : bm.iBitmaps) {
+	h = HashStream::mix(h, b.checksum());
+	h = HashStream::mix(h, (uint64_t(b.width()) << 32) | uint32_t(b.height()));
+    }
+    return h;
+}
+
 // --------------------------------------------------------------------
 
 //! Check all symbolic attributes.
@@ -35,6 +35,8 @@
 #include "ipereference.h"
 #include "ipeutils.h"
 
+#include <mutex>
+
 using namespace ipe;
 
 // --------------------------------------------------------------------
@@ -96,6 +98,23 @@ Page * Page::basic() {
 
 //! save page in XML format.
 void Page::saveAsXml(Stream & stream) const {
+    saveHeaderAsXml(stream);
+    int currentLayer = -1;
+    for (ObjSeq::const_iterator it = iObjects.begin(); it != iObjects.end(); ++it) {
+	String l;
+	if (it->iLayer != currentLayer) {
+	    currentLayer = it->iLayer;
+	    l = layer(currentLayer);
+	}
+	it->iObject->saveAsXml(stream, l);
+    }
+    stream << "</page>\n";
+}
+
+//! save page attributes, notes, layers, and views in XML format.
+/*! This opens the \c page element, the caller saves the objects and
+  closes the element. */
+void Page::saveHeaderAsXml(Stream & stream) const {
     stream << "<page";
     if (!title().empty()) {
 	stream << " title=\"";
@@ -166,16 +185,6 @@ void Page::saveAsXml(Stream & stream) const {
 	    stream << "</view>\n";
 	}
     }
-    int currentLayer = -1;
-    for (ObjSeq::const_iterator it = iObjects.begin(); it != iObjects.end(); ++it) {
-	String l;
-	if (it->iLayer != currentLayer) {
-	    currentLayer = it->iLayer;
-	    l = layer(currentLayer);
-	}
-	it->iObject->saveAsXml(stream, l);
-    }
-    stream << "</page>\n";
 }
 
 // --------------------------------------------------------------------
@@ -187,19 +196,29 @@ Page::SLayer::SLayer(String name) {
 }
 
 //! Set free data field of the layer.
-void Page::setLayerData(int index, String data) { iLayers[index].iData = data; }
+void Page::setLayerData(int index, String data) {
+    iLayers[index].iData = data;
+    invalidateHashes();
+}
 
 //! Set locking of layer \a i.
-void Page::setLocked(int i, bool flag) { iLayers[i].locked = flag; }
+void Page::setLocked(int i, bool flag) {
+    iLayers[i].locked = flag;
+    invalidateHashes();
+}
 
 //! Set snapping of layer \a i.
-void Page::setSnapping(int i, SnapMode mode) { iLayers[i].snapMode = mode; }
+void Page::setSnapping(int i, SnapMode mode) {
+    iLayers[i].snapMode = mode;
+    invalidateHashes();
+}
 
 //! Add a new layer.
 void Page::addLayer(String name) {
     iLayers.push_back(SLayer(name));
     iLayers.back().iVisible.resize(countViews());
     for (int i = 0; i < countViews(); ++i) iLayers.back().iVisible[i] = false;
+    invalidateHashes();
 }
 
 //! Find layer with given name.
@@ -257,6 +276,7 @@ void Page::moveLayer(int index, int newIndex) {
 	}
 	it->iLayer = k;
     }
+    invalidateHashes();
 }
 
 //! Rearranges the order of all layers in the layer list.
@@ -276,6 +296,7 @@ void Page::reorderLayers(const std::vector<String> & order) {
     for (ObjSeq::iterator it = iObjects.begin(); it != iObjects.end(); ++it) {
 	it->iLayer = mapping[it->iLayer];
     }
+    invalidateHashes();
 }
 
 //! Removes an empty layer from the page.
@@ -291,6 +312,7 @@ void Page::removeLayer(String name) {
 	if (k > index) it->iLayer = k - 1;
     }
     iLayers.erase(iLayers.begin() + index);
+    invalidateHashes();
 }
 
 //! Return number of objects in each layer
@@ -305,6 +327,7 @@ void Page::renameLayer(String oldName, String newName) {
     int l = findLayer(oldName);
     if (l < 0) return;
     iLayers[l].iName = newName;
+    invalidateHashes();
 }
 
 //! Returns a precise bounding box for the artwork on the page.
@@ -361,12 +384,14 @@ bool Page::objSnapsInView(int objNo, int view) const noexcept {
 void Page::setEffect(int index, Attribute sym) {
     assert(sym.isSymbolic());
     iViews[index].iEffect = sym;
+    invalidateHashes();
 }
 
 //! Set active layer of view.
 void Page::setActive(int index, String layer) {
     assert(findLayer(layer) >= 0);
     iViews[index].iActive = layer;
+    invalidateHashes();
 }
 
 //! Set visibility of layer \a layer in view \a view.
@@ -374,6 +399,7 @@ void Page::setVisible(int view, String layer, bool vis) {
     int index = findLayer(layer);
     assert(index >= 0);
     iLayers[index].iVisible[view] = vis;
+    invalidateHashes();
 }
 
 //! Insert a new view at index \a i.
@@ -383,6 +409,7 @@ void Page::insertView(int i, String active) {
     iViews[i].iMarked = false;
     for (int l = 0; l < countLayers(); ++l)
 	iLayers[l].iVisible.insert(iLayers[l].iVisible.begin() + i, false);
+    invalidateHashes();
 }
 
 //! Remove the view at index \a i.
@@ -390,6 +417,7 @@ void Page::removeView(int i) {
     iViews.erase(iViews.begin() + i);
     for (int l = 0; l < countLayers(); ++l)
 	iLayers[l].iVisible.erase(iLayers[l].iVisible.begin() + i);
+    invalidateHashes();
 }
 
 //! Remove all views of this page.
@@ -397,9 +425,13 @@ void Page::clearViews() {
     iViews.clear();
     for (LayerSeq::iterator it = iLayers.begin(); it != iLayers.end(); ++it)
 	it->iVisible.clear();
+    invalidateHashes();
 }
 
-void Page::setMarkedView(int index, bool marked) { iViews[index].iMarked = marked; }
+void Page::setMarkedView(int index, bool marked) {
+    iViews[index].iMarked = marked;
+    invalidateHashes();
+}
 
 int Page::countMarkedViews() const {
     int count = 0;
@@ -451,6 +483,7 @@ void Page::setLayerMatrix(int view, int layer, const Matrix & m) {
 	else
 	    ms.push_back({name, m});
     }
+    invalidateHashes();
 }
 
 //! Return the (combined) attribute mapping for the page style and view.
@@ -472,11 +505,15 @@ const AttributeMap & Page::pureViewMap(int index) const {
 //! Set the attribute mapping for the view.
 void Page::setViewMap(int index, const AttributeMap & map) {
     iViews[index].iAttributeMap = map;
+    invalidateHashes();
 }
 
 // --------------------------------------------------------------------
 
-Page::SObject::SObject() {
+Page::SObject::SObject()
+    : iBBoxValid(false)
+    , iHash(0)
+    , iHashValid(false) {
     iObject = nullptr;
     iLayer = 0;
     iSelect = ENotSelected;
@@ -484,7 +521,10 @@ Page::SObject::SObject() {
 
 Page::SObject::SObject(const SObject & rhs)
     : iSelect(rhs.iSelect)
-    , iLayer(rhs.iLayer) {
+    , iLayer(rhs.iLayer)
+    , iBBoxValid(false)
+    , iHash(0)
+    , iHashValid(false) {
     if (rhs.iObject)
 	iObject = rhs.iObject->clone();
     else
@@ -500,7 +540,8 @@ Page::SObject & Page::SObject::operator=(const SObject & rhs) {
 	    iObject = rhs.iObject->clone();
 	else
 	    iObject = nullptr;
-	iBBox.clear(); // invalidate
+	iBBoxValid = false;
+	iHashValid = false;
     }
     return *this;
 }
@@ -517,6 +558,7 @@ void Page::insert(int i, TSelect select, int layer, Object * obj) {
     s.iSelect = select;
     s.iLayer = layer;
     s.iObject = obj;
+    invalidateHashes();
 }
 
 //! Append a new object.
@@ -527,10 +569,14 @@ void Page::append(TSelect select, int layer, Object * obj) {
     s.iSelect = select;
     s.iLayer = layer;
     s.iObject = obj;
+    invalidateHashes();
 }
 
 //! Remove the object at index \a i.
-void Page::remove(int i) { iObjects.erase(iObjects.begin() + i); }
+void Page::remove(int i) {
+    iObjects.erase(iObjects.begin() + i);
+    invalidateHashes();
+}
 
 //! Replace the object at index \a i.
 /*! Takes ownership of \a obj. */
@@ -558,23 +604,39 @@ void Page::transform(int i, const Matrix & m) {
 }
 
 //! Invalidate the bounding box at index \a i (the object is somehow changed).
-void Page::invalidateBBox(int i) const { iObjects[i].iBBox.clear(); }
+/*! This also invalidates the cached content hash of the object, and
+  the hashes of the page. */
+void Page::invalidateBBox(int i) const {
+    iObjects[i].iBBoxValid = false;
+    iObjects[i].iHashValid = false;
+    invalidateHashes();
+}
 
 //! Return a bounding box for the object at index \a i.
 /*! This is a bounding box including the control points of the object.
   If you need a tight bounding box, you'll need to use the Object
   directly.
 
-  The Page caches the box the first time it is computed.
+  The Page caches the box the first time it is computed.  Several
+  threads can call this at the same time.
 
   Make sure you call Page::transform instead of Object::setMatrix,
   as the latter would not invalidate the bounding box.
 */
 
 Rect Page::bbox(int i) const {
-    if (iObjects[i].iBBox.isEmpty())
-	iObjects[i].iObject->addToBBox(iObjects[i].iBBox, Matrix(), true);
-    return iObjects[i].iBBox;
+    static std::mutex mutex;
+    const SObject & obj = iObjects[i];
+    if (!obj.iBBoxValid.load(std::memory_order_acquire)) {
+	Rect box;
+	obj.iObject->addToBBox(box, Matrix(), true);
+	std::lock_guard lock(mutex);
+	if (!obj.iBBoxValid.load(std::memory_order_relaxed)) {
+	    obj.iBBox = box;
+	    obj.iBBoxValid.store(true, std::memory_order_release);
+	}
+    }
+    return obj.iBBox;
 }
 
 //! Compute possible vertex snapping position for object at index \a i.
@@ -608,9 +670,119 @@ bool Page::setAttribute(int i, Property prop, Attribute value) {
     bool changed = object(i)->setAttribute(prop, value);
     if (changed && (prop == EPropTextSize || prop == EPropTransformations))
 	invalidateBBox(i);
+    else if (changed) {
+	iObjects[i].iHashValid = false;
+	invalidateHashes();
+    }
     return changed;
 }
 
+//! Return the content hash of the object at index \a i.
+/*! This is Object::contentHash(), cached by the Page in the same way
+  as the bounding box.  Several threads can call this at the same
+  time.
+
+  The hash is invalidated by the same functions that invalidate the
+  bounding box, and by setAttribute.  If you modify an object
+  directly, call invalidateBBox afterwards.
+*/
+uint64_t Page::objectHash(int i) const {
+    static std::mutex mutex;
+    const SObject & obj = iObjects[i];
+    if (!obj.iHashValid.load(std::memory_order_acquire)) {
+	uint64_t h = obj.iObject->contentHash();
+	std::lock_guard lock(mutex);
+	if (!obj.iHashValid.load(std::memory_order_relaxed)) {
+	    obj.iHash = h;
+	    obj.iHashValid.store(true, std::memory_order_release);
+	}
+    }
+    return obj.iHash;
+}
+
+//! Return a hash of the name and the objects of a layer.
+/*! It combines the objectHash() of the objects in the layer in their
+  order on the page.
+
+  The hashes of all layers are computed together and cached by the
+  page until the page or one of its objects is modified (see
+  invalidateBBox()).  Several threads can call this at the same time.
+  The same holds for viewHash() and contentHash().
+*/
+uint64_t Page::layerHash(int layer) const {
+    static std::mutex mutex;
+    if (!iHashes.iLayersValid.load(std::memory_order_acquire)) {
+	std::vector<uint64_t> hashes;
+	for (const SLayer & l : iLayers) {
+	    HashStream stream;
+	    stream << l.iName;
+	    hashes.push_back(stream.hash());
+	}
+	for (int i = 0; i < count(); ++i) {
+	    uint64_t & h = hashes[iObjects[i].iLayer];
+	    h = HashStream::mix(h, objectHash(i));
+	}
+	std::lock_guard lock(mutex);
+	if (!iHashes.iLayersValid.load(std::memory_order_relaxed)) {
+	    iHashes.iLayers = std::move(hashes);
+	    iHashes.iLayersValid.store(true, std::memory_order_release);
+	}
+    }
+    return iHashes.iLayers[layer];
+}
+
+//! Return a hash of everything shown in a view.
+/*! It combines the attributes of the view with the objectHash() of
+  the objects in the layers visible in the view. */
+uint64_t Page::viewHash(int view) const {
+    static std::mutex mutex;
+    if (!iHashes.iViewsValid.load(std::memory_order_acquire)) {
+	std::vector<uint64_t> hashes;
+	for (const SView & v : iViews) {
+	    HashStream stream;
+	    stream << v.iEffect.string() << "\n" << v.iActive << "\n" << v.iName << "\n"
+		   << int(v.iMarked) << "\n";
+	    v.iAttributeMap.saveAsXml(stream);
+	    for (const auto & s : v.iLayerMatrices)
+		stream << s.iLayer << " " << s.iMatrix << "\n";
+	    hashes.push_back(stream.hash());
+	}
+	for (int i = 0; i < count(); ++i) {
+	    int l = iObjects[i].iLayer;
+	    for (int v = 0; v < countViews(); ++v) {
+		if (!visible(v, l)) continue;
+		hashes[v] = HashStream::mix(HashStream::mix(hashes[v], objectHash(i)), l);
+	    }
+	}
+	std::lock_guard lock(mutex);
+	if (!iHashes.iViewsValid.load(std::memory_order_relaxed)) {
+	    iHashes.iViews = std::move(hashes);
+	    iHashes.iViewsValid.store(true, std::memory_order_release);
+	}
+    }
+    return iHashes.iViews[view];
+}
+
+//! Return a hash of the entire contents of the page.
+/*! It combines the page attributes, notes, layers, and views with the
+  objectHash() and layer of all objects. */
+uint64_t Page::contentHash() const {
+    static std::mutex mutex;
+    if (!iHashes.iContentValid.load(std::memory_order_acquire)) {
+	HashStream stream;
+	saveHeaderAsXml(stream);
+	uint64_t h = stream.hash();
+	for (int i = 0; i < count(); ++i)
+	    h = HashStream::mix(HashStream::mix(h, objectHash(i)), iObjects[i].iLayer);
+	std::lock_guard lock(mutex);
+	if (!iHashes.iContentValid.load(std::memory_order_relaxed)) {
+	    iHashes.iContent = h;
+	    iHashes.iContentValid.store(true, std::memory_order_release);
+	}
+    }
+    return iHashes.iContent;
+}
+
 // --------------------------------------------------------------------
 
 //! Return section title at \a level.
@@ -631,6 +803,7 @@ String Page::section(int level) const {
 void Page::setSection(int level, bool useTitle, String name) {
     iUseTitle[level] = useTitle;
     iSection[level] = useTitle ? String() : name;
+    invalidateHashes();
 }
 
 //! Set the title of this page.
@@ -638,16 +811,23 @@ void Page::setSection(int level, bool useTitle, String name) {
 void Page::setTitle(String title) {
     iTitle = title;
     iTitleObject.setText(String("\\PageTitle{") + title + "}");
+    invalidateHashes();
 }
 
 //! Return title of this page.
 String Page::title() const { return iTitle; }
 
 //! Set the notes of this page.
-void Page::setNotes(String notes) { iNotes = notes; }
+void Page::setNotes(String notes) {
+    iNotes = notes;
+    invalidateHashes();
+}
 
 //! Set if page is marked for printing.
-void Page::setMarked(bool marked) { iMarked = marked; }
+void Page::setMarked(bool marked) {
+    iMarked = marked;
+    invalidateHashes();
+}
 
 //! Return Text object representing the title text.
 /*! Return 0 if no title is set.
@@ -670,7 +850,10 @@ void Page::applyTitleStyle(const Cascade * sheet) {
     iTitleObject.setVerticalAlignment(ts->iVerticalAlignment);
 }
 
-void Page::setStyle(Attribute style) { iStyle = style; }
+void Page::setStyle(Attribute style) {
+    iStyle = style;
+    invalidateHashes();
+}
 
 Attribute Page::backgroundSymbol(const Cascade * sheet) const {
     if (const auto * ps = sheet->findPageStyle(iStyle)) return ps->iBackground;
@@ -97,6 +97,7 @@ Painter::Painter(const Cascade * style) {
     iMatrix.push_back(Matrix()); // identity
     iAttributeMap = nullptr;
     iInPath = 0;
+    iDetail = 0.0;
 }
 
 //! Virtual destructor.
@@ -107,6 +108,14 @@ Painter::~Painter() {
 //! Set a new attribute map.
 void Painter::setAttributeMap(const AttributeMap * map) { iAttributeMap = map; }
 
+//! Allow omitting details smaller than \a size when drawing.
+/*! The size is measured in the output coordinates, after applying
+  the transformation matrix.  Painters drawing to the screen can set
+  it to a fraction of a pixel, so that objects can draw simplified
+  versions of very complex paths.  The default is zero, which means
+  that everything is drawn exactly, as needed for PDF output. */
+void Painter::setDetail(double size) { iDetail = size; }
+
 //! Lookup a symbolic attribute
 /*! Uses first the attribute map and then the stylesheet. */
 Attribute Painter::lookup(Kind kind, Attribute sym) const {
@@ -29,7 +29,9 @@
 */
 
 #include "ipepdfparser.h"
+#include "ipetrace.h"
 #include "ipeutils.h"
+#include <cstddef>
 #include <cstdlib>
 
 using namespace ipe;
@@ -62,6 +64,10 @@ static char specialChars[256] = {
 
 inline int toInt(String & s) { return std::strtol(s.z(), nullptr, 10); }
 
+inline size_t nameHash(const char * s, int len) {
+    return std::hash<std::string_view>{}(std::string_view(s, len));
+}
+
 // --------------------------------------------------------------------
 
 /*! \class ipe::PdfObj
@@ -74,6 +80,16 @@ PdfObj::~PdfObj() {
     // nothing
 }
 
+//! Delete an object unless it is owned by a PdfArena.
+/*! Objects created in an arena are destroyed by the arena, so
+  deleting them (for instance as an element of an array or
+  dictionary) does nothing. */
+void PdfObj::operator delete(PdfObj * obj, std::destroying_delete_t) {
+    if (obj->iInArena) return;
+    obj->~PdfObj();
+    ::operator delete(obj);
+}
+
 //! Return this object as PDF null object.
 const PdfNull * PdfObj::null() const noexcept { return nullptr; }
 
@@ -266,8 +282,15 @@ const PdfObj * PdfArray::obj(int index, const PdfFile * file) const noexcept {
  * \brief The PDF dictionary and stream objects.
 
  A dictionary may or may not have attached stream data.
+
+ Small dictionaries are searched linearly (comparing hashes first).
+ Large dictionaries, such as the /XObject resources of a Latex run
+ with many text objects, build a hash index on their keys.
  */
 
+// dictionaries with this many keys get a hash index
+constexpr int PDFDICT_INDEX_THRESHOLD = 16;
+
 const PdfDict * PdfDict::dict() const noexcept { return this; }
 
 //! Return PDF representation of the PdfDict without the stream.
@@ -322,8 +345,33 @@ void PdfDict::setStream(const Buffer & stream) { iStream = stream; }
 void PdfDict::add(String key, const PdfObj * obj) {
     Item item;
     item.iKey = key;
+    item.iHash = nameHash(key.data(), key.size());
     item.iVal = obj;
     iItems.push_back(item);
+    int n = count();
+    if (n == PDFDICT_INDEX_THRESHOLD) {
+	iIndex = std::make_unique<std::unordered_map<std::string_view, int>>();
+	for (int i = 0; i < n; ++i) {
+	    const String & k = iItems[i].iKey;
+	    iIndex->emplace(std::string_view(k.data(), k.size()), i);
+	}
+    } else if (n > PDFDICT_INDEX_THRESHOLD) {
+	// emplace keeps the first entry for a duplicate key, like the linear search
+	iIndex->emplace(std::string_view(key.data(), key.size()), n - 1);
+    }
+}
+
+// Find the value for key (without resolving references).
+const PdfObj * PdfDict::find(const String & key) const noexcept {
+    if (iIndex) {
+	auto it = iIndex->find(std::string_view(key.data(), key.size()));
+	return (it != iIndex->end()) ? iItems[it->second].iVal : nullptr;
+    }
+    size_t hash = nameHash(key.data(), key.size());
+    for (const auto & item : iItems) {
+	if (item.iHash == hash && item.iKey == key) return item.iVal;
+    }
+    return nullptr; // not in dictionary
 }
 
 //! Look up key in dictionary.
@@ -332,16 +380,9 @@ void PdfDict::add(String key, const PdfObj * obj) {
   Returns nullptr if key is not in dictionary.
 */
 const PdfObj * PdfDict::get(String key, const PdfFile * file) const noexcept {
-    for (std::vector<Item>::const_iterator it = iItems.begin(); it != iItems.end();
-	 ++it) {
-	if (it->iKey == key) {
-	    if (file && it->iVal->ref())
-		return file->object(it->iVal->ref()->value());
-	    else
-		return it->iVal;
-	}
-    }
-    return nullptr; // not in dictionary
+    const PdfObj * obj = find(key);
+    if (obj && file && obj->ref()) return file->object(obj->ref()->value());
+    return obj;
 }
 
 //! Look up key and return if it is a dictionary.
@@ -426,6 +467,79 @@ Buffer PdfDict::inflate() const noexcept {
 
 // --------------------------------------------------------------------
 
+/*! \class ipe::PdfArena
+ * \ingroup base
+ * \brief Bulk storage for PDF objects created by the parser.
+
+ Parsing the output of Latex creates tens of thousands of small
+ objects.  Instead of allocating each of them on the heap, the parser
+ can place them in an arena, which releases them all at once.  The
+ arena also interns PDF names, so that all occurrences of a name
+ share a single String.
+*/
+
+constexpr size_t PDFARENA_BLOCK_SIZE = 64 * 1024;
+constexpr size_t PDFARENA_ALIGN = alignof(std::max_align_t);
+
+PdfArena::PdfArena()
+    : iBlock{0}
+    , iUsed{0} {
+    // nothing
+}
+
+PdfArena::~PdfArena() {
+    clear();
+    for (char * block : iBlocks) delete[] block;
+}
+
+//! Destroy all objects in the arena, but keep its memory and the interned names.
+void PdfArena::clear() noexcept {
+    // containers are created before their elements, so they are destroyed first
+    for (PdfObj * obj : iObjects) obj->~PdfObj();
+    iObjects.clear();
+    iBlock = 0;
+    iUsed = 0;
+}
+
+void * PdfArena::allocate(size_t size) {
+    size = (size + PDFARENA_ALIGN - 1) & ~(PDFARENA_ALIGN - 1);
+    assert(size <= PDFARENA_BLOCK_SIZE);
+    if (iBlock < iBlocks.size() && iUsed + size > PDFARENA_BLOCK_SIZE) {
+	++iBlock;
+	iUsed = 0;
+    }
+    if (iBlock == iBlocks.size()) iBlocks.push_back(new char[PDFARENA_BLOCK_SIZE]);
+    void * p = iBlocks[iBlock] + iUsed;
+    iUsed += size;
+    return p;
+}
+
+//! Take over all objects and memory of \a other, leaving it empty.
+void PdfArena::merge(PdfArena & other) {
+    // the blocks of other are in use, so place them before our current block
+    iBlocks.insert(iBlocks.begin(), other.iBlocks.begin(), other.iBlocks.end());
+    iBlock += other.iBlocks.size();
+    iObjects.insert(iObjects.end(), other.iObjects.begin(), other.iObjects.end());
+    iNames.merge(other.iNames);
+    other.iBlocks.clear();
+    other.iObjects.clear();
+    other.iNames.clear();
+    other.iBlock = 0;
+    other.iUsed = 0;
+}
+
+//! Return the unique String for this PDF name.
+String PdfArena::intern(const char * name, int len) {
+    auto it = iNames.find(std::string_view(name, len));
+    if (it != iNames.end()) return it->second;
+    String s(name, len);
+    // the key refers to the data of the interned string, which is never modified
+    iNames.emplace(std::string_view(s.data(), s.size()), s);
+    return s;
+}
+
+// --------------------------------------------------------------------
+
 /*! \class ipe::PdfParser
  * \ingroup base
  * \brief PDF parser
@@ -445,8 +559,11 @@ Buffer PdfDict::inflate() const noexcept {
 */
 
 //! Construct with a data source.
-PdfParser::PdfParser(DataSource & source)
-    : iSource(source) {
+/*! If \a arena is not nullptr, the parsed objects are created in the
+  arena and owned by it. */
+PdfParser::PdfParser(DataSource & source, PdfArena * arena)
+    : iSource(source)
+    , iArena(arena) {
     getChar();  // init iCh
     getToken(); // init iTok
 }
@@ -576,9 +693,15 @@ void PdfParser::getToken() {
 
 // --------------------------------------------------------------------
 
+// Create name from token (without the leading slash).
+String PdfParser::makeName(const String & tok) {
+    if (iArena) return iArena->intern(tok.data() + 1, tok.size() - 1);
+    return tok.substr(1);
+}
+
 //! Parse elements of an array.
 PdfArray * PdfParser::makeArray() {
-    std::unique_ptr<PdfArray> arr(new PdfArray);
+    std::unique_ptr<PdfArray> arr(make<PdfArray>());
     for (;;) {
 	if (iTok.iType == PdfToken::EArrayEnd) {
 	    // finish array
@@ -593,14 +716,14 @@ PdfArray * PdfParser::makeArray() {
 		PdfToken t2 = iTok;
 		getToken();
 		if (iTok.iType == PdfToken::EOp && iTok.iString == "R") {
-		    arr->append(new PdfRef(toInt(t1.iString)));
+		    arr->append(make<PdfRef>(toInt(t1.iString)));
 		    getToken();
 		} else {
-		    arr->append(new PdfNumber(Platform::toDouble(t1.iString)));
-		    arr->append(new PdfNumber(Platform::toDouble(t2.iString)));
+		    arr->append(make<PdfNumber>(Platform::toDouble(t1.iString)));
+		    arr->append(make<PdfNumber>(Platform::toDouble(t2.iString)));
 		}
 	    } else {
-		arr->append(new PdfNumber(Platform::toDouble(t1.iString)));
+		arr->append(make<PdfNumber>(Platform::toDouble(t1.iString)));
 	    }
 	} else {
 	    PdfObj * obj = getObject();
@@ -611,7 +734,7 @@ PdfArray * PdfParser::makeArray() {
 }
 
 PdfDict * PdfParser::makeDict(bool lateStream) {
-    std::unique_ptr<PdfDict> dict(new PdfDict);
+    std::unique_ptr<PdfDict> dict(make<PdfDict>());
     for (;;) {
 	if (iTok.iType == PdfToken::EDictEnd) {
 	    // finish
@@ -654,7 +777,7 @@ PdfDict * PdfParser::makeDict(bool lateStream) {
 
 	// must read name
 	if (iTok.iType != PdfToken::EName) return nullptr;
-	String name = iTok.iString.substr(1);
+	String name = makeName(iTok.iString);
 	getToken();
 
 	// check for reference object
@@ -665,12 +788,12 @@ PdfDict * PdfParser::makeDict(bool lateStream) {
 		PdfToken t2 = iTok;
 		getToken();
 		if (iTok.iType == PdfToken::EOp && iTok.iString == "R") {
-		    dict->add(name, new PdfRef(toInt(t1.iString)));
+		    dict->add(name, make<PdfRef>(toInt(t1.iString)));
 		    getToken();
 		} else
 		    return nullptr; // should be name or '>>'
 	    } else
-		dict->add(name, new PdfNumber(Platform::toDouble(t1.iString)));
+		dict->add(name, make<PdfNumber>(Platform::toDouble(t1.iString)));
 	} else {
 	    PdfObj * obj = getObject();
 	    if (!obj) return nullptr;
@@ -685,13 +808,13 @@ PdfObj * PdfParser::getObject(bool lateStream) {
     getToken();
 
     switch (tok.iType) {
-    case PdfToken::ENumber: return new PdfNumber(Platform::toDouble(tok.iString));
-    case PdfToken::EString: return new PdfString(tok.iString);
-    case PdfToken::EStringBinary: return new PdfString(tok.iString, true);
-    case PdfToken::EName: return new PdfName(tok.iString.substr(1));
-    case PdfToken::ENull: return new PdfNull;
-    case PdfToken::ETrue: return new PdfBool(true);
-    case PdfToken::EFalse: return new PdfBool(false);
+    case PdfToken::ENumber: return make<PdfNumber>(Platform::toDouble(tok.iString));
+    case PdfToken::EString: return make<PdfString>(tok.iString);
+    case PdfToken::EStringBinary: return make<PdfString>(tok.iString, true);
+    case PdfToken::EName: return make<PdfName>(makeName(tok.iString));
+    case PdfToken::ENull: return make<PdfNull>();
+    case PdfToken::ETrue: return make<PdfBool>(true);
+    case PdfToken::EFalse: return make<PdfBool>(false);
     case PdfToken::EArrayBg: return makeArray();
     case PdfToken::EDictBg:
 	return makeDict(lateStream);
@@ -808,8 +931,47 @@ static int checkXRefObj(const PdfDict * d) {
  * \brief All information obtained by parsing a PDF file.
  */
 
+// files at least this large are parsed in parallel if possible
+constexpr int PDFFILE_PARALLEL_LENGTH = 1 << 20;
+
 //! Parse entire PDF stream, and store objects.
+/*! If the stream is large and Platform::threadCount() allows, it is
+  read into memory and parsed in parallel. */
 bool PdfFile::parse(DataSource & source) {
+    IPE_TRACE_SPAN("PdfFile::parse");
+    int length = source.length();
+    int threads = Platform::threadCount();
+    if (threads > 1 && length >= PDFFILE_PARALLEL_LENGTH) {
+	Buffer data(length);
+	source.setPosition(0);
+	char * p = data.data();
+	for (int i = 0; i < length; ++i) *p++ = char(source.getChar());
+	return parse(data, threads);
+    }
+    bool ok = parseSource(source);
+    if (ok) IPE_TRACE_COUNT("PdfFile objects", iObjects.size());
+    return ok;
+}
+
+//! Parse PDF file held in memory, using up to \a threads threads.
+/*! Once the cross-reference table has been read, the objects are
+  partitioned among the threads, each with its own parser and arena.
+  Object streams and streams with an indirect /Length are then decoded
+  in parallel as well.  The results are merged in object number order,
+  so that the result is the same as when parsing with a single thread. */
+bool PdfFile::parse(const Buffer & data, int threads) {
+    IPE_TRACE_SPAN("PdfFile::parse(Buffer)");
+    BufferSource source(data);
+    iData = &data;
+    iThreads = threads;
+    bool ok = parseSource(source);
+    iData = nullptr;
+    iThreads = 1;
+    if (ok) IPE_TRACE_COUNT("PdfFile objects", iObjects.size());
+    return ok;
+}
+
+bool PdfFile::parseSource(DataSource & source) {
     int length = source.length();
     if (length < 0)
 	// could not seek to end
@@ -828,7 +990,7 @@ bool PdfFile::parse(DataSource & source) {
     int xrefPos = lex.getInt();
     source.setPosition(xrefPos);
 
-    PdfParser parser(source);
+    PdfParser parser(source, iArena.get());
     PdfToken t = parser.token();
 
     if (t.iType == PdfToken::ENumber)
@@ -845,20 +1007,31 @@ bool PdfFile::parse(DataSource & source) {
     iTrailer = std::unique_ptr<const PdfDict>(parser.getTrailer());
     if (!iTrailer) return false;
 
+    return readObjects(xref, false, source);
+}
+
+// Read the objects at the given file positions (zero means no object).
+// Object streams are decoded only if objStreams is true.
+bool PdfFile::readObjects(const std::vector<int> & xref, bool objStreams,
+			  DataSource & source) {
+    if (iData && iThreads > 1) return readObjectsParallel(xref, objStreams);
     std::vector<int> delayed;
-    // read objects
     for (int num = 0; num < size(xref); ++num) {
 	if (xref[num] > 0) {
 	    source.setPosition(xref[num]);
-	    PdfParser objParser(source);
+	    PdfParser objParser(source, iArena.get());
 	    std::unique_ptr<const PdfObj> obj(objParser.getObjectDef(true));
 	    if (!obj) {
 		ipeDebug("Failed to get object %d", num);
 		return false;
 	    }
-	    if (obj->dict() && obj->dict()->lateStream() > 0) delayed.push_back(num);
-	    // ipeDebug("Object: %s", obj->repr().z());
-	    iObjects[num] = std::move(obj);
+	    if (objStreams && isObjectStream(obj.get())) {
+		if (!parseObjectStream(obj->dict())) return false;
+	    } else {
+		if (obj->dict() && obj->dict()->lateStream() > 0) delayed.push_back(num);
+		// ipeDebug("Object: %s", obj->repr().z());
+		iObjects[num] = std::move(obj);
+	    }
 	}
     }
     return readDelayedStreams(delayed, source);
@@ -878,6 +1051,95 @@ bool PdfFile::readDelayedStreams(std::vector<int> & delayed, DataSource & source
 
 // ------------------------------------------------------------------------------------------
 
+// Parallel version of readObjects, reading from iData.
+bool PdfFile::readObjectsParallel(const std::vector<int> & xref, bool objStreams) {
+    int n = size(xref);
+    int chunks = std::max(1, std::min(iThreads, n));
+
+    // parse all objects at their file positions
+    std::vector<std::unique_ptr<const PdfObj>> objs(n);
+    std::vector<PdfArena> arenas(chunks);
+    std::vector<int> failed(chunks, -1);
+    parallelFor(n, chunks, [&](int chunk, int begin, int end) {
+	BufferSource source(*iData);
+	for (int num = begin; num < end && failed[chunk] < 0; ++num) {
+	    if (xref[num] > 0) {
+		source.setPosition(xref[num]);
+		PdfParser objParser(source, &arenas[chunk]);
+		objs[num].reset(objParser.getObjectDef(true));
+		if (!objs[num]) failed[chunk] = num;
+	    }
+	}
+    });
+    for (auto & arena : arenas) iArena->merge(arena);
+    for (int num : failed) {
+	if (num >= 0) {
+	    ipeDebug("Failed to get object %d", num);
+	    return false;
+	}
+    }
+
+    std::vector<int> streams;
+    std::vector<bool> isPlain(n, false);
+    for (int num = 0; num < n; ++num) {
+	if (!objs[num]) continue;
+	if (objStreams && isObjectStream(objs[num].get())) {
+	    streams.push_back(num);
+	} else {
+	    isPlain[num] = true;
+	    iObjects[num] = std::move(objs[num]);
+	}
+    }
+
+    // decode the object streams
+    int schunks = std::max(1, std::min(iThreads, size(streams)));
+    std::vector<ObjectList> decoded(streams.size());
+    std::vector<PdfArena> sarenas(schunks);
+    std::vector<int> sfailed(schunks, 0);
+    parallelFor(size(streams), schunks, [&](int chunk, int begin, int end) {
+	for (int i = begin; i < end && !sfailed[chunk]; ++i) {
+	    if (!readObjectStream(objs[streams[i]]->dict(), &sarenas[chunk], decoded[i]))
+		sfailed[chunk] = 1;
+	}
+    });
+    for (auto & arena : sarenas) iArena->merge(arena);
+    if (std::find(sfailed.begin(), sfailed.end(), 1) != sfailed.end()) return false;
+    for (int i = 0; i < size(streams); ++i) {
+	for (auto & [num, obj] : decoded[i]) {
+	    // same precedence as the sequential reader: the one read last wins
+	    if (num < n && isPlain[num] && num > streams[i]) continue;
+	    iObjects[num] = std::move(obj);
+	}
+    }
+
+    // read streams whose /Length was given indirectly
+    std::vector<int> delayed;
+    for (int num = 0; num < n; ++num) {
+	if (isPlain[num]) {
+	    const PdfDict * d = iObjects[num]->dict();
+	    if (d && d->lateStream() > 0) delayed.push_back(num);
+	}
+    }
+    int dchunks = std::max(1, std::min(iThreads, size(delayed)));
+    std::vector<int> dfailed(dchunks, -1);
+    parallelFor(size(delayed), dchunks, [&](int chunk, int begin, int end) {
+	BufferSource source(*iData);
+	for (int i = begin; i < end && dfailed[chunk] < 0; ++i) {
+	    const PdfDict * d = iObjects.find(delayed[i])->second->dict();
+	    if (!addStreamToDict(source, (PdfDict *)d, this)) dfailed[chunk] = delayed[i];
+	}
+    });
+    for (int num : dfailed) {
+	if (num >= 0) {
+	    ipeDebug("Failed to read stream for object %d", num);
+	    return false;
+	}
+    }
+    return readPageTree();
+}
+
+// ------------------------------------------------------------------------------------------
+
 bool PdfFile::parseFromXRefObj(PdfParser & parser, DataSource & source) {
     std::unique_ptr<const PdfObj> obj(parser.getObjectDef(false));
     if (!obj) return false;
@@ -888,34 +1150,16 @@ bool PdfFile::parseFromXRefObj(PdfParser & parser, DataSource & source) {
     if (size < 0 || !iTrailer->getNumberArray("W", nullptr, w) || w.size() != 3)
 	return parseSequentially(source);
 
-    std::vector<int> delayed;
-
+    std::vector<int> xref(size, 0);
     Buffer stream = iTrailer->inflate();
     BufferSource xb(stream);
     for (int num = 0; num < size; ++num) {
 	int objType = readBytes(xb, int(w[0]));
 	int pos = readBytes(xb, int(w[1]));
 	readBytes(xb, int(w[2])); // not used
-	if (objType == 1) {
-	    source.setPosition(pos);
-	    PdfParser objParser(source);
-	    std::unique_ptr<const PdfObj> obj(objParser.getObjectDef(true));
-	    if (!obj) {
-		ipeDebug("Failed to get object %d from XRef object", num);
-		return false;
-	    }
-	    const PdfDict * d = obj->dict();
-	    const PdfObj * type = d ? d->get("Type", this) : nullptr;
-	    if (type && type->name() && type->name()->value() == "ObjStm") {
-		if (!parseObjectStream(d)) return false;
-	    } else {
-		// ipeDebug("Object: %s", obj->repr().z());
-		if (obj->dict() && obj->dict()->lateStream() > 0) delayed.push_back(num);
-		iObjects[num] = std::move(obj);
-	    }
-	}
+	if (objType == 1) xref[num] = pos;
     }
-    return readDelayedStreams(delayed, source);
+    return readObjects(xref, true, source);
 }
 
 // ------------------------------------------------------------------------------------------
@@ -925,7 +1169,7 @@ bool PdfFile::parseFromXRefObj(PdfParser & parser, DataSource & source) {
 bool PdfFile::parseSequentially(DataSource & source) {
     ipeDebug("Falling back on sequential PDF parser");
     source.setPosition(0);
-    PdfParser parser(source);
+    PdfParser parser(source, iArena.get());
 
     for (;;) {
 	PdfToken t = parser.token();
@@ -975,7 +1219,23 @@ bool PdfFile::parseSequentially(DataSource & source) {
 
 // ------------------------------------------------------------------------------------------
 
+bool PdfFile::isObjectStream(const PdfObj * obj) const {
+    const PdfDict * d = obj->dict();
+    const PdfObj * type = d ? d->get("Type", this) : nullptr;
+    return type && type->name() && type->name()->value() == "ObjStm";
+}
+
+// Parse the objects in object stream d and add them to the file.
 bool PdfFile::parseObjectStream(const PdfDict * d) {
+    ObjectList objs;
+    if (!readObjectStream(d, iArena.get(), objs)) return false;
+    for (auto & [num, obj] : objs) iObjects[num] = std::move(obj);
+    return true;
+}
+
+// Parse the objects in object stream d into objs, creating them in arena.
+bool PdfFile::readObjectStream(const PdfDict * d, PdfArena * arena,
+			       ObjectList & objs) const {
     const PdfObj * objn = d->get("N", this);
     const PdfObj * objfirst = d->get("First", this);
     int n = objn->number() ? objn->number()->value() : -1;
@@ -983,7 +1243,7 @@ bool PdfFile::parseObjectStream(const PdfDict * d) {
     if (n < 0 || first < 0) return false;
     Buffer stream = d->inflate();
     BufferSource source(stream);
-    PdfParser parser(source);
+    PdfParser parser(source, arena);
     std::vector<int> dir;
     for (int i = 0; i < 2 * n; ++i) {
 	PdfToken t = parser.token();
@@ -999,7 +1259,7 @@ bool PdfFile::parseObjectStream(const PdfDict * d) {
 	PdfObj * obj = parser.getObject();
 	if (!obj) return false;
 	// ipeDebug("Object: %s", obj->repr().z());
-	iObjects[num] = std::unique_ptr<const PdfObj>(obj);
+	objs.emplace_back(num, std::unique_ptr<const PdfObj>(obj));
     }
     return true;
 }
@@ -1016,6 +1276,8 @@ const PdfObj * PdfFile::object(int num) const noexcept {
 }
 
 //! Take ownership of object with number \a num, remove from PdfFile.
+/*! The object lives in the arena of the PdfFile, so the caller must
+  keep arena() alive for as long as it uses the object. */
 std::unique_ptr<const PdfObj> PdfFile::take(int num) {
     auto got = iObjects.find(num);
     if (got != iObjects.end()) {
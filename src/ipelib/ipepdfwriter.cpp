@@ -38,6 +38,7 @@
 #include "ipepdfparser.h"
 #include "ipepdfwriter.h"
 #include "iperesources.h"
+#include "ipetrace.h"
 
 using namespace ipe;
 
@@ -710,6 +711,7 @@ void PdfWriter::paintView(Stream & stream, int pno, int view) {
 
 //! create contents and page stream for this page view.
 void PdfWriter::createPageView(int pno, int view) {
+    IPE_TRACE_SPAN("PdfWriter::createPageView");
     const Page * page = iDoc->page(pno);
     // Find bitmaps to embed
     BitmapFinder bm;
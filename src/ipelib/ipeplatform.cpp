@@ -30,6 +30,7 @@
 
 #include "ipeattributes.h"
 #include "ipebase.h"
+#include "ipetrace.h"
 
 #ifdef WIN32
 #define NTDDI_VERSION 0x06000000
@@ -40,6 +41,8 @@
 #include <shlobj.h>
 #else
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
 #include <sys/wait.h>
 #endif
 #ifdef __APPLE__
@@ -68,6 +71,10 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#ifndef IPEWASM
+#include <thread>
+#endif
+
 #ifdef IPEWASM
 #include <emscripten.h>
 #include <emscripten/val.h>
@@ -93,6 +100,8 @@ int Platform::libVersion() { return IPELIB_VERSION; }
 
 static bool initialized = false;
 static bool showDebug = false;
+static int numThreads = 1;
+static const char * traceFile = nullptr;
 static Platform::DebugHandler debugHandler = nullptr;
 
 #ifdef WIN32
@@ -155,6 +164,10 @@ String Platform::folder(IpeFolder ft, const char * fname) {
     return result;
 }
 
+//! Change the location of a folder.
+/*! Must be called after initLib(), and before the folder is used. */
+void Platform::setFolder(IpeFolder ft, String path) { folders[int(ft)] = path; }
+
 static void readIpeConf(String fname) {
 #ifndef IPEWASM
     String conf = Platform::readFile(fname);
@@ -315,6 +328,8 @@ static void shutdownIpelib() {
     freelocale(ipeLocale);
 #endif
     Repository::cleanup();
+    if (traceFile && !Trace::saveChromeTrace(traceFile))
+	fprintf(stderr, "Cannot write trace to '%s'\n", traceFile);
 }
 
 //! Initialize Ipelib.
@@ -325,13 +340,23 @@ static void shutdownIpelib() {
   that the correct version of Ipelib is loaded, and aborts with an
   error message if the version is not correct.  Also enables ipeDebug
   messages if environment variable IPEDEBUG is defined.  (You can
-  override this using setDebug).
+  override this using setDebug).  The environment variable IPETHREADS
+  limits the number of threads used by Ipelib (see threadCount).  If
+  the environment variable IPETRACE is set, tracing is enabled and the
+  trace is written to the file it names when the program exits (see
+  Trace).
 */
 void Platform::initLib(int version) {
     if (initialized) return;
     initialized = true;
     showDebug = getenv("IPEDEBUG") != nullptr;
     if (showDebug) fprintf(stderr, "Debug messages enabled\n");
+#ifndef IPEWASM
+    numThreads = std::max(1, int(std::thread::hardware_concurrency()));
+    if (const char * p = getenv("IPETHREADS"); p) numThreads = std::max(1, atoi(p));
+#endif
+    traceFile = getenv("IPETRACE");
+    if (traceFile) Trace::enable(true);
     debugHandler = debugHandlerImpl;
     setupFolders();
 #ifdef WIN32
@@ -371,6 +396,22 @@ void Platform::initLib(int version) {
 //! Enable or disable display of ipeDebug messages.
 void Platform::setDebug(bool debug) { showDebug = debug; }
 
+//! Return number of threads Ipelib may use for work that can be done in parallel.
+/*! This is the number of hardware threads, unless the environment
+  variable IPETHREADS was set when the library was initialized.  It is
+  always one for the Webassembly version. */
+int Platform::threadCount() noexcept { return numThreads; }
+
+//! Set the number of threads Ipelib may use.
+/*! Programs that run several Ipelib processes in parallel can use this
+  to share the hardware threads between them.  It has no effect for
+  the Webassembly version. */
+void Platform::setThreadCount(int n) noexcept {
+#ifndef IPEWASM
+    numThreads = std::max(1, n);
+#endif
+}
+
 // --------------------------------------------------------------------
 
 void ipeDebug(const char * msg, ...) noexcept {
@@ -502,12 +543,109 @@ String Platform::readFile(String fname) {
     return s;
 }
 
+// Return directory of docname (without final separator), empty if none.
+static String documentDirectory(String docname) {
+    if (docname.empty()) return String();
+    docname = Platform::realPath(docname);
+    int i = docname.size();
+    while (i > 0 && docname[i - 1] != IPESEP) --i;
+    return (i > 0) ? docname.substr(0, i - 1) : String();
+}
+
+// Command that makes the Latex format name, without the "cmd /c"
+// needed to start it on Windows, so that it can also be called from
+// a batch file.  Empty if no format can be made.
+static String dumpFormatCommand(LatexType engine, String docname, String name) {
+#ifdef IPEWASM
+    return String();
+#else
+    String dir = Platform::folder(FolderLatex, ""); // appends path separator
+    String url = Platform::readFile(dir + "url1.txt");
+    if (url.left(4) == "http") return String();
+    const char * tex = (engine == LatexType::Xetex)    ? "xetex"
+		       : (engine == LatexType::Luatex) ? "luatex"
+						       : "pdftex";
+    const char * latex = (engine == LatexType::Xetex)    ? "xelatex"
+			 : (engine == LatexType::Luatex) ? "lualatex"
+							 : "pdflatex";
+    String texinputs = documentDirectory(docname);
+    String path = Platform::latexPath();
+#ifdef WIN32
+    String bat;
+    bat += "chcp 65001\r\n";
+    if (dir.size() > 2 && dir[1] == ':') {
+	bat += dir.substr(0, 2);
+	bat += "\r\n";
+    }
+    bat += "cd \"";
+    bat += dir;
+    bat += "\"\r\n";
+    bat += "setlocal\r\n";
+    if (!texinputs.empty()) {
+	bat += "set TEXINPUTS=.;";
+	bat += texinputs;
+	bat += ";%TEXINPUTS%\r\n";
+    }
+    if (!path.empty()) {
+	bat += "PATH ";
+	bat += path;
+	bat += ";%PATH%\r\n";
+    }
+    bat += tex;
+    bat += " -ini -jobname=";
+    bat += name;
+    bat += " ^&";
+    bat += latex;
+    bat += " ";
+    bat += name;
+    bat += ".tex\r\n";
+    bat += "endlocal\r\n";
+
+    String s = dir + "dumpformat.bat";
+    std::FILE * f = Platform::fopen(s.z(), "wb");
+    if (!f) return String();
+    std::fwrite(bat.data(), 1, bat.size(), f);
+    std::fclose(f);
+
+    return String("call \"") + dir + String("dumpformat.bat\"");
+#else
+    String s("cd \"");
+    s += dir;
+    s += "\"; ";
+    if (!texinputs.empty()) {
+	s += "export TEXINPUTS=\"";
+	s += texinputs;
+	s += ":$TEXINPUTS\"; ";
+    }
+    if (path.empty())
+	s += tex;
+    else
+	s += String("\"") + path + "/" + tex + "\"";
+    s += " -ini -jobname=";
+    s += name;
+    s += " \\&";
+    s += latex;
+    s += " ";
+    s += name;
+    s += ".tex > /dev/null";
+    return s;
+#endif
+#endif
+}
+
 // amazingly, this actually works in NodeJS as is.
 // to make this async, need to run it on a different thread
 //! Returns command to run latex on file ipetemp.tex in given directory.
-/*! directory of docname is added to TEXINPUTS if its non-empty. */
-String Platform::howToRunLatex(LatexType engine, String docname) noexcept {
-    String dir = folder(FolderLatex, ""); // appends path separator
+/*! directory of docname is added to TEXINPUTS if its non-empty.  The
+  directory \a dir (ending in a path separator) defaults to the Latex
+  folder.  If it is a different directory, the Latex folder is added
+  to TEXFORMATS, so that format files cached there are found.  If \a
+  format is not empty, the command first makes this format file (see
+  howToDumpLatexFormat()). */
+String Platform::howToRunLatex(LatexType engine, String docname, String dir,
+			       String format) noexcept {
+    String latexDir = folder(FolderLatex, ""); // appends path separator
+    if (dir.empty()) dir = latexDir;
     const char * latex = (engine == LatexType::Xetex)    ? "xelatex"
 			 : (engine == LatexType::Luatex) ? "lualatex"
 							 : "pdflatex";
@@ -518,14 +656,15 @@ String Platform::howToRunLatex(LatexType engine, String docname) noexcept {
 	return how;
     }
 #endif
-    String url = Platform::readFile(dir + "url1.txt");
+    String url = Platform::readFile(latexDir + "url1.txt");
     bool online = (url.left(4) == "http");
+    String dump;
+    if (!online && !format.empty()) dump = dumpFormatCommand(engine, docname, format);
     String texinputs;
-    if (!online && !docname.empty()) {
-	docname = realPath(docname);
-	int i = docname.size();
-	while (i > 0 && docname[i - 1] != IPESEP) --i;
-	if (i > 0) texinputs = docname.substr(0, i - 1);
+    String texformats;
+    if (!online) {
+	texinputs = documentDirectory(docname);
+	if (dir != latexDir) texformats = latexDir.left(latexDir.size() - 1);
     }
 #ifdef WIN32
     if (!online && getenv("IPETEXFORMAT")) {
@@ -537,6 +676,10 @@ String Platform::howToRunLatex(LatexType engine, String docname) noexcept {
     String bat;
     // try to change codepage to UTF-8
     bat += "chcp 65001\r\n";
+    if (!dump.empty()) {
+	bat += dump;
+	bat += "\r\n";
+    }
     if (dir.size() > 2 && dir[1] == ':') {
 	bat += dir.substr(0, 2);
 	bat += "\r\n";
@@ -544,12 +687,17 @@ String Platform::howToRunLatex(LatexType engine, String docname) noexcept {
     bat += "cd \"";
     bat += dir;
     bat += "\"\r\n";
+    if (!texinputs.empty() || !texformats.empty()) bat += "setlocal\r\n";
     if (!texinputs.empty()) {
-	bat += "setlocal\r\n";
 	bat += "set TEXINPUTS=.;";
 	bat += texinputs;
 	bat += ";%TEXINPUTS%\r\n";
     }
+    if (!texformats.empty()) {
+	bat += "set TEXFORMATS=";
+	bat += texformats;
+	bat += ";%TEXFORMATS%\r\n";
+    }
     if (online) {
 	bat += "\"";
 	bat += folder(FolderConfig, "bin\\ipecurl.exe");
@@ -566,7 +714,7 @@ String Platform::howToRunLatex(LatexType engine, String docname) noexcept {
 	bat += latex;
 	bat += " ipetemp.tex\r\n";
     }
-    if (!texinputs.empty()) bat += "endlocal\r\n";
+    if (!texinputs.empty() || !texformats.empty()) bat += "endlocal\r\n";
     // bat += "pause\r\n";  // alternative for Wine
 
     String s = dir + "runlatex.bat";
@@ -582,7 +730,9 @@ String Platform::howToRunLatex(LatexType engine, String docname) noexcept {
 		: (engine == LatexType::Luatex) ? "luatex \\&latex"
 						: "pdftex \\&pdflatex";
     }
-    String s("cd \"");
+    String s;
+    if (!dump.empty()) s = String("(") + dump + "); ";
+    s += "cd \"";
     s += dir;
     s += "\"; rm -f ipetemp.log; ";
     if (!texinputs.empty()) {
@@ -590,6 +740,11 @@ String Platform::howToRunLatex(LatexType engine, String docname) noexcept {
 	s += texinputs;
 	s += ":$TEXINPUTS\"; ";
     }
+    if (!texformats.empty()) {
+	s += "export TEXFORMATS=\"";
+	s += texformats;
+	s += ":$TEXFORMATS\"; ";
+    }
     if (online) {
 #if defined(__APPLE__) && defined(IPEBUNDLE)
 	s += "\"";
@@ -612,6 +767,20 @@ String Platform::howToRunLatex(LatexType engine, String docname) noexcept {
 #endif
 }
 
+//! Returns command to create Latex format file \a name in the Latex folder.
+/*! The format is made from the source file name.tex in the Latex
+  folder.  The directory of docname is added to TEXINPUTS if its
+  non-empty.  Returns an empty string if no format can be made, for
+  instance when Latex runs in the cloud. */
+String Platform::howToDumpLatexFormat(LatexType engine, String docname,
+				      String name) noexcept {
+    String cmd = dumpFormatCommand(engine, docname, name);
+#ifdef WIN32
+    if (!cmd.empty()) cmd = String("cmd /c ") + cmd;
+#endif
+    return cmd;
+}
+
 #ifdef WIN32
 int Platform::system(String cmd) {
     // Declare and initialize process blocks
@@ -729,6 +898,89 @@ int Platform::mkdirTree(String path) {
     }
 }
 
+//! Rename file \a from to \a to, replacing \a to if it exists.
+/*! On the same file system, other processes see either the old or the
+  new file \a to.  Returns zero if successful. */
+int Platform::renameFile(String from, String to) {
+#ifdef WIN32
+    return MoveFileExW(from.w().data(), to.w().data(), MOVEFILE_REPLACE_EXISTING)
+	       ? 0
+	       : -1;
+#else
+    return std::rename(from.z(), to.z());
+#endif
+}
+
+// --------------------------------------------------------------------
+
+/*! \class ipe::FileLock
+  \ingroup base
+  \brief An exclusive lock on a file.
+
+  The file \a fname is created if it does not exist.  It is best to
+  use a file of its own for the lock, as on Windows the locked file
+  cannot be written through other handles.  If \a wait is false and
+  the lock is held elsewhere, the constructor returns immediately, and
+  locked() returns false.
+
+  The owner of the lock may remove the file while it holds the lock.
+  On Unix, the constructor then checks after locking that the file is
+  still the one at \a fname, and otherwise tries again, so that two
+  objects never hold locks on different files of the same name.  On
+  Windows, a locked file cannot be removed at all.
+*/
+FileLock::FileLock(String fname, bool wait) noexcept {
+#ifdef WIN32
+    HANDLE h = CreateFileW(fname.w().data(), GENERIC_READ | GENERIC_WRITE,
+			   FILE_SHARE_READ | FILE_SHARE_WRITE,
+			   nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    iHandle = -1;
+    if (h == INVALID_HANDLE_VALUE) return;
+    OVERLAPPED ov;
+    memset(&ov, 0, sizeof(ov));
+    DWORD flags = LOCKFILE_EXCLUSIVE_LOCK | (wait ? 0 : LOCKFILE_FAIL_IMMEDIATELY);
+    if (LockFileEx(h, flags, 0, 1, 0, &ov))
+	iHandle = reinterpret_cast<std::intptr_t>(h);
+    else
+	CloseHandle(h);
+#else
+    for (;;) {
+	iHandle = ::open(fname.z(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (iHandle < 0) {
+	    iHandle = -1;
+	    return;
+	}
+	int res;
+	while ((res = flock(iHandle, LOCK_EX | (wait ? 0 : LOCK_NB))) < 0
+	       && errno == EINTR)
+	    ;
+	if (res < 0) {
+	    ::close(iHandle);
+	    iHandle = -1;
+	    return;
+	}
+	struct stat held, named;
+	if (fstat(iHandle, &held) == 0 && ::stat(fname.z(), &named) == 0
+	    && held.st_dev == named.st_dev && held.st_ino == named.st_ino)
+	    return;
+	// the previous owner removed the file before releasing it
+	::close(iHandle);
+    }
+#endif
+}
+
+//! Release the lock.
+FileLock::~FileLock() {
+    if (iHandle == -1) return;
+#ifdef WIN32
+    CloseHandle(reinterpret_cast<HANDLE>(iHandle));
+#else
+    ::close(iHandle);
+#endif
+}
+
+// --------------------------------------------------------------------
+
 // package Latex source as a tarball to send to online Latex conversion
 String Platform::createTarball(String tex) {
     Buffer tarHeader(512);
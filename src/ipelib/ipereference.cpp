@@ -75,7 +75,9 @@ using namespace ipe;
 
 //! Create a reference to the named object in stylesheet.
 Reference::Reference(const AllAttributes & attr, Attribute name, Vector pos)
-    : Object() {
+    : Object()
+    , iSnaps(nullptr)
+    , iSnap(nullptr) {
     assert(name.isSymbolic());
     iName = name;
     iPos = pos;
@@ -92,7 +94,9 @@ Reference::Reference(const AllAttributes & attr, Attribute name, Vector pos)
 
 //! Create from XML stream.
 Reference::Reference(const XmlAttributes & attr, String /* data */)
-    : Object(attr) {
+    : Object(attr)
+    , iSnaps(nullptr)
+    , iSnap(nullptr) {
     iName = Attribute(true, attr["name"]);
     String str;
     if (attr.has("pos", str)) {
@@ -107,6 +111,36 @@ Reference::Reference(const XmlAttributes & attr, String /* data */)
     iFlags = flagsFromName(iName.string());
 }
 
+//! Copy constructor.
+/*! Only the snap positions currently used are copied. */
+Reference::Reference(const Reference & rhs)
+    : Object(rhs)
+    , iName(rhs.iName)
+    , iPos(rhs.iPos)
+    , iSize(rhs.iSize)
+    , iStroke(rhs.iStroke)
+    , iFill(rhs.iFill)
+    , iPen(rhs.iPen)
+    , iFlags(rhs.iFlags)
+    , iSnaps(nullptr)
+    , iSnap(nullptr) {
+    if (const Snaps * snap = rhs.iSnap.load(std::memory_order_acquire)) {
+	Snaps * copy = new Snaps{snap->iPos, nullptr};
+	iSnaps.store(copy, std::memory_order_relaxed);
+	iSnap.store(copy, std::memory_order_relaxed);
+    }
+}
+
+//! Destructor.
+Reference::~Reference() {
+    Snaps * s = iSnaps.load(std::memory_order_relaxed);
+    while (s) {
+	Snaps * next = s->iNext;
+	delete s;
+	s = next;
+    }
+}
+
 //! Clone object
 Object * Reference::clone() const { return new Reference(*this); }
 
@@ -167,7 +201,7 @@ void Reference::drawSimple(Painter & painter) const {
     painter.pushMatrix();
     painter.transform(matrix());
     painter.translate(iPos);
-    if (iSnap.size() > 0) {
+    if (snaps().size() > 0) {
 	const Symbol * symbol = painter.cascade()->findSymbol(iName);
 	if (symbol) {
 	    painter.untransform(symbol->iTransformations);
@@ -199,8 +233,9 @@ void Reference::drawSimple(Painter & painter) const {
 
   This only adds the position (or the snap positions) to the \a box. */
 void Reference::addToBBox(Rect & box, const Matrix & m, bool cp) const {
-    if (iSnap.size() > 0) {
-	for (const Vector & pos : iSnap) box.addPoint((m * matrix()) * (iPos + pos));
+    const std::vector<Vector> & snap = snaps();
+    if (snap.size() > 0) {
+	for (const Vector & pos : snap) box.addPoint((m * matrix()) * (iPos + pos));
     } else
 	box.addPoint((m * matrix()) * iPos);
 }
@@ -221,9 +256,10 @@ void Reference::checkStyle(const Cascade * sheet, AttributeSeq & seq) const {
 }
 
 double Reference::distance(const Vector & v, const Matrix & m, double bound) const {
-    if (iSnap.size() > 0) {
+    const std::vector<Vector> & snap = snaps();
+    if (snap.size() > 0) {
 	double d = bound;
-	for (const Vector & snapPos : iSnap) {
+	for (const Vector & snapPos : snap) {
 	    double d1 = (v - (m * (matrix() * (iPos + snapPos)))).len();
 	    if (d1 < d) d = d1;
 	}
@@ -234,8 +270,9 @@ double Reference::distance(const Vector & v, const Matrix & m, double bound) con
 
 void Reference::snapVtx(const Vector & mouse, const Matrix & m, Vector & pos,
 			double & bound) const {
-    if (iSnap.size() > 0) {
-	for (const Vector & snapPos : iSnap)
+    const std::vector<Vector> & snap = snaps();
+    if (snap.size() > 0) {
+	for (const Vector & snapPos : snap)
 	    (m * (matrix() * (iPos + snapPos))).snap(mouse, pos, bound);
     } else
 	(m * (matrix() * iPos)).snap(mouse, pos, bound);
@@ -325,9 +362,42 @@ Attribute Reference::getAttribute(Property prop) const noexcept {
 
 // --------------------------------------------------------------------
 
+// Are pos the snap positions of symbol at this size?
+static bool sameSnaps(const std::vector<Vector> & pos, const Symbol * symbol,
+		      double size) {
+    if (pos.size() != symbol->iSnap.size()) return false;
+    for (size_t i = 0; i < pos.size(); ++i)
+	if (pos[i] != size * symbol->iSnap[i]) return false;
+    return true;
+}
+
+/*! Like the BezierCache of a Shape, the cache is lock-free, so that the
+  reference can be drawn on several threads at once.  Snap positions
+  are only added to the list iSnaps, and freed with the reference, so
+  a reader of iSnap never sees them change. */
 void Reference::cacheSnaps(const Symbol * symbol, double size) const {
-    iSnap.clear();
-    for (const Vector & v : symbol->iSnap) iSnap.push_back(size * v);
+    const Snaps * current = iSnap.load(std::memory_order_acquire);
+    if (current && sameSnaps(current->iPos, symbol, size)) return;
+    Snaps * head = iSnaps.load(std::memory_order_acquire);
+    for (Snaps * s = head; s; s = s->iNext) {
+	if (sameSnaps(s->iPos, symbol, size)) {
+	    iSnap.store(s, std::memory_order_release);
+	    return;
+	}
+    }
+    Snaps * snap = new Snaps{{}, head};
+    for (const Vector & v : symbol->iSnap) snap->iPos.push_back(size * v);
+    while (!iSnaps.compare_exchange_weak(snap->iNext, snap, std::memory_order_acq_rel,
+					 std::memory_order_acquire))
+	;
+    iSnap.store(snap, std::memory_order_release);
+}
+
+// Return the snap positions cached by the last call to cacheSnaps().
+const std::vector<Vector> & Reference::snaps() const noexcept {
+    static const std::vector<Vector> none;
+    const Snaps * snap = iSnap.load(std::memory_order_acquire);
+    return snap ? snap->iPos : none;
 }
 
 // --------------------------------------------------------------------
@@ -111,28 +111,100 @@ bool PdfResources::isIpeXForm(int num) const {
     return ipeXForms.find(num) != ipeXForms.end();
 }
 
-void PdfResources::setIpeXForm(int num) { ipeXForms.insert(num); }
+// Return a copy of obj, with all references shifted by offset.
+static const PdfObj * renumbered(const PdfObj * obj, int offset) {
+    if (obj->ref()) return new PdfRef(obj->ref()->value() + offset);
+    if (obj->array()) {
+	PdfArray * a = new PdfArray;
+	for (int i = 0; i < obj->array()->count(); ++i)
+	    a->append(renumbered(obj->array()->obj(i, nullptr), offset));
+	return a;
+    }
+    if (obj->dict()) {
+	const PdfDict * od = obj->dict();
+	PdfDict * d = new PdfDict;
+	for (int i = 0; i < od->count(); ++i)
+	    d->add(od->key(i), renumbered(od->value(i), offset));
+	d->setStream(od->stream());
+	return d;
+    }
+    if (obj->number()) return new PdfNumber(obj->number()->value());
+    if (obj->name()) return new PdfName(obj->name()->value());
+    if (obj->string())
+	return new PdfString(obj->string()->value(), obj->string()->binary());
+    if (obj->boolean()) return new PdfBool(obj->boolean()->value());
+    return new PdfNull;
+}
+
+//! Mark object \a num as the XForm of an Ipe text object.
+/*! If the XForm comes from a later Latex run, the resources of that
+  run that were not renamed by collect() are added to its own
+  resources, where they take precedence over those of the page. */
+void PdfResources::setIpeXForm(int num) {
+    ipeXForms.insert(num);
+    if (iRunResources) addRunResources(num);
+}
+
+// Return object as a dictionary that can be modified (all objects
+// with an offset have been created by renumbered()).
+static PdfDict * modifiable(const PdfObj * obj) {
+    return obj ? const_cast<PdfDict *>(obj->dict()) : nullptr;
+}
+
+void PdfResources::addRunResources(int num) {
+    PdfDict * xf = modifiable(object(num));
+    if (!xf) return;
+    const PdfObj * res = xf->get("Resources");
+    if (res && res->ref()) res = object(res->ref()->value());
+    PdfDict * rd = modifiable(res);
+    if (!rd) {
+	if (res) return; // not a dictionary
+	rd = new PdfDict;
+	xf->add("Resources", rd);
+    }
+    for (int i = 0; i < iRunResources->count(); ++i) {
+	String kind = iRunResources->key(i);
+	const PdfDict * src = iRunResources->value(i)->dict();
+	const PdfObj * kobj = rd->get(kind);
+	if (kobj && kobj->ref()) kobj = object(kobj->ref()->value());
+	PdfDict * kd = modifiable(kobj);
+	if (!kd) {
+	    if (kobj) continue; // not a dictionary
+	    kd = new PdfDict;
+	    rd->add(kind, kd);
+	}
+	for (int j = 0; j < src->count(); ++j) {
+	    if (!kd->get(src->key(j))) kd->add(src->key(j), renumbered(src->value(j), 0));
+	}
+    }
+}
 
-void PdfResources::add(int num, PdfFile * file) {
-    if (object(num)) // already present
+void PdfResources::add(int num, PdfFile * file, int offset) {
+    if (object(num + offset)) // already present
 	return;
     std::unique_ptr<const PdfObj> obj = file->take(num);
     if (!obj) return; // no such object
     const PdfObj * q = obj.get();
-    iObjects[num] = std::move(obj);
-    addIndirect(q, file);
-    iEmbedSequence.push_back(num); // after all its dependencies!
+    if (offset == 0) {
+	if (std::find(iArenas.begin(), iArenas.end(), file->arena()) == iArenas.end())
+	    iArenas.push_back(file->arena());
+	iObjects[num] = std::move(obj);
+    } else
+	iObjects[num + offset].reset(renumbered(q, offset));
+    addIndirect(q, file, offset);
+    iEmbedSequence.push_back(num + offset); // after all its dependencies!
 }
 
-void PdfResources::addIndirect(const PdfObj * q, PdfFile * file) {
+void PdfResources::addIndirect(const PdfObj * q, PdfFile * file, int offset) {
     if (q->array()) {
 	const PdfArray * arr = q->array();
-	for (int i = 0; i < arr->count(); ++i) addIndirect(arr->obj(i, nullptr), file);
+	for (int i = 0; i < arr->count(); ++i)
+	    addIndirect(arr->obj(i, nullptr), file, offset);
     } else if (q->dict()) {
 	const PdfDict * dict = q->dict();
-	for (int i = 0; i < dict->count(); ++i) addIndirect(dict->value(i), file);
+	for (int i = 0; i < dict->count(); ++i) addIndirect(dict->value(i), file, offset);
     } else if (q->ref())
-	add(q->ref()->value(), file);
+	add(q->ref()->value(), file, offset);
 }
 
 const PdfObj * PdfResources::object(int num) const noexcept {
@@ -148,12 +220,26 @@ const PdfDict * PdfResources::baseResources() const noexcept {
 }
 
 //! Collect (recursively) all the given resources (of the one latex page).
-//! Takes ownership of all the scanned objects.
-bool PdfResources::collect(const PdfDict * resd, PdfFile * file) {
+/*! Takes ownership of all the scanned objects.
+
+  When the text objects were typeset in several Latex runs, this is
+  called once for each run.  The objects of later runs are copied with
+  their object numbers increased by \a offset (see nextObjectNumber()),
+  and \a suffix is appended to their XObject and Font names, so that
+  they do not clash with earlier runs.  The other kinds of resources
+  (such as the patterns and shadings of pgf, which every run numbers
+  from one) are referred to by name from the content streams.  The
+  page keeps the first definition of such a name, and setIpeXForm()
+  adds the definitions of a later run to the XForms of that run.
+*/
+bool PdfResources::collect(const PdfDict * resd, PdfFile * file, int offset,
+			   String suffix) {
     /* A resource is a dictionary, like this:
       /Font << /F8 9 0 R /F10 18 0 R >>
       /ProcSet [ /PDF /Text ]
     */
+    iRunResources.reset();
+    if (!suffix.empty()) iRunResources = std::make_unique<PdfDict>();
     for (int i = 0; i < resd->count(); ++i) {
 	String key = resd->key(i);
 	if (key == "Ipe" || key == "ProcSet") continue;
@@ -163,25 +249,48 @@ bool PdfResources::collect(const PdfDict * resd, PdfFile * file) {
 	    ipeDebug("Resource %s is not a dictionary", key.z());
 	    return false;
 	}
-	PdfDict * d = new PdfDict;
+	bool rename = (key == "XObject" || key == "Font");
+	// all resource dictionaries in iPageResources have been created here
+	PdfDict * d = const_cast<PdfDict *>(resourcesOfKind(key));
+	bool fresh = (d == nullptr);
+	if (fresh) d = new PdfDict;
+	PdfDict * run = nullptr;
+	if (iRunResources && !rename) {
+	    run = new PdfDict;
+	    iRunResources->add(key, run);
+	}
 	for (int j = 0; j < rd->count(); ++j) {
-	    if (!addToResource(d, rd->key(j), rd->value(j), file)) return false;
+	    String name = rd->key(j);
+	    if (run && !addToResource(run, name, rd->value(j), file, offset))
+		return false;
+	    if (rename)
+		name += suffix;
+	    else if (!fresh && d->get(name))
+		continue;
+	    if (!addToResource(d, name, rd->value(j), file, offset)) return false;
 	}
-	iPageResources->add(key, d);
+	if (fresh) iPageResources->add(key, d);
     }
     return true;
 }
 
+//! Return a number larger than the numbers of all objects collected so far.
+int PdfResources::nextObjectNumber() const noexcept {
+    int num = 0;
+    for (const auto & [n, obj] : iObjects) num = std::max(num, n);
+    return num + 1;
+}
+
 bool PdfResources::addToResource(PdfDict * d, String key, const PdfObj * el,
-				 PdfFile * file) {
+				 PdfFile * file, int offset) {
     if (el->name())
 	d->add(key, new PdfName(el->name()->value()));
     else if (el->number())
 	d->add(key, new PdfNumber(el->number()->value()));
     else if (el->ref()) {
 	int ref = el->ref()->value();
-	d->add(key, new PdfRef(ref));
-	add(ref, file); // take all dependencies from file
+	d->add(key, new PdfRef(ref + offset));
+	add(ref, file, offset); // take all dependencies from file
     } else if (el->array()) {
 	PdfArray * a = new PdfArray;
 	for (int i = 0; i < el->array()->count(); ++i) {
@@ -200,7 +309,8 @@ bool PdfResources::addToResource(PdfDict * d, String key, const PdfObj * el,
 	const PdfDict * eld = el->dict();
 	PdfDict * d1 = new PdfDict;
 	for (int i = 0; i < eld->count(); ++i) {
-	    if (!addToResource(d1, eld->key(i), eld->value(i), file)) return false;
+	    if (!addToResource(d1, eld->key(i), eld->value(i), file, offset))
+		return false;
 	}
 	d->add(key, d1);
     }
@@ -31,6 +31,10 @@
 #include "ipeshape.h"
 #include "ipepainter.h"
 
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+
 using namespace ipe;
 
 // --------------------------------------------------------------------
@@ -48,6 +52,192 @@ inline void snapBezier(const Vector & mouse, const Bezier & bez, Vector & pos,
 
 // --------------------------------------------------------------------
 
+/*! \class ipe::BezierCache
+  \ingroup geo
+  \brief Lazily computed Bezier curves of a Curve or ClosedSpline.
+
+  The splines of a subpath are converted to Bezier curves when they
+  are first needed, and these are then kept until the subpath is
+  modified.  For each tolerance used for bounding boxes and distances,
+  the cache also keeps polygonal chains approximating the curves, with
+  a bounding box for each curve, so that curves far from the query
+  point can be skipped.
+
+  For drawing to the screen, long runs of straight segments are
+  simplified to the precision of the screen, see Curve::draw().  The
+  simplified chains are kept for each precision used.
+
+  The cache can be filled by several threads at once.  A thread that
+  loses the race to publish its data deletes it again.  Modifying the
+  subpath clears the cache, so this must not happen while another
+  thread is using the subpath.
+*/
+
+BezierCache::Data::~Data() {
+    Flattening * f = iFlat.load(std::memory_order_relaxed);
+    while (f) {
+	Flattening * next = f->iNext;
+	delete f;
+	f = next;
+    }
+}
+
+//! Clear the cache.
+void BezierCache::clear() noexcept {
+    delete iData.exchange(nullptr, std::memory_order_acq_rel);
+    Decimation * d = iDecimation.exchange(nullptr, std::memory_order_acq_rel);
+    while (d) {
+	Decimation * next = d->iNext;
+	delete d;
+	d = next;
+    }
+}
+
+//! Store \a data in the cache, unless another thread has done so already.
+/*! Takes ownership of \a data, and returns the data in the cache. */
+const BezierCache::Data * BezierCache::publish(Data * data) const noexcept {
+    for (const auto & b : data->iBez) {
+	Rect box(b.iV[0], b.iV[1]);
+	box.addPoint(b.iV[2]);
+	box.addPoint(b.iV[3]);
+	data->iHull.push_back(box);
+    }
+    Data * current = nullptr;
+    if (iData.compare_exchange_strong(current, data, std::memory_order_acq_rel,
+				      std::memory_order_acquire))
+	return data;
+    delete data;
+    return current;
+}
+
+//! Return simplified runs for precision 2 ^ \a exponent, or nullptr.
+const BezierCache::Decimation * BezierCache::decimation(int exponent) const noexcept {
+    for (Decimation * d = iDecimation.load(std::memory_order_acquire); d; d = d->iNext)
+	if (d->iExponent == exponent) return d;
+    return nullptr;
+}
+
+//! Store \a decimation in the cache, unless another thread has done so already.
+/*! Takes ownership of \a decimation, and returns the data in the cache. */
+const BezierCache::Decimation *
+BezierCache::publish(Decimation * decimation) const noexcept {
+    decimation->iNext = iDecimation.load(std::memory_order_acquire);
+    while (!iDecimation.compare_exchange_weak(decimation->iNext, decimation,
+					      std::memory_order_acq_rel,
+					      std::memory_order_acquire)) {
+	for (Decimation * d = decimation->iNext; d; d = d->iNext) {
+	    if (d->iExponent == decimation->iExponent) {
+		delete decimation;
+		return d;
+	    }
+	}
+    }
+    return decimation;
+}
+
+// Largest factor by which the linear part of m stretches a vector.
+static double stretch(const Matrix & m) {
+    double f = m.a[0] * m.a[0] + m.a[1] * m.a[1] + m.a[2] * m.a[2] + m.a[3] * m.a[3];
+    double det = m.a[0] * m.a[3] - m.a[1] * m.a[2];
+    double s = std::sqrt(0.5 * (f + std::sqrt(std::max(0.0, f * f - 4.0 * det * det))));
+    return (s > 0.0 && std::isfinite(s)) ? s : 1.0;
+}
+
+//! Return polygonal chains approximating the curves.
+/*! The chains approximate the curves transformed by \a m to within
+  \a tolerance.  They are computed for the untransformed curves, with
+  the tolerance rounded down to a power of two, so that the same
+  chains can be used for all matrices with similar scaling. */
+const BezierCache::Flattening & BezierCache::Data::flattening(const Matrix & m,
+							       double tolerance) const {
+    int exponent = std::clamp(std::ilogb(tolerance / stretch(m)), -16, 4);
+    Flattening * head = iFlat.load(std::memory_order_acquire);
+    for (Flattening * f = head; f; f = f->iNext)
+	if (f->iExponent == exponent) return *f;
+    Flattening * f = new Flattening;
+    f->iExponent = exponent;
+    double precision = std::ldexp(1.0, exponent);
+    for (const auto & b : iBez) {
+	int first = f->iPoints.size();
+	f->iChunk.push_back(first);
+	f->iPoints.push_back(b.iV[0]);
+	b.approximate(precision, f->iPoints);
+	Rect box;
+	for (int i = first; i < size(f->iPoints); ++i) box.addPoint(f->iPoints[i]);
+	f->iBox.push_back(box);
+    }
+    f->iChunk.push_back(f->iPoints.size());
+    f->iNext = head;
+    while (!iFlat.compare_exchange_weak(f->iNext, f, std::memory_order_acq_rel,
+					std::memory_order_acquire)) {
+	for (Flattening * g = f->iNext; g; g = g->iNext) {
+	    if (g->iExponent == exponent) {
+		delete f;
+		return *g;
+	    }
+	}
+    }
+    return *f;
+}
+
+// Bounding box of rectangle r transformed by m.
+static Rect transformed(const Matrix & m, const Rect & r) {
+    Rect box(m * r.bottomLeft());
+    box.addPoint(m * r.topRight());
+    box.addPoint(m * r.topLeft());
+    box.addPoint(m * r.bottomRight());
+    return box;
+}
+
+// Add Bezier curves b0 to b1 - 1, transformed by m, to box (accurate to within 0.5).
+static void addBeziersToBBox(const BezierCache::Data & data, int b0, int b1, Rect & box,
+			     const Matrix & m) {
+    const BezierCache::Flattening & f = data.flattening(m, 0.5);
+    bool translation = m.linear().isIdentity();
+    for (int i = b0; i < b1; ++i) {
+	Rect r;
+	if (translation) {
+	    r = Rect(f.iBox[i].bottomLeft() + m.translation(),
+		     f.iBox[i].topRight() + m.translation());
+	} else {
+	    for (int k = f.iChunk[i]; k < f.iChunk[i + 1]; ++k)
+		r.addPoint(m * f.iPoints[k]);
+	}
+	box.addRect(
+	    Rect(r.bottomLeft() - Vector(0.5, 0.5), r.topRight() + Vector(0.5, 0.5)));
+    }
+}
+
+// Distance to Bezier curves b0 to b1 - 1 transformed by m, approximated to 1.0.
+static double distanceToBeziers(const BezierCache::Data & data, int b0, int b1,
+				const Vector & v, const Matrix & m, double bound) {
+    const BezierCache::Flattening & f = data.flattening(m, 1.0);
+    double d = bound;
+    double d1;
+    for (int i = b0; i < b1; ++i) {
+	if (transformed(m, f.iBox[i]).certainClearance(v, d)) continue;
+	Vector cur = m * f.iPoints[f.iChunk[i]];
+	for (int k = f.iChunk[i] + 1; k < f.iChunk[i + 1]; ++k) {
+	    Vector next = m * f.iPoints[k];
+	    if ((d1 = Segment(cur, next).distance(v, d)) < d) d = d1;
+	    cur = next;
+	}
+    }
+    return d;
+}
+
+// Snap to boundary of Bezier curves b0 to b1 - 1 transformed by m.
+static void snapBeziers(const BezierCache::Data & data, int b0, int b1,
+			const Vector & mouse, const Matrix & m, Vector & pos,
+			double & bound) {
+    for (int i = b0; i < b1; ++i) {
+	if (!transformed(m, data.iHull[i]).certainClearance(mouse, bound))
+	    snapBezier(mouse, m * data.iBez[i], pos, bound);
+    }
+}
+
+// --------------------------------------------------------------------
+
 /*! \class ipe::CurveSegment
   \ingroup geo
   \brief A segment on an SubPath.
@@ -120,7 +310,15 @@ float CurveSegment::tension() const {
 }
 
 //! Convert spline curve to a sequence of Bezier splines.
+/*! The Bezier splines are appended to \a bez. */
 void CurveSegment::beziers(std::vector<Bezier> & bez) const {
+    const BezierCache::Data & data = iCurve->bezierData();
+    bez.insert(bez.end(), data.iBez.begin() + data.iFirst[index],
+	       data.iBez.begin() + data.iFirst[index + 1]);
+}
+
+// Compute the Bezier splines of the segment (used to fill the cache).
+void CurveSegment::computeBeziers(std::vector<Bezier> & bez) const {
     switch (type()) {
     case EOldSpline: Bezier::oldSpline(countCP(), cps(), bez); break;
     case ESpline: Bezier::spline(countCP(), cps(), bez); break;
@@ -150,9 +348,9 @@ void CurveSegment::draw(Painter & painter) const {
     case ESpline:
     case ECardinalSpline:
     case ESpiroSpline: {
-	std::vector<Bezier> bez;
-	beziers(bez);
-	for (const auto & b : bez) painter.curveTo(b);
+	const BezierCache::Data & data = iCurve->bezierData();
+	for (int i = data.iFirst[index]; i < data.iFirst[index + 1]; ++i)
+	    painter.curveTo(data.iBez[i]);
 	break;
     }
     case EArc: painter.drawArc(arc()); break;
@@ -184,9 +382,8 @@ void CurveSegment::addToBBox(Rect & box, const Matrix & m, bool cpf) const {
 	if (cpf) {
 	    for (int i = 0; i < countCP(); ++i) box.addPoint(m * cp(i));
 	} else {
-	    std::vector<Bezier> bez;
-	    beziers(bez);
-	    for (const auto & b : bez) box.addRect((m * b).bbox());
+	    const BezierCache::Data & data = iCurve->bezierData();
+	    addBeziersToBBox(data, data.iFirst[index], data.iFirst[index + 1], box, m);
 	}
 	break;
     }
@@ -201,14 +398,9 @@ double CurveSegment::distance(const Vector & v, const Matrix & m, double bound)
     case ESpline:
     case ECardinalSpline:
     case ESpiroSpline: {
-	std::vector<Bezier> bez;
-	beziers(bez);
-	double d = bound;
-	double d1;
-	for (const auto & b : bez) {
-	    if ((d1 = (m * b).distance(v, d)) < d) d = d1;
-	}
-	return d;
+	const BezierCache::Data & data = iCurve->bezierData();
+	return distanceToBeziers(data, data.iFirst[index], data.iFirst[index + 1], v, m,
+				 bound);
     }
     default: // make compiler happy
 	return bound;
@@ -272,9 +464,9 @@ void CurveSegment::snapBnd(const Vector & mouse, const Matrix & m, Vector & pos,
     case EOldSpline:
     case ECardinalSpline:
     case ESpiroSpline: {
-	std::vector<Bezier> bez;
-	beziers(bez);
-	for (const auto & b : bez) snapBezier(mouse, m * b, pos, bound);
+	const BezierCache::Data & data = iCurve->bezierData();
+	snapBeziers(data, data.iFirst[index], data.iFirst[index + 1], mouse, m, pos,
+		    bound);
 	break;
     }
     }
@@ -292,6 +484,7 @@ Curve::Curve() { iClosed = false; }
 
 //! Append a straight segment to the subpath.
 void Curve::appendSegment(const Vector & v0, const Vector & v1) {
+    iCache.clear();
     if (iSeg.empty()) iCP.push_back(v0);
     assert(v0 == iCP.back());
     iCP.push_back(v1);
@@ -304,6 +497,7 @@ void Curve::appendSegment(const Vector & v0, const Vector & v1) {
 
 //! Append elliptic arc to the subpath.
 void Curve::appendArc(const Matrix & m, const Vector & v0, const Vector & v1) {
+    iCache.clear();
     if (iSeg.empty()) iCP.push_back(v0);
     assert(v0 == iCP.back());
     iCP.push_back(v1);
@@ -319,6 +513,7 @@ void Curve::appendArc(const Matrix & m, const Vector & v0, const Vector & v1) {
 void Curve::appendSpline(const std::vector<Vector> & v, CurveSegment::Type type) {
     assert(type == CurveSegment::ESpline || type == CurveSegment::ECardinalSpline
 	   || type == CurveSegment::EOldSpline);
+    iCache.clear();
     if (iSeg.empty()) iCP.push_back(v[0]);
     assert(v[0] == iCP.back());
     for (int i = 1; i < size(v); ++i) iCP.push_back(v[i]);
@@ -337,6 +532,7 @@ void Curve::appendCardinalSpline(const std::vector<Vector> & v, float tension) {
 
 //! Append a spiro spline curve.
 void Curve::appendSpiroSpline(const std::vector<Vector> & v) {
+    iCache.clear();
     if (iSeg.empty()) iCP.push_back(v[0]);
     assert(v[0] == iCP.back());
     // compute Bezier representation
@@ -360,6 +556,7 @@ void Curve::appendSpiroSpline(const std::vector<Vector> & v) {
 
 //! Append a spiro spline curve with precomputed Bezier control points.
 void Curve::appendSpiroSplinePrecomputed(const std::vector<Vector> & v, int sep) {
+    iCache.clear();
     if (iSeg.empty()) iCP.push_back(v[0]);
     assert(v[0] == iCP.back());
     // add Bezier representation
@@ -439,21 +636,129 @@ void Curve::save(Stream & stream) const {
     if (closed()) stream << "h\n";
 }
 
+// Curves with fewer segments are always drawn exactly.
+constexpr int DECIMATE_SEGMENTS = 1000;
+// Shorter runs of straight segments are not simplified.
+constexpr int DECIMATE_RUN = 64;
+
+/*! If the painter allows omitting detail (see Painter::detail()), long
+  runs of straight segments are replaced by a simplified chain.  It
+  keeps, for each column of width less than the detail, the first and
+  last vertex and the vertices with smallest and largest
+  y-coordinate, so that spikes in dense plots are preserved.  The
+  result differs from the exact drawing by less than the detail.
+*/
 void Curve::draw(Painter & painter) const {
     painter.moveTo(iCP[0]);
-    for (int i = 0; i < countSegments(); ++i) segment(i).draw(painter);
+    const int n = countSegments();
+    const BezierCache::Decimation * d = nullptr;
+    if (painter.detail() > 0.0 && n >= DECIMATE_SEGMENTS)
+	d = decimation(painter.matrix(), painter.detail());
+    int i = 0;
+    if (d) {
+	for (const auto & run : d->iRuns) {
+	    for (; i < run.iBegin; ++i) segment(i).draw(painter);
+	    // the first point of the run is the current point
+	    for (int k = run.iFirst + 1; k < run.iLast; ++k)
+		painter.lineTo(d->iPoints[k]);
+	    i = run.iEnd;
+	}
+    }
+    for (; i < n; ++i) segment(i).draw(painter);
     if (closed()) painter.closePath();
 }
 
+// Append vertices of the chain v[0], ..., v[n-1] to out, keeping the first,
+// last, lowest, and highest vertex of each column of width w.
+static void decimate(const Vector * v, int n, double w, std::vector<Vector> & out) {
+    out.push_back(v[0]);
+    int k = 1;
+    while (k < n) {
+	double column = std::floor(v[k].x / w);
+	int lo = k;
+	int hi = k;
+	int j = k + 1;
+	while (j < n && std::floor(v[j].x / w) == column) {
+	    if (v[j].y < v[lo].y) lo = j;
+	    if (v[j].y > v[hi].y) hi = j;
+	    ++j;
+	}
+	int keep[4] = {k, std::min(lo, hi), std::max(lo, hi), j - 1};
+	for (int t = 0; t < 4; ++t)
+	    if (t == 0 || keep[t] != keep[t - 1]) out.push_back(v[keep[t]]);
+	k = j;
+    }
+}
+
+// Return simplified runs for drawing with matrix m to within tolerance,
+// or nullptr if the curve should be drawn exactly.
+const BezierCache::Decimation * Curve::decimation(const Matrix & m,
+						  double tolerance) const {
+    int exponent = std::ilogb(tolerance / stretch(m));
+    if (exponent < -16) return nullptr;
+    exponent = std::min(exponent, 8);
+    if (const BezierCache::Decimation * d = iCache.decimation(exponent)) return d;
+    BezierCache::Decimation * d = new BezierCache::Decimation;
+    d->iExponent = exponent;
+    double w = std::ldexp(1.0, exponent);
+    const int n = countSegments();
+    for (int i = 0; i < n;) {
+	int j = straightRun(i, n);
+	if (j - i >= DECIMATE_RUN) {
+	    int first = iSeg[i].iLastCP - 1;
+	    int last = iSeg[j - 1].iLastCP;
+	    int p = d->iPoints.size();
+	    decimate(&iCP[first], last - first + 1, w, d->iPoints);
+	    d->iRuns.push_back({i, j, p, int(d->iPoints.size())});
+	}
+	i = (j > i) ? j : i + 1;
+    }
+    return iCache.publish(d);
+}
+
 void Curve::addToBBox(Rect & box, const Matrix & m, bool cp) const {
     for (int i = 0; i < countSegments(); ++i) segment(i).addToBBox(box, m, cp);
 }
 
+// Return the end of the run of straight segments starting at segment i.
+int Curve::straightRun(int i, int n) const {
+    while (i < n && iSeg[i].iType == CurveSegment::ESegment) ++i;
+    return i;
+}
+
+// Return points (or midpoints) of straight segments i to j - 1, transformed by m.
+/* The result is only valid until the next call on the same thread. */
+const Polyline & Curve::straightPoints(int i, int j, const Matrix & m, bool mid) const {
+    thread_local Polyline poly;
+    poly.clear();
+    int first = iSeg[i].iLastCP - 1;
+    int last = iSeg[j - 1].iLastCP;
+    if (mid) {
+	for (int k = first; k < last; ++k)
+	    poly.push_back(m * (0.5 * (iCP[k] + iCP[k + 1])));
+    } else {
+	for (int k = first; k <= last; ++k) poly.push_back(m * iCP[k]);
+    }
+    return poly;
+}
+
+/*! Runs of straight segments are handled by Polyline::nearestSegment(),
+  so that long polygonal chains are tested quickly. */
 double Curve::distance(const Vector & v, const Matrix & m, double bound) const {
     double d = bound;
-    for (int i = 0; i < countSegmentsClosing(); ++i) {
-	double d1 = segment(i).distance(v, m, d);
-	if (d1 < d) d = d1;
+    double d1;
+    const int n = countSegmentsClosing();
+    for (int i = 0; i < n;) {
+	int j = straightRun(i, n);
+	if (j > i) {
+	    const Polyline & poly = straightPoints(i, j, m, false);
+	    int k = poly.nearestSegment(v, d1);
+	    Segment seg(poly.point(k), poly.point(k + 1));
+	    if ((d1 = seg.distance(v, d)) < d) d = d1;
+	    i = j;
+	} else {
+	    if ((d1 = segment(i++).distance(v, m, d)) < d) d = d1;
+	}
     }
     return d;
 }
@@ -465,15 +770,50 @@ void Curve::snapVtx(const Vector & mouse, const Matrix & m, Vector & pos, double
     else if (closed())
 	// midpoint of closing segment
 	closingSegment().snapVtx(mouse, m, pos, bound, ctl);
-    for (int i = 0; i < countSegments(); ++i)
-	segment(i).snapVtx(mouse, m, pos, bound, ctl);
+    const int n = countSegments();
+    double sqd;
+    for (int i = 0; i < n;) {
+	int j = straightRun(i, n);
+	if (j > i) {
+	    // segment endpoints, or midpoints
+	    const Polyline & poly = straightPoints(i, j, m, ctl);
+	    int k = poly.nearestVertex(mouse, sqd);
+	    snapVertex(mouse, poly.point(k), pos, bound);
+	    i = j;
+	} else
+	    segment(i++).snapVtx(mouse, m, pos, bound, ctl);
+    }
 }
 
 void Curve::snapBnd(const Vector & mouse, const Matrix & m, Vector & pos,
 		    double & bound) const {
     snapVertex(mouse, m * segment(0).cp(0), pos, bound);
-    for (int i = 0; i < countSegmentsClosing(); ++i)
-	segment(i).snapBnd(mouse, m, pos, bound);
+    const int n = countSegmentsClosing();
+    double sqd;
+    for (int i = 0; i < n;) {
+	int j = straightRun(i, n);
+	if (j > i) {
+	    const Polyline & poly = straightPoints(i, j, m, false);
+	    int k = poly.nearestSegment(mouse, sqd);
+	    // Segment::snap only tests the second endpoint
+	    snapVertex(mouse, poly.point(k), pos, bound);
+	    Segment(poly.point(k), poly.point(k + 1)).snap(mouse, pos, bound);
+	    i = j;
+	} else
+	    segment(i++).snapBnd(mouse, m, pos, bound);
+    }
+}
+
+// Return the Bezier splines of all segments, computing them if necessary.
+const BezierCache::Data & Curve::bezierData() const {
+    if (const BezierCache::Data * data = iCache.data()) return *data;
+    BezierCache::Data * data = new BezierCache::Data;
+    for (int i = 0; i < countSegmentsClosing(); ++i) {
+	data->iFirst.push_back(data->iBez.size());
+	segment(i).computeBeziers(data->iBez);
+    }
+    data->iFirst.push_back(data->iBez.size());
+    return *iCache.publish(data);
 }
 
 //! Returns the closing segment of a closed path.
@@ -563,6 +903,9 @@ void Ellipse::snapBnd(const Vector & mouse, const Matrix & m, Vector & pos,
 /*! \class ipe::ClosedSpline
   \ingroup geo
   \brief A closed B-spline curve.
+
+  The Bezier splines of the curve are cached when first needed, so the
+  control points iCP must not be modified after that.
 */
 
 ClosedSpline::ClosedSpline(const std::vector<Vector> & v) {
@@ -580,10 +923,9 @@ void ClosedSpline::save(Stream & stream) const {
 }
 
 void ClosedSpline::draw(Painter & painter) const {
-    std::vector<Bezier> bez;
-    beziers(bez);
-    painter.moveTo(bez.front().iV[0]);
-    for (const auto & b : bez) painter.curveTo(b);
+    const BezierCache::Data & data = bezierData();
+    painter.moveTo(data.iBez.front().iV[0]);
+    for (const auto & b : data.iBez) painter.curveTo(b);
     painter.closePath();
 }
 
@@ -591,25 +933,31 @@ void ClosedSpline::addToBBox(Rect & box, const Matrix & m, bool cpf) const {
     if (cpf) {
 	for (const auto & cp : iCP) box.addPoint(m * cp);
     } else {
-	std::vector<Bezier> bez;
-	beziers(bez);
-	for (const auto & b : bez) box.addRect((m * b).bbox());
+	const BezierCache::Data & data = bezierData();
+	addBeziersToBBox(data, 0, size(data.iBez), box, m);
     }
 }
 
 double ClosedSpline::distance(const Vector & v, const Matrix & m, double bound) const {
-    std::vector<Bezier> bez;
-    beziers(bez);
-    double d = bound;
-    double d1;
-    for (const auto & b : bez) {
-	if ((d1 = (m * b).distance(v, d)) < d) d = d1;
-    }
-    return d;
+    const BezierCache::Data & data = bezierData();
+    return distanceToBeziers(data, 0, size(data.iBez), v, m, bound);
 }
 
+//! Convert closed spline to a sequence of Bezier splines.
+/*! The Bezier splines are appended to \a bez. */
 void ClosedSpline::beziers(std::vector<Bezier> & bez) const {
-    Bezier::closedSpline(iCP.size(), &iCP.front(), bez);
+    const BezierCache::Data & data = bezierData();
+    bez.insert(bez.end(), data.iBez.begin(), data.iBez.end());
+}
+
+// Return the Bezier splines, computing them if necessary.
+const BezierCache::Data & ClosedSpline::bezierData() const {
+    if (const BezierCache::Data * data = iCache.data()) return *data;
+    BezierCache::Data * data = new BezierCache::Data;
+    Bezier::closedSpline(iCP.size(), &iCP.front(), data->iBez);
+    data->iFirst.push_back(0);
+    data->iFirst.push_back(data->iBez.size());
+    return *iCache.publish(data);
 }
 
 void ClosedSpline::snapVtx(const Vector & mouse, const Matrix & m, Vector & pos,
@@ -622,9 +970,8 @@ void ClosedSpline::snapVtx(const Vector & mouse, const Matrix & m, Vector & pos,
 
 void ClosedSpline::snapBnd(const Vector & mouse, const Matrix & m, Vector & pos,
 			   double & bound) const {
-    std::vector<Bezier> bez;
-    beziers(bez);
-    for (const auto & b : bez) snapBezier(mouse, m * b, pos, bound);
+    const BezierCache::Data & data = bezierData();
+    snapBeziers(data, 0, size(data.iBez), mouse, m, pos, bound);
 }
 
 // --------------------------------------------------------------------
@@ -657,7 +1004,8 @@ void ClosedSpline::snapBnd(const Vector & mouse, const Matrix & m, Vector & pos,
   passed by value efficiently.  The only mutator methods are
   appendSubPath() and load(), which can only be called during
   construction of the Shape (that is, before its implementation has
-  been shared).
+  been shared).  The reference count is atomic, so copies of a Shape
+  can be used on several threads at once.
 */
 
 //! Construct an empty shape (zero subpaths).
@@ -669,26 +1017,20 @@ Shape::Shape() {
 //! Copy constructor (constant time).
 Shape::Shape(const Shape & rhs) {
     iImp = rhs.iImp;
-    iImp->iRefCount++;
+    iImp->iRefCount.fetch_add(1, std::memory_order_relaxed);
 }
 
 //! Destructor (takes care of reference counting).
 Shape::~Shape() {
-    if (iImp->iRefCount == 1)
-	delete iImp;
-    else
-	iImp->iRefCount--;
+    if (iImp->iRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1) delete iImp;
 }
 
 //! Assignment operator (constant-time).
 Shape & Shape::operator=(const Shape & rhs) {
     if (this != &rhs) {
-	if (iImp->iRefCount == 1)
-	    delete iImp;
-	else
-	    iImp->iRefCount--;
+	rhs.iImp->iRefCount.fetch_add(1, std::memory_order_relaxed);
+	if (iImp->iRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1) delete iImp;
 	iImp = rhs.iImp;
-	iImp->iRefCount++;
     }
     return *this;
 }
@@ -806,19 +1148,48 @@ Shape::Imp::~Imp() {
     }
 }
 
-static Vector getVector(std::vector<double> & args) {
-    Vector v;
-    v.x = args[0];
-    v.y = args[1];
-    args.erase(args.begin(), args.begin() + 2);
-    return v;
+namespace {
+// Scanner for path data, working directly on the character buffer.
+class PathLex {
+public:
+    explicit PathLex(const String & data)
+	: iTok(data.data())
+	, iPos(data.data())
+	, iEnd(data.data() + data.size()) {}
+    bool next();
+    //! Return the operator, or zero if the token is longer than one character.
+    char op() const { return (iPos - iTok == 1) ? *iTok : '\0'; }
+    double number() const;
+
+private:
+    const char * iTok;
+    const char * iPos;
+    const char * iEnd;
+};
+} // namespace
+
+//! Move to the next token, return false at the end of the data.
+bool PathLex::next() {
+    while (iPos < iEnd && uint8_t(*iPos) <= ' ') ++iPos;
+    if (iPos == iEnd) return false;
+    iTok = iPos;
+    while (iPos < iEnd && uint8_t(*iPos) > ' ') ++iPos;
+    return true;
 }
 
-static Matrix getMatrix(std::vector<double> & args) {
-    Matrix m;
-    for (int i = 0; i < 6; ++i) m.a[i] = args[i];
-    args.erase(args.begin(), args.begin() + 6);
-    return m;
+//! Convert the token like Lex::getDouble, without copying it in the common case.
+double PathLex::number() const {
+    double num = 0.0;
+    auto res = std::from_chars(iTok, iPos, num);
+    if (res.ec == std::errc() && res.ptr == iPos) return num;
+    // leading '+', hexadecimal, out of range, or not a number at all
+    return Platform::toDouble(String(iTok, iPos - iTok));
+}
+
+static Vector getVector(const double * args) { return Vector(args[0], args[1]); }
+
+static Matrix getMatrix(const double * args) {
+    return Matrix(args[0], args[1], args[2], args[3], args[4], args[5]);
 }
 
 //! Save Shape onto XML stream.
@@ -835,61 +1206,66 @@ void Shape::save(Stream & stream) const {
   will panic if the implementation has been shared. */
 bool Shape::load(String data) {
     assert(iImp->iRefCount == 1);
-    Lex stream(data);
-    String word;
-    String type;
+    PathLex stream(data);
     Curve * sp = nullptr;
     Vector org;
     int mid = -1;
     std::vector<double> args;
-    do {
-	if (stream.token() == "h") { // closing path
+    std::vector<Vector> v;
+    while (stream.next()) {
+	char type = stream.op();
+	switch (type) {
+	case 'h': // closing path
 	    if (!sp) return false;
-	    stream.nextToken(); // eat token
 	    sp->setClosed(true);
 	    sp = nullptr;
 	    mid = -1;
-	} else if (stream.token() == "m") {
+	    break;
+	case 'm':
 	    if (args.size() != 2) return false;
-	    stream.nextToken(); // eat token
 	    // begin new subpath
 	    sp = new Curve;
 	    appendSubPath(sp);
-	    org = getVector(args);
+	    org = getVector(args.data());
+	    args.clear();
 	    mid = -1;
-	} else if (stream.token() == "l") {
+	    break;
+	case 'l': {
 	    if (!sp || args.size() != 2) return false;
-	    stream.nextToken(); // eat token
-	    while (!args.empty()) {
-		Vector v = getVector(args);
-		sp->appendSegment(org, v);
-		org = v;
-	    }
+	    Vector v1 = getVector(args.data());
+	    sp->appendSegment(org, v1);
+	    org = v1;
+	    args.clear();
 	    mid = -1;
-	} else if (stream.token() == "a") {
+	    break;
+	}
+	case 'a': {
 	    if (!sp || args.size() != 8) return false;
-	    stream.nextToken();
-	    Matrix m = getMatrix(args);
+	    Matrix m = getMatrix(args.data());
 	    if (m.determinant() == 0) return false; // don't accept zero-radius arc
-	    Vector v1 = getVector(args);
+	    Vector v1 = getVector(args.data() + 6);
 	    sp->appendArc(m, org, v1);
 	    org = v1;
+	    args.clear();
 	    mid = -1;
-	} else if (stream.token() == "s" || stream.token() == "q" || stream.token() == "c"
-		   || stream.token() == "C" || stream.token() == "L") {
-	    size_t parity = (stream.token() == "C") ? 1 : 0;
+	    break;
+	}
+	case 's':
+	case 'q':
+	case 'c':
+	case 'C':
+	case 'L': {
+	    size_t parity = (type == 'C') ? 1 : 0;
 	    if (!sp || args.size() < 2 || (args.size() % 2 != parity)) return false;
-	    String typeToken = stream.token();
-	    stream.nextToken();
-	    std::vector<Vector> v;
+	    v.clear();
 	    v.push_back(org);
-	    while (args.size() >= 2) v.push_back(getVector(args));
-	    if (typeToken == "s")
+	    for (size_t i = 0; i + 1 < args.size(); i += 2)
+		v.push_back(getVector(&args[i]));
+	    if (type == 's')
 		sp->appendOldSpline(v);
-	    else if (typeToken == "C") {
-		sp->appendCardinalSpline(v, float(args.back()));
-		args.pop_back(); // remove tension
-	    } else if (typeToken == "L") {
+	    else if (type == 'C')
+		sp->appendCardinalSpline(v, float(args.back())); // last is tension
+	    else if (type == 'L') {
 		if (mid >= 0) {
 		    if ((mid % 2) != 0) // wrong parity
 			return false;
@@ -902,36 +1278,38 @@ bool Shape::load(String data) {
 	    } else
 		sp->appendSpline(v);
 	    org = v.back();
+	    args.clear();
 	    mid = -1;
-	} else if (stream.token() == "e") {
+	    break;
+	}
+	case 'e': {
 	    if (args.size() != 6) return false;
-	    stream.nextToken();
 	    sp = nullptr;
 	    mid = -1;
-	    Matrix m = getMatrix(args);
+	    Matrix m = getMatrix(args.data());
 	    if (m.determinant() == 0) return false; // don't accept zero-radius arc
-	    Ellipse * e = new Ellipse(m);
-	    appendSubPath(e);
-	} else if (stream.token() == "u") {
+	    appendSubPath(new Ellipse(m));
+	    args.clear();
+	    break;
+	}
+	case 'u':
 	    if (args.size() < 6 || (args.size() % 2 != 0)) return false;
-	    stream.nextToken();
 	    sp = nullptr;
 	    mid = -1;
-	    std::vector<Vector> v;
-	    while (!args.empty()) v.push_back(getVector(args));
-	    ClosedSpline * e = new ClosedSpline(v);
-	    appendSubPath(e);
-	} else if (stream.token() == "*") {
+	    v.clear();
+	    for (size_t i = 0; i < args.size(); i += 2) v.push_back(getVector(&args[i]));
+	    appendSubPath(new ClosedSpline(v));
+	    args.clear();
+	    break;
+	case '*':
 	    // remember position in args
 	    mid = args.size();
-	    stream.nextToken();
-	} else { // must be a number
-	    double num;
-	    stream >> num;
-	    args.push_back(num);
+	    break;
+	default: // must be a number
+	    args.push_back(stream.number());
+	    break;
 	}
-	stream.skipWhitespace();
-    } while (!stream.eos());
+    }
     // we allow the last subpath to be empty (a single trailing "m" operator)
     int sbn = countSubPaths();
     if (sbn > 0 && subPath(sbn - 1)->asCurve()
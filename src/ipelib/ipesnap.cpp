@@ -33,6 +33,7 @@
 #include "ipepage.h"
 #include "ipepath.h"
 #include "ipereference.h"
+#include "ipetrace.h"
 
 using namespace ipe;
 
@@ -352,6 +353,7 @@ Snap::TSnapModes Snap::simpleSnap(Vector & pos, const Page * page, int view,
 */
 Snap::TSnapModes Snap::snap(Vector & pos, const Page * page, int view, double snapDist,
 			    Tool * tool, Vector * autoOrg) const noexcept {
+    IPE_TRACE_SPAN("Snap::snap");
     // automatic angular snapping and angular snapping both on?
     if (autoOrg && (iSnap & ESnapAuto) && (iSnap & ESnapAngle)) {
 	// only one possible point!
@@ -35,6 +35,8 @@
 #include "ipeutils.h"
 
 #include <errno.h>
+#include <mutex>
+#include <unordered_map>
 
 using namespace ipe;
 
@@ -107,9 +109,19 @@ Symbol::~Symbol() { delete iObject; }
 
 // --------------------------------------------------------------------
 
+// Versions of style sheets and cascades are taken from a single
+// counter, so that a change to any of them is a new maximum.
+static uint64_t newVersion() {
+    static std::atomic<uint64_t> counter = 0;
+    return ++counter;
+}
+
+// --------------------------------------------------------------------
+
 //! The default constructor creates an empty style sheet.
 StyleSheet::StyleSheet() {
     iStandard = false;
+    iVersion = newVersion();
     iTitleStyle.iDefined = false;
     iPageNumberStyle.iDefined = false;
     iTextPadding.iLeft = -1.0;
@@ -119,7 +131,10 @@ StyleSheet::StyleSheet() {
 }
 
 //! Set page layout.
-void StyleSheet::setLayout(const Layout & layout) { iLayout = layout; }
+void StyleSheet::setLayout(const Layout & layout) {
+    iLayout = layout;
+    iVersion = newVersion();
+}
 
 //! Return page layout (or 0 if none defined).
 const Layout * StyleSheet::layout() const {
@@ -138,10 +153,16 @@ const TextPadding * StyleSheet::textPadding() const {
 }
 
 //! Set padding for text object bbox computation.
-void StyleSheet::setTextPadding(const TextPadding & pad) { iTextPadding = pad; }
+void StyleSheet::setTextPadding(const TextPadding & pad) {
+    iTextPadding = pad;
+    iVersion = newVersion();
+}
 
 //! Set style of page titles.
-void StyleSheet::setTitleStyle(const TitleStyle & ts) { iTitleStyle = ts; }
+void StyleSheet::setTitleStyle(const TitleStyle & ts) {
+    iTitleStyle = ts;
+    iVersion = newVersion();
+}
 
 //! Return title style (or 0 if none defined).
 const StyleSheet::TitleStyle * StyleSheet::titleStyle() const {
@@ -154,6 +175,7 @@ const StyleSheet::TitleStyle * StyleSheet::titleStyle() const {
 //! Set style of page numbering.
 void StyleSheet::setPageNumberStyle(const PageNumberStyle & pns) {
     iPageNumberStyle = pns;
+    iVersion = newVersion();
 }
 
 //! Return page number style.
@@ -168,6 +190,7 @@ const StyleSheet::PageNumberStyle * StyleSheet::pageNumberStyle() const {
 void StyleSheet::addGradient(Attribute name, const Gradient & s) {
     assert(name.isSymbolic());
     iGradients[name.index()] = s;
+    iVersion = newVersion();
 }
 
 //! Find gradient in style sheet cascade.
@@ -184,6 +207,7 @@ const Gradient * StyleSheet::findGradient(Attribute sym) const {
 void StyleSheet::addTiling(Attribute name, const Tiling & s) {
     assert(name.isSymbolic());
     iTilings[name.index()] = s;
+    iVersion = newVersion();
 }
 
 //! Find tiling in style sheet cascade.
@@ -199,6 +223,7 @@ const Tiling * StyleSheet::findTiling(Attribute sym) const {
 void StyleSheet::addEffect(Attribute name, const Effect & e) {
     assert(name.isSymbolic());
     iEffects[name.index()] = e;
+    iVersion = newVersion();
 }
 
 const Effect * StyleSheet::findEffect(Attribute sym) const {
@@ -213,6 +238,7 @@ const Effect * StyleSheet::findEffect(Attribute sym) const {
 void StyleSheet::addPageStyle(Attribute name, const PageStyle & e) {
     assert(name.isSymbolic());
     iPageStyles[name.index()] = e;
+    iVersion = newVersion();
 }
 
 const PageStyle * StyleSheet::findPageStyle(Attribute sym) const {
@@ -227,13 +253,34 @@ const PageStyle * StyleSheet::findPageStyle(Attribute sym) const {
 // --------------------------------------------------------------------
 
 //! Set line cap.
-void StyleSheet::setLineCap(TLineCap s) { iLineCap = s; }
+void StyleSheet::setLineCap(TLineCap s) {
+    iLineCap = s;
+    iVersion = newVersion();
+}
 
 //! Set line join.
-void StyleSheet::setLineJoin(TLineJoin s) { iLineJoin = s; }
+void StyleSheet::setLineJoin(TLineJoin s) {
+    iLineJoin = s;
+    iVersion = newVersion();
+}
 
 //! Set fill rule.
-void StyleSheet::setFillRule(TFillRule s) { iFillRule = s; }
+void StyleSheet::setFillRule(TFillRule s) {
+    iFillRule = s;
+    iVersion = newVersion();
+}
+
+//! Set LaTeX preamble.
+void StyleSheet::setPreamble(const String & str) {
+    iPreamble = str;
+    iVersion = newVersion();
+}
+
+//! Set name of style sheet.
+void StyleSheet::setName(const String & name) {
+    iName = name;
+    iVersion = newVersion();
+}
 
 // --------------------------------------------------------------------
 
@@ -241,6 +288,7 @@ void StyleSheet::setFillRule(TFillRule s) { iFillRule = s; }
 void StyleSheet::addSymbol(Attribute name, const Symbol & symbol) {
     assert(name.isSymbolic());
     iSymbols[name.index()] = symbol;
+    iVersion = newVersion();
 }
 
 //! Find a symbol object with given name.
@@ -261,6 +309,7 @@ const Symbol * StyleSheet::findSymbol(Attribute attr) const {
 void StyleSheet::add(Kind kind, Attribute name, Attribute value) {
     if (!name.isSymbolic()) return;
     iMap[name.index() | (kind << SHIFT)] = value;
+    iVersion = newVersion();
 }
 
 //! Find a symbolic attribute.
@@ -320,6 +369,7 @@ void StyleSheet::remove(Kind kind, Attribute sym) {
     case EEffect: iEffects.erase(sym.index()); break;
     default: iMap.erase(sym.index() | (kind << SHIFT)); break;
     };
+    iVersion = newVersion();
 }
 
 // --------------------------------------------------------------------
@@ -545,11 +595,26 @@ void StyleSheet::saveAsXml(Stream & stream, bool saveBitmaps) const {
   lookup is done from top to bottom, and returns as soon as a match is
   found. Ipe always appends the built-in "standard" style sheet at the
   bottom of the cascade.
+
+  Since find() is called for every attribute of every object drawn,
+  the cascade keeps its attribute definitions flattened into a single
+  hash table.  The table is rebuilt when the version of the cascade or
+  of one of its sheets has changed.
 */
 
+//! Flattened attribute definitions, see Cascade::find().
+struct Cascade::Lookup {
+    uint64_t iVersion;
+    std::unordered_map<int, Attribute> iMap;
+    //! Value for attributes that are not defined, by kind.
+    Attribute iNormal[EEffect + 1];
+};
+
 //! Create an empty cascade.
 /*! This does not add the standard style sheet. */
-Cascade::Cascade() {
+Cascade::Cascade()
+    : iVersion(newVersion())
+    , iLookup(nullptr) {
     // nothing
 }
 
@@ -562,7 +627,9 @@ static void destruct_sheets(std::vector<StyleSheet *> & sheets) {
 }
 
 //! Copy constructor.
-Cascade::Cascade(const Cascade & rhs) {
+Cascade::Cascade(const Cascade & rhs)
+    : iVersion(newVersion())
+    , iLookup(nullptr) {
     destruct_sheets(iSheets);
     for (int i = 0; i < rhs.count(); ++i)
 	iSheets.push_back(new StyleSheet(*rhs.iSheets[i]));
@@ -574,22 +641,80 @@ Cascade & Cascade::operator=(const Cascade & rhs) {
 	destruct_sheets(iSheets);
 	for (int i = 0; i < rhs.count(); ++i)
 	    iSheets.push_back(new StyleSheet(*rhs.iSheets[i]));
+	clearLookup();
     }
     return *this;
 }
 
 //! Destructor.
-Cascade::~Cascade() { destruct_sheets(iSheets); }
+Cascade::~Cascade() {
+    destruct_sheets(iSheets);
+    clearLookup();
+}
 
 //! Insert a style sheet into the cascade.
 /*! Takes ownership of \a sheet. */
 void Cascade::insert(int index, StyleSheet * sheet) {
     iSheets.insert(iSheets.begin() + index, sheet);
+    clearLookup();
 }
 
 //! Remove a style sheet from the cascade.
 /*! The old sheet is deleted. */
-void Cascade::remove(int index) { iSheets.erase(iSheets.begin() + index); }
+void Cascade::remove(int index) {
+    iSheets.erase(iSheets.begin() + index);
+    clearLookup();
+}
+
+// Called when the cascade is modified, so no other thread can be
+// using the lookup tables.
+void Cascade::clearLookup() {
+    iVersion = newVersion();
+    delete iLookup.exchange(nullptr);
+    for (Lookup * l : iRetired) delete l;
+    iRetired.clear();
+}
+
+//! Return a number that changes whenever the cascade or one of its sheets is modified.
+/*! It is the largest version of the cascade and its sheets. */
+uint64_t Cascade::version() const {
+    uint64_t v = iVersion;
+    for (const StyleSheet * s : iSheets) v = std::max(v, s->version());
+    return v;
+}
+
+// Return the lookup table, rebuilding it if a sheet has changed.  A
+// table that is replaced may still be in use by another thread, so it
+// is kept until the cascade itself is modified.
+const Cascade::Lookup * Cascade::lookup() const {
+    uint64_t v = version();
+    Lookup * l = iLookup.load(std::memory_order_acquire);
+    if (l && l->iVersion == v) return l;
+    static std::mutex mutex;
+    std::lock_guard lock(mutex);
+    l = iLookup.load(std::memory_order_relaxed);
+    if (l && l->iVersion == v) return l;
+    Lookup * fresh = new Lookup;
+    fresh->iVersion = v;
+    // definitions higher up in the cascade override lower ones
+    for (int i = count() - 1; i >= 0; --i) {
+	for (const auto & [key, value] : iSheets[i]->iMap) fresh->iMap[key] = value;
+    }
+    for (int kind = 0; kind <= EEffect; ++kind) {
+	Attribute normal = Attribute::normal(Kind(kind));
+	fresh->iNormal[kind] = Attribute::UNDEFINED();
+	if (count() == 0) continue;
+	if (!normal.isSymbolic()) {
+	    fresh->iNormal[kind] = normal;
+	} else {
+	    auto it = fresh->iMap.find(normal.index() | (kind << SHIFT));
+	    if (it != fresh->iMap.end()) fresh->iNormal[kind] = it->second;
+	}
+    }
+    if (l) iRetired.push_back(l);
+    iLookup.store(fresh, std::memory_order_release);
+    return fresh;
+}
 
 void Cascade::saveAsXml(Stream & stream) const {
     for (int i = count() - 1; i >= 0; --i) {
@@ -604,18 +729,17 @@ bool Cascade::has(Kind kind, Attribute sym) const {
     return false;
 }
 
+//! Find the value of a symbolic attribute.
+/*! Returns the topmost definition of \a sym, or of the "normal"
+  value if \a sym is not defined.  If \a sym is not symbolic, it is
+  returned unchanged. */
 Attribute Cascade::find(Kind kind, Attribute sym) const {
-    for (int i = 0; i < count(); ++i) {
-	Attribute a = iSheets[i]->find(kind, sym);
-	if (a != Attribute::UNDEFINED()) return a;
-    }
-    Attribute normal = Attribute::normal(kind);
-    for (int i = 0; i < count(); ++i) {
-	Attribute a = iSheets[i]->find(kind, normal);
-	if (a != Attribute::UNDEFINED()) return a;
-    }
-    // this shouldn't happen
-    return Attribute::UNDEFINED();
+    if (!sym.isSymbolic()) return count() ? sym : Attribute::UNDEFINED();
+    const Lookup * l = lookup();
+    auto it = l->iMap.find(sym.index() | (kind << SHIFT));
+    if (it != l->iMap.end()) return it->second;
+    // normal value is undefined only if the standard sheet is missing
+    return l->iNormal[kind];
 }
 
 const Symbol * Cascade::findSymbol(Attribute sym) const {
@@ -115,12 +115,13 @@ Text::Text(const Text & rhs)
     iVerticalAlignment = rhs.iVerticalAlignment;
     iHorizontalAlignment = rhs.iHorizontalAlignment;
     iXForm = rhs.iXForm;
-    if (iXForm) iXForm->iRefCount++;
+    if (iXForm) iXForm->iRefCount.fetch_add(1, std::memory_order_relaxed);
 }
 
 //! Destructor.
 Text::~Text() {
-    if (iXForm && --iXForm->iRefCount == 0) delete iXForm;
+    if (iXForm && iXForm->iRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	delete iXForm;
 }
 
 // --------------------------------------------------------------------
@@ -492,11 +493,14 @@ void Text::quadrilateral(const Matrix & m, Vector v[4]) const {
 }
 
 //! Update the PDF code for this object.
+/*! This modifies the object, and must not be called while another
+  thread uses it. */
 void Text::setXForm(XForm * xform) const {
-    if (iXForm && --iXForm->iRefCount == 0) delete iXForm;
+    if (xform) xform->iRefCount.fetch_add(1, std::memory_order_relaxed);
+    if (iXForm && iXForm->iRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	delete iXForm;
     iXForm = xform;
     if (iXForm) {
-	++iXForm->iRefCount;
 	iDepth = iXForm->iStretch * iXForm->iDepth / 100.0;
 	iHeight = iXForm->iStretch * iXForm->iBBox.height() - iDepth;
 	if (!isMinipage()) iWidth = iXForm->iStretch * iXForm->iBBox.width();
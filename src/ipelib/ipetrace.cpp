@@ -0,0 +1,230 @@
+// --------------------------------------------------------------------
+// Tracing of time spent in Ipelib
+// --------------------------------------------------------------------
+/*
+
+    This file is part of the extensible drawing editor Ipe.
+    Copyright (c) 1993-2024 Otfried Cheong
+
+    Ipe is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    As a special exception, you have permission to link Ipe with the
+    CGAL library and distribute executables, as long as you follow the
+    requirements of the Gnu General Public License in regard to all of
+    the software in the executable aside from CGAL.
+
+    Ipe is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+    or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+    License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ipe; if not, you can find it at
+    "http://www.gnu.org/copyleft/gpl.html", or write to the Free
+    Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include "ipetrace.h"
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+
+using namespace ipe;
+
+// --------------------------------------------------------------------
+
+/*! \class ipe::Trace
+  \ingroup base
+  \brief Records where Ipelib spends its time.
+
+  Code is instrumented with the macros IPE_TRACE_SPAN(name), which
+  times the enclosing scope, and IPE_TRACE_COUNT(name, delta), which
+  adds to a named counter.  Names must be string literals.  Spans
+  nest, and statistics are kept per path of nested span names (such as
+  "Document::load/ImlParser::parseDocument").
+
+  Tracing is off by default, and then costs one test per span.  If the
+  environment variable IPETRACE is set when Ipelib is initialized,
+  tracing is enabled and a trace in Chrome's JSON format (for
+  chrome://tracing or Perfetto) is written to the file named by
+  IPETRACE when the program exits.  Defining IPE_NO_TRACE when
+  compiling removes the instrumentation completely.
+*/
+
+namespace {
+
+struct Event {
+    const char * iName;
+    char iPhase; // 'X' for span, 'C' for counter
+    int iThread;
+    int64_t iStart; // microseconds
+    int64_t iValue; // duration for spans, value for counters
+};
+
+// do not grow without bound if tracing is left on
+constexpr size_t MAX_EVENTS = 1 << 20;
+
+struct TraceData {
+    std::mutex iMutex;
+    std::chrono::steady_clock::time_point iEpoch = std::chrono::steady_clock::now();
+    std::vector<Event> iEvents;
+    size_t iDropped = 0;
+    std::map<std::string, Trace::Stat> iSpans;
+    std::map<std::string, int64_t> iCounters;
+};
+
+TraceData & data() {
+    static TraceData d;
+    return d;
+}
+
+int64_t now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+	       std::chrono::steady_clock::now() - data().iEpoch)
+	.count();
+}
+
+std::atomic<int> threadCounter{0};
+thread_local int threadId = -1;
+thread_local std::vector<const char *> spanStack;
+
+int thisThread() {
+    if (threadId < 0) threadId = threadCounter++;
+    return threadId;
+}
+
+void addEvent(TraceData & d, const Event & ev) {
+    if (d.iEvents.size() < MAX_EVENTS)
+	d.iEvents.push_back(ev);
+    else
+	++d.iDropped;
+}
+
+void writeJsonString(FILE * f, const char * s) {
+    fputc('"', f);
+    for (; *s; ++s) {
+	if (*s == '"' || *s == '\\') fputc('\\', f);
+	fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+} // namespace
+
+std::atomic<bool> Trace::sEnabled{false};
+
+// --------------------------------------------------------------------
+
+//! Start timing a span (if tracing is enabled).
+Trace::Span::Span(const char * name) noexcept
+    : iName(name)
+    , iStart(-1) {
+    if (!enabled()) return;
+    iStart = now();
+    spanStack.push_back(name);
+}
+
+//! Record the span.
+Trace::Span::~Span() noexcept {
+    if (iStart < 0) return;
+    int64_t end = now();
+    std::string path;
+    for (const char * s : spanStack) {
+	if (!path.empty()) path += '/';
+	path += s;
+    }
+    spanStack.pop_back();
+    double ms = (end - iStart) / 1000.0;
+    TraceData & d = data();
+    std::lock_guard lock(d.iMutex);
+    addEvent(d, Event{iName, 'X', thisThread(), iStart, end - iStart});
+    auto it = d.iSpans.find(path);
+    if (it == d.iSpans.end())
+	it = d.iSpans.emplace(path, Stat{String(path.c_str()), 0, 0.0, 0.0}).first;
+    Stat & st = it->second;
+    ++st.iCount;
+    st.iTotal += ms;
+    if (ms > st.iMax) st.iMax = ms;
+}
+
+//! Enable or disable tracing.
+void Trace::enable(bool on) noexcept {
+    data(); // construct before use at exit
+    sEnabled = on;
+}
+
+//! Add \a delta to the counter \a name.
+void Trace::count(const char * name, int64_t delta) noexcept {
+    if (!enabled()) return;
+    TraceData & d = data();
+    int64_t ts = now();
+    std::lock_guard lock(d.iMutex);
+    int64_t value = (d.iCounters[name] += delta);
+    addEvent(d, Event{name, 'C', thisThread(), ts, value});
+}
+
+//! Discard all recorded events and statistics.
+void Trace::reset() {
+    TraceData & d = data();
+    std::lock_guard lock(d.iMutex);
+    d.iEvents.clear();
+    d.iDropped = 0;
+    d.iSpans.clear();
+    d.iCounters.clear();
+}
+
+//! Return statistics for all span paths, sorted by path.
+std::vector<Trace::Stat> Trace::spans() {
+    TraceData & d = data();
+    std::lock_guard lock(d.iMutex);
+    std::vector<Stat> result;
+    for (const auto & [path, st] : d.iSpans) result.push_back(st);
+    return result;
+}
+
+//! Return the values of all counters, sorted by name.
+std::vector<Trace::Stat> Trace::counters() {
+    TraceData & d = data();
+    std::lock_guard lock(d.iMutex);
+    std::vector<Stat> result;
+    for (const auto & [name, value] : d.iCounters)
+	result.push_back(Stat{String(name.c_str()), value, 0.0, 0.0});
+    return result;
+}
+
+//! Write recorded events in Chrome's trace event format.
+bool Trace::saveChromeTrace(const char * fname) {
+    FILE * f = Platform::fopen(fname, "w");
+    if (!f) return false;
+    TraceData & d = data();
+    std::lock_guard lock(d.iMutex);
+    fprintf(f, "{\"displayTimeUnit\": \"ms\",\n\"traceEvents\": [");
+    bool first = true;
+    for (const Event & ev : d.iEvents) {
+	fprintf(f, "%s\n{\"name\": ", first ? "" : ",");
+	first = false;
+	writeJsonString(f, ev.iName);
+	if (ev.iPhase == 'X')
+	    fprintf(f,
+		    ", \"cat\": \"ipe\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+		    "\"ts\": %lld, \"dur\": %lld}",
+		    ev.iThread, (long long)ev.iStart, (long long)ev.iValue);
+	else
+	    fprintf(f,
+		    ", \"ph\": \"C\", \"pid\": 1, \"tid\": %d, \"ts\": %lld, "
+		    "\"args\": {\"value\": %lld}}",
+		    ev.iThread, (long long)ev.iStart, (long long)ev.iValue);
+    }
+    fprintf(f, "\n],\n\"otherData\": {\"ipelib\": %d, \"dropped\": %zu}}\n",
+	    IPELIB_VERSION, d.iDropped);
+    fclose(f);
+    return true;
+}
+
+// --------------------------------------------------------------------
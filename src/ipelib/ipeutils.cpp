@@ -30,14 +30,28 @@
 
 #include "ipeutils.h"
 #include "ipegroup.h"
+#include "ipeiml.h"
 #include "ipeimage.h"
 #include "ipelet.h"
 #include "ipepage.h"
+#include "ipepath.h"
 #include "ipereference.h"
 #include "ipetext.h"
 
+#include <cstring>
 #include <zlib.h>
 
+#ifndef IPEWASM
+#include <thread>
+#endif
+
+#if !defined(WIN32) && !defined(IPEWASM)
+#define IPE_WORKER_PROCESSES
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 using namespace ipe;
 
 // --------------------------------------------------------------------
@@ -486,11 +500,92 @@ void DeflateStream::close() {
     iStream.close();
 }
 
+// size of the blocks compressed independently by DeflateStream::deflate
+constexpr int DEFLATE_BLOCK = 0x20000;
+// the largest distance deflate can refer back to
+constexpr int DEFLATE_WINDOW = 0x8000;
+
+// Compress block [begin, end) of data as raw deflate data, using the
+// preceding window as dictionary.  All but the last block end with a
+// sync flush, so that the blocks can simply be concatenated.
+static Buffer deflateBlock(const char * data, int begin, int end, bool last,
+			   int compressLevel, int & deflatedSize) {
+    z_stream z;
+    z.zalloc = nullptr;
+    z.zfree = nullptr;
+    z.opaque = nullptr;
+    int err = ::deflateInit2(&z, compressLevel, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    if (err != Z_OK) {
+	ipeDebug("deflateInit2 returns error %d", err);
+	assert(false);
+    }
+    if (begin > 0) {
+	int dict = std::min(begin, DEFLATE_WINDOW);
+	::deflateSetDictionary(&z, (const Bytef *)data + begin - dict, dict);
+    }
+    // room for the empty block of the sync flush
+    Buffer out(::deflateBound(&z, end - begin) + 16);
+    z.next_in = (Bytef *)data + begin;
+    z.avail_in = end - begin;
+    z.next_out = (Bytef *)out.data();
+    z.avail_out = out.size();
+    err = ::deflate(&z, last ? Z_FINISH : Z_SYNC_FLUSH);
+    if (err != (last ? Z_STREAM_END : Z_OK) || z.avail_in) {
+	ipeDebug("deflate returns error %d", err);
+	assert(false);
+    }
+    deflatedSize = z.next_out - (Bytef *)out.data();
+    ::deflateEnd(&z);
+    return out;
+}
+
 //! Deflate a buffer in a single run.
 /*! The returned buffer may be larger than necessary: \a deflatedSize
-  is set to the number of bytes actually used. */
+  is set to the number of bytes actually used.
+
+  Large buffers are cut into blocks that are compressed independently
+  on several threads (see Platform::threadCount), as in pigz.  Each
+  block uses the data preceding it as its dictionary, so there is
+  hardly any loss in compression.  The result is a single zlib stream,
+  and does not depend on the number of threads. */
 Buffer DeflateStream::deflate(const char * data, int size, int & deflatedSize,
 			      int compressLevel) {
+    int nBlocks = (size + DEFLATE_BLOCK - 1) / DEFLATE_BLOCK;
+    if (nBlocks > 1) {
+	std::vector<Buffer> blocks(nBlocks);
+	std::vector<int> sizes(nBlocks);
+	std::vector<uLong> checksums(nBlocks);
+	parallelFor(nBlocks, Platform::threadCount(), [&](int, int first, int last) {
+	    for (int i = first; i < last; ++i) {
+		int begin = i * DEFLATE_BLOCK;
+		int end = std::min(size, begin + DEFLATE_BLOCK);
+		blocks[i] = deflateBlock(data, begin, end, i + 1 == nBlocks,
+					 compressLevel, sizes[i]);
+		checksums[i] = ::adler32(::adler32(0, nullptr, 0),
+					 (const Bytef *)data + begin, end - begin);
+	    }
+	});
+	int total = 6;
+	for (int n : sizes) total += n;
+	Buffer deflatedData(total);
+	uint8_t * p = (uint8_t *)deflatedData.data();
+	// zlib header: deflate with 32K window, compression level hint
+	int level = compressLevel < 0 ? 6 : compressLevel;
+	*p++ = 0x78;
+	*p++ = level < 2 ? 0x01 : level < 6 ? 0x5e : level == 6 ? 0x9c : 0xda;
+	uLong adler = checksums[0];
+	for (int i = 0; i < nBlocks; ++i) {
+	    memcpy(p, blocks[i].data(), sizes[i]);
+	    p += sizes[i];
+	    if (i > 0) {
+		int len = std::min(size - i * DEFLATE_BLOCK, DEFLATE_BLOCK);
+		adler = ::adler32_combine(adler, checksums[i], len);
+	    }
+	}
+	for (int k = 3; k >= 0; --k) *p++ = uint8_t(adler >> (8 * k));
+	deflatedSize = total;
+	return deflatedData;
+    }
     uLong dfsize = uLong(size * 1.001 + 13);
     Buffer deflatedData(dfsize);
     int err = ::compress2((Bytef *)deflatedData.data(), &dfsize, (const Bytef *)data,
@@ -597,6 +692,342 @@ int InflateSource::getChar() {
 
 // --------------------------------------------------------------------
 
+/*! \class ipe::SpillFile
+  \ingroup high
+  \brief A temporary file holding compressed copies of pages and objects.
+
+  Pages are saved in XML format (as by Page::saveAsIpePage), compressed,
+  and appended to an anonymous temporary file that is removed when the
+  SpillFile is destroyed.  Objects are stored as pages holding just
+  the object.  Ipe uses this to move old undo information out of
+  memory.
+
+  The XML format does not contain the result of running Latex on text
+  objects, so the SpillFile keeps a reference to it in memory, and
+  gives it back to the text objects when they are loaded.
+
+  Space at the end of the file is reused once the pages stored last
+  have been released, so the file stays small when pages are loaded
+  back in the reverse order of storing them.
+*/
+
+//! Create the temporary file.
+/*! Check isOpen() to see if this succeeded. */
+SpillFile::SpillFile()
+    : iEnd(0) {
+    iFile = std::tmpfile();
+    if (!iFile) ipeDebug("SpillFile: cannot create temporary file");
+}
+
+SpillFile::~SpillFile() {
+    while (!iEntries.empty()) release(int(iEntries.size()) - 1);
+    if (iFile) std::fclose(iFile);
+}
+
+namespace {
+
+// Collect the text objects of a page, also inside groups.
+class TextFinder : public Visitor {
+public:
+    virtual void visitGroup(const Group * obj);
+    virtual void visitText(const Text * obj);
+
+public:
+    std::vector<const Text *> iTexts;
+};
+
+void TextFinder::visitGroup(const Group * obj) {
+    for (Group::const_iterator it = obj->begin(); it != obj->end(); ++it)
+	(*it)->accept(*this);
+}
+
+void TextFinder::visitText(const Text * obj) { iTexts.push_back(obj); }
+
+std::vector<const Text *> findTexts(const Page * page) {
+    TextFinder finder;
+    for (int i = 0; i < page->count(); ++i) page->object(i)->accept(finder);
+    return finder.iTexts;
+}
+
+} // namespace
+
+//! Store a copy of \a page, and return its id.
+/*! Returns -1 if the page could not be written. */
+int SpillFile::store(const Page * page) { return store(page, false); }
+
+//! Store a copy of \a obj, and return its id.
+/*! Returns -1 if the object could not be written. */
+int SpillFile::store(const Object * obj) {
+    std::unique_ptr<Page> page(Page::basic());
+    page->append(ENotSelected, 0, obj->clone());
+    return store(page.get(), true);
+}
+
+int SpillFile::store(const Page * page, bool object) {
+    if (!iFile) return -1;
+    String data;
+    StringStream stream(data);
+    DeflateStream deflate(stream, 6);
+    page->saveAsIpePage(deflate);
+    deflate.close();
+    if (std::fseek(iFile, iEnd, SEEK_SET) != 0
+	|| std::fwrite(data.data(), 1, data.size(), iFile) != size_t(data.size()))
+	return -1;
+    Entry e{iEnd, data.size(), object, {}};
+    for (const Text * text : findTexts(page)) {
+	Text::XForm * xf = const_cast<Text::XForm *>(text->getXForm());
+	if (xf) xf->iRefCount.fetch_add(1, std::memory_order_relaxed);
+	e.iXForms.push_back(xf);
+    }
+    iEntries.push_back(std::move(e));
+    iEnd += data.size();
+    return int(iEntries.size()) - 1;
+}
+
+//! Load the page stored under \a id.
+/*! Returns nullptr if the page cannot be read back. */
+Page * SpillFile::load(int id) {
+    if (!iFile || id < 0 || id >= int(iEntries.size()) || iEntries[id].iSize < 0)
+	return nullptr;
+    const Entry & e = iEntries[id];
+    Buffer data(e.iSize);
+    if (std::fseek(iFile, e.iOffset, SEEK_SET) != 0
+	|| std::fread(data.data(), 1, e.iSize, iFile) != size_t(e.iSize))
+	return nullptr;
+    BufferSource source(data);
+    InflateSource xml(source);
+    ImlParser parser(xml);
+    Page * page = parser.parsePageSelection();
+    if (!page) return nullptr;
+    std::vector<const Text *> texts = findTexts(page);
+    if (texts.size() == e.iXForms.size()) {
+	for (size_t i = 0; i < texts.size(); ++i) texts[i]->setXForm(e.iXForms[i]);
+    }
+    return page;
+}
+
+//! Load the object stored under \a id.
+/*! Returns nullptr if the object cannot be read back. */
+Object * SpillFile::loadObject(int id) {
+    std::unique_ptr<Page> page(load(id));
+    if (!page || page->count() != 1) return nullptr;
+    return page->object(0)->clone();
+}
+
+//! Release the space used by the page or object stored under \a id.
+void SpillFile::release(int id) {
+    if (id < 0 || id >= int(iEntries.size()) || iEntries[id].iSize < 0) return;
+    for (Text::XForm * xf : iEntries[id].iXForms) {
+	if (xf && xf->iRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1) delete xf;
+    }
+    iEntries[id].iXForms.clear();
+    iEntries[id].iSize = -1;
+    while (!iEntries.empty() && iEntries.back().iSize < 0) {
+	iEnd = iEntries.back().iOffset;
+	iEntries.pop_back();
+    }
+}
+
+namespace {
+
+class MemoryEstimator : public Visitor {
+public:
+    virtual void visitGroup(const Group * obj);
+    virtual void visitPath(const Path * obj);
+    virtual void visitText(const Text * obj);
+    virtual void visitImage(const Image * obj);
+    virtual void visitReference(const Reference * obj);
+
+public:
+    size_t iBytes = 0;
+};
+
+void MemoryEstimator::visitGroup(const Group * obj) {
+    iBytes += sizeof(Group) + obj->count() * sizeof(Object *);
+    for (Group::const_iterator it = obj->begin(); it != obj->end(); ++it)
+	(*it)->accept(*this);
+}
+
+void MemoryEstimator::visitPath(const Path * obj) {
+    iBytes += sizeof(Path);
+    const Shape & shape = obj->shape();
+    for (int i = 0; i < shape.countSubPaths(); ++i) {
+	const SubPath * sp = shape.subPath(i);
+	if (sp->type() == SubPath::ECurve) {
+	    const Curve * c = sp->asCurve();
+	    iBytes += sizeof(Curve);
+	    for (int j = 0; j < c->countSegmentsClosing(); ++j)
+		iBytes += 16 + c->segment(j).countCP() * sizeof(Vector);
+	} else if (sp->type() == SubPath::EClosedSpline) {
+	    const ClosedSpline * c = sp->asClosedSpline();
+	    iBytes += sizeof(ClosedSpline) + c->iCP.size() * sizeof(Vector);
+	} else
+	    iBytes += sizeof(Ellipse);
+    }
+}
+
+void MemoryEstimator::visitText(const Text * obj) {
+    iBytes += sizeof(Text) + obj->text().size();
+}
+
+// the bitmap is shared with the document
+void MemoryEstimator::visitImage(const Image * obj) { iBytes += sizeof(Image); }
+
+void MemoryEstimator::visitReference(const Reference * obj) {
+    iBytes += sizeof(Reference);
+}
+
+} // namespace
+
+//! Estimate the memory used by the objects of \a page.
+/*! Data shared between copies of a page, such as the contents of
+  bitmaps, is not counted. */
+size_t SpillFile::estimate(const Page * page) {
+    MemoryEstimator est;
+    for (int i = 0; i < page->count(); ++i) page->object(i)->accept(est);
+    return sizeof(Page) + page->count() * 4 * sizeof(void *) + est.iBytes;
+}
+
+//! Estimate the memory used by \a obj.
+size_t SpillFile::estimate(const Object * obj) {
+    MemoryEstimator est;
+    obj->accept(est);
+    return est.iBytes;
+}
+
+// --------------------------------------------------------------------
+
+//! Process the range [0, n) in parallel on up to \a threads threads.
+/*! The range is split into contiguous chunks of nearly equal size,
+  and \a fn is called as fn(chunk, begin, end) for each chunk, each
+  on its own thread.  Chunk 0 runs on the calling thread, and the call
+  returns when all chunks are done.  Since the chunks are numbered in
+  order, the caller can merge per-chunk results deterministically.
+
+  Without thread support (Webassembly), this simply calls fn(0, 0, n).
+*/
+void ipe::parallelFor(int n, int threads,
+		      const std::function<void(int, int, int)> & fn) {
+    int chunks = std::min(threads, n);
+#ifdef IPEWASM
+    chunks = 1;
+#endif
+    if (chunks <= 1) {
+	fn(0, 0, n);
+	return;
+    }
+#ifndef IPEWASM
+    std::vector<std::thread> workers;
+    for (int k = 1; k < chunks; ++k)
+	workers.emplace_back(fn, k, int(int64_t(k) * n / chunks),
+			     int(int64_t(k + 1) * n / chunks));
+    fn(0, 0, n / chunks);
+    for (auto & t : workers) t.join();
+#endif
+}
+
+#ifdef IPE_WORKER_PROCESSES
+// Give the worker a Latex folder of its own.  It is kept between runs,
+// so that the formats made for the preambles seen can be used again,
+// and is locked until the worker exits, so that the workers of other
+// processes skip it.
+static bool lockLatexFolder(int worker, int workers) {
+    static std::unique_ptr<FileLock> lock;
+    String base = Platform::folder(FolderLatex);
+    for (int k = worker; k < worker + 100 * workers; k += workers) {
+	String dir = base;
+	StringStream ss(dir);
+	ss << IPESEP << "batch" << k;
+	if (Platform::mkdirTree(dir) != 0) return false;
+	String fname = dir;
+	fname += IPESEP;
+	fname += "lock";
+	lock = std::make_unique<FileLock>(fname, false);
+	if (lock->locked()) {
+	    Platform::setFolder(FolderLatex, dir);
+	    return true;
+	}
+    }
+    lock.reset();
+    return false;
+}
+#endif
+
+//! Process the items [0, n) in up to \a workers child processes.
+/*! This is for work on entire documents, such as running Lua scripts
+  or converting files.  Ipelib objects can be used on several threads,
+  but such work also depends on state of the process: Latex runs in
+  the Latex folder (see Platform::folder()), messages are written to
+  stderr, and scripts can use the io and os libraries of Lua.
+
+  Each worker takes the next item from a shared counter and calls \a
+  work on it.  The string it returns is passed to \a done in the
+  calling process.  Items whose worker died are not passed to \a done.
+
+  Each worker uses a Latex folder of its own (a subdirectory of the
+  Latex folder), and its share of Platform::threadCount().
+
+  Returns false if no worker could be started (always on Windows and
+  for Webassembly).  The caller should then process the items itself.
+*/
+bool ipe::runInWorkers(int n, int workers, const std::function<String(int)> & work,
+		       const std::function<void(int, String)> & done) {
+#ifdef IPE_WORKER_PROCESSES
+    void * shared = mmap(nullptr, sizeof(std::atomic<int>), PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) return false;
+    std::atomic<int> * next = new (shared) std::atomic<int>(0);
+    std::vector<FILE *> reports;
+    fflush(stdout);
+    fflush(stderr);
+    for (int w = 0; w < workers; ++w) {
+	FILE * report = tmpfile();
+	if (!report) break;
+	pid_t pid = fork();
+	if (pid < 0) {
+	    fclose(report);
+	    break;
+	}
+	if (pid == 0) {
+	    if (!lockLatexFolder(w, workers)) {
+		fprintf(stderr, "Cannot create a Latex directory for worker %d.\n", w);
+		_exit(1);
+	    }
+	    Platform::setThreadCount(Platform::threadCount() / workers);
+	    // keep the order of lines written to stdout and stderr
+	    setvbuf(stdout, nullptr, _IOLBF, BUFSIZ);
+	    for (int k = (*next)++; k < n; k = (*next)++) {
+		String result = work(k);
+		fprintf(report, "%d %d\n", k, result.size());
+		fwrite(result.data(), 1, result.size(), report);
+		fflush(report);
+	    }
+	    _exit(0);
+	}
+	reports.push_back(report);
+    }
+    while (wait(nullptr) > 0)
+	;
+    for (FILE * report : reports) {
+	rewind(report);
+	int k, size;
+	while (fscanf(report, "%d %d", &k, &size) == 2 && fgetc(report) == '\n'
+	       && 0 <= k && k < n && size >= 0) {
+	    String result;
+	    for (int i = 0; i < size; ++i) result.append(char(fgetc(report)));
+	    done(k, result);
+	}
+	fclose(report);
+    }
+    munmap(shared, sizeof(std::atomic<int>));
+    return !reports.empty();
+#else
+    return false;
+#endif
+}
+
+// --------------------------------------------------------------------
+
 /*! \defgroup ipelet The Ipelet interface
   \brief Implementation of Ipe plugins.
 
@@ -30,7 +30,10 @@
 
 #include "ipebitmap.h"
 #include "ipedoc.h"
+#include "ipejournal.h"
+#include "ipelatex.h"
 #include "ipelua.h"
+#include "ipetrace.h"
 
 #include <cerrno>
 #include <cstring>
@@ -311,8 +314,10 @@ static int document_runLatex(lua_State * L) {
 
 static int document_prepareLatexRun(lua_State * L) {
     Document ** d = check_document(L, 1);
+    String docname;
+    if (!lua_isnoneornil(L, 2)) docname = luaL_checklstring(L, 2, nullptr);
     Latex * converter = nullptr;
-    int result = (*d)->prepareLatexRun(&converter);
+    int result = (*d)->prepareLatexRun(&converter, 1, docname);
     if (result == 0) {
 	lua_pushboolean(L, true);
 	lua_pushlightuserdata(L, converter);
@@ -348,7 +353,12 @@ static int document_howToRunLatex(lua_State * L) {
     Document ** d = check_document(L, 1);
     String docname;
     if (!lua_isnoneornil(L, 2)) docname = luaL_checklstring(L, 2, nullptr);
-    String cmd = Platform::howToRunLatex((*d)->properties().iTexEngine, docname);
+    // the converter knows whether the format must be made first
+    String format;
+    if (lua_islightuserdata(L, 3))
+	format = static_cast<Latex *>(lua_touserdata(L, 3))->formatToDump();
+    String cmd =
+	Platform::howToRunLatex((*d)->properties().iTexEngine, docname, String(), format);
     if (cmd.empty())
 	lua_pushnil(L);
     else
@@ -381,6 +391,10 @@ static int document_completeLatexRun(lua_State * L) {
 	    lua_pushliteral(L, "There was an error reading the Pdflatex output");
 	    lua_pushliteral(L, "latexoutput");
 	    break;
+	case Document::ErrLatexFormat:
+	    lua_pushliteral(L, "Latex could not load the cached format");
+	    lua_pushliteral(L, "latexformat");
+	    break;
 	default:
 	    lua_pushliteral(L, "There was an unknown error running latex");
 	    lua_pushliteral(L, "errlatex");
@@ -536,6 +550,107 @@ static const struct luaL_Reg document_methods[] = {
     {nullptr, nullptr},
 };
 
+// --------------------------------------------------------------------
+// Journal
+// --------------------------------------------------------------------
+
+static int journal_constructor(lua_State * L) {
+    Journal ** j = (Journal **)lua_newuserdata(L, sizeof(Journal *));
+    *j = nullptr;
+    luaL_getmetatable(L, "Ipe.journal");
+    lua_setmetatable(L, -2);
+    *j = new Journal;
+    return 1;
+}
+
+static Journal * check_journal(lua_State * L, int i) {
+    return *(Journal **)luaL_checkudata(L, i, "Ipe.journal");
+}
+
+static int journal_destructor(lua_State * L) {
+    Journal ** j = (Journal **)luaL_checkudata(L, 1, "Ipe.journal");
+    delete *j;
+    *j = nullptr;
+    return 0;
+}
+
+static int journal_tostring(lua_State * L) {
+    check_journal(L, 1);
+    lua_pushfstring(L, "Journal@%p", lua_topointer(L, 1));
+    return 1;
+}
+
+static int journal_lock(lua_State * L) {
+    Journal * j = check_journal(L, 1);
+    String fname = check_filename(L, 2);
+    lua_pushboolean(L, j->lock(fname.z()));
+    return 1;
+}
+
+static int journal_open(lua_State * L) {
+    Journal * j = check_journal(L, 1);
+    String fname = check_filename(L, 2);
+    Document ** d = check_document(L, 3);
+    lua_pushboolean(L, j->open(fname.z(), *d));
+    return 1;
+}
+
+// returns number of edits, or nil, error message, error code
+static int journal_recover(lua_State * L) {
+    Journal * j = check_journal(L, 1);
+    String fname = check_filename(L, 2);
+    Document ** d = check_document(L, 3);
+    int n = j->recover(fname.z(), *d);
+    if (n >= 0) {
+	lua_pushinteger(L, n);
+	return 1;
+    }
+    lua_pushnil(L);
+    switch (n) {
+    case Journal::ENoJournal: lua_pushliteral(L, "The journal cannot be read"); break;
+    case Journal::EMismatch:
+	lua_pushliteral(L, "The journal was made for a different version of the file");
+	break;
+    case Journal::ELocked:
+	lua_pushliteral(L, "The journal is in use by another Ipe window");
+	break;
+    default: lua_pushliteral(L, "The journal is corrupted"); break;
+    }
+    lua_pushinteger(L, n);
+    return 3;
+}
+
+// page number is optional, and ignored if it is not valid
+static int journal_record(lua_State * L) {
+    Journal * j = check_journal(L, 1);
+    Document ** d = check_document(L, 2);
+    int pno = (int)luaL_optinteger(L, 3, 0) - 1;
+    lua_pushboolean(L, j->record(*d, pno < (*d)->countPages() ? pno : -1));
+    return 1;
+}
+
+static int journal_isOpen(lua_State * L) {
+    lua_pushboolean(L, check_journal(L, 1)->isOpen());
+    return 1;
+}
+
+static int journal_close(lua_State * L) {
+    check_journal(L, 1)->close();
+    return 0;
+}
+
+static const struct luaL_Reg journal_methods[] = {
+    {"__gc", journal_destructor},
+    {"__tostring", journal_tostring},
+    {"lock", journal_lock},
+    {"open", journal_open},
+    {"recover", journal_recover},
+    {"record", journal_record},
+    {"isOpen", journal_isOpen},
+    {"close", journal_close},
+    {nullptr, nullptr},
+};
+
 // --------------------------------------------------------------------
 
 static int file_format(lua_State * L) {
@@ -720,9 +835,54 @@ static int get_folder(lua_State * L) {
 
 // --------------------------------------------------------------------
 
+static int trace_enable(lua_State * L) {
+    Trace::enable(lua_toboolean(L, 1));
+    return 0;
+}
+
+static int trace_reset(lua_State * L) {
+    Trace::reset();
+    return 0;
+}
+
+// returns a list of spans and a table of counters
+static int trace_statistics(lua_State * L) {
+    std::vector<Trace::Stat> spans = Trace::spans();
+    lua_createtable(L, spans.size(), 0);
+    for (int i = 0; i < size(spans); ++i) {
+	lua_createtable(L, 0, 4);
+	push_string(L, spans[i].iName);
+	lua_setfield(L, -2, "name");
+	lua_pushinteger(L, spans[i].iCount);
+	lua_setfield(L, -2, "count");
+	lua_pushnumber(L, spans[i].iTotal);
+	lua_setfield(L, -2, "total");
+	lua_pushnumber(L, spans[i].iMax);
+	lua_setfield(L, -2, "max");
+	lua_rawseti(L, -2, i + 1);
+    }
+    std::vector<Trace::Stat> counters = Trace::counters();
+    lua_createtable(L, 0, counters.size());
+    for (const auto & c : counters) {
+	lua_pushinteger(L, c.iCount);
+	lua_setfield(L, -2, c.iName.z());
+    }
+    return 2;
+}
+
+static int trace_save(lua_State * L) {
+    String s = check_filename(L, 1);
+    lua_pushboolean(L, Trace::saveChromeTrace(s.z()));
+    return 1;
+}
+
+// --------------------------------------------------------------------
+
 static const struct luaL_Reg ipelib_functions[] = {
     {"Document", document_constructor},
     {"Page", page_constructor},
+    {"SpillFile", spillfile_constructor},
+    {"Journal", journal_constructor},
     {"Vector", vector_constructor},
     {"Direction", direction_constructor},
     {"Matrix", matrix_constructor},
@@ -754,6 +914,10 @@ static const struct luaL_Reg ipelib_functions[] = {
     {"readImage", ipe_readImage},
     {"Image", image_constructor},
     {"folder", get_folder},
+    {"traceEnable", trace_enable},
+    {"traceReset", trace_reset},
+    {"traceStatistics", trace_statistics},
+    {"traceSave", trace_save},
     {nullptr, nullptr}};
 
 extern "C" int luaopen_ipe(lua_State * L) {
@@ -768,6 +932,7 @@ extern "C" int luaopen_ipe(lua_State * L) {
     luaL_newmetatable(L, "Ipe.document");
     luaL_setfuncs(L, document_methods, 0);
     lua_pop(L, 1);
+    make_metatable(L, "Ipe.journal", journal_methods);
 
     luaL_newlib(L, ipelib_functions);
     lua_setglobal(L, "ipe");
@@ -195,6 +195,7 @@ extern void push_page(lua_State * L, ipe::Page * page, bool owned = true);
 extern int check_layer(lua_State * L, int i, ipe::Page * p);
 extern int check_viewno(lua_State * L, int i, ipe::Page * p, int extra = 0);
 extern int page_constructor(lua_State * L);
+extern int spillfile_constructor(lua_State * L);
 
 // ipelet
 
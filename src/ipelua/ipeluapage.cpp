@@ -32,6 +32,7 @@
 
 #include "ipeiml.h"
 #include "ipepage.h"
+#include "ipeutils.h"
 
 using namespace ipe;
 using namespace ipelua;
@@ -370,6 +371,34 @@ static int page_replace(lua_State * L) {
     return 0;
 }
 
+// hash values are returned as integers, possibly negative
+static int page_objectHash(lua_State * L) {
+    Page * p = check_page(L, 1)->page;
+    int n = check_objno(L, 2, p);
+    lua_pushinteger(L, lua_Integer(p->objectHash(n)));
+    return 1;
+}
+
+static int page_layerHash(lua_State * L) {
+    Page * p = check_page(L, 1)->page;
+    int n = check_layer(L, 2, p);
+    lua_pushinteger(L, lua_Integer(p->layerHash(n)));
+    return 1;
+}
+
+static int page_viewHash(lua_State * L) {
+    Page * p = check_page(L, 1)->page;
+    int n = check_viewno(L, 2, p);
+    lua_pushinteger(L, lua_Integer(p->viewHash(n)));
+    return 1;
+}
+
+static int page_hash(lua_State * L) {
+    Page * p = check_page(L, 1)->page;
+    lua_pushinteger(L, lua_Integer(p->contentHash()));
+    return 1;
+}
+
 static int page_invalidateBBox(lua_State * L) {
     Page * p = check_page(L, 1)->page;
     int n = check_objno(L, 2, p);
@@ -763,6 +792,10 @@ static const struct luaL_Reg page_methods[] = {
     {"remove", page_remove},
     {"replace", page_replace},
     {"invalidateBBox", page_invalidateBBox},
+    {"objectHash", page_objectHash},
+    {"layerHash", page_layerHash},
+    {"viewHash", page_viewHash},
+    {"hash", page_hash},
     {"transform", page_transform},
     {"distance", page_distance},
     {"setAttribute", page_setAttribute},
@@ -781,10 +814,99 @@ static const struct luaL_Reg page_methods[] = {
 
 // --------------------------------------------------------------------
 
+int ipelua::spillfile_constructor(lua_State * L) {
+    SpillFile ** s = (SpillFile **)lua_newuserdata(L, sizeof(SpillFile *));
+    *s = nullptr;
+    luaL_getmetatable(L, "Ipe.spillfile");
+    lua_setmetatable(L, -2);
+    *s = new SpillFile;
+    return 1;
+}
+
+static SpillFile * check_spillfile(lua_State * L, int i) {
+    return *(SpillFile **)luaL_checkudata(L, i, "Ipe.spillfile");
+}
+
+static int spillfile_destructor(lua_State * L) {
+    SpillFile ** s = (SpillFile **)luaL_checkudata(L, 1, "Ipe.spillfile");
+    delete *s;
+    *s = nullptr;
+    return 0;
+}
+
+static int spillfile_tostring(lua_State * L) {
+    check_spillfile(L, 1);
+    lua_pushfstring(L, "SpillFile@%p", lua_topointer(L, 1));
+    return 1;
+}
+
+// returns 0 if the argument is not a page or an object
+static int spillfile_estimate(lua_State * L) {
+    check_spillfile(L, 1);
+    if (is_type(L, 2, "Ipe.page"))
+	lua_pushinteger(L, SpillFile::estimate(check_page(L, 2)->page));
+    else if (is_type(L, 2, "Ipe.object"))
+	lua_pushinteger(L, SpillFile::estimate(check_object(L, 2)->obj));
+    else
+	lua_pushinteger(L, 0);
+    return 1;
+}
+
+// returns nil if the argument is not a page or an object,
+// false if it cannot be stored
+static int spillfile_store(lua_State * L) {
+    SpillFile * s = check_spillfile(L, 1);
+    int id;
+    if (is_type(L, 2, "Ipe.page"))
+	id = s->store(check_page(L, 2)->page);
+    else if (is_type(L, 2, "Ipe.object"))
+	id = s->store(check_object(L, 2)->obj);
+    else
+	return 0;
+    if (id < 0)
+	lua_pushboolean(L, false);
+    else
+	lua_pushinteger(L, id);
+    return 1;
+}
+
+static int spillfile_load(lua_State * L) {
+    SpillFile * s = check_spillfile(L, 1);
+    int id = (int)luaL_checkinteger(L, 2);
+    if (s->isObject(id)) {
+	Object * obj = s->loadObject(id);
+	if (!obj) return 0;
+	push_object(L, obj);
+    } else {
+	Page * page = s->load(id);
+	if (!page) return 0;
+	push_page(L, page);
+    }
+    return 1;
+}
+
+static int spillfile_release(lua_State * L) {
+    SpillFile * s = check_spillfile(L, 1);
+    s->release((int)luaL_checkinteger(L, 2));
+    return 0;
+}
+
+static const struct luaL_Reg spillfile_methods[] = {
+    {"__gc", spillfile_destructor},
+    {"__tostring", spillfile_tostring},
+    {"estimate", spillfile_estimate},
+    {"store", spillfile_store},
+    {"load", spillfile_load},
+    {"release", spillfile_release},
+    {nullptr, nullptr}};
+
+// --------------------------------------------------------------------
+
 int ipelua::open_ipepage(lua_State * L) {
     luaL_newmetatable(L, "Ipe.page");
     luaL_setfuncs(L, page_methods, 0);
     lua_pop(L, 1);
+    make_metatable(L, "Ipe.spillfile", spillfile_methods);
 
     return 0;
 }
@@ -32,6 +32,11 @@
 
 using namespace ipe;
 
+// number of views rendered ahead in each direction
+constexpr int PRERENDER_VIEWS = 2;
+// memory used for rendered views
+constexpr size_t RENDER_CACHE_BYTES = 256 << 20;
+
 // --------------------------------------------------------------------
 
 bool Presenter::load(const char * fname) {
@@ -45,6 +50,8 @@ bool Presenter::load(const char * fname) {
 
     if (!okay) return false;
 
+    // stop rendering the old document
+    if (iCache) iCache->setPdf(nullptr, nullptr);
     iPdf = std::move(pdf);
 
     iFileName = fname;
@@ -56,6 +63,8 @@ bool Presenter::load(const char * fname) {
 
     iResources = std::make_unique<PdfFileResources>(iPdf.get());
     iFonts = std::make_unique<Fonts>(iResources.get());
+    if (!iCache) iCache = std::make_unique<PdfRenderCache>(RENDER_CACHE_BYTES);
+    iCache->setPdf(iPdf.get(), iFonts.get());
     iType3WarningShown = false;
 
     return true;
@@ -197,12 +206,26 @@ static const char * const type3Warning =
 void Presenter::setViewPage(PdfViewBase * view, int pdfpno) {
     view->setPage(iPdf->page(pdfpno), mediaBox(pdfpno));
     view->updatePdf();
-    if (!iType3WarningShown && iFonts->hasType3Font()) {
+    prerender(view, pdfpno);
+    if (!iType3WarningShown && iCache->hasType3Font()) {
 	showType3Warning(type3Warning);
 	iType3WarningShown = true;
     }
 }
 
+// render the views around pdfpno in the background, nearest first
+void Presenter::prerender(PdfViewBase * view, int pdfpno) {
+    std::vector<PdfRenderKey> keys;
+    if (!view->blackout()) {
+	for (int d = 0; d <= 2 * PRERENDER_VIEWS; ++d) {
+	    int pno = (d % 2) ? pdfpno + (d + 1) / 2 : pdfpno - d / 2;
+	    if (0 <= pno && pno < iPdf->countPages())
+		keys.push_back(view->renderKey(iPdf->page(pno), mediaBox(pno)));
+	}
+    }
+    iCache->prerender(view, std::move(keys));
+}
+
 void Presenter::fitBox(const Rect & box, PdfViewBase * view) {
     if (box.isEmpty()) return;
     double xfactor = box.width() > 0.0 ? (view->viewWidth() / box.width()) : 20.0;
@@ -95,6 +95,7 @@ protected:
     void makePageLabels();
     void collectPageLabels(const ipe::PdfDict * d);
     void setViewPage(ipe::PdfViewBase * view, int pdfpno);
+    void prerender(ipe::PdfViewBase * view, int pdfpno);
     String pageLabel(int pdfno);
     String currentLabel();
     virtual void showType3Warning(const char * s) = 0;
@@ -107,6 +108,8 @@ protected:
     std::unique_ptr<ipe::PdfFile> iPdf;
     std::unique_ptr<ipe::PdfFileResources> iResources;
     std::unique_ptr<ipe::Fonts> iFonts;
+    // must be destroyed before iPdf and iFonts
+    std::unique_ptr<ipe::PdfRenderCache> iCache;
 
     int iPdfPageNo;
     std::vector<String> iAnnotations;
@@ -195,9 +195,9 @@ bool AppUi::load(NSString * aFname) {
 }
 
 void AppUi::setPdf() {
-    iCurrent.pdfView->setPdf(iPdf.get(), iFonts.get());
-    iNext.pdfView->setPdf(iPdf.get(), iFonts.get());
-    iScreen.pdfView->setPdf(iPdf.get(), iFonts.get());
+    iCurrent.pdfView->setPdf(iPdf.get(), iFonts.get(), iCache.get());
+    iNext.pdfView->setPdf(iPdf.get(), iFonts.get(), iCache.get());
+    iScreen.pdfView->setPdf(iPdf.get(), iFonts.get(), iCache.get());
 }
 
 void AppUi::setView() {
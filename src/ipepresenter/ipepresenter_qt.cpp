@@ -313,9 +313,9 @@ void MainWindow::jumpTo() {
 }
 
 void MainWindow::setPdf() {
-    iScreen->pdfView()->setPdf(iPdf.get(), iFonts.get());
-    iCurrent->setPdf(iPdf.get(), iFonts.get());
-    iNext->setPdf(iPdf.get(), iFonts.get());
+    iScreen->pdfView()->setPdf(iPdf.get(), iFonts.get(), iCache.get());
+    iCurrent->setPdf(iPdf.get(), iFonts.get(), iCache.get());
+    iNext->setPdf(iPdf.get(), iFonts.get(), iCache.get());
 }
 
 void MainWindow::setView() {
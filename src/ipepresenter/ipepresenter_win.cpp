@@ -344,9 +344,9 @@ bool AppUi::load(const char * fn) {
 }
 
 void AppUi::setPdf() {
-    iScreen->setPdf(iPdf.get(), iFonts.get());
-    iCurrent->setPdf(iPdf.get(), iFonts.get());
-    iNext->setPdf(iPdf.get(), iFonts.get());
+    iScreen->setPdf(iPdf.get(), iFonts.get(), iCache.get());
+    iCurrent->setPdf(iPdf.get(), iFonts.get(), iCache.get());
+    iNext->setPdf(iPdf.get(), iFonts.get(), iCache.get());
 }
 
 void AppUi::setView() {
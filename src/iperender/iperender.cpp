@@ -31,9 +31,26 @@
 #include "ipedoc.h"
 #include "ipethumbs.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
+
+#if !defined(WIN32) && !defined(IPEWASM)
+#define IPERENDER_SERVER
+#include <cerrno>
+#include <csignal>
+#include <list>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 using ipe::Document;
 using ipe::Page;
@@ -41,43 +58,455 @@ using ipe::Thumbnail;
 
 // --------------------------------------------------------------------
 
-static int renderPage(Thumbnail::TargetFormat fm, const char * src, const char * dst,
-		      const char * pageSpec, const char * viewSpec, double zoom,
-		      double tolerance, bool transparent, bool nocrop) {
-    Document * doc = Document::loadWithErrorReport(src);
+// A document, with Latex run and fonts loaded when first needed.
+struct Loaded {
+    std::unique_ptr<Document> iDoc;
+    int iLatexShards = 0; // parallel Latex runs used, zero if Latex has not run
+    std::unique_ptr<Thumbnail> iThumbnail;
+};
+
+// Bitmaps can be made from several parallel Latex runs, but files that
+// embed the fonts need a single run, so that each font is embedded once.
+static bool runLatex(Loaded & ld, const char * src, int shards = 1) {
+    if (ld.iLatexShards == 0 || (shards == 1 && ld.iLatexShards > 1)) {
+	if (ld.iDoc->runLatex(src, shards)) return false;
+	ld.iLatexShards = shards;
+	ld.iThumbnail.reset(); // its fonts belong to the old resources
+    }
+    return true;
+}
+
+struct RenderJob {
+    Thumbnail::TargetFormat iFormat = Thumbnail::EPNG;
+    const char * iPage = nullptr;
+    const char * iView = nullptr;
+    double iZoom = 1.0;
+    double iTolerance = 0.1;
+    bool iTransparent = false;
+    bool iNoCrop = false;
+    const char * iSrc = nullptr;
+    const char * iDst = nullptr;
+};
+
+// Parse the arguments "format { options } infile outfile".
+static bool parseRenderJob(int argc, char * const argv[], RenderJob & job) {
+    if (argc < 3) return false;
+
+    if (!strcmp(argv[0], "-png")) job.iFormat = Thumbnail::EPNG;
+#ifdef CAIRO_HAS_PS_SURFACE
+    else if (!strcmp(argv[0], "-eps"))
+	job.iFormat = Thumbnail::EPS;
+#endif
+#ifdef CAIRO_HAS_PDF_SURFACE
+    else if (!strcmp(argv[0], "-pdf"))
+	job.iFormat = Thumbnail::EPDF;
+#endif
+#ifdef CAIRO_HAS_SVG_SURFACE
+    else if (!strcmp(argv[0], "-svg"))
+	job.iFormat = Thumbnail::ESVG;
+#endif
+    else
+	return false;
+
+    double dpi = 72.0;
+    int i = 1;
+    while (i < argc - 2) {
+	if (!strcmp(argv[i], "-page")) {
+	    job.iPage = argv[i + 1];
+	    i += 2;
+	} else if (!strcmp(argv[i], "-view")) {
+	    job.iView = argv[i + 1];
+	    i += 2;
+	} else if (!strcmp(argv[i], "-resolution")) {
+	    dpi = ipe::Lex(ipe::String(argv[i + 1])).getDouble();
+	    i += 2;
+	} else if (!strcmp(argv[i], "-tolerance")) {
+	    job.iTolerance = ipe::Lex(ipe::String(argv[i + 1])).getDouble();
+	    i += 2;
+	} else if (!strcmp(argv[i], "-transparent")) {
+	    job.iTransparent = true;
+	    ++i;
+	} else if (!strcmp(argv[i], "-nocrop")) {
+	    job.iNoCrop = true;
+	    ++i;
+	} else
+	    return false;
+    }
+    // remaining arguments must be two filenames
+    if (i != argc - 2) return false;
+    job.iZoom = dpi / 72.0;
+    job.iSrc = argv[i];
+    job.iDst = argv[i + 1];
+    return true;
+}
 
-    if (!doc) return 1;
+static int renderPage(Loaded & ld, const RenderJob & job) {
+    Document * doc = ld.iDoc.get();
 
-    int pageIdx = pageSpec ? doc->findPage(pageSpec) : 0;
+    int pageIdx = job.iPage ? doc->findPage(job.iPage) : 0;
     if (pageIdx < 0) {
 	fprintf(stderr, "Incorrect -page specification.\n");
-	delete doc;
 	return 1;
     }
 
     const Page * page = doc->page(pageIdx);
 
-    int viewIdx = viewSpec ? page->findView(viewSpec) : 0;
+    int viewIdx = job.iView ? page->findView(job.iView) : 0;
     if (viewIdx < 0) {
 	fprintf(stderr, "Incorrect -view specification.\n");
-	delete doc;
 	return 1;
     }
 
-    if (doc->runLatex(src)) {
-	delete doc;
+    int shards = (job.iFormat == Thumbnail::EPNG) ? ipe::Platform::threadCount() : 1;
+    if (!runLatex(ld, job.iSrc, shards)) return 1;
+
+    if (!ld.iThumbnail) ld.iThumbnail = std::make_unique<Thumbnail>(doc, 0);
+    Thumbnail & tn = *ld.iThumbnail;
+    tn.setTransparent(job.iTransparent);
+    tn.setNoCrop(job.iNoCrop);
+    if (!tn.saveRender(job.iFormat, job.iDst, page, viewIdx, job.iZoom, job.iTolerance))
+	fprintf(stderr, "Failure to render page.\n");
+    return 0;
+}
+
+// --------------------------------------------------------------------
+
+#ifdef IPERENDER_SERVER
+
+using ipe::FileFormat;
+using ipe::SaveFlag;
+
+struct ConvertJob {
+    FileFormat iFormat = FileFormat::Unknown;
+    uint32_t iFlags = SaveFlag::SaveNormal;
+    bool iRunLatex = false;
+    const char * iSrc = nullptr;
+    const char * iDst = nullptr;
+};
+
+// Parse the arguments "( -xml | -pdf ) { options } infile outfile",
+// with the options of ipetoipe that do not refer to pages.
+static bool parseConvertJob(int argc, char * const argv[], ConvertJob & job) {
+    if (argc < 3) return false;
+
+    if (!strcmp(argv[0], "-xml"))
+	job.iFormat = FileFormat::Xml;
+    else if (!strcmp(argv[0], "-pdf"))
+	job.iFormat = FileFormat::Pdf;
+    else
+	return false;
+
+    int i = 1;
+    for (; i < argc - 2; ++i) {
+	if (!strcmp(argv[i], "-export"))
+	    job.iFlags |= SaveFlag::Export;
+	else if (!strcmp(argv[i], "-markedview"))
+	    job.iFlags |= SaveFlag::MarkedView | SaveFlag::Export;
+	else if (!strcmp(argv[i], "-runlatex"))
+	    job.iRunLatex = true;
+	else if (!strcmp(argv[i], "-nozip"))
+	    job.iFlags |= SaveFlag::NoZip;
+	else if (!strcmp(argv[i], "-keepnotes"))
+	    job.iFlags |= SaveFlag::KeepNotes;
+	else
+	    return false;
+    }
+    if ((job.iFlags & SaveFlag::Export) && job.iFormat == FileFormat::Xml) return false;
+    job.iSrc = argv[i];
+    job.iDst = argv[i + 1];
+    return true;
+}
+
+static int convertDocument(Loaded & ld, const ConvertJob & job) {
+    bool needLatex = job.iFormat == FileFormat::Pdf || job.iRunLatex;
+    if (needLatex && !runLatex(ld, job.iSrc)) return 1;
+    if (!ld.iDoc->save(job.iDst, job.iFormat, job.iFlags)) {
+	fprintf(stderr, "Failed to save document!\n");
 	return 1;
     }
+    return 0;
+}
 
-    Thumbnail tn(doc, 0);
-    tn.setTransparent(transparent);
-    tn.setNoCrop(nocrop);
-    if (!tn.saveRender(fm, dst, page, viewIdx, zoom, tolerance))
-	fprintf(stderr, "Failure to render page.\n");
-    delete doc;
+// --------------------------------------------------------------------
+
+// A document kept by a server worker between jobs.
+struct CachedDocument {
+    ipe::String iPath;
+    dev_t iDevice;
+    ino_t iInode;
+    off_t iSize;
+    time_t iModified;
+    Loaded iLoaded;
+};
+
+// the number of documents kept by each server worker
+constexpr size_t MAX_CACHED_DOCUMENTS = 8;
+
+// the longest job request accepted by the server
+constexpr size_t MAX_REQUEST = 64 * 1024;
+
+static std::list<CachedDocument> documentCache; // most recently used first
+
+static volatile sig_atomic_t stopServer = 0;
+
+static void stopHandler(int) { stopServer = 1; }
+
+// Return the document in file src.  It is only loaded if the worker
+// does not have it from an earlier job, or if the file has changed.
+static Loaded * cachedDocument(const char * src) {
+    struct stat st;
+    if (stat(src, &st) != 0) {
+	fprintf(stderr, "Cannot stat file '%s'.\n", src);
+	return nullptr;
+    }
+    ipe::String path = ipe::Platform::realPath(src);
+    for (auto it = documentCache.begin(); it != documentCache.end(); ++it) {
+	if (it->iPath != path) continue;
+	if (it->iDevice == st.st_dev && it->iInode == st.st_ino
+	    && it->iSize == st.st_size && it->iModified == st.st_mtime) {
+	    documentCache.splice(documentCache.begin(), documentCache, it);
+	    return &documentCache.front().iLoaded;
+	}
+	documentCache.erase(it);
+	break;
+    }
+    std::unique_ptr<Document> doc(Document::loadWithErrorReport(src));
+    if (!doc) return nullptr;
+    documentCache.emplace_front(
+	CachedDocument{path, st.st_dev, st.st_ino, st.st_size, st.st_mtime, Loaded{}});
+    if (documentCache.size() > MAX_CACHED_DOCUMENTS) documentCache.pop_back();
+    documentCache.front().iLoaded.iDoc = std::move(doc);
+    return &documentCache.front().iLoaded;
+}
+
+static int runJob(const std::string & kind, int argc, char * const argv[]) {
+    if (kind == "render") {
+	RenderJob job;
+	if (parseRenderJob(argc, argv, job)) {
+	    Loaded * ld = cachedDocument(job.iSrc);
+	    return ld ? renderPage(*ld, job) : 1;
+	}
+    } else if (kind == "convert") {
+	ConvertJob job;
+	if (parseConvertJob(argc, argv, job)) {
+	    Loaded * ld = cachedDocument(job.iSrc);
+	    return ld ? convertDocument(*ld, job) : 1;
+	}
+    }
+    fprintf(stderr, "Invalid %s job.\n", kind.c_str());
+    return 1;
+}
+
+static bool socketAddress(const char * path, sockaddr_un & addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+	fprintf(stderr, "Socket name '%s' is too long.\n", path);
+	return false;
+    }
+    strcpy(addr.sun_path, path);
+    return true;
+}
+
+static int connectTo(const sockaddr_un & addr) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (const sockaddr *)&addr, sizeof(addr)) == 0) return fd;
+    if (fd >= 0) close(fd);
+    return -1;
+}
+
+static bool writeAll(int fd, const std::string & data) {
+    size_t done = 0;
+    while (done < data.size()) {
+	ssize_t n = write(fd, data.data() + done, data.size() - done);
+	if (n < 0 && errno == EINTR) continue;
+	if (n <= 0) return false;
+	done += n;
+    }
+    return true;
+}
+
+// Read from fd until end of file, or until the data contains stop.
+static bool readAll(int fd, std::string & data, const char * stop = nullptr) {
+    char buf[4096];
+    while (!stop || data.find(stop) == std::string::npos) {
+	if (data.size() > MAX_REQUEST && stop) return false;
+	ssize_t n = read(fd, buf, sizeof(buf));
+	if (n < 0 && errno == EINTR) continue;
+	if (n < 0) return false;
+	if (n == 0) return !stop;
+	data.append(buf, n);
+    }
+    return true;
+}
+
+// A request consists of lines: the client's current directory, the
+// kind of job, and its arguments, followed by an empty line.  The
+// reply is the exit status of the job on a line by itself, followed
+// by the messages written by the job.
+static void serveJob(int conn) {
+    std::string request;
+    if (!readAll(conn, request, "\n\n")) return;
+    std::vector<std::string> lines;
+    size_t i = 0;
+    for (size_t j = request.find('\n'); j > i; j = request.find('\n', i)) {
+	lines.push_back(request.substr(i, j - i));
+	i = j + 1;
+    }
+    if (lines.size() < 2) return;
+    std::vector<char *> argv;
+    for (size_t k = 2; k < lines.size(); ++k) argv.push_back(lines[k].data());
+
+    // messages of the job go to the client
+    FILE * out = tmpfile();
+    if (!out) return;
+    fflush(stderr);
+    int savedStderr = dup(2);
+    dup2(fileno(out), 2);
+    int status = 1;
+    if (chdir(lines[0].c_str()) == 0)
+	status = runJob(lines[1], int(argv.size()), argv.data());
+    else
+	fprintf(stderr, "Cannot change to directory '%s'.\n", lines[0].c_str());
+    fflush(stderr);
+    dup2(savedStderr, 2);
+    close(savedStderr);
+
+    std::string reply = std::to_string(status) + "\n";
+    rewind(out);
+    readAll(fileno(out), reply);
+    fclose(out);
+    writeAll(conn, reply);
+}
+
+static int serveJobs(int listener, int worker) {
+    // workers must not share a Latex directory
+    ipe::String latexDir = ipe::Platform::folder(ipe::FolderLatex);
+    ipe::StringStream ss(latexDir);
+    ss << ipe::IPESEP << "server" << worker;
+    ipe::Platform::setFolder(ipe::FolderLatex, latexDir);
+    // a client may disconnect before reading its reply
+    signal(SIGPIPE, SIG_IGN);
+    while (!stopServer) {
+	int conn = accept(listener, nullptr, nullptr);
+	if (conn < 0) {
+	    if (errno == EINTR || errno == ECONNABORTED) continue;
+	    perror("accept");
+	    return 1;
+	}
+	serveJob(conn);
+	close(conn);
+    }
     return 0;
 }
 
+// The server keeps a pool of worker processes, which keep documents,
+// Latex results, and fonts in memory between jobs.  The jobs run in
+// processes rather than threads because each job changes to the
+// directory of its client, sends what is written to stderr to the
+// client, and runs Latex in the Latex folder, and all three belong to
+// the process.  (Ipelib objects themselves can be used on several
+// threads.)
+static int runServer(const char * path, int workers) {
+    sockaddr_un addr;
+    if (!socketAddress(path, addr)) return 1;
+    if (int fd = connectTo(addr); fd >= 0) {
+	close(fd);
+	fprintf(stderr, "A server is already listening on '%s'.\n", path);
+	return 1;
+    }
+    unlink(path); // left behind by a server that was killed
+
+    // only the user running the server may connect to the socket
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    mode_t mask = umask(077);
+    int bound =
+	(listener < 0) ? -1 : bind(listener, (const sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+    if (bound != 0 || listen(listener, SOMAXCONN) != 0) {
+	perror(path);
+	return 1;
+    }
+    // the workers share the threads available
+    ipe::Platform::setThreadCount(std::max(1, ipe::Platform::threadCount() / workers));
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stopHandler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    fprintf(stderr, "Iperender is listening on '%s' with %d workers.\n", path, workers);
+    std::vector<pid_t> pids(workers, 0);
+    while (!stopServer) {
+	for (int k = 0; k < workers; ++k) {
+	    if (pids[k] != 0) continue;
+	    pid_t pid = fork();
+	    if (pid == 0) exit(serveJobs(listener, k));
+	    if (pid < 0) {
+		perror("fork");
+		stopServer = 1;
+		break;
+	    }
+	    pids[k] = pid;
+	}
+	pid_t pid = waitpid(-1, nullptr, 0);
+	if (pid <= 0) continue; // interrupted by a signal
+	for (int k = 0; k < workers; ++k)
+	    if (pids[k] == pid) pids[k] = 0;
+	if (!stopServer) {
+	    fprintf(stderr, "A worker has died, starting a new one.\n");
+	    sleep(1);
+	}
+    }
+
+    for (pid_t pid : pids)
+	if (pid > 0) kill(pid, SIGTERM);
+    while (wait(nullptr) > 0)
+	;
+    close(listener);
+    unlink(path);
+    return 0;
+}
+
+// Send a job to the server, and return its exit status.
+static int runClient(const char * path, const char * kind, int argc, char * argv[]) {
+    sockaddr_un addr;
+    if (!socketAddress(path, addr)) return 1;
+    int fd = connectTo(addr);
+    if (fd < 0) {
+	perror(path);
+	return 1;
+    }
+    std::string request = ipe::Platform::currentDirectory().z();
+    request += "\n";
+    request += kind;
+    request += "\n";
+    for (int i = 0; i < argc; ++i) {
+	if (!*argv[i] || strchr(argv[i], '\n')) {
+	    fprintf(stderr, "Cannot send argument '%s' to the server.\n", argv[i]);
+	    close(fd);
+	    return 1;
+	}
+	request += argv[i];
+	request += "\n";
+    }
+    request += "\n";
+    std::string reply;
+    bool ok = writeAll(fd, request) && readAll(fd, reply);
+    close(fd);
+    size_t nl = reply.find('\n');
+    if (!ok || nl == std::string::npos) {
+	fprintf(stderr, "The server did not complete the job.\n");
+	return 1;
+    }
+    fputs(reply.c_str() + nl + 1, stderr);
+    return atoi(reply.c_str());
+}
+
+#endif
+
 // --------------------------------------------------------------------
 
 static void usage() {
@@ -94,8 +523,12 @@ static void usage() {
     fprintf(stderr, "] "
 		    "[ -page <page> ] [ -view <view> ] [ -resolution <dpi> ] "
 		    "[ -transparent ] [ -nocrop ] "
-		    "infile outfile\n"
-		    "Iperender saves a single page of the Ipe document in some formats.\n"
+		    "infile outfile\n");
+#ifdef IPERENDER_SERVER
+    fprintf(stderr, "       iperender -server <socket> [ -workers <n> ]\n"
+		    "       iperender -client <socket> [ -convert ] <arguments>\n");
+#endif
+    fprintf(stderr, "Iperender saves a single page of the Ipe document in some formats.\n"
 		    " -page       : page to save (default 1).\n"
 		    " -view       : view to save (default 1).\n"
 		    " -resolution : resolution for png format (default 72.0 ppi).\n"
@@ -103,73 +536,42 @@ static void usage() {
 		    " -transparent: use transparent background in png format.\n"
 		    " -nocrop     : do not crop page.\n"
 		    "<page> can be a page number or a page name.\n");
+#ifdef IPERENDER_SERVER
+    fprintf(stderr,
+	    " -server     : run jobs sent to the socket by 'iperender -client'.\n"
+	    " -workers    : number of jobs run in parallel by the server.\n"
+	    " -client     : let the server run iperender with these arguments,\n"
+	    "               or ipetoipe ( -xml | -pdf ) if -convert is given.\n");
+#endif
     exit(1);
 }
 
 int main(int argc, char * argv[]) {
     ipe::Platform::initLib(ipe::IPELIB_VERSION);
 
-    // ensure at least three arguments (handles -help as well :-)
-    if (argc < 4) usage();
-
-    Thumbnail::TargetFormat fm = Thumbnail::EPNG;
-    if (!strcmp(argv[1], "-png")) fm = Thumbnail::EPNG;
-#ifdef CAIRO_HAS_PS_SURFACE
-    else if (!strcmp(argv[1], "-eps"))
-	fm = Thumbnail::EPS;
-#endif
-#ifdef CAIRO_HAS_PDF_SURFACE
-    else if (!strcmp(argv[1], "-pdf"))
-	fm = Thumbnail::EPDF;
-#endif
-#ifdef CAIRO_HAS_SVG_SURFACE
-    else if (!strcmp(argv[1], "-svg"))
-	fm = Thumbnail::ESVG;
-#endif
-    else
-	usage();
-
-    const char * page = nullptr;
-    const char * view = nullptr;
-    double dpi = 72.0;
-    double tolerance = 0.1;
-    bool transparent = false;
-    bool nocrop = false;
-
-    int i = 2;
-    while (i < argc - 2) {
-	if (!strcmp(argv[i], "-page")) {
-	    if (i + 1 == argc) usage();
-	    page = argv[i + 1];
-	    i += 2;
-	} else if (!strcmp(argv[i], "-view")) {
-	    if (i + 1 == argc) usage();
-	    view = argv[i + 1];
-	    i += 2;
-	} else if (!strcmp(argv[i], "-resolution")) {
-	    if (i + 1 == argc) usage();
-	    dpi = ipe::Lex(ipe::String(argv[i + 1])).getDouble();
-	    i += 2;
-	} else if (!strcmp(argv[i], "-tolerance")) {
-	    if (i + 1 == argc) usage();
-	    tolerance = ipe::Lex(ipe::String(argv[i + 1])).getDouble();
-	    i += 2;
-	} else if (!strcmp(argv[i], "-transparent")) {
-	    transparent = true;
-	    ++i;
-	} else if (!strcmp(argv[i], "-nocrop")) {
-	    nocrop = true;
-	    ++i;
-	} else
+#ifdef IPERENDER_SERVER
+    if (argc >= 3 && !strcmp(argv[1], "-server")) {
+	int workers = ipe::Platform::threadCount();
+	if (argc == 5 && !strcmp(argv[3], "-workers"))
+	    workers = std::max(1, atoi(argv[4]));
+	else if (argc != 3)
 	    usage();
+	return runServer(argv[2], workers);
+    }
+    if (argc >= 3 && !strcmp(argv[1], "-client")) {
+	if (argc > 3 && !strcmp(argv[3], "-convert"))
+	    return runClient(argv[2], "convert", argc - 4, argv + 4);
+	return runClient(argv[2], "render", argc - 3, argv + 3);
     }
+#endif
 
-    // remaining arguments must be two filenames
-    const char * src = argv[i];
-    const char * dst = argv[i + 1];
+    RenderJob job;
+    if (!parseRenderJob(argc - 1, argv + 1, job)) usage();
 
-    return renderPage(fm, src, dst, page, view, dpi / 72.0, tolerance, transparent,
-		      nocrop);
+    Loaded ld;
+    ld.iDoc.reset(Document::loadWithErrorReport(job.iSrc));
+    if (!ld.iDoc) return 1;
+    return renderPage(ld, job);
 }
 
 // --------------------------------------------------------------------
@@ -30,9 +30,17 @@
 
 #include "ipebase.h"
 #include "ipelua.h"
+#include "ipeutils.h"
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if !defined(WIN32) && !defined(IPEWASM)
+#define IPESCRIPT_WORKERS
+#include <unistd.h>
+#endif
 
 using namespace ipe;
 using namespace ipelua;
@@ -121,30 +129,19 @@ static void setup_globals(lua_State * L) {
 
 // --------------------------------------------------------------------
 
-static void usage() {
-    fprintf(stderr, "Usage: ipescript <script> { <arguments> }\n"
-		    "Ipescript runs a script from your scripts directories with\n"
-		    "the given arguments.\n"
-		    "Do not include the .lua extension in the script name.\n");
-    exit(1);
-}
-
-int main(int argc, char * argv[]) {
-    Platform::initLib(IPELIB_VERSION);
-
-    if (argc < 2) usage();
-
+// Run the script in a new Lua state, return false if it failed.
+static bool runScript(const char * script, const std::vector<const char *> & args) {
     String s = "require \"";
-    s += argv[1];
+    s += script;
     s += "\"";
 
     lua_State * L = setup_lua();
 
     // create table with arguments
-    lua_createtable(L, 0, argc - 2);
-    for (int i = 2; i < argc; ++i) {
-	lua_pushstring(L, argv[i]);
-	lua_rawseti(L, -2, i - 1);
+    lua_createtable(L, 0, args.size());
+    for (size_t i = 0; i < args.size(); ++i) {
+	lua_pushstring(L, args[i]);
+	lua_rawseti(L, -2, i + 1);
     }
     lua_setglobal(L, "argv");
 
@@ -154,12 +151,155 @@ int main(int argc, char * argv[]) {
     lua_pushcfunction(L, traceback);
     assert(luaL_loadstring(L, s.z()) == 0);
 
+    bool ok = true;
     if (lua_pcallk(L, 0, 0, -2, 0, nullptr)) {
 	const char * errmsg = lua_tolstring(L, -1, nullptr);
 	fprintf(stderr, "%s\n", errmsg);
+	ok = false;
     }
 
     lua_close(L);
+    return ok;
+}
+
+// --------------------------------------------------------------------
+
+struct FileRun {
+    const char * iFile;
+    int iStatus = -1; // -1 if the script did not finish
+    String iOutput;
+};
+
+// Run the script with the file appended to the arguments.
+static void runOnFile(const char * script, std::vector<const char *> args,
+		      FileRun & run) {
+    args.push_back(run.iFile);
+    run.iStatus = runScript(script, args) ? 0 : 1;
+}
+
+#ifdef IPESCRIPT_WORKERS
+
+// Run the script with stdout and stderr captured in run.iOutput.
+static void runCaptured(const char * script, const std::vector<const char *> & args,
+			FileRun & run) {
+    FILE * out = tmpfile();
+    if (!out) {
+	runOnFile(script, args, run);
+	return;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    int savedStdout = dup(1);
+    int savedStderr = dup(2);
+    dup2(fileno(out), 1);
+    dup2(fileno(out), 2);
+    runOnFile(script, args, run);
+    fflush(stdout);
+    fflush(stderr);
+    dup2(savedStdout, 1);
+    dup2(savedStderr, 2);
+    close(savedStdout);
+    close(savedStderr);
+    rewind(out);
+    int ch;
+    while ((ch = fgetc(out)) != EOF) run.iOutput.append(char(ch));
+    fclose(out);
+}
+
+// Run the script in worker processes, each with its own Lua states.
+// Separate Lua states could run on threads, but a script can run Latex
+// in the Latex folder, its output is captured by redirecting stdout
+// and stderr, and it can call os.exit, and all of these act on the
+// whole process.  If no worker can be started, the script runs on the
+// files one by one.
+static void runInWorkers(const char * script, const std::vector<const char *> & args,
+			 std::vector<FileRun> & runs, int jobs) {
+    auto work = [&](int k) {
+	FileRun & run = runs[k];
+	runCaptured(script, args, run);
+	char buf[16];
+	snprintf(buf, sizeof(buf), "%d\n", run.iStatus);
+	return String(buf) + run.iOutput;
+    };
+    auto done = [&](int k, String result) {
+	FileRun & run = runs[k];
+	int i = result.find('\n');
+	if (i < 0) return;
+	run.iStatus = std::atoi(result.left(i).z());
+	run.iOutput = result.substr(i + 1);
+    };
+    if (!ipe::runInWorkers(int(runs.size()), jobs, work, done))
+	for (FileRun & run : runs) runCaptured(script, args, run);
+}
+
+#endif
+
+static int runBatch(const char * script, const std::vector<const char *> & args,
+		    const std::vector<const char *> & files, int jobs) {
+    std::vector<FileRun> runs;
+    for (const char * file : files) runs.push_back(FileRun{file});
+#ifdef IPESCRIPT_WORKERS
+    runInWorkers(script, args, runs, std::min(jobs, int(runs.size())));
+#else
+    for (FileRun & run : runs) {
+	printf("==> %s <==\n", run.iFile);
+	fflush(stdout);
+	runOnFile(script, args, run);
+    }
+#endif
+    int failed = 0;
+    for (const FileRun & run : runs) {
+#ifdef IPESCRIPT_WORKERS
+	printf("==> %s <==\n%s", run.iFile, run.iOutput.z());
+#endif
+	if (run.iStatus != 0) ++failed;
+	if (run.iStatus < 0) printf("The script did not finish.\n");
+    }
+    fflush(stdout);
+    if (failed) fprintf(stderr, "The script failed for %d of %d files.\n", failed,
+			int(runs.size()));
+    return failed ? 1 : 0;
+}
+
+// --------------------------------------------------------------------
+
+static void usage() {
+    fprintf(stderr, "Usage: ipescript <script> { <arguments> }\n"
+		    "       ipescript -batch [ -jobs <n> ] <script> { <arguments> } "
+		    "-- { <file> }\n"
+		    "Ipescript runs a script from your scripts directories with\n"
+		    "the given arguments.\n"
+		    "Do not include the .lua extension in the script name.\n"
+		    "With -batch, the script is run once for each file, with the\n"
+		    "file appended to the arguments, on n files at once (default:\n"
+		    "one per processor).  The output of each run is shown after all\n"
+		    "have finished.\n");
+    exit(1);
+}
+
+int main(int argc, char * argv[]) {
+    Platform::initLib(IPELIB_VERSION);
+
+    if (argc < 2) usage();
+
+    if (!strcmp(argv[1], "-batch")) {
+	int i = 2;
+	int jobs = Platform::threadCount();
+	if (i + 1 < argc && !strcmp(argv[i], "-jobs")) {
+	    jobs = std::max(1, atoi(argv[i + 1]));
+	    i += 2;
+	}
+	if (i >= argc) usage();
+	const char * script = argv[i++];
+	std::vector<const char *> args;
+	while (i < argc && strcmp(argv[i], "--")) args.push_back(argv[i++]);
+	if (i == argc) usage();
+	std::vector<const char *> files(argv + i + 1, argv + argc);
+	return runBatch(script, args, files, jobs);
+    }
+
+    std::vector<const char *> args(argv + 2, argv + argc);
+    runScript(argv[1], args);
     return 0;
 }
 
@@ -29,15 +29,32 @@
 */
 
 #include "ipedoc.h"
+#include "ipeutils.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 
+#if !defined(WIN32) && !defined(IPEWASM)
+#define IPETOIPE_WORKERS
+#include <unistd.h>
+#endif
+
 using ipe::Document;
 using ipe::FileFormat;
+using ipe::Platform;
 using ipe::SaveFlag;
 using ipe::String;
 
+struct Options {
+    FileFormat iFormat = FileFormat::Unknown;
+    uint32_t iFlags = SaveFlag::SaveNormal;
+    bool iRunLatex = false;
+    const char * iPages = nullptr;
+    const char * iView = nullptr;
+};
+
 static int topdf(Document * doc, String src, String dst, uint32_t flags,
 		 int fromPage = -1, int toPage = -1, int viewNo = -1) {
     int res = doc->runLatex(src);
@@ -62,11 +79,255 @@ static int topdf(Document * doc, String src, String dst, uint32_t flags,
     return 0;
 }
 
+// Guess the output filename, return empty string if impossible.
+static String outputName(String infile, FileFormat frm) {
+    String outfile = infile;
+    String ext = infile.right(4);
+    if (ext == ".ipe" || ext == ".pdf" || ext == ".xml")
+	outfile = infile.left(infile.size() - 4);
+    switch (frm) {
+    case FileFormat::Xml: outfile += ".ipe"; break;
+    case FileFormat::Pdf: outfile += ".pdf";
+    default: break;
+    }
+    return (outfile == infile) ? String() : outfile;
+}
+
+static int convert(const Options & opt, String infile, String outfile) {
+    std::unique_ptr<Document> doc(Document::loadWithErrorReport(infile.z()));
+
+    if (!doc) return 1;
+
+    fprintf(stderr, "Document %s has %d pages (%d views)\n", infile.z(),
+	    doc->countPages(), doc->countTotalViews());
+
+    // parse pages and view
+    int fromPage = -1;
+    int toPage = -1;
+    int viewNo = -1;
+
+    if (opt.iPages) {
+	String p(opt.iPages);
+	int j = p.find('-');
+	if (j >= 0) {
+	    fromPage = (j > 0) ? doc->findPage(p.left(j)) : 0;
+	    toPage = (j < p.size() - 1) ? doc->findPage(p.substr(j + 1))
+					: doc->countPages() - 1;
+	}
+	if (fromPage < 0 || fromPage > toPage) {
+	    fprintf(stderr, "incorrect -pages specification.\n");
+	    return 1;
+	}
+    } else if (opt.iView) {
+	String v(opt.iView);
+	int j = v.find('-');
+	if (j > 0) {
+	    fromPage = doc->findPage(v.left(j));
+	    if (fromPage >= 0) viewNo = doc->page(fromPage)->findView(v.substr(j + 1));
+	}
+	if (fromPage < 0 || viewNo < 0) {
+	    fprintf(stderr, "incorrect -view specification.\n");
+	    return 1;
+	}
+    }
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "ipetoipe %d.%d.%d", ipe::IPELIB_VERSION / 10000,
+	     (ipe::IPELIB_VERSION / 100) % 100, ipe::IPELIB_VERSION % 100);
+    Document::SProperties props = doc->properties();
+    props.iCreator = buf;
+    doc->setProperties(props);
+
+    switch (opt.iFormat) {
+    case FileFormat::Xml:
+	if (opt.iRunLatex)
+	    return topdf(doc.get(), infile, outfile, opt.iFlags);
+	else
+	    doc->save(outfile.z(), FileFormat::Xml, SaveFlag::SaveNormal);
+    default: return 0;
+
+    case FileFormat::Pdf:
+	return topdf(doc.get(), infile, outfile, opt.iFlags, fromPage, toPage, viewNo);
+    }
+}
+
+// --------------------------------------------------------------------
+
+struct BatchFile {
+    String iInput;
+    String iOutput;
+    int iStatus = -1; // -1 if the conversion did not finish
+    double iSeconds = 0.0;
+    String iMessages;
+};
+
+static void convertBatchFile(const Options & opt, BatchFile & bf) {
+    auto start = std::chrono::steady_clock::now();
+    if (bf.iOutput.empty()) {
+	fprintf(stderr, "Cannot guess output filename.\n");
+	bf.iStatus = 1;
+    } else
+	bf.iStatus = convert(opt, bf.iInput, bf.iOutput);
+    bf.iSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+		      .count();
+}
+
+#ifdef IPETOIPE_WORKERS
+
+// Convert file with messages captured in bf.iMessages.
+static void convertCaptured(const Options & opt, BatchFile & bf) {
+    FILE * out = tmpfile();
+    if (!out) {
+	convertBatchFile(opt, bf);
+	return;
+    }
+    fflush(stderr);
+    int savedStderr = dup(2);
+    dup2(fileno(out), 2);
+    convertBatchFile(opt, bf);
+    fflush(stderr);
+    dup2(savedStderr, 2);
+    close(savedStderr);
+    rewind(out);
+    int ch;
+    while ((ch = fgetc(out)) != EOF) bf.iMessages.append(char(ch));
+    fclose(out);
+}
+
+// Run the conversions in worker processes.  Ipelib objects can be used
+// on several threads, but a conversion runs Latex in the Latex folder,
+// and its messages are captured by redirecting stdout and stderr, and
+// both are shared by all threads of a process.  If no worker can be
+// started, the files are converted one by one.
+static void convertInWorkers(const Options & opt, std::vector<BatchFile> & files,
+			     int jobs) {
+    auto work = [&](int k) {
+	BatchFile & bf = files[k];
+	convertCaptured(opt, bf);
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%d %g\n", bf.iStatus, bf.iSeconds);
+	return String(buf) + bf.iMessages;
+    };
+    auto done = [&](int k, String result) {
+	BatchFile & bf = files[k];
+	int i = result.find('\n');
+	if (i < 0 || sscanf(result.left(i).z(), "%d %lg", &bf.iStatus, &bf.iSeconds) != 2)
+	    return;
+	bf.iMessages = result.substr(i + 1);
+    };
+    if (!ipe::runInWorkers(int(files.size()), jobs, work, done))
+	for (BatchFile & bf : files) convertCaptured(opt, bf);
+}
+
+#endif
+
+static void writeJsonString(FILE * f, String s) {
+    fputc('"', f);
+    for (int i = 0; i < s.size(); ++i) {
+	unsigned char ch = s[i];
+	if (ch == '"' || ch == '\\')
+	    fprintf(f, "\\%c", ch);
+	else if (ch == '\n')
+	    fputs("\\n", f);
+	else if (ch < 0x20)
+	    fprintf(f, "\\u%04x", ch);
+	else
+	    fputc(ch, f);
+    }
+    fputc('"', f);
+}
+
+static void writeSummary(FILE * f, const std::vector<BatchFile> & files, double seconds) {
+    int failed = std::count_if(files.begin(), files.end(),
+			       [](const BatchFile & bf) { return bf.iStatus != 0; });
+    fprintf(f, "{\"seconds\": %.3f, \"failed\": %d, \"files\": [", seconds, failed);
+    for (size_t k = 0; k < files.size(); ++k) {
+	const BatchFile & bf = files[k];
+	fprintf(f, "%s\n{\"input\": ", k ? "," : "");
+	writeJsonString(f, bf.iInput);
+	fprintf(f, ", \"output\": ");
+	writeJsonString(f, bf.iOutput);
+	fprintf(f, ", \"status\": %d, \"seconds\": %.3f, \"messages\": ", bf.iStatus,
+		bf.iSeconds);
+	writeJsonString(f, bf.iMessages);
+	fprintf(f, "}");
+    }
+    fprintf(f, "\n]}\n");
+}
+
+// Return the files to convert, with directories replaced by the files
+// in them that can be converted to the output format.
+static std::vector<BatchFile> batchFiles(const std::vector<String> & inputs,
+					 FileFormat frm) {
+    std::vector<BatchFile> files;
+    for (const String & input : inputs) {
+	std::vector<String> names;
+	if (!Platform::listDirectory(input, names)) {
+	    files.push_back(BatchFile{input, outputName(input, frm)});
+	    continue;
+	}
+	std::sort(names.begin(), names.end());
+	for (const String & name : names) {
+	    String ext = name.right(4);
+	    bool ok = (frm == FileFormat::Pdf) ? (ext == ".ipe" || ext == ".xml")
+					       : (ext == ".pdf");
+	    if (!ok) continue;
+	    String path = input;
+	    path += ipe::IPESEP;
+	    path += name;
+	    files.push_back(BatchFile{path, outputName(path, frm)});
+	}
+    }
+    return files;
+}
+
+static int convertBatch(const Options & opt, const std::vector<String> & inputs,
+			int jobs, const char * summary) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<BatchFile> files = batchFiles(inputs, opt.iFormat);
+    jobs = std::min(jobs, int(files.size()));
+#ifdef IPETOIPE_WORKERS
+    if (jobs > 1)
+	convertInWorkers(opt, files, jobs);
+    else
+	for (BatchFile & bf : files) convertCaptured(opt, bf);
+#else
+    for (BatchFile & bf : files) convertBatchFile(opt, bf);
+#endif
+    double seconds =
+	std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int failed = 0;
+    for (const BatchFile & bf : files) {
+	if (bf.iStatus == 0) continue;
+	++failed;
+	fprintf(stderr, "Failed to convert %s:\n%s", bf.iInput.z(),
+		bf.iStatus < 0 ? "The conversion did not finish.\n" : bf.iMessages.z());
+    }
+    fprintf(stderr, "Converted %d of %d files in %.1f seconds.\n",
+	    int(files.size()) - failed, int(files.size()), seconds);
+
+    if (summary) {
+	FILE * f = strcmp(summary, "-") ? Platform::fopen(summary, "w") : stdout;
+	if (!f) {
+	    fprintf(stderr, "Cannot write summary to '%s'.\n", summary);
+	    return 1;
+	}
+	writeSummary(f, files, seconds);
+	if (f != stdout) fclose(f);
+    }
+    return failed ? 1 : 0;
+}
+
+// --------------------------------------------------------------------
+
 static void usage() {
     fprintf(
 	stderr,
 	"Usage: ipetoipe ( -xml | -pdf ) <options> "
 	"infile [ outfile ]\n"
+	"       ipetoipe -batch ( -xml | -pdf ) <options> "
+	"{ infile | directory }\n"
 	"Ipetoipe converts between the different Ipe file formats.\n"
 	" -export      : output contains no Ipe markup.\n"
 	" -pages <n-m> : export only these pages (implies -export).\n"
@@ -77,7 +338,12 @@ static void usage() {
 	" -runlatex    : run Latex even for XML output.\n"
 	" -nozip       : do not compress PDF streams.\n"
 	" -keepnotes   : save page notes as PDF annotations even when exporting.\n"
-	"Pages can be specified by page number or by section title.\n");
+	"Pages can be specified by page number or by section title.\n"
+	"With -batch, each file is converted to a file with the same basename,\n"
+	"and the files in a directory that can be converted are converted.\n"
+	" -jobs <n>    : convert n files at once (default: one per processor).\n"
+	" -summary <f> : write results and timings in JSON to f (- for stdout).\n"
+	" -nocache     : do not reuse the Latex results of earlier conversions.\n");
     exit(1);
 }
 
@@ -87,19 +353,22 @@ int main(int argc, char * argv[]) {
     // ensure at least two arguments (handles -help as well :-)
     if (argc < 3) usage();
 
-    FileFormat frm = FileFormat::Unknown;
-    if (!strcmp(argv[1], "-xml"))
-	frm = FileFormat::Xml;
-    else if (!strcmp(argv[1], "-pdf"))
-	frm = FileFormat::Pdf;
+    bool batch = !strcmp(argv[1], "-batch");
+    int i = batch ? 2 : 1;
+
+    Options opt;
+    if (!strcmp(argv[i], "-xml"))
+	opt.iFormat = FileFormat::Xml;
+    else if (!strcmp(argv[i], "-pdf"))
+	opt.iFormat = FileFormat::Pdf;
 
-    if (frm == FileFormat::Unknown) usage();
+    if (opt.iFormat == FileFormat::Unknown) usage();
+    ++i;
 
-    uint32_t flags = SaveFlag::SaveNormal;
-    bool runLatex = false;
-    const char * pages = nullptr;
-    const char * view = nullptr;
-    int i = 2;
+    int jobs = Platform::threadCount();
+    const char * summary = nullptr;
+    bool cache = true;
+    std::vector<String> inputs;
 
     String infile;
     String outfile;
@@ -107,31 +376,45 @@ int main(int argc, char * argv[]) {
     while (i < argc) {
 
 	if (!strcmp(argv[i], "-export")) {
-	    flags |= SaveFlag::Export;
+	    opt.iFlags |= SaveFlag::Export;
 	    ++i;
 	} else if (!strcmp(argv[i], "-view")) {
-	    flags |= SaveFlag::Export;
+	    opt.iFlags |= SaveFlag::Export;
 	    if (i + 1 == argc) usage();
-	    view = argv[i + 1];
+	    opt.iView = argv[i + 1];
 	    i += 2;
 	} else if (!strcmp(argv[i], "-pages")) {
-	    flags |= SaveFlag::Export;
+	    opt.iFlags |= SaveFlag::Export;
 	    if (i + 1 == argc) usage();
-	    pages = argv[i + 1];
+	    opt.iPages = argv[i + 1];
 	    i += 2;
 	} else if (!strcmp(argv[i], "-markedview")) {
-	    flags |= SaveFlag::MarkedView;
-	    flags |= SaveFlag::Export;
+	    opt.iFlags |= SaveFlag::MarkedView;
+	    opt.iFlags |= SaveFlag::Export;
 	    ++i;
 	} else if (!strcmp(argv[i], "-runlatex")) {
-	    runLatex = true;
+	    opt.iRunLatex = true;
 	    ++i;
 	} else if (!strcmp(argv[i], "-nozip")) {
-	    flags |= SaveFlag::NoZip;
+	    opt.iFlags |= SaveFlag::NoZip;
 	    ++i;
 	} else if (!strcmp(argv[i], "-keepnotes")) {
-	    flags |= SaveFlag::KeepNotes;
+	    opt.iFlags |= SaveFlag::KeepNotes;
+	    ++i;
+	} else if (batch && !strcmp(argv[i], "-jobs")) {
+	    if (i + 1 == argc) usage();
+	    jobs = std::max(1, atoi(argv[i + 1]));
+	    i += 2;
+	} else if (batch && !strcmp(argv[i], "-summary")) {
+	    if (i + 1 == argc) usage();
+	    summary = argv[i + 1];
+	    i += 2;
+	} else if (batch && !strcmp(argv[i], "-nocache")) {
+	    cache = false;
 	    ++i;
+	} else if (batch) {
+	    // all remaining arguments are files or directories
+	    while (i < argc) inputs.push_back(argv[i++]);
 	} else {
 	    // last one or two arguments must be filenames
 	    infile = argv[i];
@@ -144,94 +427,38 @@ int main(int argc, char * argv[]) {
 	}
     }
 
-    if (infile.empty()) usage();
+    if (batch ? inputs.empty() : infile.empty()) usage();
 
-    if ((flags & SaveFlag::Export) && frm == FileFormat::Xml) {
+    if ((opt.iFlags & SaveFlag::Export) && opt.iFormat == FileFormat::Xml) {
 	fprintf(stderr, "-export only available with -pdf.\n");
 	exit(1);
     }
 
-    if (pages && frm != FileFormat::Pdf) {
+    if (opt.iPages && opt.iFormat != FileFormat::Pdf) {
 	fprintf(stderr, "-pages only available with -pdf.\n");
 	exit(1);
     }
 
-    if (pages && view) {
+    if (opt.iPages && opt.iView) {
 	fprintf(stderr, "cannot specify both -pages and -view.\n");
 	exit(1);
     }
 
-    if (outfile.empty()) {
-	outfile = infile;
-	String ext = infile.right(4);
-	if (ext == ".ipe" || ext == ".pdf" || ext == ".xml")
-	    outfile = infile.left(infile.size() - 4);
-	switch (frm) {
-	case FileFormat::Xml: outfile += ".ipe"; break;
-	case FileFormat::Pdf: outfile += ".pdf";
-	default: break;
-	}
-	if (outfile == infile) {
-	    fprintf(stderr, "Cannot guess output filename.\n");
-	    exit(1);
-	}
+    if (batch) {
+	// shared by the workers, which have Latex folders of their own
+	if (cache) Document::setLatexCache(Platform::folder(ipe::FolderLatex, "cache"));
+	return convertBatch(opt, inputs, jobs, summary);
     }
 
-    std::unique_ptr<Document> doc(Document::loadWithErrorReport(infile.z()));
-
-    if (!doc) return 1;
-
-    fprintf(stderr, "Document %s has %d pages (%d views)\n", infile.z(),
-	    doc->countPages(), doc->countTotalViews());
-
-    // parse pages and view
-    int fromPage = -1;
-    int toPage = -1;
-    int viewNo = -1;
-
-    if (pages) {
-	String p(pages);
-	int j = p.find('-');
-	if (j >= 0) {
-	    fromPage = (j > 0) ? doc->findPage(p.left(j)) : 0;
-	    toPage = (j < p.size() - 1) ? doc->findPage(p.substr(j + 1))
-					: doc->countPages() - 1;
-	}
-	if (fromPage < 0 || fromPage > toPage) {
-	    fprintf(stderr, "incorrect -pages specification.\n");
-	    exit(1);
-	}
-    } else if (view) {
-	String v(view);
-	int j = v.find('-');
-	if (j > 0) {
-	    fromPage = doc->findPage(v.left(j));
-	    if (fromPage >= 0) viewNo = doc->page(fromPage)->findView(v.substr(j + 1));
-	}
-	if (fromPage < 0 || viewNo < 0) {
-	    fprintf(stderr, "incorrect -view specification.\n");
+    if (outfile.empty()) {
+	outfile = outputName(infile, opt.iFormat);
+	if (outfile.empty()) {
+	    fprintf(stderr, "Cannot guess output filename.\n");
 	    exit(1);
 	}
     }
 
-    char buf[64];
-    sprintf(buf, "ipetoipe %d.%d.%d", ipe::IPELIB_VERSION / 10000,
-	    (ipe::IPELIB_VERSION / 100) % 100, ipe::IPELIB_VERSION % 100);
-    Document::SProperties props = doc->properties();
-    props.iCreator = buf;
-    doc->setProperties(props);
-
-    switch (frm) {
-    case FileFormat::Xml:
-	if (runLatex)
-	    return topdf(doc.get(), infile, outfile, flags);
-	else
-	    doc->save(outfile.z(), FileFormat::Xml, SaveFlag::SaveNormal);
-    default: return 0;
-
-    case FileFormat::Pdf:
-	return topdf(doc.get(), infile, outfile, flags, fromPage, toPage, viewNo);
-    }
+    return convert(opt, infile, outfile);
 }
 
 // --------------------------------------------------------------------